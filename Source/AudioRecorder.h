@@ -3,10 +3,39 @@
 
     AudioRecorder.h
 
-    A simple class that acts as an AudioIODeviceCallback and writes the
-    incoming audio data to a WAV file.
-
-    Borrowed from JUCE's Audio Recording Demo, with some mild tweaks
+    A simple class that records the incoming audio into a take buffer, and
+    writes it to a WAV file alongside.
+
+    Borrowed from JUCE's Audio Recording Demo, with some mild tweaks.  It's no
+    longer a device callback itself: while recording it's armed on the shared
+    CaptureDispatcher, which hands it the input, and its writer runs on the
+    dispatcher's disk thread rather than a thread of its own.
+
+    The take (a LoopTake) is allocated up front at the loop's length, and what
+    we play back after a take is that, full float resolution - the WAV is
+    only there so the take persists, and is finished off in the background.
+
+    Punching in and out happens on the audio thread, against the LoopSource
+    we're recording for: once armed, the take starts on exactly the sample the
+    loop comes back round to 0, and ends exactly one loop later, with the
+    LoopSource told which sample of the block to switch at.
+
+    Each recorder takes its own device inputs (one, a pair, or all of them),
+    so several tracks can record different inputs in the same pass of the
+    loop.  They all read straight out of the block the dispatcher hands round,
+    each copying only its own channels.
+
+    What comes in at any moment is what was played along to the loop a
+    round trip earlier (the device's input plus output latency, or what the
+    LatencyCalibrator measured), so the take is captured that much later than
+    the punch: sample 0 of the take is what was played as the loop went past
+    0.  The loop starts playing the take at the punch out as usual, while the
+    last few ms of it are still arriving - they're at the very end of the
+    take, which doesn't get played until a whole loop later.
+
+    Nothing gets drawn from the audio thread: whatever shows the take as it
+    comes in reads it back on the message thread, up to
+    getNumSamplesRecorded().
 
   ==============================================================================
 */
@@ -14,16 +43,19 @@
 #pragma once
 
 
-#include <JuceHeader.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <juce_events/juce_events.h>
+#include "CaptureDispatcher.h"
+#include "LoopSource.h"
+#include "LoopTake.h"
 
 
-class AudioRecorder : public juce::AudioIODeviceCallback, public juce::ChangeBroadcaster
+class AudioRecorder : public CaptureTarget, public juce::ChangeBroadcaster
 {
 public:
-    AudioRecorder(juce::AudioThumbnail& thumbnailToUpdate)
-        : thumbnail(thumbnailToUpdate)
+    AudioRecorder(CaptureDispatcher& dispatcherToUse, LoopSource& loopToRecordFor)
+        : dispatcher(dispatcherToUse), loop(loopToRecordFor)
     {
-        backgroundThread.startThread();
     }
 
     ~AudioRecorder() override
@@ -31,132 +63,257 @@ public:
         stop();
     }
 
-    //==============================================================================
-    void startRecording(const juce::File& file)
+    //Message thread: which device inputs get recorded - numChannels of them from firstChannel, or
+    //every input from firstChannel on if numChannels is 0.  Takes effect from the next arm()
+    void setInputChannels(int firstChannel, int numChannels)
     {
-        stop();
-
-        if (sampleRate > 0)
-        {
-            // Create an OutputStream to write to our destination file...
-            file.deleteFile();
-
-            if (auto fileStream = std::unique_ptr<juce::FileOutputStream>(file.createOutputStream()))
-            {
-                // Now create a WAV writer object that writes to our output stream...
-                juce::WavAudioFormat wavFormat;
-
-                if (auto writer = wavFormat.createWriterFor(fileStream.get(), sampleRate, inputChannels, 16, {}, 0))
-                {
-
-                    if (writer->getNumChannels() != 0)
-                    {
-                        fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
+        firstInputChannel = juce::jmax(0, firstChannel);
+        numInputChannelsWanted = juce::jmax(0, numChannels);
+    }
 
-                        // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
-                        // write the data to disk on our background thread.
-                        threadedWriter.reset(new juce::AudioFormatWriter::ThreadedWriter(writer, backgroundThread, 32768));
+    int getFirstInputChannel() const noexcept   { return firstInputChannel; }
+    int getNumInputChannelsWanted() const noexcept { return numInputChannelsWanted; }
 
-                        // Reset our recording thumbnail
-                        thumbnail.reset(writer->getNumChannels(), writer->getSampleRate());
-                        nextSampleNum = 0;
+    //==============================================================================
+    //Message thread: allocates the take, e.g. as soon as the track is armed, so
+    //starting the take doesn't have to.  Does nothing if one the right size is already there
+    void prepareTake(int numSamplesInTake)
+    {
+        const int inputChannels = getNumChannelsToRecord();
 
-                        // And now, swap over our active writer pointer so that the audio callback will start using it..
-                        const juce::ScopedLock sl(writerLock);
-                        activeWriter = threadedWriter.get();
-                    }
+        if (state.load() != idle || inputChannels <= 0 || numSamplesInTake <= 0)
+            return;
 
-                }
-            }
+        if (take == nullptr || take->getNumChannels() != inputChannels || take->getNumSamples() != numSamplesInTake)
+        {
+            take = std::make_unique<LoopTake>(inputChannels, numSamplesInTake);
+            take->makeWritable();
+            channelPointers.calloc((size_t)inputChannels);
         }
     }
 
-    void stop()
+    //Message thread: the take starts on the audio thread the next time the loop comes back round
+    //to its start, and records exactly numSamplesInTake (one loop) from there.  Anything still being
+    //written to disk (e.g. an overdub into the same file) has to land before we replace it, so until
+    //then we're only waiting to arm - updateArming() finishes the job once the disk thread is done
+    void arm(const juce::File& file, int numSamplesInTake)
     {
-        // First, clear this pointer to stop the audio callback from using our writer object..
+        stop();
+
+        if (dispatcher.hasPendingWrites())
         {
-            const juce::ScopedLock sl(writerLock);
-            activeWriter = nullptr;
+            prepareTake(numSamplesInTake);
+            fileToArm = file;
+            numSamplesToArm = numSamplesInTake;
+            armWhenWritesFinish = true;
+            return;
         }
 
-        // Now we can delete the writer object. It's done in this order because the deletion could
-        // take a little time while remaining data gets flushed to disk, so it's best to avoid blocking
-        // the audio callback while this happens.
-        threadedWriter.reset();
+        startArmed(file, numSamplesInTake);
     }
 
-
-    bool isRecording() const
+    //Message thread, on a timer: arms for real once the disk thread has caught up
+    void updateArming()
     {
-        return activeWriter.load() != nullptr;
+        if (armWhenWritesFinish && !dispatcher.hasPendingWrites())
+        {
+            armWhenWritesFinish = false;
+            startArmed(fileToArm, numSamplesToArm);
+        }
     }
 
-    //==============================================================================
-    void audioDeviceAboutToStart(juce::AudioIODevice* device) override
+    //Message thread: stops wherever the take has got to.  Returns the take (always a full loop long,
+    //silent after wherever we stopped), or nullptr if it never started.  It's ready to play straight
+    //away, the WAV gets finished on the disk thread
+    std::unique_ptr<LoopTake> stop()
     {
-        sampleRate = device->getCurrentSampleRate();
+        armWhenWritesFinish = false;
+
+        // First, disarm so the audio callback stops using our writer object - once this returns it's
+        // not in the middle of a captureBlock either..
+        dispatcher.disarm(this);
+        const auto previousState = state.exchange(idle);
+        const bool tookAnything = previousState >= recording;
 
-        // AF: Get number of input channels
-        auto activeInputChannels = device->getActiveInputChannels();
-        inputChannels = activeInputChannels.countNumberOfSetBits();
+        // Flushing what's left to disk can take a little time, so the writer gets closed on the disk
+        // thread instead of blocking here
+        if (threadedWriter != nullptr)
+            dispatcher.finishWritingInBackground(std::move(threadedWriter));
 
-        if (!settingsHaveBeenOpened && inputChannels > 1)
-            inputChannels = 1;
+        if (!tookAnything || take == nullptr)
+            return {};
 
-        // AF: Get number of output channels
-        auto activeOutputChannels = device->getActiveOutputChannels();
-        outputChannels = activeOutputChannels.countNumberOfSetBits();
+        // Stopped part way, so the LoopSource never got to play it - whatever wasn't recorded
+        // can go back to being silence that takes up no memory
+        if (previousState == recording)
+            take->dropSilentChunks();
+
+        return std::move(take);
     }
 
-    void audioDeviceStopped() override
+    //(waiting for the disk counts - the take still starts at a loop start once it's armed)
+    bool isArmed() const            { return state.load() == armed || armWhenWritesFinish; }
+    bool isRecording() const        { return state.load() >= recording; }
+
+    //True once a take has run a full loop and all of it has come in.  The LoopSource is already
+    //playing it, it just needs collecting with stop()
+    bool hasFinishedTake() const    { return state.load() == finished; }
+
+    //Message thread: the take while it's being recorded (nullptr if there isn't one), and how many of
+    //its samples have come in so far.  Those ones are done with, so they can be read (e.g. to draw them)
+    //while the audio thread carries on with the rest
+    const LoopTake* getTakeBeingRecorded() const noexcept
     {
-        sampleRate = 0;
+        return isRecording() ? take.get() : nullptr;
     }
 
-    void audioDeviceIOCallback(const float** inputChannelData, int numInputChannels,
-        float** outputChannelData, int numOutputChannels,
-        int numSamples) override
+    juce::int64 getNumSamplesRecorded() const noexcept
     {
-        const juce::ScopedLock sl(writerLock);
+        return nextSampleNum.load(std::memory_order_acquire);
+    }
+
+    //==============================================================================
+    //Audio thread, called before the LoopSource renders this block
+    void captureBlock(const float* const* inputChannelData, int numInputChannels, int numSamples) override
+    {
+        auto* writer = threadedWriter.get();
+
+        //the take only follows the loop while it's actually going round
+        if (writer == nullptr || numInputChannels < firstChannelToRecord + take->getNumChannels() || !loop.isPlaying())
+            return;
+
+        if (state.load() == armed)
+        {
+            const int punchInSample = loop.getSamplesUntilLoopStart();
+
+            if (punchInSample >= numSamples)
+                return;
 
-        if (activeWriter.load() != nullptr && numInputChannels >= thumbnail.getNumChannels())
+            state = recording;
+            loop.scheduleRecordingChange(true, punchInSample);
+            samplesSincePunchIn = -punchInSample;
+        }
+
+        if (state.load() != recording && state.load() != finishing)
+            return;
+
+        const int takeLength = take->getNumSamples();
+
+        //a full loop - punch out on exactly the sample the loop wraps, and the loop plays the take from there
+        if (state.load() == recording && samplesSincePunchIn + numSamples >= takeLength)
         {
-            activeWriter.load()->write(inputChannelData, numSamples);
+            state = finishing;
+            loop.scheduleRecordingChange(false, (int)(takeLength - samplesSincePunchIn), take.get());
+        }
+
+        //the input that's come back round for the part of the take we haven't got yet
+        const int startSample = (int)juce::jlimit((juce::int64)0, (juce::int64)numSamples, latency - samplesSincePunchIn);
+        const auto recordedSoFar = nextSampleNum.load(std::memory_order_relaxed);
+        const int numToRecord = juce::jmin(numSamples - startSample, takeLength - (int)recordedSoFar);
+        samplesSincePunchIn += numSamples;
 
-            // Create an AudioBuffer to wrap our incoming data, note that this does no allocations or copies, it simply references our input data
-            juce::AudioBuffer<float> buffer(const_cast<float**> (inputChannelData), thumbnail.getNumChannels(), numSamples);
-            thumbnail.addBlock(nextSampleNum, buffer, 0, numSamples);
-            nextSampleNum += numSamples;
+        if (numToRecord <= 0)
+            return;
+
+        for (int channel = 0; channel < take->getNumChannels(); ++channel)
+        {
+            const auto* input = inputChannelData[firstChannelToRecord + channel] + startSample;
+            take->copyFrom(channel, (int)recordedSoFar, input, numToRecord);
+            channelPointers[channel] = const_cast<float*>(input);
         }
 
-        // We need to clear the output buffers, in case they're full of junk..
-        for (int i = 0; i < numOutputChannels; ++i)
-            if (outputChannelData[i] != nullptr)
-                juce::FloatVectorOperations::clear(outputChannelData[i], numSamples);
+        writer->write(channelPointers.getData(), numToRecord);
+
+        //once this is stored the message thread can read these samples, so it comes after the copy
+        nextSampleNum.store(recordedSoFar + numToRecord, std::memory_order_release);
+
+        if (recordedSoFar + numToRecord >= takeLength)
+            state = finished;
     }
 
-    int getInputChannels()
+    //How many of the inputs we're routed to the device actually has (0 if it doesn't have the first one)
+    int getNumChannelsToRecord() const
     {
-        return inputChannels;
+        const int available = dispatcher.getNumInputChannels() - firstInputChannel;
+
+        if (available <= 0)
+            return 0;
+
+        return numInputChannelsWanted > 0 ? juce::jmin(numInputChannelsWanted, available) : available;
     }
 
-    int getOutputChannels()
+private:
+    //Message thread: opens the WAV and arms on the dispatcher, once nothing's left to write
+    void startArmed(const juce::File& file, int numSamplesInTake)
     {
-        return outputChannels;
-    }
+        const auto sampleRate = dispatcher.getSampleRate();
+        const int inputChannels = getNumChannelsToRecord();
 
-    bool settingsHaveBeenOpened = false;
+        prepareTake(numSamplesInTake);
 
-private:
-    juce::AudioThumbnail& thumbnail;
-    juce::TimeSliceThread backgroundThread{ "Audio Recorder Thread" }; // the thread that will write our audio data to disk
-    std::unique_ptr<juce::AudioFormatWriter::ThreadedWriter> threadedWriter; // the FIFO used to buffer the incoming data
-    int inputChannels = 1;
-    int outputChannels = 2;
-    double sampleRate = 0.0;
-    juce::int64 nextSampleNum = 0;
+        if (sampleRate > 0 && inputChannels > 0 && take != nullptr)
+        {
+            latency = juce::jlimit(0, numSamplesInTake, dispatcher.getRoundTripLatency());
+            firstChannelToRecord = firstInputChannel;
 
-    juce::CriticalSection writerLock;
-    std::atomic<juce::AudioFormatWriter::ThreadedWriter*> activeWriter{ nullptr };
-};
+            // Create an OutputStream to write to our destination file...
+            file.deleteFile();
+
+            if (auto fileStream = std::unique_ptr<juce::FileOutputStream>(file.createOutputStream()))
+            {
+                // Now create a WAV writer object that writes to our output stream...
+                juce::WavAudioFormat wavFormat;
+
+                if (auto writer = wavFormat.createWriterFor(fileStream.get(), sampleRate, (unsigned int)inputChannels, 24, {}, 0))
+                {
+
+                    if (writer->getNumChannels() != 0)
+                    {
+                        fileStream.release(); // (passes responsibility for deleting the stream to the writer object that is now using it)
+
+                        // Now we'll create one of these helper objects which will act as a FIFO buffer, and will
+                        // write the data to disk on our background thread.
+                        threadedWriter.reset(new juce::AudioFormatWriter::ThreadedWriter(writer, dispatcher.getDiskWriterThread(), 32768));
 
+                        nextSampleNum = 0;
+
+                        // And now arm ourselves so that the audio callback will start listening for the loop start..
+                        state = armed;
+                        dispatcher.arm(this);
+                    }
+
+                }
+            }
+        }
+    }
+
+    enum RecorderState
+    {
+        idle,
+        armed,
+        recording,
+        finishing,  //punched out, the last of the take is still on its way back through the device
+        finished
+    };
+
+    CaptureDispatcher& dispatcher; // hands us the input, and owns the thread that will write our audio data to disk
+    LoopSource& loop;
+    std::unique_ptr<juce::AudioFormatWriter::ThreadedWriter> threadedWriter; // the FIFO used to buffer the incoming data
+    std::unique_ptr<LoopTake> take; // what we record into, sized to the loop before the take starts
+    juce::HeapBlock<float*> channelPointers; // where this block's input starts, for the writer
+    std::atomic<juce::int64> nextSampleNum{ 0 };  //written on the audio thread, see getNumSamplesRecorded()
+    juce::int64 samplesSincePunchIn = 0;  //audio thread only - negative in the block we punch in
+    int latency = 0;  //how far behind the loop the input is, set before we're armed
+    int firstChannelToRecord = 0;  //and which input the take starts at
+
+    //message thread - the routing, see setInputChannels()
+    int firstInputChannel = 0;
+    int numInputChannelsWanted = 1;
+
+    //message thread - an arm() that's waiting for the disk thread to catch up
+    bool armWhenWritesFinish = false;
+    juce::File fileToArm;
+    int numSamplesToArm = 0;
+
+    std::atomic<int> state{ idle };
+};
@@ -3,47 +3,46 @@
 
     AudioTrack.h
 
-    A class to represent an Audio Track.  Contains all track-specific controls and
-    methods.  Inherits from AudioIODeviceCallback to allow passing input data to
-    the Audio Recorder class, parallel to our main audio processing chain.
+    A class to represent an Audio Track on screen.  Contains all track-specific
+    controls and the waveform, on top of the TrackEngine that does the actual
+    recording and playback (see TrackEngine.h) - nothing in here touches the
+    audio, so the engine works the same with or without one of these.
+
+    The take being recorded gets drawn as it comes in, read back from the
+    take on our timer rather than from the audio thread.
 
   ==============================================================================
 */
 
 #pragma once
 
-#include "AudioRecorder.h"
-#include "LoopSource.h"
-#include "SaveLoad.h"
+#include "TrackEngine.h"
 #include "customUI.h"
 
 
-class AudioTrack : public juce::AudioAppComponent,
-    private juce::ChangeListener, public juce::ChangeBroadcaster, public juce::AudioIODeviceCallback,
-    public juce::Slider::Listener, public juce::Button::Listener, private juce::Timer, public juce::MouseListener
+class AudioTrack : public juce::Component, public juce::ChangeBroadcaster,
+    private juce::ChangeListener, private TrackEngine::Listener,
+    public juce::Slider::Listener, public juce::Button::Listener, private juce::Timer
 {
 public:
-    AudioTrack()
+    AudioTrack(TrackEngine& engineToControl)
+        : engine(engineToControl)
     {
         formatManager.registerBasicFormats();
         thumbnail.addChangeListener(this);
-        loopSource.addChangeListener(this);
-        deviceManager.addAudioCallback(&recorder);   
+        engine.addListener(this);
 
         // AF: Initialize track sliders
         panSlider.setRange(-1.0, 1.0);
-        panSlider.setValue(0.0);
         panSlider.addListener(this);
         panSlider.setDoubleClickReturnValue(true, 0.0, juce::ModifierKeys::altModifier);
         panSlider.setTextBoxStyle(juce::Slider::TextEntryBoxPosition::NoTextBox, true, 0, 0);
 
         slipController.addListener(this);
-        slipController.setRange(-loopSource.getMasterLoopLength(), loopSource.getMasterLoopLength());
-        slipController.setValue(0);
+        slipController.setRange((double)-engine.getMasterLoopLength(), (double)engine.getMasterLoopLength());
         slipController.setDoubleClickReturnValue(true, 0.0, juce::ModifierKeys::altModifier);
 
         gainSlider.setRange(0.0, 1.0);
-        gainSlider.setValue(1.0);
         gainSlider.addListener(this);
         gainSlider.setDoubleClickReturnValue(true, 1.0, juce::ModifierKeys::altModifier);
         gainSlider.setSliderStyle(juce::Slider::SliderStyle::LinearVertical);
@@ -51,48 +50,37 @@ public:
 
         reverseButton.addListener(this);
 
-        startTimer(10); //used for vertical line position marker
+        overdubButton.setClickingTogglesState(true);
+        overdubButton.addListener(this);
 
+        undoButton.addListener(this);
+        redoButton.addListener(this);
+        undoButton.setEnabled(false);
+        redoButton.setEnabled(false);
 
-    }
+        inputSelector.setTooltip("Which inputs this track records");
+        inputSelector.onChange = [this] { inputChoiceSelected(); };
 
+        syncWithEngine();
+        redrawThumbnail();
 
+        startTimer(10); //used for vertical line position marker
+    }
 
     ~AudioTrack() override
     {
+        engine.removeListener(this);
         thumbnail.removeChangeListener(this);
-        deviceManager.removeAudioCallback(&recorder);
-    }
-
-    //DN:: Gives this class access to the buffer
-    void audioDeviceIOCallback(const float** inputChannelData,
-        int numInputChannels,
-        float** outputChannelData,
-        int numOutputChannels,
-        int numSamples) override
-    {
-        if (!settingsHaveBeenOpened && numInputChannels > 1)
-            numInputChannels = 1;
-        recorder.audioDeviceIOCallback(inputChannelData, numInputChannels,outputChannelData, numOutputChannels,numSamples);
-    }
-
-    void audioDeviceAboutToStart(juce::AudioIODevice* device) override
-    {
-        recorder.audioDeviceAboutToStart(device);
     }
 
-    /** Called to indicate that the device has stopped. */
-    void audioDeviceStopped() override 
-    {
-        recorder.audioDeviceStopped();
-    } 
+    TrackEngine& getEngine() noexcept { return engine; }
 
     void setDisplayFullThumbnail(bool displayFull)
     {
         displayFullThumb = displayFull;
         repaint();
     }
-    
+
     void paint(juce::Graphics& g) override
     {
         auto thumbnailBorder = 8;
@@ -107,21 +95,38 @@ public:
         const juce::Rectangle<float> area(getLocalBounds().reduced(thumbnailBorder).toFloat());
         g.drawRoundedRectangle(area, ROUNDED_CORNER_SIZE, THIN_LINE);
 
-        if (thumbnail.getTotalLength() > 0.0)
+        const double sampleRate = engine.getSampleRate();
+
+        if (thumbnail.getTotalLength() > 0.0 && sampleRate > 0.0)
         {
             //DN:  paint the thumbnail audio horizontally relative to master loop and the slip offset
             auto startTime = -(double)slipController.getValue() / sampleRate;
-            auto endTime = ((double)loopSource.getMasterLoopLength() / (double)sampleRate) + (double)startTime;
+            auto endTime = ((double)engine.getMasterLoopLength() / sampleRate) + (double)startTime;
 
             auto thumbArea = getLocalBounds().reduced(thumbnailBorder);
-            
-            thumbnail.drawChannels(g, thumbArea, startTime, endTime, 1.0f); // 1.0f is zoom
+
+            if (engine.isReversed())
+            {
+                //the thumbnail is still of the audio the forwards way round, so draw the part that's
+                //playing backwards into each spot and mirror it, rather than redrawing it reversed
+                const double loopLengthSeconds = endTime - startTime;
+                startTime = (double)slipController.getValue() / sampleRate + thumbnail.getTotalLength() - loopLengthSeconds;
+                endTime = startTime + loopLengthSeconds;
+
+                juce::Graphics::ScopedSaveState saveState(g);
+                g.addTransform(juce::AffineTransform::scale(-1.0f, 1.0f, (float)thumbArea.getCentreX(), 0.0f));
+                thumbnail.drawChannels(g, thumbArea, startTime, endTime, 1.0f);
+            }
+            else
+            {
+                thumbnail.drawChannels(g, thumbArea, startTime, endTime, 1.0f); // 1.0f is zoom
+            }
 
             //DN: paint vertical line to indicate playhead position
             g.setColour(VERTICAL_LINE_COLOR);
-            auto audioPosition = (float)loopSource.getPosition();
-            auto drawPosition = (audioPosition / loopSource.getMasterLoopLength()) * (float)thumbArea.getWidth() + (float)thumbArea.getX();            
-            g.drawLine(drawPosition, (float)thumbArea.getY()+8, drawPosition, (float)thumbArea.getBottom()-8, 2.0f);      
+            auto audioPosition = (float)engine.getPosition();
+            auto drawPosition = (audioPosition / engine.getMasterLoopLength()) * (float)thumbArea.getWidth() + (float)thumbArea.getX();
+            g.drawLine(drawPosition, (float)thumbArea.getY()+8, drawPosition, (float)thumbArea.getBottom()-8, 2.0f);
 
 
             //DN: horizontal line that always goes all the way across even if our audio is shorter
@@ -132,385 +137,281 @@ public:
         }
     }
 
-    void prepareToPlay(int samplesPerBlockExpected, double newSampleRate) override 
+    void setShouldLightUp(bool shouldThisLightUp)
+    {
+        shouldLightUp = shouldThisLightUp;
+    }
+
+    //Puts the controls back in line with the engine, e.g. after a project's been loaded into it
+    void syncWithEngine()
     {
-        samplesPerBlock = samplesPerBlockExpected;
-        sampleRate = newSampleRate;
-        loopSource.prepareToPlay(samplesPerBlockExpected, newSampleRate);
+        panSlider.setValue(engine.getPan(), juce::dontSendNotification);
+        gainSlider.setValue(engine.getGain(), juce::dontSendNotification);
+        slipController.setValue(engine.getSlip(), juce::dontSendNotification);
+        overdubButton.setToggleState(engine.isOverdubbing(), juce::dontSendNotification);
+        setInputChannels(engine.getFirstInputChannel(), engine.getNumInputChannelsWanted());
+        updateSlipController();
+        repaint();
     }
 
-    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override 
+    //DN: helper function to draw the thumbnail of whatever the track is playing now, a chunk
+    //at a time so nothing gets copied
+    void redrawThumbnail()
     {
-        loopSource.getNextAudioBlock(bufferToFill);
+        const auto& take = engine.getLoopTake();
+        thumbnail.reset(take.getNumChannels(), engine.getSampleRate(), take.getNumSamples());
 
-        // AF: If only 1 output (mono), panning shouldn't work
-        if (recorder.getOutputChannels() > 1)
+        take.forEachChunk([this](int startSample, const juce::AudioBuffer<float>& chunkAudio, int numInChunk)
         {
+            thumbnail.addBlock(startSample, chunkAudio, 0, numInChunk);
+        });
+    }
 
-            ////DN: overall gain , applies to both channels
-            int numOutputChannels = bufferToFill.buffer->getNumChannels();
-            for (int channel = 0; channel < numOutputChannels; ++channel)
-            {
-                auto gainWriter = bufferToFill.buffer->getWritePointer(channel, bufferToFill.startSample);
-                for (auto sample = 0; sample < bufferToFill.numSamples; ++sample)
-                {
-                    gainWriter[sample] = gainWriter[sample] * gainSliderValue;
-                }
-            }
-
-            // AF:  Panning volume control //  
-            // AF: This value determines the channel
-            // 0 == L // 1 == R
-            int channel = 0;
-            double gain = 1 - fabs(panSliderValue);
-
-            // AF: This if statement chooses which channel is going to be muted/lowered
-            if (panSliderValue < 0)
-                channel = 1;
-            else if (panSliderValue > 0)
-                channel = 0;
-            else
-                gain = 1.0;
-
-            auto panWriter = bufferToFill.buffer->getWritePointer(channel, bufferToFill.startSample);
 
-            for (auto sample = 0; sample < bufferToFill.numSamples; ++sample)
-            {
-                panWriter[sample] = panWriter[sample] * gain;
-            }
-        }
+    // AF: Listener for changes of values from slider
+    // (required by Listener class)
+    void sliderValueChanged(juce::Slider* slider) override
+    {
+        if (slider == &panSlider)
+            engine.setPan(slider->getValue());
 
+        if (slider == &gainSlider)
+            engine.setGain(slider->getValue());
 
-        //DN: this is where we set the bool that will auto-stop recording at the end of the loop
-        if (isRecording() && (loopSource.getPosition() + samplesPerBlock >= loopSource.getMasterLoopLength()))
+        if (slider == &slipController)
         {
-            aboutToOverflow = true;
+            engine.setSlip((int)slider->getValue());
+            repaint();
         }
     }
 
-    void releaseResources() override 
-    {
-        loopSource.releaseResources();
-    }
-
-    void startRecording()
+    /** Called when the button is clicked. */
+    void buttonClicked(juce::Button* button) override
     {
-        if (!juce::RuntimePermissions::isGranted(juce::RuntimePermissions::writeExternalStorage))
+        if (button == &overdubButton)
         {
-            SafePointer<AudioTrack> safeThis(this);
-
-            juce::RuntimePermissions::request(juce::RuntimePermissions::writeExternalStorage,
-                [safeThis](bool granted) mutable
-                {
-                    if (granted)
-                        safeThis->startRecording();
-                });
-            return;
-        }
-
-        slipController.setValue(0);
-
-        loopSource.setBeginningOfFile(false);
+            engine.setOverdubbing(overdubButton.getToggleState());
 
-        //DN:  tell loopSource to play silence/not access loopBuffer while we switch it out
-        loopSource.startRecording(); 
+            //turning it on might not have worked, and bakes the slip in if it did
+            overdubButton.setToggleState(engine.isOverdubbing(), juce::dontSendNotification);
+            slipController.setValue(engine.getSlip(), juce::dontSendNotification);
+            repaint();
+        }
 
-        recorder.startRecording(lastRecording);
+        if (button == &undoButton)
+            engine.undo();
 
-        setDisplayFullThumbnail(false);
-    }
+        if (button == &redoButton)
+            engine.redo();
 
-    void stopRecording()
-    {
-        recorder.stop();
-        waitingToRecord = false;
-        loopSource.setBeginningOfFile(false);
-       
-        auto file = lastRecording;
-        auto reader = formatManager.createReaderFor(file);
-        if (reader != nullptr)
+        if (button == &reverseButton)
         {
-            //DN: set up a memory buffer to hold the audio for this loop file
-            auto loopBuffer = std::make_unique<juce::AudioBuffer<float>>(reader->numChannels, reader->lengthInSamples);
-            //DN: read the audio file into the loopBuffer
-            reader->read(loopBuffer.get(), 0, reader->lengthInSamples, 0, true, true);
-            //DN: need to delete here because the "createReaderFor" method says to - maybe switch to a unique ptr later for "good practice" reasons!
-            delete reader; 
-            // DN: send the loopBuffer object to the loopSource which will handle playback, transfer ownership of unique ptr
-            loopSource.setBuffer(loopBuffer.release());
-            loopSource.stopRecording();
+            //only the direction changes, the thumbnail just gets drawn mirrored
+            engine.reverse();
+            repaint();
         }
     }
 
-    // --
-    bool isRecording()
+    //Fills the input selector for a device with numInputs inputs: each one on its own, each pair, and all
+    //of them.  The track keeps its inputs if the device has them, otherwise it goes back to the first one
+    void updateInputChoices(int numInputs)
     {
-        return recorder.isRecording();
-    }
+        inputChoices.clearQuick();
+        inputSelector.clear(juce::dontSendNotification);
 
-    bool isPlaying()
-    {
-        return loopSource.isPlaying();
-    }
+        for (int i = 0; i < numInputs; ++i)
+            addInputChoice("IN " + juce::String(i + 1), i, 1);
 
-    void setShouldLightUp(bool shouldThisLightUp)
-    {
-        shouldLightUp = shouldThisLightUp;
-    }
+        for (int i = 0; i + 1 < numInputs; i += 2)
+            addInputChoice("IN " + juce::String(i + 1) + "+" + juce::String(i + 2), i, 2);
 
-    // DN:  set position in samples now, not seconds anymore (made it an int, not a double)
-    void setPosition(juce::int64 newPosition)
-    {
-        loopSource.setNextReadPosition(newPosition);
-    }
+        if (numInputs > 2)
+            addInputChoice("ALL IN", 0, 0);
 
-    // Playback mode
-    void start()
-    {
-        loopSource.start(0);
+        inputSelector.setEnabled(numInputs > 0);
+        inputSelector.setTextWhenNothingSelected(numInputs > 0 ? "IN" : "NO IN");
+        setInputChannels(engine.getFirstInputChannel(), engine.getNumInputChannelsWanted());
     }
 
-    void stop()
+    void mouseEnter(const juce::MouseEvent& event) override
     {
-        loopSource.stop();
+        setMouseCursor(juce::MouseCursor::DraggingHandCursor);
     }
 
-    //Call this for all tracks to keep them in sync
-    void setMasterLoop(int tempo, int measures)
-    {
-        loopSource.setMasterLoop(tempo, measures);
-        repaint();
-    }
 
-    int getPosition()
+    void mouseExit(const juce::MouseEvent& event) override
     {
-        return loopSource.getPosition();
+        setMouseCursor(juce::MouseCursor::NormalCursor);
     }
 
-    //make sure to set this up before calling startRecording()
-    void setLastRecording(juce::File file)
+    void mouseDown(const juce::MouseEvent& event) override
     {
-        lastRecording = file;
+        dragStart = slipController.getValue();
     }
 
-    void setWaitingToRecord(bool newWaitingToRecord)
+    void mouseDrag(const juce::MouseEvent& event) override
     {
-        waitingToRecord = newWaitingToRecord;
-    }
+        if (engine.isOverdubbing())
+            return;
 
-    bool isWaitingToRecord()
-    {
-        return waitingToRecord;
+        auto thumbArea = getLocalBounds();
+        auto difference = (double)event.getDistanceFromDragStartX()/(double)thumbArea.getWidth() * engine.getMasterLoopLength();
+        auto newOffset = dragStart + difference;
+        slipController.setValue(newOffset);
+        repaint();
     }
 
-    //similar to stopRecording, call this after setAsLastRecording to load audio from disk into memory and redraw thumbnail
-    //also used when loading a project
-    void redrawAndBufferAudio()
-    {
-        auto file = lastRecording;
-        auto reader = formatManager.createReaderFor(file);
+    juce::Slider panSlider;
+    juce::Label panLabel;
 
-        if (reader != nullptr)
-        {
-            //DN: set up a memory buffer to hold the audio for this loop file
-            auto loopBuffer = std::make_unique<juce::AudioBuffer<float>>(reader->numChannels, reader->lengthInSamples);
-            //DN: read the audio file into the loopBuffer
-            reader->read(loopBuffer.get(), 0, reader->lengthInSamples, 0, true, true);
-            //DN: need to delete here because the "createReaderFor" method says to - maybe switch to a unique ptr later for "good practice" reasons!
-            delete reader;
+    std::unique_ptr<juce::Drawable> reverseSVG;
+    juce::DrawableButton reverseButton{ "reverseButton",juce::DrawableButton::ButtonStyle::ImageFitted };
 
-            redrawThumbnailWithBuffer(loopBuffer.get());
+    juce::TextButton overdubButton{ "OD" };
+    juce::TextButton undoButton{ "UNDO" };
+    juce::TextButton redoButton{ "REDO" };
+    juce::ComboBox inputSelector{ "inputSelector" };
 
-            // DN: send the loopBuffer object to the loopSource which will handle playback, transfer ownership of unique ptr
-            loopSource.setBuffer(loopBuffer.release());
-        }
-        else
-        {
-            //if the lastRecording object doesn't exist, we want to reset the loopSource to be blank
-            auto loopBuffer = std::make_unique<juce::AudioBuffer<float>>(1, loopSource.getMasterLoopLength());
-            for (int channel = 0; channel < loopBuffer->getNumChannels(); ++channel)
-            {
-                auto writer = loopBuffer->getWritePointer(channel, 0);
-                for (int i = 0; i < loopBuffer->getNumSamples(); ++i)
-                    writer[i] = 0;  //DN: zero out to avoid pops/clicks
-            }
+    juce::Slider slipController;
+    juce::Slider gainSlider;
 
-            redrawThumbnailWithBuffer(loopBuffer.get());
 
-            // DN: send the loopBuffer object to the loopSource which will handle playback, transfer ownership of unique ptr
-            loopSource.setBuffer(loopBuffer.release());
-        }
+    TransportButton recordButton{ "recordButton",MAIN_BACKGROUND_COLOR,MAIN_BACKGROUND_COLOR,MAIN_BACKGROUND_COLOR, TransportButton::TransportButtonRole::Record };
 
-        repaint();
-    }
 
-    //DN: helper function to draw the thumbnail
-    void redrawThumbnailWithBuffer(juce::AudioBuffer<float>* loopBuffer)
+private:
+    struct InputChoice
     {
-        //DN: temp const buffer used only for drawing
-        juce::AudioBuffer<float> tmpBuffer(loopBuffer->getArrayOfWritePointers(), loopBuffer->getNumChannels(), loopBuffer->getNumSamples());
-        //for (int ch = 0; ch < loopBuffer->getNumChannels(); ++ch)
-        //    tmpBuffer.copyFrom(ch, 0, loopBuffer.get(), loopBuffer->getNumSamples());
-        thumbnail.reset(loopBuffer->getNumChannels(), sampleRate, loopBuffer->getNumSamples());
-        thumbnail.addBlock(0, tmpBuffer, 0, loopBuffer->getNumSamples());
-    }
-
+        int firstChannel, numChannels;
+    };
 
-    // AF: Listener for changes of values from slider
-    // (required by Listener class)
-    void sliderValueChanged(juce::Slider* slider) override
+    void addInputChoice(const juce::String& name, int firstChannel, int numChannels)
     {
-        if (slider == &panSlider)
-        {
-            panSliderValue = slider->getValue();
-        }
+        inputChoices.add({ firstChannel, numChannels });
+        inputSelector.addItem(name, inputChoices.size());
+    }
 
-        if(slider == &gainSlider)
-        {
-            gainSliderValue = slider->getValue();
-        }
+    void inputChoiceSelected()
+    {
+        const int index = inputSelector.getSelectedItemIndex();
 
-        if (slider == &slipController)
-        {
-            loopSource.setFileStartOffset(slider->getValue());
-            repaint();
-        }
+        if (juce::isPositiveAndBelow(index, inputChoices.size()))
+            engine.setInputChannels(inputChoices[index].firstChannel, inputChoices[index].numChannels);
     }
 
-    /** Called when the button is clicked. */
-    void buttonClicked(juce::Button* button)
+    //Selects numChannels inputs from firstChannel on (0 is all of them), or the first input if the
+    //device doesn't have those
+    void setInputChannels(int firstChannel, int numChannels)
     {
-        if (button == &reverseButton)
-        {
-            loopSource.reverseAudio();
+        int index = -1;
 
-            //account for slip here?
-            redrawThumbnailWithBuffer(loopSource.getLoopBuffer());
+        for (int i = 0; i < inputChoices.size() && index < 0; ++i)
+            if (inputChoices[i].firstChannel == firstChannel && inputChoices[i].numChannels == numChannels)
+                index = i;
 
-            isReversed = !isReversed;
+        if (index < 0 && !inputChoices.isEmpty())
+        {
+            firstChannel = 0;
+            numChannels = 1;
+            index = 0;
         }
+
+        engine.setInputChannels(firstChannel, numChannels);
+        inputSelector.setSelectedItemIndex(index, juce::dontSendNotification);
     }
 
-    /** Called when the button's state changes. */
-    void buttonStateChanged(juce::Button* button)
+    //DN: only show the slip controller once there's audio to slip.  Not the WAV - a silent track's
+    //is only deleted once it's finished being written, and that's not worth waiting for
+    void updateSlipController()
     {
+        const bool hasRecording = engine.getLoopTake().hasAudio();
+        slipController.setEnabled(hasRecording);
+        slipController.setVisible(hasRecording);
     }
 
-    juce::XmlElement* getTrackState(int trackNum)
+    //Adds whatever of the take being recorded has come in since last time.  The audio thread is done
+    //with those samples, so they're read straight out of the take, a contiguous run at a time
+    void drawTakeSoFar()
     {
-        juce::String trackElementName = TRACK_FILENAME + juce::String(trackNum);
-        // create an inner element..
-        juce::XmlElement* trackElement = new juce::XmlElement(trackElementName);
-
-        trackElement->setAttribute("id", trackNum);
-        trackElement->setAttribute("pan", panSliderValue);
-        trackElement->setAttribute("isReversed", isReversed);
-        trackElement->setAttribute("slipValue", slipController.getValue());
-        trackElement->setAttribute("gain", gainSlider.getValue());
+        const auto* take = engine.getTakeBeingRecorded();
 
-        return trackElement;
-    }
+        if (take == nullptr)
+            return;
 
-    void restoreTrackState(juce::XmlElement* trackState)
-    {
-        //set pan
-        panSliderValue = trackState->getDoubleAttribute("pan");
-        panSlider.setValue(panSliderValue);
-
-        //set gain
-        gainSliderValue = trackState->getDoubleAttribute("gain");
-        gainSlider.setValue(gainSliderValue);
-
-        //set up slip (needs to happen before reverse)
-        const double newSlipValue = trackState->getDoubleAttribute("slipValue");
-        slipController.setValue(newSlipValue);
-        loopSource.setFileStartOffset(newSlipValue);
-        repaint();
+        const int numRecorded = (int)engine.getNumSamplesRecorded();
+        channelPointers.resize((size_t)take->getNumChannels());
 
-        //set up reverse
-        isReversed = trackState->getBoolAttribute("isReversed");
-        if (isReversed)
+        while (numSamplesDrawn < numRecorded)
         {
-            loopSource.reverseAudio();
-            redrawThumbnailWithBuffer(loopSource.getLoopBuffer());
+            const int numToDraw = juce::jmin(take->getNumContiguousSamples(numSamplesDrawn), numRecorded - numSamplesDrawn);
+
+            for (int channel = 0; channel < take->getNumChannels(); ++channel)
+                channelPointers[(size_t)channel] = const_cast<float*>(take->getReadPointer(channel, numSamplesDrawn));
+
+            //a view over the take, which the thumbnail only reads
+            const juce::AudioBuffer<float> drawn(channelPointers.data(), take->getNumChannels(), numToDraw);
+            thumbnail.addBlock(numSamplesDrawn, drawn, 0, numToDraw);
+            numSamplesDrawn += numToDraw;
         }
     }
 
-    void initializeTrackState()
+    //==============================================================================
+    void takeStarted(TrackEngine&) override
     {
-        panSliderValue = 0.0;
-        panSlider.setValue(0.0);
-        gainSlider.setValue(1.0);
-        isReversed = false;
-        slipController.setValue(0.0);
+        //the new take always starts at the top of the loop
+        slipController.setValue(0, juce::dontSendNotification);
+        setDisplayFullThumbnail(false);
+
+        if (const auto* take = engine.getTakeBeingRecorded())
+            thumbnail.reset(take->getNumChannels(), engine.getSampleRate());
+
+        numSamplesDrawn = 0;
     }
 
-    void mouseEnter(const juce::MouseEvent& event)
+    void takeFinished(TrackEngine&) override
     {
-        setMouseCursor(juce::MouseCursor::DraggingHandCursor);
+        //whatever came in after the last timer tick, or nothing at all if it never started
+        redrawThumbnail();
+        repaint();
+        sendChangeMessage(); //DN: needed to tell mainComponent we're stopping
     }
 
-
-    void mouseExit(const juce::MouseEvent& event)
+    //Undo/redo, an overdub, loading or the loop stretching to a new tempo swapped what's playing for another version
+    void loopAudioReplaced(TrackEngine&) override
     {
-        setMouseCursor(juce::MouseCursor::NormalCursor);
+        slipController.setValue(engine.getSlip(), juce::dontSendNotification);
+        updateSlipController();
+        redrawThumbnail();
+        repaint();
     }
 
-    void mouseDown(const juce::MouseEvent& event)
+    void playStateChanged(TrackEngine&) override
     {
-        dragStart = slipController.getValue();
+        trackChanged();
     }
 
-    void mouseDrag(const juce::MouseEvent& event)
+    void changeListenerCallback(juce::ChangeBroadcaster*) override
     {
-        auto thumbArea = getLocalBounds();
-        auto difference = (double)event.getDistanceFromDragStartX()/(double)thumbArea.getWidth() * loopSource.getMasterLoopLength();
-        auto newOffset = dragStart + difference;
-        slipController.setValue(newOffset);
-        repaint();
+        trackChanged();
     }
 
-    void setSettingsHaveBeenOpened(bool newValue)
+    //DN: any time any change happens check if we need to turn on/off slip controller, and let mainComponent know
+    void trackChanged()
     {
-        settingsHaveBeenOpened = newValue;
-        recorder.settingsHaveBeenOpened = newValue;
+        updateSlipController();
+        sendSynchronousChangeMessage();
     }
 
-
-    juce::Slider panSlider;
-    juce::Label panLabel;
-    double panSliderValue = 0.0;
-
-    std::unique_ptr<juce::Drawable> reverseSVG;
-    juce::DrawableButton reverseButton{ "reverseButton",juce::DrawableButton::ButtonStyle::ImageFitted };
-
-    juce::Slider slipController;
-    juce::Slider gainSlider;
-    double gainSliderValue = 1.0;
-
-
-    TransportButton recordButton{ "recordButton",MAIN_BACKGROUND_COLOR,MAIN_BACKGROUND_COLOR,MAIN_BACKGROUND_COLOR, TransportButton::TransportButtonRole::Record };
-
-
-private:
-
-    void timerCallback()
+    void timerCallback() override
     {
-        if (isRecording() && aboutToOverflow)
-        {
-            DBG("CALLING STOP RECORD");
-            stopRecording();
-            aboutToOverflow = false;
-            sendChangeMessage(); //DN: needed to tell mainComponent we're stopping
-        }
+        if (engine.isRecording())
+            drawTakeSoFar();
 
-        if (waitingToRecord && loopSource.readyToRecord())
-        {
-           startRecording();
-            waitingToRecord = false;
-        }
+        undoButton.setEnabled(engine.canUndo());
+        redoButton.setEnabled(engine.canRedo());
+        overdubButton.setToggleState(engine.isOverdubbing(), juce::dontSendNotification);
 
-        if (waitingToRecord)
+        if (engine.isWaitingToRecord())
         {
             blinkingCounter++;
             if (blinkingCounter == 50)
@@ -522,55 +423,31 @@ private:
                 shouldLightUp = true;
 
         }
-        else if (isRecording())
+        else if (engine.isRecording())
             shouldLightUp = true;
         else
             shouldLightUp = false;
 
-        if(loopSource.isPlaying()) //DN: added this if so we don't call this when not playing back
+        if (engine.isPlaying()) //DN: added this if so we don't call this when not playing back
             repaint();
     }
 
 
+    TrackEngine& engine;
+
     juce::AudioFormatManager formatManager;
     juce::AudioThumbnailCache thumbnailCache{ 10 };
     juce::AudioThumbnail thumbnail{ 512, formatManager, thumbnailCache };
+    int numSamplesDrawn = 0;  //how much of the take being recorded is in the thumbnail so far
+    std::vector<float*> channelPointers;  //where each of its channels is, for drawTakeSoFar()
 
-    int samplesPerBlock = 44100;
-    int sampleRate = 44100;
-    bool aboutToOverflow = false;
-    bool isReversed = false;
     bool shouldLightUp = false;
-    bool waitingToRecord = false;
-    bool settingsHaveBeenOpened = false;
+    juce::Array<InputChoice> inputChoices;  //what each item in the inputSelector routes to
     juce::int64 dragStart = 0;
     int blinkingCounter = 0;
 
-    AudioRecorder recorder{ thumbnail };
-    LoopSource loopSource;
-    juce::File lastRecording;
-
     // ---
     bool displayFullThumb = false;
 
-    void changeListenerCallback(juce::ChangeBroadcaster* source) override
-    {      
-
-        //DN: any time any change happens check if we need to turn on/off slip controller
-        if (!lastRecording.exists())
-        {
-            slipController.setEnabled(false);
-            slipController.setVisible(false);
-        }
-        else
-        {
-            slipController.setEnabled(true);
-            slipController.setVisible(true);
-        }
-
-        sendSynchronousChangeMessage();
-    }
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(AudioTrack)
 };
-
-
-
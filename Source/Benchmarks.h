@@ -0,0 +1,758 @@
+/*
+  ==============================================================================
+
+    Benchmarks.h
+
+    Microbenchmarks for the audio path, run from the command line with no
+    window and no audio device:
+
+        467AudioLoopStation --benchmark [--out <file.json>] [--baseline <file.json>]
+                            [--tolerance <percent>] [--filter <text>] [--quick]
+                            [--seconds <per case>]
+
+    Each case drives one part of the engine - a LoopSource, a TrackEngine, the
+    InputMonitor, the Metronome, or the whole mixer graph (tracks, metronome
+    and input monitor in a MixEngine, rendered serially or in parallel) -
+    with made-up audio, one block at a time as fast as it'll go, across a
+    range of block sizes (16 to 4096), sample rates, channel counts, track
+    counts and loop lengths.
+
+    The "playback" cases play the same loop through LoopSource and through
+    the per-sample render it had before it worked in spans (kept here as a
+    reference, with the gain and pan passes AudioTrack did after it), at
+    every block size from 32 to 2048, and the two are printed side by side
+    at the end.  Every block is timed on its own, so the results
+    are the median, p99, mean and fastest block, the time per sample, and how
+    much of the block's deadline that is.
+
+    They're printed as they go, and written as JSON to --out (benchmark.json
+    by default).  Given a --baseline from an earlier run, every case is
+    compared with it by name, and anything whose median has got more than
+    --tolerance percent (15 by default) slower is a regression.  The exit
+    code is 0 if there weren't any, 1 if there were, and 2 if the benchmarks
+    couldn't run.  Build with the Release configuration, or the numbers are
+    for the debug build.
+
+    Before any of that, the mixer graph renders the same blocks serially and
+    in parallel - including blocks much bigger than it was prepared for - and
+    the two have to match, or the exit code is 1 and nothing's measured.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <iostream>
+#include <map>
+#include <numeric>
+#include <vector>
+#include "CaptureDispatcher.h"
+#include "InputMonitor.h"
+#include "LoopSource.h"
+#include "Metronome.h"
+#include "MixEngine.h"
+#include "TrackEngine.h"
+#include "TransportClock.h"
+
+
+class Benchmarks
+{
+public:
+    static bool isBenchmarkCommand(const juce::StringArray& arguments)
+    {
+        return arguments.contains("--benchmark");
+    }
+
+    //Message thread, before there's any window: returns the process's exit code
+    static int run(const juce::StringArray& arguments)
+    {
+        juce::File outputFile = juce::File::getCurrentWorkingDirectory().getChildFile("benchmark.json");
+        juce::File baselineFile;
+        juce::String filter;
+        double tolerance = 15.0;
+        double secondsPerCase = 0.25;
+        bool quick = false;
+
+        for (int i = 0; i < arguments.size(); ++i)
+        {
+            const auto& argument = arguments[i];
+            const bool hasValue = i + 1 < arguments.size();
+
+            if (argument == "--benchmark")                  continue;
+            else if (argument == "--quick")                 quick = true;
+            else if (argument == "--out" && hasValue)       outputFile = juce::File::getCurrentWorkingDirectory().getChildFile(arguments[++i]);
+            else if (argument == "--baseline" && hasValue)  baselineFile = juce::File::getCurrentWorkingDirectory().getChildFile(arguments[++i]);
+            else if (argument == "--tolerance" && hasValue) tolerance = arguments[++i].getDoubleValue();
+            else if (argument == "--filter" && hasValue)    filter = arguments[++i];
+            else if (argument == "--seconds" && hasValue)   secondsPerCase = arguments[++i].getDoubleValue();
+            else                                            return fail("Unknown option " + argument);
+        }
+
+        if (secondsPerCase <= 0.0)
+            return fail("--seconds has to be more than 0");
+
+        std::map<juce::String, double> baseline;
+
+        if (baselineFile != juce::File())
+        {
+            const auto result = readBaseline(baselineFile, baseline);
+
+            if (result.failed())
+                return fail(result.getErrorMessage());
+        }
+
+        if (quick)
+            secondsPerCase = juce::jmin(secondsPerCase, 0.05);
+
+        if (!parallelRenderMatchesSerial())
+            return 1;
+
+        juce::Array<juce::var> results;
+        int numRegressions = 0;
+
+        for (const auto& config : getConfigs(quick))
+        {
+            const auto name = config.getName();
+
+            if (filter.isNotEmpty() && !name.contains(filter))
+                continue;
+
+            auto fixture = createFixture(config);
+            const auto stats = measure(*fixture, config, secondsPerCase);
+            auto result = stats.toVar(config);
+
+            juce::String line;
+            line << name.paddedRight(' ', 64)
+                 << " median " << juce::String(stats.medianNs / 1000.0, 2).paddedLeft(' ', 9) << "us"
+                 << "  p99 " << juce::String(stats.p99Ns / 1000.0, 2).paddedLeft(' ', 9) << "us"
+                 << "  " << juce::String(stats.deadlineLoad * 100.0, 2).paddedLeft(' ', 6) << "% of the block";
+
+            const auto previous = baseline.find(name);
+
+            if (previous != baseline.end() && previous->second > 0.0)
+            {
+                const double change = stats.medianNs / previous->second - 1.0;
+                const bool regressed = change * 100.0 > tolerance;
+
+                result.getDynamicObject()->setProperty("baselineMedianNs", previous->second);
+                result.getDynamicObject()->setProperty("change", change);
+                result.getDynamicObject()->setProperty("regression", regressed);
+
+                line << "  " << (change >= 0.0 ? "+" : "") << juce::String(change * 100.0, 1) << "%"
+                     << (regressed ? "  REGRESSION" : "");
+
+                if (regressed)
+                    ++numRegressions;
+            }
+
+            std::cout << line << std::endl;
+            results.add(result);
+        }
+
+        if (results.isEmpty())
+            return fail("No benchmarks match --filter " + filter);
+
+        comparePlayback(results);
+
+        auto* root = new juce::DynamicObject();
+        const juce::var rootVar(root);
+        root->setProperty("version", 1);
+        root->setProperty("time", juce::Time::getCurrentTime().toISO8601(true));
+        root->setProperty("cpu", juce::SystemStats::getCpuModel());
+        root->setProperty("numCpus", juce::SystemStats::getNumCpus());
+       #if JUCE_DEBUG
+        root->setProperty("build", "Debug");
+       #else
+        root->setProperty("build", "Release");
+       #endif
+        root->setProperty("secondsPerCase", secondsPerCase);
+        root->setProperty("results", results);
+
+        if (baselineFile != juce::File())
+        {
+            root->setProperty("baseline", baselineFile.getFullPathName());
+            root->setProperty("tolerancePercent", tolerance);
+            root->setProperty("regressions", numRegressions);
+        }
+
+        if (!outputFile.replaceWithText(juce::JSON::toString(rootVar)))
+            return fail("Couldn't write " + outputFile.getFullPathName());
+
+        std::cout << results.size() << " benchmarks -> " << outputFile.getFullPathName() << std::endl;
+
+        if (baselineFile != juce::File())
+            std::cout << numRegressions << " more than " << juce::String(tolerance, 1) << "% slower than "
+                      << baselineFile.getFullPathName() << std::endl;
+
+        return numRegressions > 0 ? 1 : 0;
+    }
+
+private:
+    static constexpr int tempo = 120;
+    static constexpr int numOutputChannels = 2;
+    static constexpr int numWarmUpBlocks = 32;
+    static constexpr int minBlocksPerCase = 64;
+    static constexpr int maxBlocksPerCase = 200000;
+
+    //One case: what gets driven, and with what.  numTracks and beats are 0 where they don't apply
+    struct Config
+    {
+        juce::String component;
+        int blockSize;
+        double sampleRate;
+        int numChannels;
+        int numTracks;
+        int beats;
+        juce::String variant;
+
+        //What the case is called in the results, and matched against the baseline by
+        juce::String getName() const
+        {
+            juce::String name;
+            name << component << "/block=" << blockSize << "/rate=" << (int)sampleRate << "/channels=" << numChannels;
+
+            if (numTracks > 0)
+                name << "/tracks=" << numTracks;
+
+            if (beats > 0)
+                name << "/beats=" << beats;
+
+            if (variant.isNotEmpty())
+                name << "/" << variant;
+
+            return name;
+        }
+    };
+
+    static std::vector<Config> getConfigs(bool quick)
+    {
+        const auto blockSizes = quick ? std::vector<int>{ 64, 512, 4096 } : std::vector<int>{ 16, 64, 256, 1024, 4096 };
+        const auto sampleRates = quick ? std::vector<double>{ 48000.0 } : std::vector<double>{ 44100.0, 96000.0 };
+        const auto loopBeats = quick ? std::vector<int>{ 4 } : std::vector<int>{ 4, 32 };
+        const auto trackCounts = quick ? std::vector<int>{ 4, 32 } : std::vector<int>{ 1, 4, 16, 64 };
+
+        std::vector<Config> configs;
+
+        for (auto blockSize : blockSizes)
+            for (auto sampleRate : sampleRates)
+            {
+                for (int channels = 1; channels <= 2; ++channels)
+                    for (auto beats : loopBeats)
+                        for (auto* direction : { "forward", "reversed" })
+                            configs.push_back({ "loopSource", blockSize, sampleRate, channels, 0, beats, direction });
+
+                for (auto beats : loopBeats)
+                    configs.push_back({ "trackEngine", blockSize, sampleRate, 2, 0, beats, {} });
+
+                for (auto channels : { 1, 2, 8 })
+                    configs.push_back({ "inputMonitor", blockSize, sampleRate, channels, 0, 0, {} });
+
+                configs.push_back({ "metronome", blockSize, sampleRate, numOutputChannels, 0, 4, {} });
+
+                //every track has its own copy of the loop, so the graph sticks to short ones
+                for (auto numTracks : trackCounts)
+                    for (auto* mode : { "serial", "parallel" })
+                        configs.push_back({ "mixer", blockSize, sampleRate, 2, numTracks, 4, mode });
+            }
+
+        //the old per-sample render against LoopSource's spans, at the block sizes devices actually run at
+        const auto playbackBlockSizes = quick ? std::vector<int>{ 32, 256, 2048 } : std::vector<int>{ 32, 64, 128, 256, 512, 1024, 2048 };
+
+        for (auto blockSize : playbackBlockSizes)
+            for (int channels = 1; channels <= 2; ++channels)
+                for (auto* render : { "perSample", "spans" })
+                    configs.push_back({ "playback", blockSize, 48000.0, channels, 0, 4, render });
+
+        return configs;
+    }
+
+    //==============================================================================
+    //Something that renders a block into the output, set up and ready to go
+    class Fixture
+    {
+    public:
+        virtual ~Fixture() = default;
+
+        //output has already been cleared
+        virtual void renderBlock(juce::AudioBuffer<float>& output) = 0;
+    };
+
+    static void fillWithNoise(juce::AudioBuffer<float>& buffer)
+    {
+        juce::Random random(467);
+
+        for (int channel = 0; channel < buffer.getNumChannels(); ++channel)
+        {
+            auto* samples = buffer.getWritePointer(channel);
+
+            for (int i = 0; i < buffer.getNumSamples(); ++i)
+                samples[i] = (random.nextFloat() * 2.0f - 1.0f) * 0.25f;
+        }
+    }
+
+    //A loop's worth of noise on disk, for the classes that load their audio from a WAV
+    static std::unique_ptr<juce::TemporaryFile> writeNoiseWAV(int numChannels, int numSamples, double sampleRate)
+    {
+        auto file = std::make_unique<juce::TemporaryFile>(".wav");
+        juce::AudioBuffer<float> audio(numChannels, numSamples);
+        fillWithNoise(audio);
+
+        juce::WavAudioFormat wavFormat;
+        auto fileStream = std::make_unique<juce::FileOutputStream>(file->getFile());
+        std::unique_ptr<juce::AudioFormatWriter> writer(wavFormat.createWriterFor(fileStream.get(), sampleRate, (unsigned int)numChannels,
+                                                                                   24, {}, 0));
+
+        if (writer != nullptr)
+        {
+            fileStream.release();  //(the writer deletes it)
+            writer->writeFromAudioSampleBuffer(audio, 0, numSamples);
+        }
+
+        return file;
+    }
+
+    //A LoopSource playing a loop of noise, gain and pan applied on the way into the output
+    class LoopSourceFixture : public Fixture
+    {
+    public:
+        LoopSourceFixture(const Config& config)
+        {
+            loop.prepareToPlay(config.blockSize, config.sampleRate);
+            loop.setMasterLoop(tempo, config.beats);
+
+            juce::AudioBuffer<float> audio(config.numChannels, (int)loop.getMasterLoopLength());
+            fillWithNoise(audio);
+            loop.loadTake(LoopTake::fromBuffer(audio), config.sampleRate);
+
+            if (config.variant == "reversed")
+                loop.reverseAudio();
+
+            loop.clearHistory();
+
+            //the same as OfflineRenderer: empty blocks until it's playing what it's been handed
+            while (loop.isTimeStretchPending())
+            {
+                if (!loop.updateTimeStretch())
+                    juce::Thread::sleep(5);
+
+                renderNothing();
+            }
+
+            loop.start(0);
+            clock.start();
+            renderNothing();
+        }
+
+        void renderBlock(juce::AudioBuffer<float>& output) override
+        {
+            loop.mixNextAudioBlock(juce::AudioSourceChannelInfo(&output, 0, output.getNumSamples()), gains, gains);
+            clock.advance(output.getNumSamples());
+        }
+
+    private:
+        void renderNothing()
+        {
+            juce::AudioBuffer<float> empty(numOutputChannels, 0);
+            loop.mixNextAudioBlock(juce::AudioSourceChannelInfo(&empty, 0, 0), gains, gains);
+        }
+
+        TransportClock clock;
+        LoopSource loop{ clock };
+        const ChannelGains gains = ChannelGains::fromGainAndPan(0.8f, 0.25f);
+    };
+
+    //LoopSource's render from before it worked in spans, and the gain and pan passes AudioTrack made over
+    //it afterwards, as they were: every sample of every channel checks for the wrap and whether it's in
+    //the recorded audio, then reads it with getSample().  Only here to measure the spans against
+    class PerSampleLoopFixture : public Fixture
+    {
+    public:
+        PerSampleLoopFixture(const Config& config)
+            : loopBuffer(config.numChannels, (int)TransportClock::getLoopLengthInSamples(tempo, config.beats, config.sampleRate)),
+              masterLoopLength(loopBuffer.getNumSamples())
+        {
+            fillWithNoise(loopBuffer);
+        }
+
+        void renderBlock(juce::AudioBuffer<float>& output) override
+        {
+            const juce::ScopedLock sl(callbackLock);
+            const int numSamples = output.getNumSamples();
+
+            //it filled the block itself, starting from silence
+            output.clear();
+
+            const int loopBufferSize = loopBuffer.getNumSamples();
+            const int maxInChannels = loopBuffer.getNumChannels();
+            const int maxOutChannels = output.getNumChannels();
+            int pos = position;
+
+            for (int i = 0; i < maxOutChannels; ++i)
+            {
+                auto* writer = output.getWritePointer(i);
+                pos = position;
+
+                for (int sample = 0; sample < numSamples; ++sample)
+                {
+                    if (pos == masterLoopLength)
+                        pos = 0;
+
+                    if ((pos > fileStartOffset) && (pos < (loopBufferSize + fileStartOffset)))
+                        writer[sample] = loopBuffer.getSample(i % maxInChannels, pos - fileStartOffset);
+
+                    pos++;
+                }
+            }
+
+            position = pos;
+
+            for (int channel = 0; channel < maxOutChannels; ++channel)
+            {
+                auto* gainWriter = output.getWritePointer(channel);
+
+                for (int sample = 0; sample < numSamples; ++sample)
+                    gainWriter[sample] = gainWriter[sample] * gain;
+            }
+
+            auto* panWriter = output.getWritePointer(pan > 0.0f ? 0 : 1);
+            const float panGain = 1.0f - std::abs(pan);
+
+            for (int sample = 0; sample < numSamples; ++sample)
+                panWriter[sample] = panWriter[sample] * panGain;
+        }
+
+    private:
+        juce::AudioBuffer<float> loopBuffer;
+        const int masterLoopLength;
+        const int fileStartOffset = 0;
+        int position = 0;
+        const float gain = 0.8f, pan = 0.25f;  //the same as LoopSourceFixture's
+        juce::CriticalSection callbackLock;
+    };
+
+    //A whole track, loaded from a WAV the way the app loads one
+    class TrackEngineFixture : public Fixture
+    {
+    public:
+        TrackEngineFixture(const Config& config)
+        {
+            wav = writeNoiseWAV(config.numChannels, (int)TransportClock::getLoopLengthInSamples(tempo, config.beats, config.sampleRate),
+                                config.sampleRate);
+
+            track.prepareToPlay(config.blockSize, config.sampleRate);
+            track.setMasterLoop(tempo, config.beats);
+            track.setLastRecording(wav->getFile());
+            track.loadAudio();
+            track.start();
+            clock.start();
+        }
+
+        void renderBlock(juce::AudioBuffer<float>& output) override
+        {
+            track.mixNextAudioBlock(juce::AudioSourceChannelInfo(&output, 0, output.getNumSamples()));
+            clock.advance(output.getNumSamples());
+        }
+
+    private:
+        std::unique_ptr<juce::TemporaryFile> wav;
+        CaptureDispatcher dispatcher;
+        TransportClock clock;
+        TrackEngine track{ dispatcher, clock };
+    };
+
+    class InputMonitorFixture : public Fixture
+    {
+    public:
+        InputMonitorFixture(const Config& config)
+            : input(config.numChannels, config.blockSize)
+        {
+            fillWithNoise(input);
+            monitor.prepareToPlay(config.blockSize, config.sampleRate);
+        }
+
+        void renderBlock(juce::AudioBuffer<float>& output) override
+        {
+            monitor.setInput(input, input.getNumChannels(), output.getNumSamples());
+            monitor.mixNextAudioBlock(juce::AudioSourceChannelInfo(&output, 0, output.getNumSamples()));
+        }
+
+    private:
+        juce::AudioBuffer<float> input;
+        InputMonitor monitor;
+    };
+
+    class MetronomeFixture : public Fixture
+    {
+    public:
+        MetronomeFixture(const Config& config)
+        {
+            metronome.prepareToPlay(config.blockSize, config.sampleRate);
+            metronome.setMasterLoop(tempo, config.beats);
+            metronome.start();
+            clock.start();
+        }
+
+        void renderBlock(juce::AudioBuffer<float>& output) override
+        {
+            metronome.mixNextAudioBlock(juce::AudioSourceChannelInfo(&output, 0, output.getNumSamples()));
+            clock.advance(output.getNumSamples());
+        }
+
+    private:
+        TransportClock clock;
+        Metronome metronome{ clock };
+    };
+
+    //What MainComponent plays through: every track, the metronome and the input monitor in a MixEngine
+    class MixerFixture : public Fixture
+    {
+    public:
+        MixerFixture(const Config& config)
+            : input(numOutputChannels, config.blockSize)
+        {
+            fillWithNoise(input);
+            wav = writeNoiseWAV(config.numChannels, (int)TransportClock::getLoopLengthInSamples(tempo, config.beats, config.sampleRate),
+                                config.sampleRate);
+
+            mixer.setMinSourcesForParallelRender(config.variant == "parallel" ? 2 : std::numeric_limits<int>::max());
+            mixer.prepareToPlay(config.blockSize, config.sampleRate, numOutputChannels);
+
+            for (int i = 0; i < config.numTracks; ++i)
+            {
+                auto* track = tracks.add(new TrackEngine(dispatcher, clock));
+                mixer.addSource(track);
+                track->setMasterLoop(tempo, config.beats);
+                track->setLastRecording(wav->getFile());
+                track->loadAudio();
+                track->start();
+            }
+
+            metronome.setMasterLoop(tempo, config.beats);
+            metronome.start();
+            mixer.addSource(&metronome);
+            mixer.addSource(&monitor);
+            clock.start();
+        }
+
+        ~MixerFixture() override
+        {
+            for (auto* track : tracks)
+                mixer.removeSource(track);
+        }
+
+        void renderBlock(juce::AudioBuffer<float>& output) override
+        {
+            monitor.setInput(input, input.getNumChannels(), output.getNumSamples());
+            mixer.getNextAudioBlock(juce::AudioSourceChannelInfo(&output, 0, output.getNumSamples()));
+            clock.advance(output.getNumSamples());
+        }
+
+    private:
+        juce::AudioBuffer<float> input;
+        std::unique_ptr<juce::TemporaryFile> wav;
+        CaptureDispatcher dispatcher;
+        TransportClock clock;
+        juce::OwnedArray<TrackEngine> tracks;
+        Metronome metronome{ clock };
+        InputMonitor monitor;
+        MixEngine mixer;  //declared last, so it's gone before anything it plays
+    };
+
+    static std::unique_ptr<Fixture> createFixture(const Config& config)
+    {
+        if (config.component == "loopSource")      return std::make_unique<LoopSourceFixture>(config);
+        if (config.component == "playback")        return config.variant == "perSample" ? std::unique_ptr<Fixture>(std::make_unique<PerSampleLoopFixture>(config))
+                                                                                        : std::make_unique<LoopSourceFixture>(config);
+        if (config.component == "trackEngine")     return std::make_unique<TrackEngineFixture>(config);
+        if (config.component == "inputMonitor")    return std::make_unique<InputMonitorFixture>(config);
+        if (config.component == "metronome")       return std::make_unique<MetronomeFixture>(config);
+
+        return std::make_unique<MixerFixture>(config);
+    }
+
+    //==============================================================================
+    //The parallel mixer has to play exactly what the serial one does, block after block, whatever size
+    //the device hands it - a driver can go past the size it asked to be prepared for
+    static bool parallelRenderMatchesSerial()
+    {
+        const int preparedBlockSize = 256;
+        const Config serialConfig{ "mixer", preparedBlockSize, 48000.0, 2, 16, 4, "serial" };
+        auto parallelConfig = serialConfig;
+        parallelConfig.variant = "parallel";
+
+        MixerFixture serial(serialConfig), parallel(parallelConfig);
+
+        for (int blockSize : { preparedBlockSize, 4096, 100, 20000, preparedBlockSize })
+        {
+            juce::AudioBuffer<float> serialOutput(numOutputChannels, blockSize), parallelOutput(numOutputChannels, blockSize);
+            serialOutput.clear();
+            parallelOutput.clear();
+            serial.renderBlock(serialOutput);
+            parallel.renderBlock(parallelOutput);
+
+            for (int channel = 0; channel < numOutputChannels; ++channel)
+                for (int i = 0; i < blockSize; ++i)
+                    if (std::abs(serialOutput.getSample(channel, i) - parallelOutput.getSample(channel, i)) > 1.0e-5f)
+                    {
+                        std::cerr << "The parallel mixer doesn't match the serial one: a " << blockSize << " sample block differs at sample "
+                                  << i << " of channel " << channel << std::endl;
+                        return false;
+                    }
+        }
+
+        return true;
+    }
+
+    //==============================================================================
+    struct Stats
+    {
+        int numBlocks = 0;
+        double medianNs = 0.0;
+        double p99Ns = 0.0;
+        double meanNs = 0.0;
+        double minNs = 0.0;
+        double nsPerSample = 0.0;
+        double deadlineLoad = 0.0;  //the median block's time over how long the block lasts
+
+        juce::var toVar(const Config& config) const
+        {
+            auto* object = new juce::DynamicObject();
+            const juce::var result(object);
+
+            object->setProperty("name", config.getName());
+            object->setProperty("component", config.component);
+            object->setProperty("blockSize", config.blockSize);
+            object->setProperty("sampleRate", config.sampleRate);
+            object->setProperty("channels", config.numChannels);
+            object->setProperty("tracks", config.numTracks);
+            object->setProperty("beats", config.beats);
+            object->setProperty("variant", config.variant);
+            object->setProperty("blocks", numBlocks);
+            object->setProperty("medianNs", medianNs);
+            object->setProperty("p99Ns", p99Ns);
+            object->setProperty("meanNs", meanNs);
+            object->setProperty("minNs", minNs);
+            object->setProperty("nsPerSample", nsPerSample);
+            object->setProperty("deadlineLoad", deadlineLoad);
+
+            return result;
+        }
+    };
+
+    //Renders blocks for secondsPerCase (and at least minBlocksPerCase of them), timing each one on its own.
+    //Clearing the output isn't part of the time
+    static Stats measure(Fixture& fixture, const Config& config, double secondsPerCase)
+    {
+        juce::AudioBuffer<float> output(numOutputChannels, config.blockSize);
+
+        for (int i = 0; i < numWarmUpBlocks; ++i)
+        {
+            output.clear();
+            fixture.renderBlock(output);
+        }
+
+        const double nsPerTick = 1.0e9 / (double)juce::Time::getHighResolutionTicksPerSecond();
+        const auto endTicks = juce::Time::getHighResolutionTicks()
+                              + (juce::int64)(secondsPerCase * (double)juce::Time::getHighResolutionTicksPerSecond());
+
+        std::vector<double> blockNs;
+        blockNs.reserve(maxBlocksPerCase);
+
+        while ((int)blockNs.size() < minBlocksPerCase
+               || ((int)blockNs.size() < maxBlocksPerCase && juce::Time::getHighResolutionTicks() < endTicks))
+        {
+            output.clear();
+
+            const auto startTicks = juce::Time::getHighResolutionTicks();
+            fixture.renderBlock(output);
+            blockNs.push_back((double)(juce::Time::getHighResolutionTicks() - startTicks) * nsPerTick);
+        }
+
+        std::sort(blockNs.begin(), blockNs.end());
+
+        Stats stats;
+        stats.numBlocks = (int)blockNs.size();
+        stats.medianNs = blockNs[blockNs.size() / 2];
+        stats.p99Ns = blockNs[juce::jmin(blockNs.size() - 1, (size_t)(0.99 * (double)blockNs.size()))];
+        stats.meanNs = std::accumulate(blockNs.begin(), blockNs.end(), 0.0) / (double)blockNs.size();
+        stats.minNs = blockNs.front();
+        stats.nsPerSample = stats.medianNs / config.blockSize;
+        stats.deadlineLoad = stats.medianNs / (1.0e9 * config.blockSize / config.sampleRate);
+
+        return stats;
+    }
+
+    //Each "playback" block size with both renders side by side: the spans' result gets the per-sample median
+    //and how many times faster it is, and they're printed as a table
+    static void comparePlayback(const juce::Array<juce::var>& results)
+    {
+        std::map<juce::String, double> perSampleMedians;
+
+        for (const auto& result : results)
+            if (result["component"].toString() == "playback" && result["variant"].toString() == "perSample")
+                perSampleMedians[result["name"].toString().upToLastOccurrenceOf("/", false, false)] = (double)result["medianNs"];
+
+        bool printedHeading = false;
+
+        for (const auto& result : results)
+        {
+            if (result["component"].toString() != "playback" || result["variant"].toString() != "spans")
+                continue;
+
+            const auto perSample = perSampleMedians.find(result["name"].toString().upToLastOccurrenceOf("/", false, false));
+
+            if (perSample == perSampleMedians.end())
+                continue;
+
+            const double spansNs = (double)result["medianNs"];
+            const double speedup = spansNs > 0.0 ? perSample->second / spansNs : 0.0;
+            result.getDynamicObject()->setProperty("perSampleMedianNs", perSample->second);
+            result.getDynamicObject()->setProperty("speedup", speedup);
+
+            if (!printedHeading)
+            {
+                std::cout << std::endl << "Loop playback, per-sample render vs spans (median per block):" << std::endl;
+                printedHeading = true;
+            }
+
+            juce::String line;
+            line << "  block " << juce::String((int)result["blockSize"]).paddedLeft(' ', 4)
+                 << "  channels " << (int)result["channels"]
+                 << "  per-sample " << juce::String(perSample->second / 1000.0, 2).paddedLeft(' ', 9) << "us"
+                 << "  spans " << juce::String(spansNs / 1000.0, 2).paddedLeft(' ', 9) << "us"
+                 << "  " << juce::String(speedup, 1).paddedLeft(' ', 6) << "x";
+
+            std::cout << line << std::endl;
+        }
+
+        if (printedHeading)
+            std::cout << std::endl;
+    }
+
+    //The median of every case in an earlier run's JSON, by name
+    static juce::Result readBaseline(const juce::File& file, std::map<juce::String, double>& baseline)
+    {
+        if (!file.existsAsFile())
+            return juce::Result::fail("Couldn't find the baseline " + file.getFullPathName());
+
+        const auto parsed = juce::JSON::parse(file);
+        const auto* results = parsed["results"].getArray();
+
+        if (results == nullptr)
+            return juce::Result::fail(file.getFullPathName() + " isn't a benchmark results file");
+
+        for (const auto& result : *results)
+            baseline[result["name"].toString()] = (double)result["medianNs"];
+
+        return juce::Result::ok();
+    }
+
+    static int fail(const juce::String& message)
+    {
+        std::cerr << message << std::endl
+                  << "Usage: --benchmark [--out <file.json>] [--baseline <file.json>] [--tolerance <percent>]" << std::endl
+                  << "       [--filter <text>] [--quick] [--seconds <per case>]" << std::endl;
+        return 2;
+    }
+};
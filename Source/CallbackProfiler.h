@@ -0,0 +1,414 @@
+/*
+  ==============================================================================
+
+    CallbackProfiler.h
+
+    Measures where the audio callback's time goes.  Each stage of the callback
+    (the whole callback, input capture, the mixer, and every source and
+    recorder inside them) has a Stage, and a ScopedTimer around the work adds
+    how long it took into that Stage's counters and histogram.  That's two
+    reads of the high resolution clock and a few relaxed atomic adds per stage
+    per block - no locks, nothing allocated, nothing to wait on.  A stage
+    timed by whichever render worker picks it up works the same way.
+
+    Once a second the message thread reads every registered Stage and works
+    out, for that second: its share of the real time the audio covered (its
+    DSP load), its p50/p99/max time per call, and how many callbacks missed
+    their deadline (took longer than the audio they produced lasts).  The
+    results go to a ChangeBroadcaster for the overlay (ProfilerOverlay.h),
+    and, if there's a log file, get appended to it every logIntervalSeconds.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_devices/juce_audio_devices.h>
+#include <atomic>
+#include <cmath>
+
+
+class CallbackProfiler : public juce::ChangeBroadcaster, private juce::Timer
+{
+public:
+    //Block times are binned 8 to an octave (about 9% apart), from 1us up to 1s
+    static constexpr int bucketsPerOctave = 8;
+    static constexpr int numBuckets = 20 * bucketsPerOctave;
+    static constexpr int logIntervalSeconds = 10;
+
+    //==============================================================================
+    //One thing that gets timed.  Written by whichever thread runs the work (one at a time),
+    //read by the profiler on the message thread
+    class Stage
+    {
+    public:
+        Stage() noexcept
+            : microsecondsPerTick(1.0e6 / (double)juce::Time::getHighResolutionTicksPerSecond())
+        {
+            for (auto& bucket : buckets)
+                bucket.store(0, std::memory_order_relaxed);
+        }
+
+        void addTime(juce::int64 ticks) noexcept
+        {
+            totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+            numCalls.fetch_add(1, std::memory_order_relaxed);
+            buckets[getBucket((double)ticks * microsecondsPerTick)].fetch_add(1, std::memory_order_relaxed);
+
+            auto previousMax = maxTicks.load(std::memory_order_relaxed);
+
+            while (ticks > previousMax && !maxTicks.compare_exchange_weak(previousMax, ticks, std::memory_order_relaxed))
+            {
+            }
+        }
+
+    private:
+        friend class CallbackProfiler;
+
+        static int getBucket(double microseconds) noexcept
+        {
+            if (microseconds <= 1.0)
+                return 0;
+
+            return juce::jmin(numBuckets - 1, (int)(bucketsPerOctave * std::log2(microseconds)));
+        }
+
+        const double microsecondsPerTick;
+
+        //these only ever count up, the profiler works from the difference since it last looked
+        std::atomic<juce::int64> totalTicks{ 0 };
+        std::atomic<juce::uint32> numCalls{ 0 };
+        std::atomic<juce::uint32> buckets[numBuckets];
+
+        std::atomic<juce::int64> maxTicks{ 0 };  //since the profiler last looked - it resets this
+
+        JUCE_DECLARE_NON_COPYABLE(Stage)
+    };
+
+    //Times from construction to destruction into the stage, if there is one
+    struct ScopedTimer
+    {
+        explicit ScopedTimer(Stage* stageToTime) noexcept
+            : stage(stageToTime), startTicks(stage != nullptr ? juce::Time::getHighResolutionTicks() : 0)
+        {
+        }
+
+        ~ScopedTimer() noexcept
+        {
+            if (stage != nullptr)
+                stage->addTime(juce::Time::getHighResolutionTicks() - startTicks);
+        }
+
+        Stage* const stage;
+        const juce::int64 startTicks;
+    };
+
+    //Wraps the whole audio callback: times it, and checks it against the time the block lasts
+    struct ScopedCallback
+    {
+        ScopedCallback(CallbackProfiler& profilerToUse, int numSamplesInBlock) noexcept
+            : profiler(profilerToUse), numSamples(numSamplesInBlock), startTicks(juce::Time::getHighResolutionTicks())
+        {
+        }
+
+        ~ScopedCallback() noexcept
+        {
+            profiler.callbackFinished(juce::Time::getHighResolutionTicks() - startTicks, numSamples);
+        }
+
+        CallbackProfiler& profiler;
+        const int numSamples;
+        const juce::int64 startTicks;
+    };
+
+    //==============================================================================
+    //What one stage did over the last second.  Times are in milliseconds
+    struct StageStats
+    {
+        juce::String name;
+        double load = 0.0;  //0 to 1, of the time the audio lasted
+        double p50 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+        int numCalls = 0;
+    };
+
+    struct Snapshot
+    {
+        juce::Array<StageStats> stages;  //the whole callback first, then in the order they were added
+        int numCallbacks = 0;
+        int missedDeadlines = 0;
+        int totalMissedDeadlines = 0;  //since the profiler started
+        int deviceXRuns = -1;          //what the driver has counted, if it can tell us
+        double blockMilliseconds = 0.0;
+    };
+
+    //==============================================================================
+    CallbackProfiler(juce::AudioDeviceManager& deviceManagerToWatch)
+        : deviceManager(deviceManagerToWatch)
+    {
+        registrations.add(new Registration(callbackStage, "Callback"));
+        startTimer(1000);
+    }
+
+    ~CallbackProfiler() override
+    {
+        stopTimer();
+    }
+
+    //Called from prepareToPlay, before any blocks arrive
+    void prepare(double sampleRate)
+    {
+        ticksPerSample = (double)juce::Time::getHighResolutionTicksPerSecond() / sampleRate;
+    }
+
+    //Message thread: the stage shows up in the results under this name from the next second on.
+    //It has to be removed again before it's deleted
+    void addStage(Stage& stage, const juce::String& name)
+    {
+        registrations.add(new Registration(stage, name));
+    }
+
+    void removeStage(Stage& stage)
+    {
+        for (int i = registrations.size(); --i > 0;)
+            if (&registrations.getUnchecked(i)->stage == &stage)
+                registrations.remove(i);
+    }
+
+    //Message thread: the latest second's results
+    const Snapshot& getLatest() const noexcept { return latest; }
+
+    //Message thread: appends the results to this file every logIntervalSeconds.  An empty File stops logging
+    void setLogFile(const juce::File& newLogFile)
+    {
+        if (newLogFile == logFile)
+            return;
+
+        logFile = newLogFile;
+        secondsSinceLog = 0;
+        totalCallbacksSinceLog = 0;
+        missedDeadlinesSinceLog = 0;
+
+        for (auto* registration : registrations)
+            registration->clearLogged();
+
+        if (logFile != juce::File())
+            logFile.appendText("Logging DSP load every " + juce::String(logIntervalSeconds) + "s" + juce::newLine);
+    }
+
+    const juce::File& getLogFile() const noexcept { return logFile; }
+
+private:
+    //A stage, and what the profiler remembers about it between reads
+    struct Registration
+    {
+        Registration(Stage& stageToRead, const juce::String& stageName)
+            : stage(stageToRead), name(stageName)
+        {
+            lastTicks = stage.totalTicks.load(std::memory_order_relaxed);
+            lastCalls = stage.numCalls.load(std::memory_order_relaxed);
+
+            for (int i = 0; i < numBuckets; ++i)
+                lastBuckets[i] = stage.buckets[i].load(std::memory_order_relaxed);
+
+            stage.maxTicks.store(0, std::memory_order_relaxed);
+            clearLogged();
+        }
+
+        void clearLogged()
+        {
+            loggedTicks = 0;
+            loggedCalls = 0;
+            loggedMaxTicks = 0;
+            std::fill(loggedBuckets, loggedBuckets + numBuckets, 0u);
+        }
+
+        Stage& stage;
+        juce::String name;
+
+        juce::int64 lastTicks;
+        juce::uint32 lastCalls;
+        juce::uint32 lastBuckets[numBuckets];
+
+        //added up between log entries
+        juce::int64 loggedTicks;
+        juce::uint32 loggedCalls;
+        juce::int64 loggedMaxTicks;
+        juce::uint32 loggedBuckets[numBuckets];
+    };
+
+    //Audio thread, at the end of every callback
+    void callbackFinished(juce::int64 ticks, int numSamples) noexcept
+    {
+        callbackStage.addTime(ticks);
+
+        const auto blockTicks = (juce::int64)(numSamples * ticksPerSample.load(std::memory_order_relaxed));
+        audioTicks.fetch_add(blockTicks, std::memory_order_relaxed);
+        numCallbacks.fetch_add(1, std::memory_order_relaxed);
+
+        if (ticks > blockTicks)
+            missedDeadlines.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void timerCallback() override
+    {
+        const auto newAudioTicks = audioTicks.load(std::memory_order_relaxed);
+        const auto newCallbacks = numCallbacks.load(std::memory_order_relaxed);
+        const auto newMissedDeadlines = missedDeadlines.load(std::memory_order_relaxed);
+
+        const auto audioTicksThisSecond = newAudioTicks - lastAudioTicks;
+
+        latest.numCallbacks = (int)(newCallbacks - lastCallbacks);
+        latest.missedDeadlines = (int)(newMissedDeadlines - lastMissedDeadlines);
+        latest.totalMissedDeadlines = (int)newMissedDeadlines;
+        latest.blockMilliseconds = latest.numCallbacks > 0 ? ticksToMilliseconds(audioTicksThisSecond) / latest.numCallbacks : 0.0;
+        latest.deviceXRuns = -1;
+
+        if (auto* device = deviceManager.getCurrentAudioDevice())
+            latest.deviceXRuns = device->getXRunCount();
+
+        lastAudioTicks = newAudioTicks;
+        lastCallbacks = newCallbacks;
+        lastMissedDeadlines = newMissedDeadlines;
+
+        latest.stages.clearQuick();
+
+        for (auto* registration : registrations)
+            latest.stages.add(readStage(*registration, audioTicksThisSecond));
+
+        loggedAudioTicks += audioTicksThisSecond;
+        totalCallbacksSinceLog += latest.numCallbacks;
+        missedDeadlinesSinceLog += latest.missedDeadlines;
+
+        if (logFile != juce::File() && ++secondsSinceLog >= logIntervalSeconds)
+            writeLogEntry();
+
+        sendChangeMessage();
+    }
+
+    //What the stage did since the last read, which also gets added to what's waiting to be logged
+    StageStats readStage(Registration& registration, juce::int64 audioTicksThisSecond)
+    {
+        auto& stage = registration.stage;
+
+        const auto ticks = stage.totalTicks.load(std::memory_order_relaxed);
+        const auto calls = stage.numCalls.load(std::memory_order_relaxed);
+        const auto maxTicks = stage.maxTicks.exchange(0, std::memory_order_relaxed);
+
+        juce::uint32 buckets[numBuckets];
+
+        for (int i = 0; i < numBuckets; ++i)
+        {
+            const auto count = stage.buckets[i].load(std::memory_order_relaxed);
+            buckets[i] = count - registration.lastBuckets[i];
+            registration.lastBuckets[i] = count;
+            registration.loggedBuckets[i] += buckets[i];
+        }
+
+        const auto ticksThisSecond = ticks - registration.lastTicks;
+        const auto callsThisSecond = calls - registration.lastCalls;
+        registration.lastTicks = ticks;
+        registration.lastCalls = calls;
+
+        registration.loggedTicks += ticksThisSecond;
+        registration.loggedCalls += callsThisSecond;
+        registration.loggedMaxTicks = juce::jmax(registration.loggedMaxTicks, maxTicks);
+
+        return makeStats(registration.name, ticksThisSecond, audioTicksThisSecond, callsThisSecond, maxTicks, buckets);
+    }
+
+    StageStats makeStats(const juce::String& name, juce::int64 ticks, juce::int64 audioTicksCovered,
+                         juce::uint32 calls, juce::int64 maxTicks, const juce::uint32* buckets) const
+    {
+        StageStats stats;
+        stats.name = name;
+        stats.load = audioTicksCovered > 0 ? (double)ticks / (double)audioTicksCovered : 0.0;
+        stats.p50 = getPercentile(buckets, calls, 0.5);
+        stats.p99 = getPercentile(buckets, calls, 0.99);
+        stats.max = ticksToMilliseconds(maxTicks);
+        stats.numCalls = (int)calls;
+        return stats;
+    }
+
+    //The top of the bucket the percentile falls in, in milliseconds
+    static double getPercentile(const juce::uint32* buckets, juce::uint32 totalCount, double percentile)
+    {
+        if (totalCount == 0)
+            return 0.0;
+
+        const auto target = (juce::uint64)std::ceil(percentile * totalCount);
+        juce::uint64 countSoFar = 0;
+
+        for (int i = 0; i < numBuckets; ++i)
+        {
+            countSoFar += buckets[i];
+
+            if (countSoFar >= target)
+                return std::exp2((double)(i + 1) / bucketsPerOctave) / 1000.0;
+        }
+
+        return std::exp2((double)numBuckets / bucketsPerOctave) / 1000.0;
+    }
+
+    double ticksToMilliseconds(juce::int64 ticks) const
+    {
+        return juce::Time::highResolutionTicksToSeconds(ticks) * 1000.0;
+    }
+
+    //One line per stage over the whole interval, so a spike between two looks at the overlay still shows up
+    void writeLogEntry()
+    {
+        juce::String entry;
+        entry << juce::Time::getCurrentTime().toString(true, true, true, true)
+              << "  callbacks " << totalCallbacksSinceLog
+              << "  missed deadlines " << missedDeadlinesSinceLog
+              << "  device xruns " << latest.deviceXRuns
+              << "  block " << juce::String(latest.blockMilliseconds, 2) << "ms" << juce::newLine;
+
+        for (auto* registration : registrations)
+        {
+            const auto stats = makeStats(registration->name, registration->loggedTicks, loggedAudioTicks, registration->loggedCalls,
+                                         registration->loggedMaxTicks, registration->loggedBuckets);
+
+            entry << "    " << stats.name.paddedRight(' ', 16)
+                  << " load " << juce::String(stats.load * 100.0, 1).paddedLeft(' ', 5) << "%"
+                  << "  p50 " << juce::String(stats.p50, 3) << "ms"
+                  << "  p99 " << juce::String(stats.p99, 3) << "ms"
+                  << "  max " << juce::String(stats.max, 3) << "ms" << juce::newLine;
+
+            registration->clearLogged();
+        }
+
+        logFile.appendText(entry);
+
+        secondsSinceLog = 0;
+        loggedAudioTicks = 0;
+        totalCallbacksSinceLog = 0;
+        missedDeadlinesSinceLog = 0;
+    }
+
+    juce::AudioDeviceManager& deviceManager;
+
+    //audio thread side
+    Stage callbackStage;
+    std::atomic<double> ticksPerSample{ (double)juce::Time::getHighResolutionTicksPerSecond() / 44100.0 };
+    std::atomic<juce::int64> audioTicks{ 0 };  //how long all the audio called back for so far lasts
+    std::atomic<juce::uint32> numCallbacks{ 0 };
+    std::atomic<juce::uint32> missedDeadlines{ 0 };
+
+    //message thread side
+    juce::OwnedArray<Registration> registrations;  //the callback's own stage is always first
+    Snapshot latest;
+    juce::int64 lastAudioTicks = 0;
+    juce::uint32 lastCallbacks = 0;
+    juce::uint32 lastMissedDeadlines = 0;
+
+    juce::File logFile;
+    int secondsSinceLog = 0;
+    juce::int64 loggedAudioTicks = 0;
+    int totalCallbacksSinceLog = 0;
+    int missedDeadlinesSinceLog = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CallbackProfiler)
+};
@@ -0,0 +1,277 @@
+/*
+  ==============================================================================
+
+    CaptureDispatcher.h
+
+    The one place device input gets handed out to whatever is recording it.
+    MainComponent already copies the input into a capture buffer each block;
+    it passes that here, and we give it to each armed CaptureTarget in turn.
+    Tracks that aren't recording aren't in the list at all, so they cost
+    nothing on the audio thread however many of them there are.
+
+    It also knows how far behind the output the input is - the round trip
+    through the device - which recording and overdubbing compensate for.
+    That's what the driver reports, unless the LatencyCalibrator has measured
+    it for the current device settings.
+
+    Also owns the one background thread every recorder writes to disk on, and
+    closes finished WAV writers on it so stopping a take never waits on disk.
+    Loops changed in memory (e.g. by overdubbing) get written out on it too,
+    straight out of a copy of the take that shares its chunks, so queueing
+    one copies no audio.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_formats/juce_audio_formats.h>
+#include "CallbackProfiler.h"
+#include "LoopTake.h"
+#include "RealtimeHandoff.h"
+
+
+//Anything that wants the device input while it's armed, e.g. a track's AudioRecorder
+class CaptureTarget
+{
+public:
+    virtual ~CaptureTarget() = default;
+
+    //Audio thread: mustn't block or allocate
+    virtual void captureBlock(const float* const* inputChannelData, int numInputChannels, int numSamples) = 0;
+
+    //Message thread, before the target is armed: the dispatcher times every block it captures into this
+    void setProfilerStage(CallbackProfiler::Stage* newStage) noexcept    { profilerStage = newStage; }
+    CallbackProfiler::Stage* getProfilerStage() const noexcept          { return profilerStage; }
+
+private:
+    CallbackProfiler::Stage* profilerStage = nullptr;
+};
+
+
+class CaptureDispatcher
+{
+public:
+    CaptureDispatcher()
+    {
+        armedTargets.publish(std::make_unique<juce::Array<CaptureTarget*>>());
+        diskWriterThread.addTimeSliceClient(&pendingDiskWork);
+        diskWriterThread.startThread();
+    }
+
+    ~CaptureDispatcher()
+    {
+        diskWriterThread.removeTimeSliceClient(&pendingDiskWork);
+        diskWriterThread.stopThread(2000);
+        pendingDiskWork.doAll();
+    }
+
+    //Called from prepareToPlay with the device's layout, before any blocks arrive.  reportedLatency is
+    //the device's input plus output latency, in samples
+    void prepare(double newSampleRate, int newNumInputChannels, int reportedLatency)
+    {
+        //a measurement only holds for the settings it was made with
+        if (newSampleRate != sampleRate.load() || reportedLatency != reportedRoundTripLatency.load())
+            measuredRoundTripLatency = -1;
+
+        sampleRate = newSampleRate;
+        numInputChannels = newNumInputChannels;
+        reportedRoundTripLatency = reportedLatency;
+    }
+
+    double getSampleRate() const noexcept { return sampleRate.load(); }
+    int getNumInputChannels() const noexcept { return numInputChannels.load(); }
+
+    //How many samples after something is played its echo comes back in the input
+    int getRoundTripLatency() const noexcept
+    {
+        const int measured = measuredRoundTripLatency.load();
+        return measured >= 0 ? measured : reportedRoundTripLatency.load();
+    }
+
+    //Message thread: a loopback measurement to use instead of what the driver reports, until the
+    //device's settings change.  -1 goes back to the driver's figure
+    void setMeasuredLatency(int newRoundTripLatency) noexcept
+    {
+        measuredRoundTripLatency = newRoundTripLatency;
+    }
+
+    bool hasMeasuredLatency() const noexcept { return measuredRoundTripLatency.load() >= 0; }
+
+    //Every recorder's ThreadedWriter runs on this
+    juce::TimeSliceThread& getDiskWriterThread() noexcept { return diskWriterThread; }
+
+    //Message thread: flushes the rest of the writer's data and closes its file on the disk thread
+    void finishWritingInBackground(std::unique_ptr<juce::AudioFormatWriter::ThreadedWriter> writer)
+    {
+        pendingDiskWork.add(std::move(writer));
+        diskWriterThread.notify();
+    }
+
+    //Message thread: writes the take (forwards, however it's played) to a WAV on the disk thread, replacing
+    //the file in one go once it's all written.  What's queued is a copy that shares the take's chunks, so
+    //the take can carry on being edited meanwhile
+    void writeTakeInBackground(const LoopTake& take, const juce::File& file, double sampleRate)
+    {
+        pendingDiskWork.add(take, file, sampleRate);
+        diskWriterThread.notify();
+    }
+
+    //True while a finished take or a buffer is still on its way to disk.  Poll this (e.g. on a timer)
+    //rather than waiting on the message thread
+    bool hasPendingWrites() const noexcept
+    {
+        return pendingDiskWork.hasPending();
+    }
+
+    //Message thread: the target gets input from the next block on
+    void arm(CaptureTarget* target)
+    {
+        jassert(target != nullptr);
+
+        const juce::ScopedLock sl(writerLock);
+        auto* current = armedTargets.getForWriter();
+
+        if (current->contains(target))
+            return;
+
+        auto newList = std::make_unique<juce::Array<CaptureTarget*>>(*current);
+        newList->add(target);
+        armedTargets.publish(std::move(newList));
+    }
+
+    //Message thread: once this returns the audio thread is done with the target,
+    //so whatever it writes into can be torn down
+    void disarm(CaptureTarget* target)
+    {
+        const juce::ScopedLock sl(writerLock);
+        auto* current = armedTargets.getForWriter();
+
+        if (!current->contains(target))
+            return;
+
+        auto newList = std::make_unique<juce::Array<CaptureTarget*>>(*current);
+        newList->removeFirstMatchingValue(target);
+        armedTargets.publish(std::move(newList));
+        armedTargets.waitForReaderToMoveOn();
+    }
+
+    //Audio thread
+    void dispatch(const juce::AudioBuffer<float>& input, int numChannels, int numSamples)
+    {
+        const RealtimeHandoff<juce::Array<CaptureTarget*>>::ScopedRead targets(armedTargets);
+
+        for (auto* target : *targets)
+        {
+            const CallbackProfiler::ScopedTimer timer(target->getProfilerStage());
+            target->captureBlock(input.getArrayOfReadPointers(), numChannels, numSamples);
+        }
+    }
+
+private:
+    //Everything queued up for the disk thread: finished ThreadedWriters to delete (their destructor
+    //is what flushes and closes the file), and whole takes to write out
+    class PendingDiskWork : public juce::TimeSliceClient
+    {
+    public:
+        void add(std::unique_ptr<juce::AudioFormatWriter::ThreadedWriter> writer)
+        {
+            const juce::ScopedLock sl(lock);
+            writersToClose.add(writer.release());
+            ++numPending;
+        }
+
+        void add(const LoopTake& take, const juce::File& file, double sampleRate)
+        {
+            const juce::ScopedLock sl(lock);
+            takesToWrite.add(new TakeToWrite{ take, file, sampleRate });
+            ++numPending;
+        }
+
+        bool hasPending() const noexcept { return numPending.load() > 0; }
+
+        void doAll()
+        {
+            juce::OwnedArray<juce::AudioFormatWriter::ThreadedWriter> toClose;
+            juce::OwnedArray<TakeToWrite> toWrite;
+
+            {
+                const juce::ScopedLock sl(lock);
+                toClose.swapWith(writersToClose);
+                toWrite.swapWith(takesToWrite);
+            }
+
+            const int numDone = toClose.size() + toWrite.size();
+            toClose.clear();
+
+            for (auto* job : toWrite)
+                job->write();
+
+            numPending -= numDone;
+        }
+
+        int useTimeSlice() override
+        {
+            if (hasPending())
+                doAll();
+
+            return 50;
+        }
+
+    private:
+        struct TakeToWrite
+        {
+            LoopTake take;
+            juce::File file;
+            double sampleRate;
+
+            void write()
+            {
+                //written to a temp file first, so the real one is never left half-written
+                juce::TemporaryFile tempFile(file);
+
+                if (auto fileStream = std::unique_ptr<juce::FileOutputStream>(tempFile.getFile().createOutputStream()))
+                {
+                    juce::WavAudioFormat wavFormat;
+
+                    if (auto writer = std::unique_ptr<juce::AudioFormatWriter>(wavFormat.createWriterFor(fileStream.get(), sampleRate,
+                                                                                   (unsigned int)take.getNumChannels(), 24, {}, 0)))
+                    {
+                        fileStream.release(); // (the writer owns the stream now)
+                        bool written = true;
+
+                        //straight out of the chunks, nothing gets copied into one big buffer first
+                        take.forEachChunk([&](int, const juce::AudioBuffer<float>& chunkAudio, int numSamples)
+                        {
+                            if (written)
+                                written = writer->writeFromAudioSampleBuffer(chunkAudio, 0, numSamples);
+                        });
+
+                        writer.reset();
+
+                        if (written)
+                            tempFile.overwriteTargetFileWithTemporary();
+                    }
+                }
+            }
+        };
+
+        juce::CriticalSection lock;
+        juce::OwnedArray<juce::AudioFormatWriter::ThreadedWriter> writersToClose;
+        juce::OwnedArray<TakeToWrite> takesToWrite;
+        std::atomic<int> numPending{ 0 };
+    };
+
+    RealtimeHandoff<juce::Array<CaptureTarget*>> armedTargets;
+    juce::CriticalSection writerLock;  //never taken on the audio thread
+
+    juce::TimeSliceThread diskWriterThread{ "Audio Recorder Thread" };
+    PendingDiskWork pendingDiskWork;
+
+    std::atomic<double> sampleRate{ 0.0 };
+    std::atomic<int> numInputChannels{ 0 };
+    std::atomic<int> reportedRoundTripLatency{ 0 };
+    std::atomic<int> measuredRoundTripLatency{ -1 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CaptureDispatcher)
+};
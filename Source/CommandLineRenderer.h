@@ -0,0 +1,114 @@
+/*
+  ==============================================================================
+
+    CommandLineRenderer.h
+
+    Batch-bounces saved projects from the command line, with no window and
+    no audio device:
+
+        467AudioLoopStation --render <project> [<project> ...] --out <folder>
+                            [--loops <n>] [--format wav|flac] [--bits <n>]
+                            [--rate <hz>] [--metronome] [--no-stems] [--no-mix]
+                            [--threads <n>]
+
+    A project is either the name of one in Loopspace's Saved Loops folder, or
+    the path to a project folder.  Each one is rendered by OfflineRenderer
+    into a folder of its own name inside the output folder.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <iostream>
+#include "OfflineRenderer.h"
+#include "SaveLoad.h"
+
+
+class CommandLineRenderer
+{
+public:
+    static bool isRenderCommand(const juce::StringArray& arguments)
+    {
+        return arguments.contains("--render");
+    }
+
+    //Message thread, before there's any window: returns the process's exit code
+    static int run(const juce::StringArray& arguments)
+    {
+        OfflineRenderer::Options options;
+        juce::StringArray projects;
+        juce::File outputFolder = juce::File::getCurrentWorkingDirectory();
+
+        for (int i = 0; i < arguments.size(); ++i)
+        {
+            const auto& argument = arguments[i];
+            const bool hasValue = i + 1 < arguments.size();
+
+            if (argument == "--render")                     continue;
+            else if (argument == "--metronome")             options.includeMetronome = true;
+            else if (argument == "--no-stems")              options.renderStems = false;
+            else if (argument == "--no-mix")                options.renderMix = false;
+            else if (argument == "--out" && hasValue)       outputFolder = juce::File::getCurrentWorkingDirectory().getChildFile(arguments[++i]);
+            else if (argument == "--loops" && hasValue)     options.numRepetitions = arguments[++i].getIntValue();
+            else if (argument == "--format" && hasValue)    options.format = arguments[++i];
+            else if (argument == "--bits" && hasValue)      options.bitsPerSample = arguments[++i].getIntValue();
+            else if (argument == "--rate" && hasValue)      options.sampleRate = arguments[++i].getDoubleValue();
+            else if (argument == "--threads" && hasValue)   options.numThreads = arguments[++i].getIntValue();
+            else if (argument.startsWith("-"))              return fail("Unknown option " + argument);
+            else                                            projects.add(argument);
+        }
+
+        if (projects.isEmpty())
+            return fail("Nothing to render");
+
+        if (options.numRepetitions < 1)
+            return fail("--loops has to be at least 1");
+
+        OfflineRenderer renderer(options);
+        int exitCode = 0;
+
+        for (const auto& project : projects)
+        {
+            const auto projectFolder = findProject(project);
+            const auto destination = outputFolder.getChildFile(projectFolder.getFileName());
+            const auto startTime = juce::Time::getMillisecondCounterHiRes();
+
+            const auto result = renderer.render(projectFolder, destination);
+
+            if (result.failed())
+            {
+                std::cerr << project << ": " << result.getErrorMessage() << std::endl;
+                exitCode = 1;
+                continue;
+            }
+
+            std::cout << project << " -> " << destination.getFullPathName() << " ("
+                      << juce::String((juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0, 2) << "s)" << std::endl;
+        }
+
+        return exitCode;
+    }
+
+private:
+    //A path to a project folder, or the name of a saved one
+    static juce::File findProject(const juce::String& project)
+    {
+        const auto asPath = juce::File::getCurrentWorkingDirectory().getChildFile(project);
+
+        if (asPath.getChildFile(PROJECT_STATE_XML_FILENAME).existsAsFile())
+            return asPath;
+
+        DirectoryTree directoryTree;
+        return directoryTree.getProjectFolder(project);
+    }
+
+    static int fail(const juce::String& message)
+    {
+        std::cerr << message << std::endl
+                  << "Usage: --render <project> [<project> ...] --out <folder> [--loops <n>] [--format wav|flac] [--bits <n>]" << std::endl
+                  << "       [--rate <hz>] [--metronome] [--no-stems] [--no-mix] [--threads <n>]" << std::endl;
+        return 1;
+    }
+};
@@ -0,0 +1,451 @@
+/*
+  ==============================================================================
+
+    DummyAudioDevice.h
+
+    An audio device that isn't there: a thread of its own calls the audio
+    callback a block at a time, with made-up input and the output thrown
+    away.  It lets the whole app run with no sound card (e.g. on a headless
+    CI machine), so the audio callback can be exercised exactly as it would
+    be by a driver.
+
+    By default it's paced to real time with silent input, but its Options
+    can also make it:
+      - run on a simulated clock, N times faster than real time or as fast
+        as the callback can go, so a day's session takes minutes
+      - feed the inputs a tone, seeded noise or a (looped) audio file
+      - write everything sent to the outputs to a WAV file
+      - misbehave like a real driver: callbacks arriving late (jitter),
+        dropped blocks (xruns), and blocks smaller than the buffer size
+    All the randomness comes from the seed, so a run can be repeated.
+
+    It's an AudioIODeviceType, so it's added to an AudioDeviceManager like
+    any other and selected by its type name.  The type keeps a Session that
+    counts everything its devices have done, and survives the device being
+    closed and reopened (e.g. to change the buffer size).
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_devices/juce_audio_devices.h>
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <atomic>
+#include <cmath>
+
+#define DUMMY_DEVICE_TYPE_NAME "Dummy"
+#define DUMMY_DEVICE_NAME "Dummy Device"
+
+
+class DummyAudioIODevice : public juce::AudioIODevice, private juce::Thread
+{
+public:
+    struct Options
+    {
+        enum class Input
+        {
+            silence,
+            tone,
+            noise,
+            file
+        };
+
+        double speed = 1.0;                 //1 is real time, 10 is ten times as fast, 0 is as fast as the callback can go
+        int numChannels = 2;
+        Input input = Input::silence;
+        juce::File inputFile;               //for Input::file, looped
+        juce::File captureFile;             //if set, the outputs are written here as a WAV
+        double jitterMilliseconds = 0.0;    //each callback is up to this late (only when paced to a clock)
+        double xrunProbability = 0.0;       //chance of a block being dropped instead of called back
+        bool variableBlockSizes = false;    //each callback gets anything from 1 sample up to the buffer size
+        juce::int64 seed = 1;
+
+        //For a command line's argument parsing loop: if arguments[i] is one of the device's options, reads
+        //it (moving i past its value) and returns true.  A bad value is put in error.
+        bool parseArgument(const juce::StringArray& arguments, int& i, juce::String& error)
+        {
+            const auto& argument = arguments[i];
+            const bool hasValue = i + 1 < arguments.size();
+
+            if (argument == "--variable-blocks")
+            {
+                variableBlockSizes = true;
+                return true;
+            }
+
+            if (!hasValue || !(argument == "--speed" || argument == "--channels" || argument == "--input"
+                               || argument == "--capture" || argument == "--jitter" || argument == "--xruns"
+                               || argument == "--seed"))
+                return false;
+
+            const auto value = arguments[++i];
+
+            if (argument == "--speed")          speed = value.getDoubleValue();
+            else if (argument == "--channels")  numChannels = value.getIntValue();
+            else if (argument == "--capture")   captureFile = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+            else if (argument == "--jitter")    jitterMilliseconds = value.getDoubleValue();
+            else if (argument == "--xruns")     xrunProbability = value.getDoubleValue();
+            else if (argument == "--seed")      seed = value.getLargeIntValue();
+            else if (value == "silence")        input = Input::silence;
+            else if (value == "tone")           input = Input::tone;
+            else if (value == "noise")          input = Input::noise;
+            else
+            {
+                input = Input::file;
+                inputFile = juce::File::getCurrentWorkingDirectory().getChildFile(value);
+            }
+
+            if (speed < 0.0 || numChannels < 1 || jitterMilliseconds < 0.0 || xrunProbability < 0.0 || xrunProbability >= 1.0)
+                error = "Bad value for " + argument + ": " + value;
+
+            return true;
+        }
+
+        static const char* getUsage()
+        {
+            return "[--speed <x real time, 0 for flat out>] [--channels <n>] [--input silence|tone|noise|<file>]\n"
+                   "       [--capture <file.wav>] [--jitter <ms>] [--xruns <probability>] [--variable-blocks] [--seed <n>]";
+        }
+    };
+
+    //Shared by a type and all the devices it makes (only one of which runs at a time): what they've done
+    //between them, and the capture file they all write to.  The counts are written on the device thread
+    //and can be read from anywhere.
+    struct Session
+    {
+        std::atomic<juce::int64> samplesElapsed{ 0 };      //the simulated clock, dropped blocks included
+        std::atomic<juce::int64> samplesCalledBack{ 0 };   //what actually went through the callback
+        std::atomic<juce::int64> blocksCalledBack{ 0 };
+        std::atomic<juce::int64> blocksDropped{ 0 };
+        std::atomic<juce::int64> nonFiniteBlocks{ 0 };     //blocks with a NaN or inf anywhere in the output
+
+        std::unique_ptr<juce::AudioFormatWriter> captureWriter;
+    };
+
+    DummyAudioIODevice(const juce::String& deviceName, const juce::String& typeName,
+                       const Options& deviceOptions, std::shared_ptr<Session> sharedSession)
+        : juce::AudioIODevice(deviceName, typeName), juce::Thread("Dummy Audio Device"),
+          options(deviceOptions), session(std::move(sharedSession)), random(deviceOptions.seed)
+    {
+        options.numChannels = juce::jmax(1, options.numChannels);
+    }
+
+    ~DummyAudioIODevice() override
+    {
+        close();
+    }
+
+    juce::StringArray getOutputChannelNames() override  { return getChannelNames("Out "); }
+    juce::StringArray getInputChannelNames() override   { return getChannelNames("In "); }
+
+    juce::Array<double> getAvailableSampleRates() override  { return { 44100.0, 48000.0, 88200.0, 96000.0 }; }
+    juce::Array<int> getAvailableBufferSizes() override     { return { 16, 32, 64, 128, 256, 512, 1024, 2048, 4096 }; }
+    int getDefaultBufferSize() override                     { return 512; }
+
+    juce::String open(const juce::BigInteger& inputChannels, const juce::BigInteger& outputChannels,
+                      double sampleRate, int bufferSizeSamples) override
+    {
+        close();
+
+        currentSampleRate = sampleRate > 0.0 ? sampleRate : 44100.0;
+        currentBufferSize = bufferSizeSamples > 0 ? bufferSizeSamples : getDefaultBufferSize();
+        activeInputs = inputChannels;
+        activeInputs.setRange(options.numChannels, activeInputs.getHighestBit() + 1, false);
+        activeOutputs = outputChannels;
+        activeOutputs.setRange(options.numChannels, activeOutputs.getHighestBit() + 1, false);
+
+        inputBuffer.setSize(options.numChannels, currentBufferSize);
+        inputBuffer.clear();
+        outputBuffer.setSize(options.numChannels, currentBufferSize);
+
+        if (options.input == Options::Input::file && fileAudio.getNumSamples() == 0)
+        {
+            lastError = readInputFile();
+
+            if (lastError.isNotEmpty())
+                return lastError;
+        }
+
+        if (options.captureFile != juce::File() && session->captureWriter == nullptr)
+        {
+            lastError = createCaptureWriter();
+
+            if (lastError.isNotEmpty())
+                return lastError;
+        }
+
+        opened = true;
+        return {};
+    }
+
+    void close() override
+    {
+        stop();
+        opened = false;
+    }
+
+    bool isOpen() override      { return opened; }
+    bool isPlaying() override   { return callback != nullptr; }
+
+    void start(juce::AudioIODeviceCallback* newCallback) override
+    {
+        if (!opened || newCallback == nullptr || newCallback == callback)
+            return;
+
+        stop();
+        newCallback->audioDeviceAboutToStart(this);
+        callback = newCallback;
+        startThread(9);
+    }
+
+    void stop() override
+    {
+        stopThread(2000);
+
+        if (auto* lastCallback = callback)
+        {
+            callback = nullptr;
+            lastCallback->audioDeviceStopped();
+        }
+
+        if (session->captureWriter != nullptr)
+            session->captureWriter->flush();
+    }
+
+    juce::String getLastError() override                   { return lastError; }
+    int getCurrentBufferSizeSamples() override              { return currentBufferSize; }
+    double getCurrentSampleRate() override                  { return currentSampleRate; }
+    int getCurrentBitDepth() override                       { return 32; }
+    juce::BigInteger getActiveOutputChannels() const override  { return activeOutputs; }
+    juce::BigInteger getActiveInputChannels() const override   { return activeInputs; }
+    int getOutputLatencyInSamples() override                { return 0; }
+    int getInputLatencyInSamples() override                 { return 0; }
+    int getXRunCount() const noexcept override              { return (int)session->blocksDropped.load(); }
+
+private:
+    juce::StringArray getChannelNames(const juce::String& prefix) const
+    {
+        juce::StringArray names;
+
+        for (int channel = 0; channel < options.numChannels; ++channel)
+            names.add(prefix + juce::String(channel + 1));
+
+        return names;
+    }
+
+    juce::String readInputFile()
+    {
+        juce::AudioFormatManager formatManager;
+        formatManager.registerBasicFormats();
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(options.inputFile));
+
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+            return "Couldn't read the input file " + options.inputFile.getFullPathName();
+
+        fileAudio.setSize((int)reader->numChannels, (int)reader->lengthInSamples);
+        reader->read(&fileAudio, 0, fileAudio.getNumSamples(), 0, true, true);
+        filePosition = 0;
+        return {};
+    }
+
+    juce::String createCaptureWriter()
+    {
+        options.captureFile.deleteFile();
+        std::unique_ptr<juce::FileOutputStream> stream(options.captureFile.createOutputStream());
+
+        if (stream == nullptr || stream->failedToOpen())
+            return "Couldn't write the capture file " + options.captureFile.getFullPathName();
+
+        juce::WavAudioFormat wavFormat;
+        session->captureWriter.reset(wavFormat.createWriterFor(stream.get(), currentSampleRate, (unsigned int)options.numChannels,
+                                                      24, {}, 0));
+
+        if (session->captureWriter == nullptr)
+            return "Couldn't write the capture file " + options.captureFile.getFullPathName();
+
+        stream.release();  //the writer owns it now
+        return {};
+    }
+
+    //Device thread: the next numSamples of whatever's on the inputs
+    void fillInput(int numSamples)
+    {
+        switch (options.input)
+        {
+            case Options::Input::silence:
+                break;
+
+            case Options::Input::tone:
+            {
+                const double phaseStep = juce::MathConstants<double>::twoPi * 440.0 / currentSampleRate;
+
+                for (int i = 0; i < numSamples; ++i)
+                {
+                    const auto sample = (float)(0.25 * std::sin(tonePhase));
+                    tonePhase = std::fmod(tonePhase + phaseStep, juce::MathConstants<double>::twoPi);
+
+                    for (int channel = 0; channel < options.numChannels; ++channel)
+                        inputBuffer.setSample(channel, i, sample);
+                }
+
+                break;
+            }
+
+            case Options::Input::noise:
+                for (int channel = 0; channel < options.numChannels; ++channel)
+                    for (int i = 0; i < numSamples; ++i)
+                        inputBuffer.setSample(channel, i, random.nextFloat() * 0.5f - 0.25f);
+
+                break;
+
+            case Options::Input::file:
+                for (int done = 0; done < numSamples;)
+                {
+                    const int toCopy = juce::jmin(numSamples - done, fileAudio.getNumSamples() - filePosition);
+
+                    for (int channel = 0; channel < options.numChannels; ++channel)
+                        inputBuffer.copyFrom(channel, done, fileAudio, channel % fileAudio.getNumChannels(), filePosition, toCopy);
+
+                    done += toCopy;
+                    filePosition = (filePosition + toCopy) % fileAudio.getNumSamples();
+                }
+
+                break;
+        }
+    }
+
+    //Device thread
+    void checkOutput(int numSamples)
+    {
+        for (int channel = 0; channel < options.numChannels; ++channel)
+        {
+            const auto* samples = outputBuffer.getReadPointer(channel);
+
+            for (int i = 0; i < numSamples; ++i)
+            {
+                if (!std::isfinite(samples[i]))
+                {
+                    ++session->nonFiniteBlocks;
+                    return;
+                }
+            }
+        }
+    }
+
+    //Calls back every block's worth of (sped up) time, catching up without sleeping if it falls behind,
+    //or straight away if it isn't paced at all
+    void run() override
+    {
+        const bool paced = options.speed > 0.0;
+        const double blockMilliseconds = paced ? 1000.0 * currentBufferSize / currentSampleRate / options.speed : 0.0;
+        auto nextBlockTime = juce::Time::getMillisecondCounterHiRes();
+
+        juce::HeapBlock<const float*> inputs(options.numChannels);
+        juce::HeapBlock<float*> outputs(options.numChannels);
+
+        for (int channel = 0; channel < options.numChannels; ++channel)
+        {
+            inputs[channel] = inputBuffer.getReadPointer(channel);
+            outputs[channel] = outputBuffer.getWritePointer(channel);
+        }
+
+        const int numInputs = activeInputs.countNumberOfSetBits();
+        const int numOutputs = activeOutputs.countNumberOfSetBits();
+
+        while (!threadShouldExit())
+        {
+            const int numSamples = options.variableBlockSizes ? 1 + random.nextInt(currentBufferSize) : currentBufferSize;
+            fillInput(numSamples);
+
+            //a dropped block's time still passes, it's just never called back
+            if (options.xrunProbability > 0.0 && random.nextDouble() < options.xrunProbability)
+            {
+                ++session->blocksDropped;
+            }
+            else
+            {
+                callback->audioDeviceIOCallback(inputs, numInputs, outputs, numOutputs, numSamples);
+                checkOutput(numSamples);
+
+                if (session->captureWriter != nullptr)
+                    session->captureWriter->writeFromAudioSampleBuffer(outputBuffer, 0, numSamples);
+
+                session->samplesCalledBack += numSamples;
+                ++session->blocksCalledBack;
+            }
+
+            session->samplesElapsed += numSamples;
+
+            if (!paced)
+                continue;
+
+            //jitter makes this block late without pushing all the later ones back
+            nextBlockTime += blockMilliseconds * numSamples / currentBufferSize;
+            const double jitter = options.jitterMilliseconds > 0.0 ? random.nextDouble() * options.jitterMilliseconds : 0.0;
+            const auto waitTime = nextBlockTime + jitter - juce::Time::getMillisecondCounterHiRes();
+
+            if (waitTime > 1.0)
+                wait((int)waitTime);
+        }
+    }
+
+    Options options;
+    std::shared_ptr<Session> session;
+    juce::Random random;  //device thread only, once it's started
+
+    juce::AudioIODeviceCallback* callback = nullptr;  //only changed while the thread isn't running
+    double currentSampleRate = 44100.0;
+    int currentBufferSize = 512;
+    juce::BigInteger activeInputs, activeOutputs;
+    juce::AudioBuffer<float> inputBuffer, outputBuffer;
+    juce::AudioBuffer<float> fileAudio;
+    int filePosition = 0;
+    double tonePhase = 0.0;
+    juce::String lastError;
+    bool opened = false;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DummyAudioIODevice)
+};
+
+
+class DummyAudioIODeviceType : public juce::AudioIODeviceType
+{
+public:
+    DummyAudioIODeviceType(const DummyAudioIODevice::Options& deviceOptions = {})
+        : juce::AudioIODeviceType(DUMMY_DEVICE_TYPE_NAME), options(deviceOptions)
+    {
+    }
+
+    void scanForDevices() override {}
+
+    juce::StringArray getDeviceNames(bool) const override      { return { DUMMY_DEVICE_NAME }; }
+    int getDefaultDeviceIndex(bool) const override              { return 0; }
+    int getIndexOfDevice(juce::AudioIODevice* device, bool) const override  { return device != nullptr ? 0 : -1; }
+    bool hasSeparateInputsAndOutputs() const override           { return false; }
+
+    juce::AudioIODevice* createDevice(const juce::String& outputDeviceName, const juce::String& inputDeviceName) override
+    {
+        if (outputDeviceName != DUMMY_DEVICE_NAME && inputDeviceName != DUMMY_DEVICE_NAME)
+            return nullptr;
+
+        //each device gets its own seed, so reopening doesn't replay the same noise and faults
+        auto deviceOptions = options;
+        deviceOptions.seed += numDevicesCreated++;
+
+        return new DummyAudioIODevice(DUMMY_DEVICE_NAME, DUMMY_DEVICE_TYPE_NAME, deviceOptions, session);
+    }
+
+    //Still valid after the type's gone
+    std::shared_ptr<const DummyAudioIODevice::Session> getSession() const
+    {
+        return session;
+    }
+
+private:
+    const DummyAudioIODevice::Options options;
+    std::shared_ptr<DummyAudioIODevice::Session> session = std::make_shared<DummyAudioIODevice::Session>();
+    int numDevicesCreated = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(DummyAudioIODeviceType)
+};
@@ -0,0 +1,89 @@
+/*
+  ==============================================================================
+
+    EngineMain.cpp
+
+    Startup code for the engine on its own, without the GUI: the LooperEngine
+    target in CMakeLists.txt, which only links the non-GUI JUCE modules.  It
+    runs the command-line jobs that don't need a window - bouncing projects,
+    the benchmarks and soak runs - the same way the app does:
+
+        LooperEngine --render <project> --out <folder> ...
+        LooperEngine --benchmark ...
+        LooperEngine --soak ...
+
+    The real-time check drives the whole GUI, so that one's only in the app.
+
+  ==============================================================================
+*/
+
+#include <juce_events/juce_events.h>
+#include <iostream>
+#include "Benchmarks.h"
+#include "CommandLineRenderer.h"
+#include "SoakTest.h"
+
+//DN: JUCEApplicationBase rather than JUCEApplication, which is part of juce_gui_basics
+class LooperEngineApplication : public juce::JUCEApplicationBase
+{
+public:
+    LooperEngineApplication() {}
+
+    const juce::String getApplicationName() override       { return "LooperEngine"; }
+    const juce::String getApplicationVersion() override    { return "1.0.0"; }
+    bool moreThanOneInstanceAllowed() override             { return true; }
+
+    void initialise(const juce::String&) override
+    {
+        const auto arguments = getCommandLineParameterArray();
+
+        if (CommandLineRenderer::isRenderCommand(arguments))
+        {
+            setApplicationReturnValue(CommandLineRenderer::run(arguments));
+            quit();
+            return;
+        }
+
+        if (Benchmarks::isBenchmarkCommand(arguments))
+        {
+            setApplicationReturnValue(Benchmarks::run(arguments));
+            quit();
+            return;
+        }
+
+        //runs on the dummy device until the session's done, then quits with its result
+        if (SoakTest::isSoakCommand(arguments))
+        {
+            soakTest.reset(new SoakTest(arguments));
+            return;
+        }
+
+        std::cerr << "usage: LooperEngine --render ... | --benchmark ... | --soak ..." << std::endl;
+        setApplicationReturnValue(1);
+        quit();
+    }
+
+    void shutdown() override
+    {
+        soakTest = nullptr;
+    }
+
+    void systemRequestedQuit() override
+    {
+        quit();
+    }
+
+    void anotherInstanceStarted(const juce::String&) override {}
+    void suspended() override {}
+    void resumed() override {}
+
+    void unhandledException(const std::exception* e, const juce::String& sourceFilename, int lineNumber) override
+    {
+        std::cerr << sourceFilename << ":" << lineNumber << ": " << (e != nullptr ? e->what() : "unknown exception") << std::endl;
+    }
+
+private:
+    std::unique_ptr<SoakTest> soakTest;
+};
+
+START_JUCE_APPLICATION(LooperEngineApplication)
@@ -5,52 +5,62 @@
 
     //DN:  A simple AudioSource class where we can send the audio input in buffer 
     form, to be read from by our main mixer
+
+    The input isn't copied in here - MainComponent captures each block into a
+    buffer it allocated in prepareToPlay, and we just read from that by reference.
   ==============================================================================
 */
 
 #pragma once
 
 
-#include <JuceHeader.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include "MixEngine.h"
 
 
-class InputMonitor : public juce::AudioSource
+class InputMonitor : public juce::AudioSource, public MixEngineSource
 {
 public:
     InputMonitor()
     {
-        inputBuffer.reset(new juce::AudioBuffer<float>(2, 0));
     }
     ~InputMonitor(){}
 
-    void prepareToPlay(int samplesPerBlockExpected, double sampleRate){}
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override {}
 
-    void releaseResources(){}
+    void releaseResources() override {}
 
-    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill)
+    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
     {
+        bufferToFill.clearActiveBufferRegion();
+        mixNextAudioBlock(bufferToFill);
+    }
 
-        int loopBufferSize = inputBuffer->getNumSamples();
-        int maxInChannels = inputBuffer->getNumChannels();
-        int maxOutChannels = bufferToFill.buffer->getNumChannels();
+    //adds the input straight into the output, scaled by gain, in one pass per channel
+    void mixNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToMixInto) override
+    {
+        int maxOutChannels = bufferToMixInto.buffer->getNumChannels();
+        int numSamplesToCopy = juce::jmin(bufferToMixInto.numSamples, numInputSamples);
 
-        if (loopBufferSize > 0 && maxInChannels > 0)
+        if (inputBuffer == nullptr || numInputChannels == 0 || numSamplesToCopy == 0 || gain == 0.0)
+            return;
+
+        for (int i = 0; i < maxOutChannels; ++i)
         {
-            for (int i = 0; i < maxOutChannels; ++i)
-            {
-                auto writer = bufferToFill.buffer->getWritePointer(i, bufferToFill.startSample);
-
-                for (auto sample = 0; sample < bufferToFill.numSamples; ++sample)
-                {
-                    writer[sample] = inputBuffer->getSample(i % maxInChannels, juce::jmin(sample, loopBufferSize)) * gain;
-                }
-            }
+            auto writer = bufferToMixInto.buffer->getWritePointer(i, bufferToMixInto.startSample);
+            auto reader = inputBuffer->getReadPointer(i % numInputChannels);
+
+            juce::FloatVectorOperations::addWithMultiply(writer, reader, (float)gain, numSamplesToCopy);
         }
     }
 
-    void setBuffer(juce::AudioSampleBuffer* newBuffer)
+    //Audio thread, once per block: points us at the samples captured for this block.
+    //Only the pointer and sizes are stored, the audio itself isn't copied
+    void setInput(const juce::AudioBuffer<float>& capturedInput, int numChannels, int numSamples)
     {
-        inputBuffer.reset(newBuffer);
+        inputBuffer = &capturedInput;
+        numInputChannels = juce::jmin(numChannels, capturedInput.getNumChannels());
+        numInputSamples = juce::jmin(numSamples, capturedInput.getNumSamples());
     }
 
     void setGain(double newGain)
@@ -59,6 +69,8 @@ public:
     }
 
 private:
-    std::unique_ptr<juce::AudioBuffer<float>> inputBuffer;
+    const juce::AudioBuffer<float>* inputBuffer = nullptr;
+    int numInputChannels = 0;
+    int numInputSamples = 0;
     double gain = 1.0;
 };
\ No newline at end of file
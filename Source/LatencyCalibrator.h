@@ -0,0 +1,223 @@
+/*
+  ==============================================================================
+
+    LatencyCalibrator.h
+
+    Measures the real round trip from output to input, to the sample, for
+    when what the driver reports isn't right.  Loop the output back into the
+    input (a cable, or a mic near a speaker), and it plays a few short bursts
+    of noise, records what comes back, and cross-correlates each burst with
+    the recording - the lag where they line up best is the latency.  Every
+    burst has to agree, or there's nothing trustworthy to go on and the
+    measurement fails.
+
+    It's a MixEngineSource for the output and a CaptureTarget for the input,
+    only added to either while it's measuring.  Both sides count samples from
+    the first block the input arrives in, and the input is captured before
+    the output renders in every block, so the two counts line up exactly.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_events/juce_events.h>
+#include "CaptureDispatcher.h"
+#include "MixEngine.h"
+
+
+class LatencyCalibrator : public CaptureTarget, public MixEngineSource,
+                          public juce::ChangeBroadcaster, private juce::Timer
+{
+public:
+    LatencyCalibrator(CaptureDispatcher& dispatcherToUse, MixEngine& mixerToUse)
+        : dispatcher(dispatcherToUse), mixer(mixerToUse)
+    {
+        //the same burst every time - any noise does, it just has to correlate sharply with itself
+        juce::Random random(0x10091);
+
+        for (auto& sample : burst)
+            sample = (random.nextFloat() * 2.0f - 1.0f) * burstLevel;
+    }
+
+    ~LatencyCalibrator() override
+    {
+        stop();
+    }
+
+    //Message thread: plays the bursts and listens for them.  Sends a change message once there's a
+    //result (see getResult()).  Only makes sense with nothing else playing
+    void start()
+    {
+        stop();
+
+        const auto sampleRate = dispatcher.getSampleRate();
+
+        if (sampleRate <= 0.0 || dispatcher.getNumInputChannels() <= 0)
+        {
+            result = -1;
+            sendChangeMessage();
+            return;
+        }
+
+        burstSpacing = juce::roundToInt(sampleRate * 0.5);  //so up to ~0.5s of latency can be measured
+        recording.calloc((size_t)(burstSpacing * numBursts));
+
+        samplesCaptured = 0;
+        samplesPlayed = 0;
+        started = false;
+        finished = false;
+        result = -1;
+
+        //added to the mixer first, so it's playing from the block the input starts arriving in
+        mixer.addSource(this);
+        dispatcher.arm(this);
+        running = true;
+        startTimer(50);
+    }
+
+    bool isRunning() const noexcept { return running; }
+
+    //The round trip in samples, or -1 if there wasn't a clear enough echo of every burst to go on
+    int getResult() const noexcept { return result; }
+
+    //==============================================================================
+    //Audio thread: the input, summed to mono
+    void captureBlock(const float* const* inputChannelData, int numInputChannels, int numSamples) override
+    {
+        const int totalLength = burstSpacing * numBursts;
+
+        if (!started)
+        {
+            samplesPlayed = 0;
+            started = true;
+        }
+
+        const int numToCapture = juce::jmin(numSamples, totalLength - samplesCaptured);
+
+        for (int channel = 0; channel < numInputChannels && numToCapture > 0; ++channel)
+            juce::FloatVectorOperations::add(recording + samplesCaptured, inputChannelData[channel], numToCapture);
+
+        samplesCaptured += juce::jmax(0, numToCapture);
+
+        if (samplesCaptured >= totalLength)
+            finished = true;
+    }
+
+    //Audio thread: a burst at the start of every burstSpacing samples, on every output channel
+    void mixNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToMixInto) override
+    {
+        if (!started)
+            return;
+
+        for (int i = 0; i < bufferToMixInto.numSamples; ++i)
+        {
+            const int positionInBurst = (samplesPlayed + i) % burstSpacing;
+
+            if (positionInBurst >= burstLength || samplesPlayed + i >= burstSpacing * numBursts)
+                continue;
+
+            for (int channel = 0; channel < bufferToMixInto.buffer->getNumChannels(); ++channel)
+                bufferToMixInto.buffer->addSample(channel, bufferToMixInto.startSample + i, burst[(size_t)positionInBurst]);
+        }
+
+        samplesPlayed += bufferToMixInto.numSamples;
+    }
+
+    void prepareToPlay(int, double) override {}
+    void releaseResources() override {}
+
+private:
+    static constexpr int numBursts = 4;
+    static constexpr int burstLength = 1024;
+    static constexpr float burstLevel = 0.5f;
+
+    //Message thread: takes us out of the audio callback, after which nothing touches the recording
+    void stop()
+    {
+        stopTimer();
+
+        if (running)
+        {
+            dispatcher.disarm(this);
+            mixer.removeSource(this);
+            running = false;
+        }
+    }
+
+    void timerCallback() override
+    {
+        if (!finished.load())
+            return;
+
+        stop();
+        result = findLatency();
+        sendChangeMessage();
+    }
+
+    //Message thread: the lag of each burst's echo, which all have to agree to within a sample
+    int findLatency() const
+    {
+        std::array<int, numBursts> lags;
+
+        for (int i = 0; i < numBursts; ++i)
+        {
+            lags[(size_t)i] = findEcho(recording + i * burstSpacing);
+
+            if (lags[(size_t)i] < 0)
+                return -1;
+        }
+
+        std::sort(lags.begin(), lags.end());
+        return lags.back() - lags.front() <= 1 ? lags[numBursts / 2] : -1;
+    }
+
+    //Where in one burst's slot of the recording the burst correlates best, if that stands well clear
+    //of how it correlates everywhere else (i.e. it's an echo, not just noise in the room)
+    int findEcho(const float* slot) const
+    {
+        const int numLags = burstSpacing - burstLength;
+        int bestLag = -1;
+        float bestScore = 0.0f;
+        double sumOfSquares = 0.0;
+
+        for (int lag = 0; lag < numLags; ++lag)
+        {
+            float score = 0.0f;
+
+            for (int i = 0; i < burstLength; ++i)
+                score += burst[(size_t)i] * slot[lag + i];
+
+            //either polarity - some interfaces invert
+            score = std::abs(score);
+            sumOfSquares += (double)score * score;
+
+            if (score > bestScore)
+            {
+                bestScore = score;
+                bestLag = lag;
+            }
+        }
+
+        const auto rms = std::sqrt(sumOfSquares / juce::jmax(1, numLags));
+        return bestScore > 8.0 * rms ? bestLag : -1;
+    }
+
+    CaptureDispatcher& dispatcher;
+    MixEngine& mixer;
+    std::array<float, burstLength> burst;
+
+    juce::HeapBlock<float> recording;  //written by the audio thread until finished, then read here
+    int burstSpacing = 22050;
+    bool running = false;
+    int result = -1;
+
+    //audio thread only, while we're armed
+    bool started = false;
+    int samplesCaptured = 0;
+    int samplesPlayed = 0;
+    std::atomic<bool> finished{ false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LatencyCalibrator)
+};
@@ -13,37 +13,107 @@
     during the appropriate section of the master Loop by respecting the 
     fileStartOffset and the length of what's in the loopBuffer.
 
+    The loopBuffer is handed over through a RealtimeHandoff, so new audio can be
+    published from the message thread (stopRecording, loadAudio,
+    reverseAudio) without the audio callback ever blocking on a lock or reading
+    a buffer that's already been freed.
+
+    Where we are in the loop comes from the shared TransportClock rather than a
+    counter of our own, so every track (and the metronome) stays locked to the
+    same 64-bit timeline, including tracks added while playing.
+
+    Recording punches in and out on the audio thread: the track's AudioRecorder
+    schedules the change for an exact sample in the block that's about to
+    render, so the loop goes silent and comes back with the new take exactly
+    at the loop boundary.
+
+    Overdubbing works the other way round: the loop keeps playing, and while
+    it's armed on the CaptureDispatcher the input gets summed into the
+    loopBuffer in place, right after each span has been played out of it.
+    The input is a round trip behind what it was played along to, so it
+    lands that far back in the loop.
+
+    The audio itself is a LoopTake (chunked and reference counted), and every
+    take, reverse and overdub is a step in the track's TakeHistory.  Undo and
+    redo publish a state that's already in memory, so the audio thread just
+    picks up a different pointer on its next block.
+
+    Reversing is the take's playback direction, not a change to its samples:
+    spans of a reversed take are read backwards, and when the direction flips
+    the block crossfades from the old direction into the new one.
+
+    When the tempo changes, the loop length changes straight away but the
+    audio would still be at the old tempo, so the current state gets
+    stretched to fit on a TimeStretcher thread.  The old version keeps playing
+    until it's ready, and the audio thread switches to the new one at the top
+    of the loop.  It's always stretched from what's in the history rather than
+    from the last stretch, so changing the tempo over and over doesn't wear
+    the audio down.  The same goes for the device's sample rate: a take that
+    isn't at the rate we're running at (e.g. a project saved at 44.1k opened
+    at 48k) gets converted in the same job.  Each state keeps the versions
+    it's been converted to, so switching back to a rate it's been at is free.
+
+    Loading a project uses the same route: the loaded take is converted to
+    fit the project's tempo if it needs to be and offered to the audio thread
+    like a stretch, but held back until LooperEngine names the transport
+    sample it can take over from - the same loop start for every track, so
+    the whole project swaps in at once.  The project's loop length takes
+    over on the audio thread at that same sample, counting from there (see
+    TransportClock::scheduleLoopRestart()), so the loop that's playing keeps
+    its length right up to its end.
+
+    The slip offset reaches the audio thread through a ParameterQueue rather
+    than being read from under the message thread.  A slip crossfades from
+    the old offset to the new one across the block instead of jumping, and the
+    offset that goes with a newly published take only takes effect once the
+    audio thread is actually reading that take.
+
   ==============================================================================
 */
 
 #pragma once
 
-#include <JuceHeader.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include <juce_events/juce_events.h>
+#include <limits>
+#include "RealtimeHandoff.h"
+#include "ParameterQueue.h"
+#include "MixKernels.h"
+#include "TransportClock.h"
+#include "CaptureDispatcher.h"
+#include "TakeHistory.h"
+#include "TimeStretcher.h"
 
-class LoopSource: public juce::PositionableAudioSource, public juce::ChangeBroadcaster
+class LoopSource: public juce::PositionableAudioSource, public juce::ChangeBroadcaster, public CaptureTarget
 {
 public:
-    LoopSource()
+    LoopSource(const TransportClock& transportToFollow)
+        : transport(transportToFollow)
     {
-        masterLoopTempo = 120; 
-        masterLoopBeatsPerLoop = 16;
         calcMasterLoopLength();
-        loopBuffer.reset(new juce::AudioBuffer<float>(2, 0));  //DN: just set up a length 0 buffer so silent playback can happen 
+        playingTempo = masterLoopTempo;
+        playingRate = sampleRate;
+        publishTake(std::make_unique<LoopTake>(2, 0));  //DN: just set up a length 0 buffer so silent playback can happen 
+        clearHistory();
     }
 
     ~LoopSource()
     {
+        if (stretchRequest != nullptr)
+            stretchRequest->cancel();
     }
 
     //==============================================================================
+    //The position follows the TransportClock - move that instead.  This just updates what
+    //getPosition() reports until the next block
     void setNextReadPosition(juce::int64 newPosition) override
     {
         jassert(newPosition >= 0);
 
-        position = newPosition;
+        position = (int)newPosition;
     }
 
-    juce::int64 getNextReadPosition() const override { return static_cast<juce::int64> (position); }
+    juce::int64 getNextReadPosition() const override { return static_cast<juce::int64> (position.load()); }
 
     //required by the base class
     juce::int64 getTotalLength() const override 
@@ -70,54 +140,150 @@ public:
     }
 
     //==============================================================================
+    //(the audio gets converted to a new rate the next time updateTimeStretch() is called)
     void prepareToPlay(int samplesPerBlockExpected, double newSampleRate)
     {
-        const juce::ScopedLock sl(callbackLock);
-
         sampleRate = newSampleRate;
         calcMasterLoopLength();  //DN:  if sample rate changes, need to recalc masterLoopLength
     }
 
+    double getSampleRate() const noexcept { return sampleRate.load(); }
+
+    //Message thread: the rate the loop's audio is at, which is the device's once any conversion has taken over
+    double getLoopSampleRate() const noexcept { return playingRate; }
+
 
-    //Call this for all tracks to keep them in sync
+    //Call this for all tracks to keep them in sync.  A new tempo starts the audio stretching to match
     void setMasterLoop(int tempo, int beatsPerLoop)
     {
+        const bool tempoChanged = tempo != masterLoopTempo;
+
         masterLoopTempo = tempo;
         masterLoopBeatsPerLoop = beatsPerLoop;
         calcMasterLoopLength();
+
+        if (tempoChanged)
+            stretchToFit();
     }
 
     //DN: calculates the length in samples of the master loop (important - masterLoopLength is used in the audio processing block)
     void calcMasterLoopLength()
     {
-        double lengthInSeconds = (double)(60.0f / masterLoopTempo) * masterLoopBeatsPerLoop;
-        masterLoopLength = int((lengthInSeconds * sampleRate) + 0.5f); //the 0.5 is to account for the integer cast, allows for correct rounding
+        masterLoopLength = (int)TransportClock::getLoopLengthInSamples(masterLoopTempo, masterLoopBeatsPerLoop, sampleRate);
+        pendingLoopLength = (int)TransportClock::getLoopLengthInSamples(pendingTempo, pendingBeatsPerLoop, sampleRate);
     }
     
     
     void releaseResources() override {}
 
-    void setBuffer(juce::AudioSampleBuffer* newBuffer)
+    //Message thread: a take that's just been recorded, as a new undo step.  The audio thread switches
+    //to it on its next block, the old one is freed on the release pool thread once the callback is done with it
+    void setTake(std::unique_ptr<LoopTake> newTake)
     {
-        loopBuffer.reset(newBuffer);
+        cancelTimeStretch();
+        playingTempo = masterLoopTempo;
+        playingRate = sampleRate;
+        history.push({ *newTake, fileStartOffset, playingTempo, playingRate });
+        publishTake(std::move(newTake));
+    }
+
+    //Message thread: audio from disk (e.g. loading a project), or silence for an empty track.
+    //Either way the undo history starts over.  It's taken to be at the current tempo, and gets converted
+    //in the background if it isn't at the device's rate
+    void loadTake(std::unique_ptr<LoopTake> newTake, double takeSampleRate)
+    {
+        cancelTimeStretch();
+        playingTempo = masterLoopTempo;
+        playingRate = takeSampleRate;
+        publishTake(std::move(newTake));
+        clearHistory();
+        stretchToFit();
+    }
+
+    //Message thread: a loaded project's audio, at takeTempo and takeSampleRate with its own slip, and the project's
+    //loop.  The undo history starts over with it, but the current audio and loop keep playing while it's converted
+    //to fit the new loop (if it needs to be) and until adoptLoadedTakeFrom() says when they can take over
+    void loadTakeAtLoopStart(std::unique_ptr<LoopTake> newTake, int takeTempo, double takeSampleRate, int newFileStartOffset,
+                             int loopTempo, int loopBeatsPerLoop)
+    {
+        cancelTimeStretch();
+        pendingTempo = loopTempo;
+        pendingBeatsPerLoop = loopBeatsPerLoop;
+        calcMasterLoopLength();
+        history.reset({ *newTake, newFileStartOffset, takeTempo, takeSampleRate });
+        convertLoadedTake(notYet);
+    }
+
+    //Message thread: the loaded take hasn't taken over yet
+    bool isLoadPending() const noexcept { return loadPending; }
+
+    //Message thread: the loaded take is ready and waiting for adoptLoadedTakeFrom() (or has already taken over)
+    bool isLoadedTakeReady() const noexcept { return !loadPending || offeredStretch.load() != nullptr; }
+
+    //Message thread: the loaded take and loop take over the first time the loop comes round to its start at or
+    //after transportSample, which should be a loop start (or where the loop restarts from).  While we're stopped
+    //they take over on the first updateTimeStretch() once the transport's got there
+    void adoptLoadedTakeFrom(juce::int64 transportSample) noexcept
+    {
+        if (loadPending)
+        {
+            loopChangeFrom = transportSample;
+            adoptStretchFrom = transportSample;
+        }
+    }
+
+    //Message thread: what saving the project should write - what's playing, or while overdubbing the state
+    //the overdub started from, since the overdub is still being written into
+    TakeHistory::State getStateToSave()
+    {
+        if (overdubbing)
+        {
+            const auto& current = history.getCurrent();
+            return { current.take, current.fileStartOffset, current.tempo, current.sampleRate };
+        }
+
+        return { *loopBuffer.getForWriter(), fileStartOffset, playingTempo, playingRate };
+    }
+
+    //Message thread: whatever is playing now becomes the only state there is
+    void clearHistory()
+    {
+        history.reset({ *loopBuffer.getForWriter(), fileStartOffset, playingTempo, playingRate });
+    }
+
+    bool canUndo() const noexcept { return history.canUndo(); }
+    bool canRedo() const noexcept { return history.canRedo(); }
+
+    //Message thread: these only swap in a state that's already in memory, nothing gets copied
+    void undo()
+    {
+        if (history.canUndo())
+            restoreState(history.undo());
+    }
+
+    void redo()
+    {
+        if (history.canRedo())
+            restoreState(history.redo());
+    }
+
+    void setMaxUndoSteps(int newMaxUndoSteps)
+    {
+        history.setMaxUndoSteps(newMaxUndoSteps);
     }
 
     void start(int position)
     {
         if (!playing && position < masterLoopLength)
         {
-            {
-                const juce::ScopedLock sl(callbackLock);
-                playing = true;
-                stopped = false;
-            }
+            stopped = false;
+            playing = true;
             sendChangeMessage();
         }
     }
 
     void stop()
     {
-        beginningOfFile = false;
         if (playing)
         {
             playing = false;
@@ -125,111 +291,402 @@ public:
         }
     }
 
-    void startRecording()
+    //Audio thread, during input capture: how far into the block that's about to render the loop
+    //goes back to 0.  0 if it's already sitting at the start
+    int getSamplesUntilLoopStart() const noexcept
+    {
+        const auto blockStartSample = transport.getBlockStartSample();
+        const int loopLength = getLoopLengthAt(blockStartSample);
+        const int pos = getLoopPositionAt(blockStartSample);
+
+        return (pos == 0 || loopLength <= 0) ? 0 : loopLength - pos;
+    }
+
+    //Audio thread, during input capture: from sampleInBlock of the next block on, go silent (or stop
+    //being silent) because we're being recorded over.  Finishing a take passes the take's buffer,
+    //which plays from that same sample until the message thread hands it over with setTake()
+    void scheduleRecordingChange(bool shouldBeRecording, int sampleInBlock, const LoopTake* finishedTakeToPlay = nullptr)
     {
-        recording = true;
+        pendingRecording = shouldBeRecording;
+        pendingRecordingChangeSample = juce::jmax(0, sampleInBlock);
+        pendingFinishedTake = finishedTakeToPlay;
     }
 
+    //Message thread: lays the current audio out over the whole loop, at the slip offset and in the
+    //direction it's playing, in a buffer with room for the numInputChannels device inputs from
+    //firstInputChannel on.  Overdubbing then writes straight into it, so nothing ever has to grow on the
+    //audio thread.  Afterwards the slip offset is 0 and the loop plays forwards.  inputLatency is how far
+    //the input lags the loop (see CaptureDispatcher::getRoundTripLatency())
+    void prepareForOverdub(int firstInputChannel, int numInputChannels, int inputLatency)
+    {
+        //whatever is playing is what gets overdubbed, a stretch that hasn't taken over yet isn't wanted
+        cancelTimeStretch();
+        playingTempo = masterLoopTempo;
+        playingRate = sampleRate;
+
+        const auto* playing = loopBuffer.getForWriter();
+        std::unique_ptr<LoopTake> reversalApplied;
+
+        if (playing->isPlayedReversed())
+        {
+            reversalApplied = playing->withReversalApplied();
+            playing = reversalApplied.get();
+        }
+
+        const auto& current = *playing;
+        const int loopLength = masterLoopLength;
+        const int numChannels = juce::jmax(1, numInputChannels, current.getNumChannels());
+
+        std::unique_ptr<LoopTake> overdubTake;
+
+        if (reversalApplied == nullptr && fileStartOffset == 0
+            && current.getNumSamples() == loopLength && current.getNumChannels() == numChannels)
+        {
+            //already laid out right, it just needs its own copy of the chunks to write into
+            overdubTake = std::make_unique<LoopTake>(current);
+            overdubTake->makeWritable();
+        }
+        else
+        {
+            overdubTake = std::make_unique<LoopTake>(numChannels, loopLength);
+
+            const int audioStart = juce::jmax(0, fileStartOffset);
+            const int audioEnd = juce::jmin(loopLength, fileStartOffset + current.getNumSamples());
+
+            if (current.getNumChannels() > 0)
+                for (int channel = 0; channel < numChannels && audioEnd > audioStart; ++channel)
+                    overdubTake->copyFrom(channel, audioStart, current, channel % current.getNumChannels(),
+                                          audioStart - fileStartOffset, audioEnd - audioStart);
+        }
+
+        overdubbedChunks.calloc((size_t)juce::jmax(1, overdubTake->getNumChunks()));
+        overdubLatency = juce::jlimit(0, loopLength, inputLatency);
+        firstOverdubChannel = juce::jmax(0, firstInputChannel);
+        numOverdubChannels = numInputChannels;
+        fileStartOffset = 0;
+        publishTake(std::move(overdubTake));
+    }
+
+    //Message thread: call prepareForOverdub() and arm us on the CaptureDispatcher first.  Turning it off,
+    //disarm us first - once this returns the audio thread has finished writing into the loopBuffer,
+    //and the overdub is an undo step
+    void setOverdubbing(bool shouldOverdub)
+    {
+        overdubbing = shouldOverdub;
+
+        if (!shouldOverdub)
+        {
+            loopBuffer.waitForReaderToMoveOn();
+            finishOverdub();
+        }
+    }
+
+    bool isOverdubbing() const noexcept { return overdubbing.load(); }
+
+    //How much of what's already in the loop survives each overdub pass: 1 keeps everything,
+    //lower values fade older layers out
+    void setOverdubFeedback(float newFeedback)
+    {
+        overdubFeedback = juce::jlimit(0.0f, 1.0f, newFeedback);
+    }
+
+    //Audio thread, before we render: hang on to this block's input for overdubbing
+    void captureBlock(const float* const* inputChannelData, int numInputChannels, int numSamples) override
+    {
+        //just the inputs this track is routed to
+        overdubInput = inputChannelData + firstOverdubChannel;
+        numOverdubInputChannels = juce::jmin(numOverdubChannels, numInputChannels - firstOverdubChannel);
+        numOverdubInputSamples = numSamples;
+    }
+
+    //Message thread: after the take has been passed to setTake() (or thrown away), stop playing
+    //silence / the unhanded-over take from the next block on
     void stopRecording()
     {
-        recording = false;
+        recordingStopRequested = true;
     }
 
+    //Message thread, called regularly (e.g. from a timer): sends on any slip that couldn't be queued
+    //while the audio thread wasn't running
+    void flushParameterChanges()
+    {
+        parameters.flush();
+    }
 
-    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
+    //Message thread, called regularly (e.g. from a timer) while nothing is recording or overdubbing:
+    //starts converting to the device's rate if it's changed, and hands a finished stretch to the audio
+    //thread, which switches to it the next time the loop comes round to 0.  Returns true once it has,
+    //and the stretched take is the loopBuffer
+    bool updateTimeStretch()
+    {
+        //prepareToPlay() can come from the device's thread, so a new rate is picked up here
+        const bool stretchPending = stretchRequest != nullptr || stretchedTake != nullptr;
+
+        if (!overdubbing && (stretchPending ? stretchedRate : playingRate) != sampleRate.load())
+            stretchToFit();
+
+        if (stretchedTake != nullptr)
+        {
+            //stopped, there's no loop boundary coming - the audio thread isn't rendering, so just swap it in (a loaded
+            //project's once the transport's where it was told to, the loop length changes with it)
+            if (offeredStretch.load() != nullptr && (!stopped || transport.getBlockStartSample() < adoptStretchFrom.load()))
+                return false;
+
+            offeredStretch = nullptr;
+            handOverStretchedTake();
+            return true;
+        }
+
+        //wait for the audio thread to let go of the last one first
+        if (stretchRequest != nullptr && stretchRequest->isFinished() && !stretchHandedOver)
+        {
+            //the state it came from hasn't changed (that would have cancelled it), so it can keep the conversion
+            //DN: copy-constructed in place - a LoopTake can't be assigned to (its SharedResourcePointer can't be)
+            if (stretchRequest->converted != nullptr)
+            {
+                auto& atOtherRates = history.getCurrent().atOtherRates;
+                atOtherRates.erase(stretchedRate);
+                atOtherRates.emplace(stretchedRate, *stretchRequest->converted);
+            }
+
+            stretchedTake = std::move(stretchRequest->result);
+            stretchRequest = nullptr;
+
+            if (stretchedTake != nullptr)
+                offeredStretch = stretchedTake.get();
+        }
+
+        return false;
+    }
+
+    //Message thread: a conversion or stretch is on its way that updateTimeStretch() hasn't handed over yet
+    bool isTimeStretchPending() const noexcept
     {
-        const juce::ScopedLock sl(callbackLock);
-        
-        auto hitLoopEnd = false;
+        return stretchRequest != nullptr || stretchedTake != nullptr;
+    }
+
 
+    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
         bufferToFill.clearActiveBufferRegion();  //DN: start with silence, so if we need it it's already there
 
-        if (!stopped)
+        const ChannelGains unity{};
+        mixNextAudioBlock(bufferToFill, unity, unity);
+    }
+
+    //Adds the next block on top of what's already in bufferToMixInto, with each output channel's
+    //gain ramping from startGains to endGains across the block.  This is what the MixEngine uses,
+    //so the loop goes from the loopBuffer into the mix with gain and pan applied in the same pass
+    void mixNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToMixInto,
+                           const ChannelGains& startGains, const ChannelGains& endGains)
+    {
+        //holds on to whichever buffer is current for the rest of this block, no lock taken
+        const RealtimeHandoff<LoopTake>::ScopedRead currentBuffer(loopBuffer);
+
+        //the message thread has dealt with the last take - this has to be checked inside the
+        //ScopedRead, before finishedTake is touched, since that buffer may be retired after this
+        if (recordingStopRequested.exchange(false))
+        {
+            recording = false;
+            finishedTake = nullptr;
+            pendingRecordingChangeSample = -1;
+        }
+
+        //same again for a stretched take, once it's been published as the loopBuffer
+        if (stretchHandedOver.exchange(false))
+            adoptedStretch = nullptr;
+
+        parameters.drain([this](const ParameterQueue::Change& change) { applyParameterChange(change); });
+
+        //a new take's offset only applies once we're reading that take
+        if (offsetPendingFor != nullptr && offsetPendingFor == currentBuffer.get())
+        {
+            playOffset = pendingOffset;
+            offsetPendingFor = nullptr;
+            slipping = false;
+        }
+
+        const auto blockStartSample = transport.getBlockStartSample();
+        int loopLength = getLoopLengthAt(blockStartSample);
+        const int numSamples = bufferToMixInto.numSamples;
+
+        if (!stopped && loopLength > 0 && numSamples > 0)
         {
-            int loopBufferSize = loopBuffer->getNumSamples();
-            int maxInChannels = loopBuffer->getNumChannels();
+            // DN: if someone hit "stop", fade out over the start of this block and leave the rest silent
+            const bool fadingOut = !playing;
+            const int numSamplesToRender = fadingOut ? juce::jmin(256, numSamples) : numSamples;
+            const auto rampEnd = fadingOut ? ChannelGains::silent() : endGains;
 
-            int maxOutChannels = bufferToFill.buffer->getNumChannels();
+            int pos = getLoopPositionAt(blockStartSample);
+            int samplesDone = 0;
 
-            int pos = position;
-            for (int i = 0; i < maxOutChannels; ++i)
+            //DN: the block is split into spans at the loop wrap point (and wherever recording punches
+            //in or out), and each span is mixed in one go rather than checking every sample
+            while (samplesDone < numSamples)
             {
-                auto writer = bufferToFill.buffer->getWritePointer(i, bufferToFill.startSample);
+                //a loaded project's loop length takes over at the top of the loop
+                if (pos >= loopLength)
+                {
+                    pos = 0;
+                    loopLength = getLoopLengthAt(blockStartSample + samplesDone);
+
+                    if (loopLength <= 0)
+                        break;
+                }
+
+                //DN: audio stretched to a new tempo only takes over at the top of the loop, so it comes in on the beat
+                //(and a loaded project's only at the loop start it's been given, so every track swaps together)
+                if (pos == 0 && blockStartSample + samplesDone >= adoptStretchFrom.load())
+                    if (auto* stretched = offeredStretch.exchange(nullptr))
+                        adoptedStretch = stretched;
+
+                if (samplesDone >= pendingRecordingChangeSample && pendingRecordingChangeSample >= 0)
+                    applyPendingRecordingChange();
+
+                int spanLength = juce::jmin(numSamples - samplesDone, loopLength - pos);
+
+                if (pendingRecordingChangeSample > samplesDone)
+                    spanLength = juce::jmin(spanLength, pendingRecordingChangeSample - samplesDone);
+
+                const int renderLength = juce::jlimit(0, spanLength, numSamplesToRender - samplesDone);
 
-                pos = position; //need to reset/use a separate counter for each channel
-                for (auto sample = 0; sample < bufferToFill.numSamples; ++sample)
+                //DN:  we only want to read the fileBuffer to output if it's not currently being recorded over
+                if (!recording && renderLength > 0)
                 {
-                    if (pos == masterLoopLength)
+                    const float spanStart = (float)samplesDone / (float)numSamplesToRender;
+                    const float spanEnd = (float)(samplesDone + renderLength) / (float)numSamplesToRender;
+                    auto spanStartGains = ChannelGains::interpolate(startGains, rampEnd, spanStart);
+                    auto spanEndGains = ChannelGains::interpolate(startGains, rampEnd, spanEnd);
+                    const auto* source = &getTakeToPlay(*currentBuffer);
+                    const bool reversed = source->isPlayedReversed();
+                    const int offset = getOffsetToPlayAt();
+                    const int previousOffset = (slipping && source == currentBuffer.get()) ? slipStartOffset : offset;
+                    const int destStartSample = bufferToMixInto.startSample + samplesDone;
+
+                    //DN: the direction just flipped, or the loop was slipped - fade the old one out across the block while the new one fades in
+                    if (reversed != playingReversed || offset != previousOffset)
                     {
-                        pos = 0;
-
-                        // AF: Update position only at last iteration of the outer loop
-                        // to prevent channels for being out of sync
-                        if (i == maxOutChannels - 1)
-                        {
-                            hitLoopEnd = true;
-                        }
-                    }
+                        mixLoopSpan(*source, *bufferToMixInto.buffer, destStartSample, pos, renderLength,
+                                    ChannelGains::interpolate(spanStartGains, ChannelGains::silent(), spanStart),
+                                    ChannelGains::interpolate(spanEndGains, ChannelGains::silent(), spanEnd),
+                                    previousOffset, playingReversed);
 
-                    //DN:  we only want to read the fileBuffer to output if it's not currently being recorded over,
-                    // and the position is within the range it should be played back
-                    //ignore null warning - should never be null since we allocate a dummy buffer in the constructor
-                    if (!recording && (pos > fileStartOffset) && (pos < (loopBufferSize + fileStartOffset)))
-                        writer[sample] = loopBuffer->getSample(i%maxInChannels,pos-fileStartOffset);
+                        spanStartGains = ChannelGains::interpolate(ChannelGains::silent(), spanStartGains, spanStart);
+                        spanEndGains = ChannelGains::interpolate(ChannelGains::silent(), spanEndGains, spanEnd);
+                    }
 
-                    pos++;
+                    mixLoopSpan(*source, *bufferToMixInto.buffer, destStartSample, pos, renderLength,
+                                spanStartGains, spanEndGains, offset, reversed);
                 }
-            }
 
-            // Check for beginning of file
-            if (hitLoopEnd)
-                beginningOfFile = true;
-            else if (position > (sampleRate/3))  //DN: delay where flag will stay true
-                beginningOfFile = false;
+                //DN: the span has been played out of the loop, now layer the input on top of it for next time round
+                if (!recording && finishedTake == nullptr && overdubbing)
+                    overdubSpan(*currentBuffer, pos, samplesDone, spanLength);
+
+                pos += spanLength;
+                samplesDone += spanLength;
+            }
 
             position = pos;
+            stopped = fadingOut;
+        }
+
+        playingReversed = getTakeToPlay(*currentBuffer).isPlayedReversed();
+        slipping = false;
 
-            if (!playing)
+        //a change scheduled past the end of what we rendered (e.g. we were stopped) still has to happen
+        if (pendingRecordingChangeSample >= 0)
+            applyPendingRecordingChange();
+
+        //the input only belongs to this block
+        numOverdubInputSamples = 0;
+    }
+
+    //DN: mixes the part of [loopPosition, loopPosition + numSamples) that overlaps the audio in the
+    //loopBuffer (i.e. [offset, offset + loopBufferSize)), anything either side of it
+    //is the silent region so there's nothing to add.  The gains ramp across the whole span, which gets
+    //mixed a chunk of the take at a time.  Reversed, the audio still sits in the same part of the loop,
+    //it's just read from its end back to its start
+    void mixLoopSpan(const LoopTake& source, juce::AudioBuffer<float>& dest,
+                     int destStartSample, int loopPosition, int numSamples,
+                     const ChannelGains& spanStartGains, const ChannelGains& spanEndGains, int offset, bool reversed)
+    {
+        const int sourceLength = source.getNumSamples();
+        const int numSourceChannels = source.getNumChannels();
+
+        if (sourceLength == 0 || numSourceChannels == 0)
+            return;
+
+        const int audioStart = juce::jmax(loopPosition, offset);
+        const int audioEnd = juce::jmin(loopPosition + numSamples, offset + sourceLength);
+
+        for (int loopSample = audioStart; loopSample < audioEnd;)
+        {
+            const int takeSample = reversed ? sourceLength - 1 - (loopSample - offset) : loopSample - offset;
+            const int run = juce::jmin(audioEnd - loopSample, reversed ? LoopTake::getNumContiguousSamplesBackFrom(takeSample)
+                                                                       : source.getNumContiguousSamples(takeSample));
+            const auto runStartGains = ChannelGains::interpolate(spanStartGains, spanEndGains, (float)(loopSample - loopPosition) / (float)numSamples);
+            const auto runEndGains = ChannelGains::interpolate(spanStartGains, spanEndGains, (float)(loopSample + run - loopPosition) / (float)numSamples);
+
+            for (int channel = 0; channel < dest.getNumChannels(); ++channel)
             {
-                beginningOfFile = false;
-                // DN: someone hit "stop", so fade out the last block we just filled
-                for (int i = bufferToFill.buffer->getNumChannels(); --i >= 0;)
-                    bufferToFill.buffer->applyGainRamp(i, bufferToFill.startSample, juce::jmin(256, bufferToFill.numSamples), 1.0f, 0.0f);
+                auto* destSamples = dest.getWritePointer(channel, destStartSample + (loopSample - loopPosition));
+                auto* sourceSamples = source.getReadPointer(channel % numSourceChannels, takeSample);
 
-                if (bufferToFill.numSamples > 256)
-                    bufferToFill.buffer->clear(bufferToFill.startSample + 256, bufferToFill.numSamples - 256);
+                if (reversed)
+                    MixKernels::addReversedWithGainRamp(destSamples, sourceSamples, run, runStartGains.forChannel(channel), runEndGains.forChannel(channel));
+                else
+                    MixKernels::addWithGainRamp(destSamples, sourceSamples, run, runStartGains.forChannel(channel), runEndGains.forChannel(channel));
             }
 
-            stopped = !playing;
+            loopSample += run;
         }
     }
 
-    bool readyToRecord()
+    //Slipping isn't an undo step of its own, it's remembered with the current one - except for
+    //lining up a take that's being recorded, which doesn't belong to the audio being replaced
+    void setFileStartOffset(int newStartOffset, bool keepWithCurrentState = true)
     {
-        if (beginningOfFile)
-            return true;
+        fileStartOffset = newStartOffset;
+        parameters.push(slipParameter, newStartOffset);
 
-        return false;
-    }
+        if (keepWithCurrentState)
+        {
+            auto& current = history.getCurrent();
+            current.fileStartOffset = convertLength(newStartOffset, playingTempo, playingRate, current.tempo, current.sampleRate);
 
-    void setBeginningOfFile(bool boolean)
-    {
-        beginningOfFile = boolean;
+            //so a stretch that's on its way doesn't undo the slip when it takes over
+            if (stretchRequest != nullptr || stretchedTake != nullptr)
+                stretchedOffset = convertLength(newStartOffset, playingTempo, playingRate, stretchedTempo, stretchedRate);
+        }
     }
 
-    void setFileStartOffset(int newStartOffset)
+    int getFileStartOffset() const noexcept { return fileStartOffset; }
+
+    //Message thread: flips the direction the loop plays in.  The samples aren't touched - it's the same
+    //chunks with the flag flipped, so it's instant however long the loop is
+    void reverseAudio()
     {
-        fileStartOffset = newStartOffset;
+        cancelTimeStretch();
+
+        auto flipped = std::make_unique<LoopTake>(*loopBuffer.getForWriter());
+        flipped->setPlayedReversed(!flipped->isPlayedReversed());
+        history.push({ *flipped, fileStartOffset, playingTempo, playingRate });
+        publishTake(std::move(flipped));
+
+        stretchToFit();
     }
 
-    void reverseAudio()
+    //Message thread only
+    bool isReversed()
     {
-        loopBuffer->reverse(0, loopBuffer->getNumSamples());
+        return loopBuffer.getForWriter()->isPlayedReversed();
     }
 
-    juce::AudioBuffer<float>* getLoopBuffer()
+    //Message thread only
+    const LoopTake& getLoopTake()
     {
-        return loopBuffer.get();
+        return *loopBuffer.getForWriter();
     }
 
     int getBpm()
@@ -238,22 +695,369 @@ public:
     }
 
 private:
+    //Sums the input that arrived while [loopPosition, loopPosition + numSamples) played into the loop, in
+    //place.  It was played along to the loop overdubLatency samples earlier, so that's where it goes -
+    //a part that's already been played out this time round, wrapping back to the end if need be
+    void overdubSpan(LoopTake& loop, int loopPosition, int inputStartSample, int numSamples)
+    {
+        const int loopLength = loop.getNumSamples();
+
+        //prepareForOverdub lays the loop out from 0 at full length - anything else isn't ours to write into
+        if (numOverdubInputChannels <= 0 || playOffset != 0
+            || inputStartSample + numSamples > numOverdubInputSamples
+            || loopPosition + numSamples > loopLength)
+            return;
+
+        const float feedback = overdubFeedback;
+
+        for (int done = 0; done < numSamples;)
+        {
+            int destSample = loopPosition + done - overdubLatency;
+
+            if (destSample < 0)
+                destSample += loopLength;
+
+            const int run = juce::jmin(numSamples - done, loop.getNumContiguousSamples(destSample));
+
+            for (int channel = 0; channel < loop.getNumChannels(); ++channel)
+                MixKernels::overdub(loop.getWritePointer(channel, destSample),
+                                    overdubInput[channel % numOverdubInputChannels] + inputStartSample + done,
+                                    run, feedback);
+
+            overdubbedChunks[LoopTake::getChunkIndex(destSample)] = true;
+            done += run;
+        }
+    }
+
+    //Message thread, once the audio thread is done overdubbing: the chunks it never got to go back
+    //to sharing the ones they were copied from, so the undo step only costs what was played over
+    void finishOverdub()
+    {
+        auto result = std::make_unique<LoopTake>(*loopBuffer.getForWriter());
+        const auto& before = history.getCurrent();
+        bool anyOverdubbed = false;
+
+        if (before.fileStartOffset == 0 && !before.take.isPlayedReversed() && before.take.hasSameLayoutAs(*result))
+        {
+            for (int i = 0; i < result->getNumChunks(); ++i)
+            {
+                if (overdubbedChunks[i])
+                    anyOverdubbed = true;
+                else
+                    result->shareChunkWith(i, before.take);
+            }
+
+            //nothing got played over, so it's not worth an undo step
+            if (!anyOverdubbed)
+            {
+                publishTake(std::move(result));
+                stretchToFit();
+                return;
+            }
+        }
+
+        history.push({ *result, fileStartOffset, playingTempo, playingRate });
+        publishTake(std::move(result));
+        stretchToFit();
+    }
+
+    void restoreState(const TakeHistory::State& state)
+    {
+        cancelTimeStretch();
+        fileStartOffset = state.fileStartOffset;
+        playingTempo = state.tempo;
+        playingRate = state.sampleRate;
+        publishTake(std::make_unique<LoopTake>(state.take));
+        stretchToFit();
+    }
+
+    //Message thread: if what's playing isn't at the master tempo and the device's rate, starts the current
+    //state converting and stretching to fit.  A version that already fits (the state's own, or one it's
+    //been converted to before) needs no work, but still waits for the top of the loop
+    void stretchToFit()
+    {
+        //a loaded take that hasn't taken over yet is converted again instead, and still waits for its loop start
+        if (loadPending && !(stretchedTake != nullptr && offeredStretch.load() == nullptr))
+        {
+            if (pendingTempo > 0 && sampleRate.load() > 0.0
+                && (stretchedTempo != pendingTempo || stretchedRate != sampleRate.load()))
+                convertLoadedTake(adoptStretchFrom);
+
+            return;
+        }
+
+        cancelTimeStretch();
+
+        const auto& state = history.getCurrent();
+        const double deviceRate = sampleRate;
+
+        if ((playingTempo == masterLoopTempo && playingRate == deviceRate)
+            || masterLoopTempo <= 0 || deviceRate <= 0.0 || state.tempo <= 0 || state.sampleRate <= 0.0 || overdubbing)
+            return;
+
+        //silence is silence at any tempo or rate
+        if (!state.take.hasAudio())
+        {
+            playingTempo = masterLoopTempo;
+            playingRate = deviceRate;
+            return;
+        }
+
+        stretchedTempo = masterLoopTempo;
+        stretchedRate = deviceRate;
+        stretchedOffset = convertLength(state.fileStartOffset, state.tempo, state.sampleRate, stretchedTempo, stretchedRate);
+
+        const auto* source = &state.take;
+        double sourceRate = state.sampleRate;
+        const auto converted = state.atOtherRates.find(stretchedRate);
+
+        if (converted != state.atOtherRates.end())
+        {
+            source = &converted->second;
+            sourceRate = stretchedRate;
+        }
+
+        if (sourceRate == stretchedRate && state.tempo == stretchedTempo)
+        {
+            stretchedTake = std::make_unique<LoopTake>(*source);
+            offeredStretch = stretchedTake.get();
+            return;
+        }
+
+        stretchRequest = timeStretcher->stretch(*source, sourceRate, stretchedRate,
+                                                convertLength(source->getNumSamples(), state.tempo, sourceRate, stretchedTempo, stretchedRate));
+    }
+
+    //Message thread: starts the current state (a loaded project's) converting to the project's tempo and the
+    //device's rate, to be offered to the audio thread from transport sample adoptFrom on (notYet until
+    //adoptLoadedTakeFrom()).  Unlike stretchToFit() it's offered even if it already fits, since it isn't
+    //what's playing.  The loop that's playing isn't touched
+    void convertLoadedTake(juce::int64 adoptFrom)
+    {
+        cancelTimeStretch();
+        loadPending = true;
+        loopChangeFrom = adoptFrom;
+        adoptStretchFrom = adoptFrom;
+
+        const auto& state = history.getCurrent();
+        const bool canConvert = pendingTempo > 0 && sampleRate.load() > 0.0 && state.tempo > 0 && state.sampleRate > 0.0;
+        stretchedTempo = canConvert ? pendingTempo : state.tempo;
+        stretchedRate = canConvert ? sampleRate.load() : state.sampleRate;
+        stretchedOffset = convertLength(state.fileStartOffset, state.tempo, state.sampleRate, stretchedTempo, stretchedRate);
+
+        //silence is silence at any tempo or rate
+        if (!state.take.hasAudio() || (state.tempo == stretchedTempo && state.sampleRate == stretchedRate))
+        {
+            stretchedTake = std::make_unique<LoopTake>(state.take);
+            offeredStretch = stretchedTake.get();
+            return;
+        }
+
+        stretchRequest = timeStretcher->stretch(state.take, state.sampleRate, stretchedRate,
+                                                convertLength(state.take.getNumSamples(), state.tempo, state.sampleRate, stretchedTempo, stretchedRate));
+    }
+
+    //Message thread: forgets any stretch that's on its way.  If the audio thread has already switched
+    //to one, it gets published properly first, so whatever replaces it retires it safely
+    void cancelTimeStretch()
+    {
+        if (stretchRequest != nullptr)
+        {
+            stretchRequest->cancel();
+            stretchRequest = nullptr;
+        }
+
+        if (stretchedTake != nullptr)
+        {
+            if (offeredStretch.exchange(nullptr) != nullptr)
+                stretchedTake.reset();  //never picked up
+            else
+                handOverStretchedTake();
+        }
+
+        //a project being loaded gets dropped too - what replaces it is an edit to what's playing, on the loop
+        //that's playing
+        loadPending = false;
+        loopChangeFrom = notYet;
+        adoptStretchFrom = 0;
+    }
+
+    //Message thread: the audio thread is playing the stretched take (or isn't rendering at all), so it
+    //becomes the loopBuffer.  The audio thread stops using its own pointer to it on its next block
+    void handOverStretchedTake()
+    {
+        //a loaded project's loop has taken over on the audio thread already, this catches up with it
+        if (loopChangeFrom.load() != notYet)
+        {
+            masterLoopTempo = pendingTempo;
+            masterLoopBeatsPerLoop = pendingBeatsPerLoop;
+            calcMasterLoopLength();
+            loopChangeFrom = notYet;
+        }
+
+        loadPending = false;
+        adoptStretchFrom = 0;
+        fileStartOffset = stretchedOffset;
+        playingTempo = stretchedTempo;
+        playingRate = stretchedRate;
+        publishTake(std::move(stretchedTake));
+        stretchHandedOver = true;
+    }
+
+    //A number of samples at one tempo and rate, at another
+    static int convertLength(int numSamples, int fromTempo, double fromRate, int toTempo, double toRate) noexcept
+    {
+        if (fromTempo <= 0 || toTempo <= 0 || fromRate <= 0.0 || toRate <= 0.0)
+            return numSamples;
+
+        return juce::roundToInt((double)numSamples * fromTempo / toTempo * toRate / fromRate);
+    }
+
+    //Audio thread: a take that's just been recorded or stretched, until the message thread has
+    //made it the loopBuffer
+    const LoopTake& getTakeToPlay(const LoopTake& current) const noexcept
+    {
+        if (finishedTake != nullptr)
+            return *finishedTake;
+
+        return adoptedStretch != nullptr ? *adoptedStretch : current;
+    }
+
+    int getOffsetToPlayAt() const noexcept
+    {
+        return (finishedTake == nullptr && adoptedStretch != nullptr) ? stretchedOffset.load() : playOffset;
+    }
+
+    enum Parameter
+    {
+        slipParameter,        //the user moved the loop - crossfaded
+        takeOffsetParameter   //the offset a newly published take plays at
+    };
+
+    //Message thread: every take that becomes the loopBuffer is followed by the offset it plays at
+    void publishTake(std::unique_ptr<LoopTake> take)
+    {
+        const auto* published = take.get();
+        loopBuffer.publish(std::move(take));
+        parameters.push(takeOffsetParameter, fileStartOffset, published);
+    }
+
+    //Audio thread, at the start of a block
+    void applyParameterChange(const ParameterQueue::Change& change) noexcept
+    {
+        const int offset = (int)change.value;
+
+        if (change.parameter == takeOffsetParameter)
+        {
+            offsetPendingFor = change.target;
+            pendingOffset = offset;
+        }
+        else if (change.parameter == slipParameter)
+        {
+            //the message thread slipped the take it had just published, which we haven't got to yet
+            if (offsetPendingFor != nullptr)
+            {
+                pendingOffset = offset;
+            }
+            else if (offset != playOffset)
+            {
+                if (!slipping)
+                    slipStartOffset = playOffset;
+
+                slipping = true;
+                playOffset = offset;
+            }
+        }
+    }
+
+    //how long the loop is at a point on the transport timeline - a loaded project's loop from where it takes over
+    int getLoopLengthAt(juce::int64 transportSample) const noexcept
+    {
+        return transportSample >= loopChangeFrom.load() ? pendingLoopLength.load() : masterLoopLength.load();
+    }
+
+    //where in the loop a point on the transport timeline falls
+    int getLoopPositionAt(juce::int64 transportSample) const noexcept
+    {
+        const int loopLength = getLoopLengthAt(transportSample);
+        const auto sinceLoopOrigin = juce::jmax((juce::int64)0, transportSample - transport.getLoopOriginAt(transportSample));
+
+        return loopLength > 0 ? (int)(sinceLoopOrigin % loopLength) : 0;
+    }
+
+    void applyPendingRecordingChange() noexcept
+    {
+        recording = pendingRecording;
+
+        if (pendingFinishedTake != nullptr)
+            finishedTake = pendingFinishedTake;
+
+        pendingRecordingChangeSample = -1;
+        pendingFinishedTake = nullptr;
+    }
+
     //==============================================================================
-    std::unique_ptr<juce::AudioBuffer<float>> loopBuffer;  //DN: array containing the audio we've read into memory in AudioTrack.h stopRecording()
-    int position = 0; //DN:  important, this tracks our position as we iterate over the masterLoopLength, which can be longer and start before the audio file
-    int fileStartOffset = 0;  //DN:  set this to delay when the contents of the loopBuffer play back, relative to position 0
+    const TransportClock& transport;
+    RealtimeHandoff<LoopTake> loopBuffer;  //DN: array containing the audio we've read into memory in TrackEngine.h stopRecording()
+    TakeHistory history;  //message thread only
+    bool playingReversed = false;  //audio thread only - which way the last block was read
+    std::atomic<int> position{ 0 }; //DN:  where the last block left us in the masterLoopLength (which can be longer and start before the audio file), for drawing the playhead
+    int fileStartOffset = 0;  //DN:  set this to delay when the contents of the loopBuffer play back, relative to position 0 (message thread)
+
+    //the offset as the audio thread sees it - it only ever changes by way of the queue
+    ParameterQueue parameters;
+    int playOffset = 0;  //audio thread only, what the loopBuffer plays at
+    const void* offsetPendingFor = nullptr;  //a take we've been sent the offset for, but aren't reading yet
+    int pendingOffset = 0;
+    bool slipping = false;  //slipped this block - crossfade from slipStartOffset
+    int slipStartOffset = 0;
     
-    bool stopped = true, playing = false, recording = false, playAcrossAllChannels = true;
-    double sampleRate = 44100.0;
+    std::atomic<bool> stopped{ true }, playing{ false }, recording{ false };
+    bool playAcrossAllChannels = true;
+    std::atomic<double> sampleRate{ 44100.0 };
+
+    //recording punch in/out - set during input capture, applied while rendering, audio thread only
+    int pendingRecordingChangeSample = -1;
+    bool pendingRecording = false;
+    const LoopTake* pendingFinishedTake = nullptr;
+    const LoopTake* finishedTake = nullptr;  //a finished take the message thread hasn't picked up yet
+    std::atomic<bool> recordingStopRequested{ false };
 
-    // AF: Flag to set when it's ready to record
-    bool beginningOfFile = false;
+    //overdubbing - the input pointers are only valid for the block they were captured in
+    std::atomic<bool> overdubbing{ false };
+    std::atomic<float> overdubFeedback{ 1.0f };
+    const float* const* overdubInput = nullptr;
+    int numOverdubInputChannels = 0;
+    int numOverdubInputSamples = 0;
+    juce::HeapBlock<bool> overdubbedChunks;  //set by the audio thread, read once it's finished
+    int overdubLatency = 0;  //set by prepareForOverdub, before the audio thread starts overdubbing
+    int firstOverdubChannel = 0, numOverdubChannels = 0;  //the inputs the track is routed to
 
-    juce::CriticalSection callbackLock;
+    //following the tempo and device rate - a stretch is requested, then offered to the audio thread, which adopts it at
+    //the top of the loop, and then it's handed over as the loopBuffer
+    juce::SharedResourcePointer<TimeStretcher> timeStretcher;
+    TimeStretcher::Request::Ptr stretchRequest;  //message thread only
+    std::unique_ptr<LoopTake> stretchedTake;  //message thread: owns the stretch while it's offered/adopted
+    std::atomic<const LoopTake*> offeredStretch{ nullptr };
+    const LoopTake* adoptedStretch = nullptr;  //audio thread only
+    std::atomic<bool> stretchHandedOver{ false };
+    std::atomic<int> stretchedOffset{ 0 };
+    std::atomic<juce::int64> adoptStretchFrom{ 0 };  //the offered take waits for the transport to get here (a loaded project's)
+    bool loadPending = false;  //message thread only
+    int stretchedTempo = 0;
+    double stretchedRate = 0.0;
+    int playingTempo = 0;  //message thread - the tempo and rate the loopBuffer's audio is at
+    double playingRate = 0.0;
 
-    int masterLoopTempo;
-    int masterLoopBeatsPerLoop;
-    int masterLoopLength; //DN: length in SAMPLES of the loop, so this depends on tempo, measures ,timesig, and sample Rate
+    //set on the message thread (and prepareToPlay), read on the audio thread and the render workers
+    std::atomic<int> masterLoopTempo{ 120 };
+    std::atomic<int> masterLoopBeatsPerLoop{ 16 };
+    std::atomic<int> masterLoopLength{ 0 }; //DN: length in SAMPLES of the loop, so this depends on tempo, measures ,timesig, and sample Rate
 
+    //a loaded project's loop, which takes over from loopChangeFrom on - until then it's notYet
+    static constexpr juce::int64 notYet = std::numeric_limits<juce::int64>::max();
+    int pendingTempo = 0, pendingBeatsPerLoop = 0;  //message thread
+    std::atomic<int> pendingLoopLength{ 0 };
+    std::atomic<juce::int64> loopChangeFrom{ notYet };
 
 };
\ No newline at end of file
@@ -0,0 +1,314 @@
+/*
+  ==============================================================================
+
+    LoopTake.h
+
+    A loop's audio, stored as a list of fixed-size chunks rather than one long
+    buffer.  The chunks are reference counted, so copying a LoopTake only
+    copies the list - both copies share the same audio until one of them
+    swaps a chunk for a new one.  That's what lets the undo history keep every
+    version of a loop while only paying for the chunks that actually changed
+    between them.
+
+    A chunk's channels are pages from the shared SamplePagePool.  A chunk
+    that's all silence has no pages at all - it reads as the pool's silent
+    page - so an empty track, or the silence after a short take, costs nothing.
+
+    A take can be marked to play reversed.  The samples stay the way they
+    were recorded (which is also how they're written to disk) and LoopSource
+    just reads them backwards, so reversing never touches the audio.
+
+    Reading and writing samples is fine on the audio thread (nothing gets
+    allocated), but anything that adds or copies chunks is message thread only.
+    Only write into a take that's been through makeWritable().
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include "SamplePagePool.h"
+
+
+class LoopTake
+{
+public:
+    //~0.37s at 44.1k - small enough that a partial edit doesn't copy much, big enough
+    //that a span rarely needs splitting
+    static constexpr int samplesPerChunk = SamplePagePool::samplesPerPage;
+
+    LoopTake() = default;
+
+    //Silence - no pages get used until makeWritable()
+    LoopTake(int numChannelsToUse, int numSamplesToUse)
+        : numChannels(juce::jmax(0, numChannelsToUse)), numSamples(juce::jmax(0, numSamplesToUse))
+    {
+        chunks.ensureStorageAllocated(getNumChunks());
+
+        for (int i = 0; i < getNumChunks(); ++i)
+            chunks.add(nullptr);
+    }
+
+    //Shares every chunk with the other take.  There's no assigning one, since its pagePool can't be
+    LoopTake(const LoopTake&) = default;
+
+    //Only the chunks with something in them take up pages
+    static std::unique_ptr<LoopTake> fromBuffer(const juce::AudioBuffer<float>& buffer)
+    {
+        auto take = std::make_unique<LoopTake>(buffer.getNumChannels(), buffer.getNumSamples());
+
+        for (int i = 0; i < take->getNumChunks(); ++i)
+        {
+            const int startSample = i * samplesPerChunk;
+            const int numInChunk = take->getNumContiguousSamples(startSample);
+            bool silent = true;
+
+            for (int channel = 0; channel < take->numChannels && silent; ++channel)
+                silent = isSilent(buffer.getReadPointer(channel, startSample), numInChunk);
+
+            if (silent)
+                continue;
+
+            auto* chunk = new Chunk(*take->pagePool, take->numChannels, false);
+            take->chunks.set(i, chunk);
+
+            for (int channel = 0; channel < take->numChannels; ++channel)
+            {
+                juce::FloatVectorOperations::copy(chunk->pages.getUnchecked(channel), buffer.getReadPointer(channel, startSample), numInChunk);
+                juce::FloatVectorOperations::clear(chunk->pages.getUnchecked(channel) + numInChunk, samplesPerChunk - numInChunk);
+            }
+        }
+
+        return take;
+    }
+
+    std::unique_ptr<juce::AudioBuffer<float>> toBuffer() const
+    {
+        auto buffer = std::make_unique<juce::AudioBuffer<float>>(numChannels, numSamples);
+
+        forEachChunk([&buffer](int startSample, const juce::AudioBuffer<float>& chunkAudio, int numInChunk)
+        {
+            for (int channel = 0; channel < chunkAudio.getNumChannels(); ++channel)
+                buffer->copyFrom(channel, startSample, chunkAudio, channel, 0, numInChunk);
+        });
+
+        return buffer;
+    }
+
+    int getNumChannels() const noexcept   { return numChannels; }
+    int getNumSamples() const noexcept    { return numSamples; }
+    int getNumChunks() const noexcept     { return (numSamples + samplesPerChunk - 1) / samplesPerChunk; }
+
+    static int getChunkIndex(int sample) noexcept { return sample / samplesPerChunk; }
+
+    //How many samples from here on are in one piece of memory
+    int getNumContiguousSamples(int sample) const noexcept
+    {
+        return juce::jmin(samplesPerChunk - sample % samplesPerChunk, numSamples - sample);
+    }
+
+    //The same, reading backwards from here (this sample included)
+    static int getNumContiguousSamplesBackFrom(int sample) noexcept
+    {
+        return sample % samplesPerChunk + 1;
+    }
+
+    bool isPlayedReversed() const noexcept              { return playReversed; }
+    void setPlayedReversed(bool shouldPlayReversed)     { playReversed = shouldPlayReversed; }
+
+    const float* getReadPointer(int channel, int sample) const noexcept
+    {
+        if (auto* chunk = chunks.getObjectPointerUnchecked(getChunkIndex(sample)))
+            return chunk->pages.getUnchecked(channel) + sample % samplesPerChunk;
+
+        return SamplePagePool::getSilentPage() + sample % samplesPerChunk;
+    }
+
+    //Only write into chunks nothing else is sharing - see makeWritable()
+    float* getWritePointer(int channel, int sample) noexcept
+    {
+        auto* chunk = chunks.getObjectPointerUnchecked(getChunkIndex(sample));
+        jassert(chunk != nullptr);
+
+        return chunk->pages.getUnchecked(channel) + sample % samplesPerChunk;
+    }
+
+    //Audio thread safe, as long as the chunks written to aren't shared
+    void copyFrom(int destChannel, int destSample, const float* source, int numToCopy) noexcept
+    {
+        while (numToCopy > 0)
+        {
+            const int run = juce::jmin(numToCopy, getNumContiguousSamples(destSample));
+            juce::FloatVectorOperations::copy(getWritePointer(destChannel, destSample), source, run);
+
+            source += run;
+            destSample += run;
+            numToCopy -= run;
+        }
+    }
+
+    void copyFrom(int destChannel, int destSample, const LoopTake& source, int sourceChannel, int sourceSample, int numToCopy) noexcept
+    {
+        while (numToCopy > 0)
+        {
+            const int run = juce::jmin(numToCopy, source.getNumContiguousSamples(sourceSample));
+            copyFrom(destChannel, destSample, source.getReadPointer(sourceChannel, sourceSample), run);
+
+            sourceSample += run;
+            destSample += run;
+            numToCopy -= run;
+        }
+    }
+
+    //Message thread: gives this take its own pages for every chunk - copies of the ones it shares,
+    //and cleared ones for silence - so it can be written to
+    void makeWritable()
+    {
+        for (int i = 0; i < chunks.size(); ++i)
+        {
+            auto* chunk = chunks.getObjectPointerUnchecked(i);
+
+            if (chunk == nullptr)
+                chunks.set(i, new Chunk(*pagePool, numChannels, true));
+            else if (chunk->getReferenceCount() > 1)
+                chunks.set(i, new Chunk(*chunk));
+        }
+    }
+
+    //Message thread: gives back the pages of any chunk that turned out to be silent, e.g. the end
+    //of a take that was stopped early.  Not while the audio thread might be reading this take
+    void dropSilentChunks()
+    {
+        for (int i = 0; i < chunks.size(); ++i)
+        {
+            auto* chunk = chunks.getObjectPointerUnchecked(i);
+
+            if (chunk == nullptr)
+                continue;
+
+            const int numInChunk = getNumContiguousSamples(i * samplesPerChunk);
+            bool silent = true;
+
+            for (int channel = 0; channel < numChannels && silent; ++channel)
+                silent = isSilent(chunk->pages.getUnchecked(channel), numInChunk);
+
+            if (silent)
+                chunks.set(i, nullptr);
+        }
+    }
+
+    //Message thread: swaps our chunk for the other take's, e.g. to go back to sharing one that didn't change
+    void shareChunkWith(int chunkIndex, const LoopTake& other)
+    {
+        jassert(hasSameLayoutAs(other));
+        chunks.set(chunkIndex, other.chunks[chunkIndex]);
+    }
+
+    //False if every chunk is silence
+    bool hasAudio() const noexcept
+    {
+        for (auto* chunk : chunks)
+            if (chunk != nullptr)
+                return true;
+
+        return false;
+    }
+
+    bool hasSameLayoutAs(const LoopTake& other) const noexcept
+    {
+        return numChannels == other.numChannels && numSamples == other.numSamples;
+    }
+
+    //True if every chunk is the very same one as the other take's - the same audio, without comparing
+    //any samples.  (Reversal isn't part of it, that's only how it's played)
+    bool sharesEveryChunkWith(const LoopTake& other) const noexcept
+    {
+        if (!hasSameLayoutAs(other))
+            return false;
+
+        for (int i = 0; i < chunks.size(); ++i)
+            if (chunks.getObjectPointerUnchecked(i) != other.chunks.getObjectPointerUnchecked(i))
+                return false;
+
+        return true;
+    }
+
+    //Message thread: a copy with the samples themselves reversed, playing forwards - i.e. the way a
+    //reversed take sounds.  Every chunk changes, so none are shared
+    std::unique_ptr<LoopTake> withReversalApplied() const
+    {
+        auto buffer = toBuffer();
+
+        if (playReversed)
+            buffer->reverse(0, buffer->getNumSamples());
+
+        return fromBuffer(*buffer);
+    }
+
+    //Calls callback(startSample, chunkAudio, numSamplesInChunk) for each chunk in order.  The
+    //last chunk's buffer is longer than what's actually in the take, and a silent chunk is the
+    //shared silent page, so never write to chunkAudio
+    template <typename Callback>
+    void forEachChunk(Callback&& callback) const
+    {
+        juce::HeapBlock<float*> channelPointers((size_t)juce::jmax(1, numChannels));
+
+        for (int i = 0; i < chunks.size(); ++i)
+        {
+            const int startSample = i * samplesPerChunk;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                channelPointers[channel] = const_cast<float*>(getReadPointer(channel, startSample));
+
+            const juce::AudioBuffer<float> chunkAudio(channelPointers.getData(), numChannels, samplesPerChunk);
+            callback(startSample, chunkAudio, getNumContiguousSamples(startSample));
+        }
+    }
+
+private:
+    struct Chunk : public juce::ReferenceCountedObject
+    {
+        Chunk(SamplePagePool& poolToUse, int numChannels, bool clearPages)
+            : pool(poolToUse)
+        {
+            for (int channel = 0; channel < numChannels; ++channel)
+                pages.add(pool.acquire(clearPages));
+        }
+
+        Chunk(const Chunk& other)
+            : juce::ReferenceCountedObject(), pool(other.pool)
+        {
+            for (auto* otherPage : other.pages)
+            {
+                auto* page = pool.acquire(false);
+                juce::FloatVectorOperations::copy(page, otherPage, samplesPerChunk);
+                pages.add(page);
+            }
+        }
+
+        ~Chunk() override
+        {
+            for (auto* page : pages)
+                pool.release(page);
+        }
+
+        SamplePagePool& pool;
+        juce::Array<float*> pages;  //one per channel, samplesPerChunk long
+    };
+
+    static bool isSilent(const float* samples, int numSamplesToCheck) noexcept
+    {
+        const auto range = juce::FloatVectorOperations::findMinAndMax(samples, numSamplesToCheck);
+        return range.getStart() == 0.0f && range.getEnd() == 0.0f;
+    }
+
+    //declared first so it outlives the chunks, which hand their pages back to it
+    juce::SharedResourcePointer<SamplePagePool> pagePool;
+    juce::ReferenceCountedArray<Chunk> chunks;
+    int numChannels = 0;
+    int numSamples = 0;
+    bool playReversed = false;
+
+    JUCE_LEAK_DETECTOR(LoopTake)
+};
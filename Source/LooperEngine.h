@@ -0,0 +1,613 @@
+/*
+  ==============================================================================
+
+    LooperEngine.h
+
+    The whole looper without its window: the tracks (TrackEngines), the
+    transport they all follow, recording, the metronome, input monitoring,
+    latency calibration, the profiler and saving and loading projects, behind
+    a plain C++ API.  It's an AudioSource, so anything that can play one can
+    run it - MainComponent is the GUI on top of one, and it's just as happy
+    in a console app with no display:
+
+        juce::AudioDeviceManager deviceManager;
+        deviceManager.initialiseWithDefaultDevices(2, 2);
+
+        LooperEngine engine{ deviceManager };
+        juce::AudioSourcePlayer player;
+        player.setSource(&engine);
+        deviceManager.addAudioCallback(&player);
+
+        engine.setLoopLength(120, 8);
+        engine.play();
+        engine.getTrack(0)->setWaitingToRecord(true);
+
+    It only needs the non-GUI JUCE modules (core, events, data_structures,
+    audio_basics, audio_devices, audio_formats, dsp), plus a message thread
+    for its timers, and the headers under it include just those.  Everything
+    here is message thread only, apart from the AudioSource callbacks.
+
+    The app builds it through the Projucer's exporters, as before.  On its
+    own it's the LooperEngine console target in CMakeLists.txt (with
+    EngineMain.cpp), which links nothing but those modules - so anything
+    that drags a GUI class into the engine stops it building.
+
+    Projects save and load in the background (see ProjectIO.h) while the
+    loop carries on playing.  A loaded project doesn't cut in wherever the
+    read happens to finish: once every track's audio has been read and
+    converted to fit the project's tempo, the tracks' audio, the loop length
+    and the metronome all swap over together on the audio thread at the next
+    loop start.  Until then the loop that's playing is left alone.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_devices/juce_audio_devices.h>
+#include "CallbackProfiler.h"
+#include "CaptureDispatcher.h"
+#include "InputMonitor.h"
+#include "LatencyCalibrator.h"
+#include "Metronome.h"
+#include "MixEngine.h"
+#include "ProjectIO.h"
+#include "RealtimeSafetyChecker.h"
+#include "SaveLoad.h"
+#include "TrackEngine.h"
+#include "TransportClock.h"
+
+
+class LooperEngine : public juce::AudioSource, private juce::ChangeListener, private juce::Timer
+{
+public:
+    class Listener
+    {
+    public:
+        virtual ~Listener() = default;
+
+        //a track was added at the end, as track number index + 1
+        virtual void trackAdded(TrackEngine&, int /*index*/) {}
+        //the last track is about to go - let go of it before returning
+        virtual void trackRemoving(TrackEngine&, int /*index*/) {}
+        //the latency calibration finished: the round trip in samples, or -1 if there was no clear echo
+        virtual void latencyMeasured(int /*result*/) {}
+        //a save or load is under way - see its getProgress()
+        virtual void projectProgress(const ProjectIO::Request&) {}
+        //a save or load finished, was cancelled or failed (see its result).  A loaded project has
+        //taken over every track by the time this is called
+        virtual void projectFinished(const ProjectIO::Request&) {}
+    };
+
+    LooperEngine(juce::AudioDeviceManager& deviceManagerToUse)
+        : deviceManager(deviceManagerToUse)
+    {
+        latencyCalibrator.addChangeListener(this);
+
+        //DN: every stage of the audio callback gets timed - the tracks add their own as they're created
+        profiler.addStage(inputCaptureStage, "Input capture");
+        profiler.addStage(mixerStage, "Mixer");
+        profiler.addStage(metronomeStage, "Metronome");
+        profiler.addStage(inputMonitorStage, "Input monitor");
+        metronome.setProfilerStage(&metronomeStage);
+        inputAudio.setProfilerStage(&inputMonitorStage);
+
+        mixer.addSource(&metronome);
+        metronome.setMasterLoop(tempo, beats);
+
+        for (int i = 0; i < DEFAULT_NUM_TRACKS; ++i)
+            addTrack();
+
+        mixer.addSource(&inputAudio);
+    }
+
+    ~LooperEngine() override
+    {
+        stopTimer();
+
+        if (projectRequest != nullptr)
+            projectRequest->cancel();
+
+        latencyCalibrator.removeChangeListener(this);
+    }
+
+    void addListener(Listener* listener)      { listeners.add(listener); }
+    void removeListener(Listener* listener)   { listeners.remove(listener); }
+
+    //==============================================================================
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate) override
+    {
+        //AudioSourcePlayer calls this from audioDeviceAboutToStart, so this is the one place we
+        //read the device's channel layout and size the input capture buffer for it
+        int numInputChannels = 0;
+        int numOutputChannels = 2;
+        int maxBlockSize = samplesPerBlockExpected;
+        int roundTripLatency = 0;
+
+        if (auto* device = deviceManager.getCurrentAudioDevice())
+        {
+            numInputChannels = device->getActiveInputChannels().countNumberOfSetBits();
+            numOutputChannels = device->getActiveOutputChannels().countNumberOfSetBits();
+            maxBlockSize = juce::jmax(maxBlockSize, device->getCurrentBufferSizeSamples());
+            roundTripLatency = device->getInputLatencyInSamples() + device->getOutputLatencyInSamples();
+        }
+
+        inputCaptureBuffer.setSize(juce::jmax(1, numInputChannels), maxBlockSize);
+        inputCaptureBuffer.clear();
+        deviceInputChannels = numInputChannels;
+        captureDispatcher.prepare(sampleRate, numInputChannels, roundTripLatency);
+
+        mixer.prepareToPlay(maxBlockSize, sampleRate, numOutputChannels);
+        profiler.prepare(sampleRate);
+    }
+
+    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
+    {
+        //everything from here on has to be real-time safe (checked in RealtimeCheck builds)
+        const RealtimeSafetyChecker::ScopedAudioThread audioThread;
+        const CallbackProfiler::ScopedCallback profiledCallback(profiler, bufferToFill.numSamples);
+
+        auto maxInputChannels = deviceInputChannels.load();
+        maxInputChannels = juce::jmin(maxInputChannels, bufferToFill.buffer->getNumChannels(), inputCaptureBuffer.getNumChannels());
+
+        //the device handed us a bigger block than it announced - never write past the capture buffer, just drop the input
+        if (bufferToFill.numSamples > inputCaptureBuffer.getNumSamples())
+            maxInputChannels = 0;
+
+        /// DN: This code grabs the audio input, puts it in a buffer, and sends that to an AudioSource class
+        //  which can be added to or removed from our main mixer
+        // The capture is needed because the mixer clears and renders over the same buffer the input arrives in
+        for (auto channel = 0; channel < maxInputChannels; ++channel)
+            inputCaptureBuffer.copyFrom(channel, 0, *bufferToFill.buffer, channel, bufferToFill.startSample, bufferToFill.numSamples);
+
+        //InputMonitor reads straight out of the capture buffer, nothing else is copied or allocated
+        inputAudio.setInput(inputCaptureBuffer, monitorAllInputs ? maxInputChannels : juce::jmin(1, maxInputChannels),
+                            bufferToFill.numSamples);
+
+        //and any armed tracks get this same block to record, straight from the capture buffer - every
+        //input, each track only reads the ones it's routed to
+        {
+            const CallbackProfiler::ScopedTimer timer(&inputCaptureStage);
+            captureDispatcher.dispatch(inputCaptureBuffer, maxInputChannels, bufferToFill.numSamples);
+        }
+
+        //DN: This gets the audio from everything that's been added to the mixer and sends it to the output
+        //every track/input adds itself straight into bufferToFill with its gain and pan in the same pass
+        {
+            const CallbackProfiler::ScopedTimer timer(&mixerStage);
+            mixer.getNextAudioBlock(bufferToFill);
+        }
+
+        //everything has rendered this block against the same transport position, now move it on
+        transport.advance(bufferToFill.numSamples);
+    }
+
+    void releaseResources() override
+    {
+        mixer.releaseResources();
+    }
+
+    //==============================================================================
+    //Adds a silent track at the end, which joins in straight away if we're playing (it follows the
+    //same transport, so it's already in sync).  nullptr once there are MAX_NUM_TRACKS
+    TrackEngine* addTrack()
+    {
+        if (tracks.size() >= MAX_NUM_TRACKS)
+            return nullptr;
+
+        auto* track = tracks.add(new TrackEngine(captureDispatcher, transport));
+        const int trackNum = tracks.size();
+
+        track->setMasterLoop(tempo, beats);
+        track->setLastRecording(savedLoopDirTree.setFreshWAVInTempLoopDir(DirectoryTree::getTrackWAVName(trackNum)));
+        track->loadAudio();
+
+        if (transport.isRunning())
+            track->start();
+
+        mixer.addSource(track);
+        profiler.addStage(track->playbackStage, "Track " + juce::String(trackNum));
+        profiler.addStage(track->recordingStage, "Track " + juce::String(trackNum) + " rec");
+
+        listeners.call([track, trackNum](Listener& l) { l.trackAdded(*track, trackNum - 1); });
+        return track;
+    }
+
+    void removeLastTrack()
+    {
+        auto* track = tracks.getLast();
+
+        if (track == nullptr)
+            return;
+
+        const int index = tracks.size() - 1;
+        listeners.call([track, index](Listener& l) { l.trackRemoving(*track, index); });
+
+        //the mixer waits until the audio thread has let go of it, so it's safe to delete after this
+        mixer.removeSource(track);
+        profiler.removeStage(track->playbackStage);
+        profiler.removeStage(track->recordingStage);
+
+        savedLoopDirTree.deleteWAVFromTempLoopDir(DirectoryTree::getTrackWAVName(tracks.size()));
+        tracks.removeLast();
+    }
+
+    void setNumTracks(int newNumTracks)
+    {
+        newNumTracks = juce::jlimit(1, MAX_NUM_TRACKS, newNumTracks);
+
+        while (tracks.size() > newNumTracks)
+            removeLastTrack();
+
+        while (tracks.size() < newNumTracks)
+            addTrack();
+    }
+
+    int getNumTracks() const noexcept            { return tracks.size(); }
+    TrackEngine* getTrack(int index) const noexcept { return tracks[index]; }
+
+    //==============================================================================
+    //Every track starts from wherever the transport is
+    void play()
+    {
+        transport.start();
+
+        for (auto* track : tracks)
+            track->start();
+    }
+
+    //Stops the transport and the metronome, and anything being recorded or overdubbed where it's got to
+    void stop()
+    {
+        metronome.stop();
+        transport.stop();
+
+        for (auto* track : tracks)
+        {
+            track->stop();
+            track->setOverdubbing(false);
+            track->setWaitingToRecord(false);
+
+            if (track->isRecording())
+                track->stopRecording();
+        }
+    }
+
+    //Back to the top of the loop, once stopped
+    void rewind()
+    {
+        transport.setPosition(0);
+
+        for (auto* track : tracks)
+            track->setPosition(0);
+
+        //that forgot where a loaded project was going to swap in, so it swaps in here instead
+        if (swappingInProject && swapPointChosen)
+            swapInProjectAt(transport.getBlockStartSample());
+    }
+
+    //True if any tracks are playing
+    bool isPlaying() const
+    {
+        for (auto* track : tracks)
+            if (track->isPlaying())
+                return true;
+
+        return false;
+    }
+
+    //True if any tracks are recording, or waiting to
+    bool isRecording() const
+    {
+        for (auto* track : tracks)
+            if (track->isRecording() || track->isWaitingToRecord())
+                return true;
+
+        return false;
+    }
+
+    //Every track and the metronome follow the same loop - recorded loops get stretched to a new tempo.  Ignored
+    //while a loaded project is swapping in, since its loop is about to take over
+    void setLoopLength(int newTempo, int newBeats)
+    {
+        if (swappingInProject)
+            return;
+
+        tempo = newTempo;
+        beats = newBeats;
+        metronome.setMasterLoop(tempo, beats);
+
+        for (auto* track : tracks)
+            track->setMasterLoop(tempo, beats);
+    }
+
+    int getTempo() const noexcept   { return tempo; }
+    int getBeats() const noexcept   { return beats; }
+
+    void setMetronomeOn(bool shouldBeOn)
+    {
+        if (shouldBeOn)
+            metronome.start();
+        else
+            metronome.stop();
+    }
+
+    bool isMetronomeOn()    { return metronome.getState() == Metronome::Playing; }
+
+    //Monitors every input, rather than just the first one (e.g. once the inputs have been picked in the settings)
+    void setMonitorAllInputs(bool shouldMonitorAll)
+    {
+        monitorAllInputs = shouldMonitorAll;
+    }
+
+    //==============================================================================
+    //Plays bursts out and listens for them coming back through the input, with the output looped back into
+    //it.  Listeners hear the result.  False if it can't start because something is playing
+    bool measureLatency()
+    {
+        //the bursts have to be the only thing coming back through the input
+        if (isPlaying())
+            return false;
+
+        //monitoring the input would feed every burst straight back round again
+        inputAudio.setGain(0.0);
+        latencyCalibrator.start();
+        return true;
+    }
+
+    //==============================================================================
+    //A new, empty project at the current tempo.  Not while a save or load is going
+    void newProject()
+    {
+        if (isBusyWithProject())
+            return;
+
+        //the tracks go silent now, their WAVs go once anything still being written into them is done
+        for (auto* track : tracks)
+        {
+            track->clearAudio();
+            track->initializeState();
+        }
+    }
+
+    //Starts saving the project in the background: what every track is playing right now (or what it was
+    //before the overdub it's in the middle of), with their settings in PROJECT_STATE_XML_FILENAME.  The
+    //project's folder is made if it's new.  False if a save or load is already going
+    bool startSavingProject(const juce::String& projectName)
+    {
+        if (isBusyWithProject())
+            return false;
+
+        auto projectState = std::make_unique<juce::XmlElement>("projectState");
+        projectState->setAttribute("tempo", tempo);
+        projectState->setAttribute("beats", beats);
+        projectState->setAttribute("numTracks", tracks.size());
+
+        std::vector<ProjectIO::TrackAudio> audio;
+
+        for (int i = 0; i < tracks.size(); ++i)
+        {
+            //shares the take's chunks, so nothing is copied here however long the loop is
+            const auto toSave = tracks[i]->getAudioToSave();
+            projectState->addChildElement(tracks[i]->getState(i + 1, toSave).release());
+            audio.push_back({ std::make_unique<LoopTake>(toSave.take), toSave.sampleRate });
+        }
+
+        startProjectRequest(projectIO.save(projectName, savedLoopDirTree.getProjectFolder(projectName),
+                                           std::move(projectState), std::move(audio)));
+        return true;
+    }
+
+    //Starts reading a saved project in the background.  What's playing carries on until it's all been read and
+    //converted, then every track swaps to the project's audio, settings and loop length at the next loop start,
+    //along with the metronome.  False if a save or load is already going
+    bool startLoadingProject(const juce::String& projectName)
+    {
+        if (isBusyWithProject())
+            return false;
+
+        startProjectRequest(projectIO.load(projectName, savedLoopDirTree.getProjectFolder(projectName)));
+        return true;
+    }
+
+    //Gives up on the save or load that's going.  Too late once a loaded project is waiting for the loop start
+    void cancelProjectRequest()
+    {
+        if (projectRequest != nullptr && !swappingInProject)
+            projectRequest->cancel();
+    }
+
+    //A save or load is going, and listeners haven't been told it's finished yet
+    bool isBusyWithProject() const noexcept { return projectRequest != nullptr; }
+
+    juce::StringArray getSavedProjectNames()
+    {
+        return savedLoopDirTree.getLoopFolderNamesArray();
+    }
+
+    DirectoryTree& getDirectoryTree() noexcept              { return savedLoopDirTree; }
+    CaptureDispatcher& getCaptureDispatcher() noexcept      { return captureDispatcher; }
+    CallbackProfiler& getProfiler() noexcept                { return profiler; }
+
+    //The timeline every track and the metronome follow
+    const TransportClock& getTransport() const noexcept     { return transport; }
+
+private:
+    void startProjectRequest(ProjectIO::Request::Ptr request)
+    {
+        projectRequest = request;
+        swappingInProject = false;
+        swapPointChosen = false;
+        startTimer(50);
+    }
+
+    //Follows the save or load along, and swaps a loaded project in once it's been read
+    void timerCallback() override
+    {
+        if (projectRequest == nullptr)
+        {
+            stopTimer();
+            return;
+        }
+
+        if (!projectRequest->isFinished())
+        {
+            listeners.call([this](Listener& l) { l.projectProgress(*projectRequest); });
+            return;
+        }
+
+        if (projectRequest->type == ProjectIO::Request::Type::load && projectRequest->result.wasOk())
+        {
+            if (!swappingInProject)
+            {
+                swappingInProject = true;
+                swapInProject(*projectRequest);
+            }
+
+            if (!hasProjectSwappedIn((int)projectRequest->tracks.size()))
+                return;
+        }
+
+        stopTimer();
+        auto finished = projectRequest;
+        projectRequest = nullptr;
+        swappingInProject = false;
+
+        listeners.call([&finished](Listener& l) { l.projectFinished(*finished); });
+    }
+
+    //Hands every track its audio from the project (tracks it doesn't have go silent, and get removed once it's
+    //swapped in), which gets converted to the project's loop while the old loop plays on.  Nothing here waits
+    //on the disk - the tracks' WAVs catch up once the project has taken over
+    void swapInProject(ProjectIO::Request& loaded)
+    {
+        const auto& projectState = *loaded.state;
+        const int numTracks = (int)loaded.tracks.size();
+        projectTempo = projectState.getIntAttribute("tempo", tempo);
+        projectBeats = projectState.getIntAttribute("beats", beats);
+
+        //DN: the project replaces the audio anything's being recorded into
+        for (auto* track : tracks)
+        {
+            track->setOverdubbing(false);
+            track->setWaitingToRecord(false);
+
+            if (track->isRecording())
+                track->stopRecording();
+        }
+
+        while (tracks.size() < numTracks)
+            addTrack();
+
+        //the temp WAVs get the project's audio written into them once it's taken over
+        for (int i = 0; i < tracks.size(); ++i)
+        {
+            if (i < numTracks)
+                tracks[i]->loadAudioAtLoopStart(std::move(loaded.tracks[(size_t)i].take), loaded.tracks[(size_t)i].sampleRate,
+                                                projectState.getChildByName(DirectoryTree::getTrackWAVName(i + 1)),
+                                                projectTempo, projectBeats);
+            else
+                tracks[i]->loadAudioAtLoopStart(nullptr, 0.0, nullptr, projectTempo, projectBeats);
+        }
+    }
+
+    //Once every track's audio is ready, the swap is scheduled for the next loop start - a little way ahead, so
+    //nothing misses it (or right away if we're stopped).  True once every track has swapped over, and any
+    //extra tracks are gone
+    bool hasProjectSwappedIn(int numTracks)
+    {
+        if (!swapPointChosen)
+        {
+            for (auto* track : tracks)
+                if (!track->isLoadedAudioReady())
+                    return false;
+
+            const auto now = transport.getBlockStartSample();
+            const juce::int64 loopLength = tracks.isEmpty() ? 0 : tracks.getFirst()->getMasterLoopLength();
+            auto swapPoint = now;
+
+            if (transport.isRunning() && loopLength > 0)
+            {
+                const auto margin = (juce::int64)(tracks.getFirst()->getSampleRate() * 0.05);
+                const auto origin = transport.getLoopOriginAt(now);
+                const auto loopsToWait = (now + margin - origin + loopLength - 1) / loopLength;
+                swapPoint = origin + loopsToWait * loopLength;
+            }
+
+            swapInProjectAt(swapPoint);
+        }
+
+        for (auto* track : tracks)
+            if (track->isLoadPending())
+                return false;
+
+        while (tracks.size() > numTracks)
+            removeLastTrack();
+
+        //the engine catches up with the loop that's taken over (as does a track added while it was swapping in)
+        tempo = projectTempo;
+        beats = projectBeats;
+
+        for (auto* track : tracks)
+            track->setMasterLoop(tempo, beats);
+
+        return true;
+    }
+
+    //The loop restarts at the project's length from swapPoint on - the transport first, so every track and the
+    //metronome count from there as they switch over
+    void swapInProjectAt(juce::int64 swapPoint)
+    {
+        transport.scheduleLoopRestart(swapPoint);
+        metronome.setMasterLoopFrom(projectTempo, projectBeats, swapPoint);
+
+        for (auto* track : tracks)
+            track->startLoadedAudioFrom(swapPoint);
+
+        swapPointChosen = true;
+    }
+
+    void changeListenerCallback(juce::ChangeBroadcaster*) override
+    {
+        inputAudio.setGain(1.0);
+
+        const int result = latencyCalibrator.getResult();
+
+        if (result >= 0)
+            captureDispatcher.setMeasuredLatency(result);
+
+        listeners.call([result](Listener& l) { l.latencyMeasured(result); });
+    }
+
+    juce::AudioDeviceManager& deviceManager;
+    juce::ListenerList<Listener> listeners;
+
+    TransportClock transport;  //the timeline the tracks and metronome all follow, declared before them
+    Metronome metronome{ transport };
+    DirectoryTree savedLoopDirTree;
+    int tempo = 120, beats = 8;
+
+    CaptureDispatcher captureDispatcher;  //declared before the tracks so it outlives their recorders
+    juce::OwnedArray<TrackEngine> tracks;
+
+    InputMonitor inputAudio;
+    MixEngine mixer;
+    LatencyCalibrator latencyCalibrator{ captureDispatcher, mixer };
+
+    // Profiling - the parts of the callback that aren't a track's (see CallbackProfiler.h)
+    CallbackProfiler::Stage inputCaptureStage, mixerStage, metronomeStage, inputMonitorStage;
+    CallbackProfiler profiler{ deviceManager };
+
+    //Input capture - sized in prepareToPlay from the device's channel layout, so the callback never allocates or queries the device
+    juce::AudioBuffer<float> inputCaptureBuffer;
+    std::atomic<int> deviceInputChannels{ 0 };
+    std::atomic<bool> monitorAllInputs{ false };
+
+    //Saving and loading projects - the request that's going, and how far a loaded one is with swapping in
+    ProjectIO projectIO;
+    ProjectIO::Request::Ptr projectRequest;
+    bool swappingInProject = false, swapPointChosen = false;
+    int projectTempo = 120, projectBeats = 8;  //a loaded project's loop, until it's taken over
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(LooperEngine)
+};
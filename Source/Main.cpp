@@ -8,6 +8,10 @@
 
 #include <JuceHeader.h>
 #include "MainComponent.h"
+#include "Benchmarks.h"
+#include "CommandLineRenderer.h"
+#include "RealtimeCheck.h"
+#include "SoakTest.h"
 
 //==============================================================================
 class _467AudioLoopStationApplication  : public juce::JUCEApplication
@@ -25,6 +29,38 @@ public:
     {
         // This method is where you should put your application's initialisation code..
 
+        //DN: bouncing saved projects from the command line doesn't need a window (or an audio device)
+        const auto arguments = getCommandLineParameterArray();
+
+        if (CommandLineRenderer::isRenderCommand(arguments))
+        {
+            setApplicationReturnValue(CommandLineRenderer::run(arguments));
+            quit();
+            return;
+        }
+
+        //DN: nor do the benchmarks - they drive the audio classes directly, with made-up audio
+        if (Benchmarks::isBenchmarkCommand(arguments))
+        {
+            setApplicationReturnValue(Benchmarks::run(arguments));
+            quit();
+            return;
+        }
+
+        //DN: checking the audio thread doesn't need a window either - it runs the app on a dummy device until its script is done
+        if (RealtimeCheck::isCheckCommand(arguments))
+        {
+            realtimeCheck.reset(new RealtimeCheck(arguments));
+            return;
+        }
+
+        //DN: or soaking the engine - a whole day's session on the dummy device, on a simulated clock
+        if (SoakTest::isSoakCommand(arguments))
+        {
+            soakTest.reset(new SoakTest(arguments));
+            return;
+        }
+
         mainWindow.reset (new MainWindow (getApplicationName()));
     }
 
@@ -33,6 +69,8 @@ public:
         // Add your application's shutdown code here..
 
         mainWindow = nullptr; // (deletes our window)
+        realtimeCheck = nullptr;
+        soakTest = nullptr;
     }
 
     //==============================================================================
@@ -98,6 +136,8 @@ public:
 
 private:
     std::unique_ptr<MainWindow> mainWindow;
+    std::unique_ptr<RealtimeCheck> realtimeCheck;
+    std::unique_ptr<SoakTest> soakTest;
 };
 
 //==============================================================================
@@ -19,6 +19,26 @@ MainComponent::MainComponent()
                                         false);
     audioSetupComp->setLookAndFeel(&settingsLF);
 
+    //under the device selector: loop the output back into the input, and measure the real round trip
+    settingsContent.addAndMakeVisible(audioSetupComp.get());
+    settingsContent.addAndMakeVisible(&measureLatencyButton);
+    settingsContent.addAndMakeVisible(&latencyLabel);
+    audioSetupComp->setBounds(0, 0, 600, 400);
+    measureLatencyButton.setBounds(10, 405, 160, 30);
+    latencyLabel.setBounds(180, 405, 410, 30);
+    measureLatencyButton.onClick = [this] { measureLatencyButtonClicked(); };
+
+    //and whether to show (or log) how much of each audio callback every stage of it takes up
+    settingsContent.addAndMakeVisible(&showProfilerButton);
+    settingsContent.addAndMakeVisible(&logProfilerButton);
+    showProfilerButton.setBounds(10, 440, 160, 26);
+    logProfilerButton.setBounds(180, 440, 410, 26);
+    showProfilerButton.onClick = [this] { profilerOverlay.setVisible(showProfilerButton.getToggleState()); };
+    logProfilerButton.onClick = [this]
+    {
+        engine.getProfiler().setLogFile(logProfilerButton.getToggleState() ? engine.getDirectoryTree().getProfilerLogFile() : juce::File());
+    };
+
 
     // AF: Initialize state enum
     state = Stopped;
@@ -59,115 +79,28 @@ MainComponent::MainComponent()
     loopLengthButton.setBeatsBox(boxPtr);
 
     // AF: Metronome
-    mixer.addInputSource(&metronome, false);
     addAndMakeVisible(&metronomeButton);
-    metronome.setBpm(tempoBox.getText().getIntValue());
+    updateLoopLength();
     metronomeButton.onClick = [this] { metronomeButtonClicked(); };
 
-    //DN: create tracks 
-    for (int i = 0; i < NUM_TRACKS; ++i)
-    {
-        auto track = new AudioTrack;
-        tracksArray.add(track);
-    }
-
+    //DN: tracks live in a scrolling list, since there can be a lot more of them than fit on screen
+    trackListViewport.setViewedComponent(&trackListContent, false);
+    trackListViewport.setScrollBarsShown(true, false);
+    addAndMakeVisible(&trackListViewport);
 
-    //Initialize all tracks
-    for (auto& track : tracksArray)
+    addAndMakeVisible(&addTrackButton);
+    addTrackButton.onClick = [this]
     {
-        track->setMasterLoop(tempoBox.getText().getIntValue(), beatsBox.getText().getIntValue());
-        addAndMakeVisible(track->panSlider);
-
-        addAndMakeVisible(track->gainSlider);
-        track->gainSlider.setNumDecimalPlacesToDisplay(2);
+        //DN: it joins in with the other tracks if we're already playing (it follows the same transport, so it's already in sync)
+        if (engine.addTrack() != nullptr)
+            unsavedChanges = true;
+    };
 
-        //DN: set up reverse icon
-        std::unique_ptr<juce::XmlElement> reverse_svg_xml(juce::XmlDocument::parse(BinaryData::fadrepeat_svg)); // GET THE SVG AS A XML
-        track->reverseSVG = juce::Drawable::createFromSVG(*reverse_svg_xml.get()); // GET THIS AS DRAWABLE
-        track->reverseButton.setImages(track->reverseSVG.get());
+    //DN: the engine starts out with its default tracks, already set up with fresh WAVs - they just need their controls
+    engine.addListener(this);
 
-        addAndMakeVisible(track->reverseButton);
-        addAndMakeVisible(track->recordButton);
-        track->recordButton.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
-        track->addChangeListener(this);
-        addAndMakeVisible(*track);
-        mixer.addInputSource(track, false);
-
-        deviceManager.addAudioCallback(track);
-
-        //callback lambda for each track's record button
-        track->recordButton.onClick = [this, &track]
-        {
-            tempoBox.setReadOnly(true);
-            tempoBox.setEnabled(false);
-            tempoBox.setColour(juce::TextEditor::textColourId, SECONDARY_DRAW_COLOR);
-            auto text = tempoBox.getText();
-            tempoBox.clear();
-            tempoBox.setText(text);
-            tempoBoxLabel.setColour(juce::Label::textColourId, SECONDARY_DRAW_COLOR);
-
-            if (track->isRecording())
-            {
-                track->stopRecording();
-
-                // AF: Enable other track "Record" buttons
-                for (auto& otherTrack : tracksArray)
-                {
-                    if (&otherTrack != &track)
-                        otherTrack->recordButton.setEnabled(true);
-                }               
-
-                track->setDisplayFullThumbnail(true);
-            }
-            else
-            {
-                // AF: Begin playback when user clicks record if it's not already playing
-                if (state == Stopped)
-                {
-                    changeState(Starting);
-                }
-
-                //DN: this prevents the exception that happens if you don't have any audio card set up
-                if (deviceManager.getCurrentAudioDevice())
-                {
-                    if (!juce::RuntimePermissions::isGranted(juce::RuntimePermissions::writeExternalStorage))
-                    {
-                        SafePointer<MainComponent> safeThis(this);
-
-                        juce::RuntimePermissions::request(juce::RuntimePermissions::writeExternalStorage,
-                            [safeThis, &track](bool granted) mutable
-                            {
-                                if (granted)
-                                {
-                                    for (auto& i : safeThis->tracksArray)
-                                    {
-                                        if (&i != &track)
-                                            i->startRecording();
-                                    }
-                                }
-                            });
-                        return;
-                    }
-
-                    //AF: Make other record buttons disabled
-                    for (auto& otherTrack : tracksArray)
-                    {
-                        if (&otherTrack != &track)
-                            otherTrack->recordButton.setEnabled(false);
-                    }
-                    
-                    track->setWaitingToRecord(true);
-                    unsavedChanges = true; //if we record something we want to make sure to warn them to save it when switching projects
-                }
-            }
-        };
-    }
-
-    //DN: Set up default directory loop wav files and feed them to Audio track objects
-    initializeTempWAVs();
-    redrawAndBufferAudio();
-
-    mixer.addInputSource(&inputAudio, false);
+    for (int i = 0; i < engine.getNumTracks(); ++i)
+        trackAdded(*engine.getTrack(i), i);
 
     addAndMakeVisible(&appTitle);
     appTitle.setJustificationType(juce::Justification::centred);
@@ -232,13 +165,18 @@ MainComponent::MainComponent()
 
     //DN:  set up the dropdown that lets you load previously saved projects
     //DN: set first item index offset to 1, 0 will be when no project is selected
-    savedLoopsDropdown.addItemList(savedLoopDirTree.getLoopFolderNamesArray(),1); 
+    savedLoopsDropdown.addItemList(engine.getSavedProjectNames(),1); 
     savedLoopsDropdown.setJustificationType(juce::Justification::centred);
 
     savedLoopsDropdown.setTextWhenNothingSelected("  NO PROJECT LOADED");
     savedLoopsDropdown.setTextWhenNoChoicesAvailable("NO PROJECTS FOUND");
     savedLoopsDropdown.onChange = [this] { savedLoopSelected();  };
 
+    //DN: saving and loading show their progress over the dropdown, with a way to cancel
+    addChildComponent(&projectProgressBar);
+    addChildComponent(&cancelProjectButton);
+    cancelProjectButton.onClick = [this] { engine.cancelProjectRequest(); };
+
 
     // Some platforms require permissions to open input channels so request that here
     if (juce::RuntimePermissions::isRequired (juce::RuntimePermissions::recordAudio)
@@ -269,6 +207,9 @@ MainComponent::MainComponent()
     saveProjectDialog.addButton("Cancel", 0);
     saveProjectDialog.addButton("Save", 1);
 
+    //on top of everything else, until it's turned on in settings
+    addChildComponent(&profilerOverlay);
+
     // Make sure you set the size of the component after
     // you add any child components.
     setSize(960, 700);
@@ -277,6 +218,7 @@ MainComponent::MainComponent()
 MainComponent::~MainComponent()
 {
     deviceManager.removeChangeListener(this);
+    engine.removeListener(this);
     setLookAndFeel(nullptr);
     unsavedProgressWarning.setLookAndFeel(nullptr);
     saveProjectDialog.setLookAndFeel(nullptr);
@@ -286,63 +228,104 @@ MainComponent::~MainComponent()
 }
 
 //==============================================================================
-void MainComponent::prepareToPlay (int samplesPerBlockExpected, double sampleRate)
+void MainComponent::trackAdded(TrackEngine& trackEngine, int index)
 {
-    mixer.prepareToPlay(samplesPerBlockExpected, sampleRate);
-}
+    auto* track = tracksArray.insert(index, new AudioTrack(trackEngine));
+
+    trackListContent.addAndMakeVisible(track->panSlider);
+
+    trackListContent.addAndMakeVisible(track->gainSlider);
+    track->gainSlider.setNumDecimalPlacesToDisplay(2);
+
+    //DN: set up reverse icon
+    std::unique_ptr<juce::XmlElement> reverse_svg_xml(juce::XmlDocument::parse(BinaryData::fadrepeat_svg)); // GET THE SVG AS A XML
+    track->reverseSVG = juce::Drawable::createFromSVG(*reverse_svg_xml.get()); // GET THIS AS DRAWABLE
+    track->reverseButton.setImages(track->reverseSVG.get());
+
+    trackListContent.addAndMakeVisible(track->reverseButton);
+    trackListContent.addAndMakeVisible(track->overdubButton);
+    trackListContent.addAndMakeVisible(track->undoButton);
+    trackListContent.addAndMakeVisible(track->redoButton);
+    track->overdubButton.onClick = [this] { unsavedChanges = true; };
+    track->undoButton.onClick = [this] { unsavedChanges = true; };
+    track->redoButton.onClick = [this] { unsavedChanges = true; };
+    trackListContent.addAndMakeVisible(track->recordButton);
+    track->recordButton.setColour(juce::TextButton::textColourOnId, juce::Colours::black);
+    trackListContent.addAndMakeVisible(track->inputSelector);
+    track->updateInputChoices(engine.getCaptureDispatcher().getNumInputChannels());
+    track->addChangeListener(this);
+    trackListContent.addAndMakeVisible(*track);
+
+    //callback lambda for each track's record button
+    //(captures the track pointer, not a reference into tracksArray, since the array can reallocate as tracks are added)
+    track->recordButton.onClick = [this, track]
+    {
+        //(the tempo stays editable, recorded loops get stretched to follow it)
+        if (track->getEngine().isRecording())
+        {
+            track->getEngine().stopRecording();
+            track->setDisplayFullThumbnail(true);
+        }
+        else
+        {
+            // AF: Begin playback when user clicks record if it's not already playing
+            if (state == Stopped)
+            {
+                changeState(Starting);
+            }
 
-void MainComponent::getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill)
-{
-    auto* device = deviceManager.getCurrentAudioDevice();
-    auto activeInputChannels = device->getActiveInputChannels();
-    auto activeOutputChannels = device->getActiveOutputChannels();
-    auto maxInputChannels = activeInputChannels.countNumberOfSetBits();
+            //DN: this prevents the exception that happens if you don't have any audio card set up
+            if (deviceManager.getCurrentAudioDevice())
+            {
+                if (!juce::RuntimePermissions::isGranted(juce::RuntimePermissions::writeExternalStorage))
+                {
+                    SafePointer<MainComponent> safeThis(this);
+
+                    juce::RuntimePermissions::request(juce::RuntimePermissions::writeExternalStorage,
+                        [safeThis, track](bool granted) mutable
+                        {
+                            if (granted && safeThis != nullptr)
+                                track->getEngine().setWaitingToRecord(true);
+                        });
+                    return;
+                }
 
-    //DN: force input to be 1 channel only initially
-    if (!settingsHaveBeenOpened && maxInputChannels > 1)
-        maxInputChannels = 1;
-        
-    auto maxOutputChannels = activeOutputChannels.countNumberOfSetBits();
-    auto test = device->getInputChannelNames();
-
-    auto sourceBuffer = std::make_unique<juce::AudioBuffer<float>>(maxInputChannels, bufferToFill.numSamples);
-
-    /// DN: This code grabs the audio input, puts it in a buffer, and sends that to an AudioSource class
-    //  which can be added to or removed from our main mixer
-  
-     //DN: if input is mono, this will write the same data twice, but that's ok
-     // we need to account for the outputChannels in case it's set to mono or nothing
-    //even though we're not writing to the output buffer here
-    if (maxInputChannels == 0)
-    {
-        for (auto channel = 0; channel < maxOutputChannels; ++channel)
-            bufferToFill.buffer->clear(channel, bufferToFill.startSample, bufferToFill.numSamples);
+                //(other tracks can be recording too - each one takes its own inputs, in the same pass)
+                track->getEngine().setWaitingToRecord(true);
+                unsavedChanges = true; //if we record something we want to make sure to warn them to save it when switching projects
+            }
+        }
+    };
 
-        sourceBuffer->clear();
-    }
-    for (auto channel = 0; channel < maxInputChannels; ++channel)
-    {
-        //DN: get the input and fill that channel of our source buffer
-        auto* reader = bufferToFill.buffer->getReadPointer(channel,
-            bufferToFill.startSample);
+    resized();
+}
 
-        auto* writer = sourceBuffer->getWritePointer(channel, bufferToFill.startSample);
+void MainComponent::trackRemoving(TrackEngine&, int index)
+{
+    auto* track = tracksArray[index];
 
-        for (auto sample = 0; sample < bufferToFill.numSamples; ++sample)
-            writer[sample] = reader[sample];
+    if (track == nullptr)
+        return;
 
-    }
+    track->removeChangeListener(this);
+    tracksArray.remove(index);
+    resized();
+}
 
-    //send filled buffer to the AudioSource
-    inputAudio.setBuffer(sourceBuffer.release());
+//==============================================================================
+void MainComponent::prepareToPlay (int samplesPerBlockExpected, double sampleRate)
+{
+    engine.prepareToPlay(samplesPerBlockExpected, sampleRate);
+}
 
-    //DN: This gets the audio from everything that's been added to the mixer and sends it to the output
-    mixer.getNextAudioBlock(bufferToFill);
+void MainComponent::getNextAudioBlock (const juce::AudioSourceChannelInfo& bufferToFill)
+{
+    engine.getNextAudioBlock(bufferToFill);
 }
 
 void MainComponent::releaseResources()
 {
-    mixer.releaseResources();
+    engine.releaseResources();
 }
 
 //==============================================================================
@@ -373,7 +356,10 @@ void MainComponent::resized()
     playButton.setBounds(transportButtonArea.reduced(0, headerHeight*0.22f));
 
 
-    savedLoopsDropdown.setBounds(headerArea.removeFromRight(350).reduced(8,headerHeight*0.33f));
+    auto projectArea = headerArea.removeFromRight(350).reduced(8,headerHeight*0.33f);
+    savedLoopsDropdown.setBounds(projectArea);
+    cancelProjectButton.setBounds(projectArea.removeFromRight(80));
+    projectProgressBar.setBounds(projectArea.withTrimmedRight(5));
     int saveClearButtonsWidth = 55;
 
     auto saveButtonArea = headerArea.removeFromRight(saveClearButtonsWidth).reduced(5, headerHeight * 0.35f);
@@ -391,27 +377,60 @@ void MainComponent::resized()
     rect.expand(mainFullOuterBorder,mainFullOuterBorder);
     auto loopControllerRow = rect.removeFromTop(25);
     loopLengthButton.setBounds(loopControllerRow.removeFromRight(46));
+    addTrackButton.setBounds(loopControllerRow.removeFromLeft(leftColumnWidth).reduced(mainFullOuterBorder, 0));
 
     rect.reduce(mainFullOuterBorder,mainFullOuterBorder);
-    for (auto& track : tracksArray)
+    trackListViewport.setBounds(rect);
+
+    //DN: the track list scrolls, so lay the tracks out in its own coordinates, 120px a track
+    const int trackHeight = 120;
+    trackListContent.setSize(juce::jmax(0, rect.getWidth() - trackListViewport.getScrollBarThickness()), trackHeight * tracksArray.size());
+    rect = trackListContent.getLocalBounds();
+    for (auto* track : tracksArray)
     {
-        auto trackArea = rect.removeFromTop(120);
+        auto trackArea = rect.removeFromTop(trackHeight);
         auto trackControlsL = trackArea.removeFromLeft(200);
-        track->recordButton.setBounds(trackControlsL.removeFromLeft(80).reduced(8));
+        auto recordColumn = trackControlsL.removeFromLeft(80);
+        track->inputSelector.setBounds(recordColumn.removeFromBottom(26).reduced(8, 2));
+        track->recordButton.setBounds(recordColumn.reduced(8));
         track->panSlider.setBounds(trackControlsL.removeFromLeft(60));
         track->gainSlider.setBounds(trackControlsL.removeFromLeft(60).reduced(15,0));
         auto trackControlsR = trackArea.removeFromLeft(leftColumnWidth-200);
-        trackControlsR.reduce(0, 42);
-        track->reverseButton.setBounds(trackControlsR);
+        trackControlsR.reduce(0, 8);
+        track->reverseButton.setBounds(trackControlsR.removeFromTop(26));
+        track->overdubButton.setBounds(trackControlsR.removeFromTop(26).reduced(4, 2));
+        track->undoButton.setBounds(trackControlsR.removeFromTop(26).reduced(4, 2));
+        track->redoButton.setBounds(trackControlsR.removeFromTop(26).reduced(4, 2));
         track->setBounds(trackArea);
     }
+
+    profilerOverlay.setBounds(getWidth() - 440, 60, 420, profilerOverlay.getIdealHeight());
 }
 
 
 // AF: ========================= Audio Playing Declarations ================================
 
+void MainComponent::latencyMeasured(int result)
+{
+    measureLatencyButton.setEnabled(true);
+
+    if (result >= 0)
+        updateLatencyLabel();
+    else
+        latencyLabel.setText("No clear echo - is the output looped back into the input?", juce::dontSendNotification);
+}
+
 void MainComponent::changeListenerCallback(juce::ChangeBroadcaster* source)
 {
+    //new device settings throw away a measurement made with the old ones, and may have different inputs
+    if (source == &deviceManager)
+    {
+        updateLatencyLabel();
+
+        for (auto* track : tracksArray)
+            track->updateInputChoices(engine.getCaptureDispatcher().getNumInputChannels());
+    }
+
     for (auto& track : tracksArray)
     {
         if (source == track)
@@ -419,17 +438,17 @@ void MainComponent::changeListenerCallback(juce::ChangeBroadcaster* source)
             //DN:  we need this to handle things if recording is cut off automatically
             //DN: this will also be hit whenever any of the track controls are clicked on
             //DN: and when you initially hit the play button, so be careful what is added here
-            if (!trackCurrentlyRecording())
+            //(only the tracks that are done - others may still be recording in this pass)
+            for (auto& i : tracksArray)
             {
-                for (auto& i : tracksArray)
+                if (!i->getEngine().isRecording() && !i->getEngine().isWaitingToRecord())
                 {
                     i->setDisplayFullThumbnail(true);
-                    i->recordButton.setEnabled(true);
                     i->setShouldLightUp(false);
                 }
             }
 
-            if (track->isPlaying())
+            if (track->getEngine().isPlaying())
                 changeState(Playing);
             else
                 changeState(Stopped);
@@ -445,17 +464,45 @@ void MainComponent::playButtonClicked()
 
 void MainComponent::stopButtonClicked()
 {
+    // AF: Stop tracks (and anything recording) if stop button is clicked
     changeState(Stopping);
+}
 
-    // AF: Stop tracks if stop button is clicked
-    for (auto& track : tracksArray)
-    {
-        track->setWaitingToRecord(false);
-        if (track->isRecording())
-        {
-            track->stopRecording();
-        }
-    }
+void MainComponent::clickPlay()        { playButton.triggerClick(); }
+void MainComponent::clickStop()        { stopButton.triggerClick(); }
+void MainComponent::clickMetronome()   { metronomeButton.triggerClick(); }
+void MainComponent::clickAddTrack()    { addTrackButton.triggerClick(); }
+
+void MainComponent::clickRecord(int trackIndex)
+{
+    if (auto* track = tracksArray[trackIndex])
+        track->recordButton.triggerClick();
+}
+
+void MainComponent::clickOverdub(int trackIndex)
+{
+    if (auto* track = tracksArray[trackIndex])
+        track->overdubButton.triggerClick();
+}
+
+void MainComponent::clickReverse(int trackIndex)
+{
+    if (auto* track = tracksArray[trackIndex])
+        track->reverseButton.triggerClick();
+}
+
+void MainComponent::clickUndo(int trackIndex)
+{
+    if (auto* track = tracksArray[trackIndex])
+        track->undoButton.triggerClick();
+}
+
+//the same as typing them in
+void MainComponent::setLoopLength(int tempo, int beats)
+{
+    tempoBox.setText(juce::String(tempo), false);
+    beatsBox.setText(juce::String(beats), false);
+    textEditorReturnKeyPressed(tempoBox);
 }
 
 // AF: ========================= Save/Load Declarations ================================
@@ -463,6 +510,9 @@ void MainComponent::stopButtonClicked()
 
 void MainComponent::saveButtonClicked()
 {
+    if (engine.isBusyWithProject())
+        return;
+
     juce::String newFolderName;
     bool isNewProject = savedLoopsDropdown.getSelectedId() == 0;
 
@@ -481,7 +531,6 @@ void MainComponent::saveButtonClicked()
                 result = saveProjectDialog.runModalLoop();
                 newFolderName = saveProjectDialog.getTextEditorContents("newProjectName");
             }
-            savedLoopDirTree.saveWAVsTo(newFolderName);
         }
         else
         {
@@ -498,52 +547,18 @@ void MainComponent::saveButtonClicked()
     else
     {
         unsavedChanges = false;
-        newFolderName = savedLoopsDropdown.getText();
-        savedLoopDirTree.saveWAVsTo(newFolderName);  //DN: save loop to project folder selected in dropdown
+        newFolderName = savedLoopsDropdown.getText();  //DN: save loop to project folder selected in dropdown
     }
 
-    //DN: now we refresh the dropdown list with the current folders
-    //and find the folder we just saved To, then make it the current selection
-    juce::StringArray folderNames = savedLoopDirTree.getLoopFolderNamesArray();
-    savedLoopsDropdown.clear(juce::dontSendNotification);
-    savedLoopsDropdown.addItemList(folderNames,1); //DN: set first item index offset to 1, 0 will be when no project is selected
-    for (int i = 0; i < folderNames.size(); ++i)
-    {
-        if (folderNames[i] == newFolderName)
-        {
-            //account for dropdown index offset, don't trigger savedLoopSelected
-            savedLoopsDropdown.setSelectedId(i + 1, juce::dontSendNotification); 
-            currentProjectListID = i+1;
-        }
-            
-    }
-
-    //DN: save the track states to an xml file in the project folder
-    // create an outer node
-    juce::XmlElement projectState("projectState");
-    projectState.setAttribute("tempo", tempoBox.getText().getIntValue());
-    projectState.setAttribute("beats", beatsBox.getText().getIntValue());
-
-    for (int i = 0; i < NUM_TRACKS; ++i)
-    {
-        projectState.addChildElement(tracksArray[i]->getTrackState(i+1));
-    }
-
-    //write it to a file in this project's folder
-    juce::File destFile = savedLoopDirTree.getProjectFolder(newFolderName).getChildFile(PROJECT_STATE_XML_FILENAME);
-    
-    projectState.writeTo(destFile);
-
-
-    //Need feedback if you hit save on an existing project
-    if (!isNewProject)
-    {
-        juce::AlertWindow savedNotification("Project Saved!", "", juce::AlertWindow::NoIcon);
-        savedNotification.setLookAndFeel(&customLookAndFeel);
-        savedNotification.addButton("OK", 1);
-        savedNotification.runModalLoop();
-    }
+    //DN: the WAVs and the track states get written in the background while the loop plays on,
+    //the dropdown catches up in projectFinished once they're on disk
+    if (!engine.startSavingProject(newFolderName))
+        return;
 
+    savingNewProject = isNewProject;
+    projectIOProgress = 0.0;
+    projectProgressBar.setTextToDisplay("SAVING...");
+    updateProjectControls();
 }
 
 void MainComponent::initializeButtonClicked()
@@ -561,8 +576,7 @@ void MainComponent::initializeButtonClicked()
 
     savedLoopsDropdown.setSelectedId(0,juce::dontSendNotification);
     currentProjectListID = 0;
-    initializeTempWAVs();
-    redrawAndBufferAudio();
+    engine.newProject();
     tempoBox.setReadOnly(false);
     tempoBox.setEnabled(true);
     tempoBox.setColour(juce::TextEditor::textColourId, MAIN_DRAW_COLOR);
@@ -572,23 +586,21 @@ void MainComponent::initializeButtonClicked()
     tempoBoxLabel.setColour(juce::Label::textColourId, MAIN_DRAW_COLOR);
     for (auto& track : tracksArray)
     {
-        track->initializeTrackState();
+        track->syncWithEngine();
     }
     unsavedChanges = false;
 }
 
 void MainComponent::settingsButtonClicked()
 {
-    settingsHaveBeenOpened = true;
-    for (auto& track : tracksArray)
-    {
+    //DN: only monitor 1 channel until the user has picked their inputs in settings
+    engine.setMonitorAllInputs(true);
 
-        track->setSettingsHaveBeenOpened(true);
-    }
     //DN: set up settings window
-    settingsWindow.content.setNonOwned(audioSetupComp.get());
+    updateLatencyLabel();
+    settingsWindow.content.setNonOwned(&settingsContent);
 
-    settingsWindow.content->setSize(600, 400);
+    settingsWindow.content->setSize(600, 476);
     settingsWindow.content->setColour(juce::ComboBox::backgroundColourId, MAIN_BACKGROUND_COLOR);
     settingsWindow.content->setColour(juce::ComboBox::outlineColourId, MAIN_DRAW_COLOR);
     settingsWindow.content->setColour(juce::ComboBox::textColourId, MAIN_DRAW_COLOR);
@@ -601,6 +613,33 @@ void MainComponent::settingsButtonClicked()
     settingsWindow.runModal();
 }
 
+void MainComponent::measureLatencyButtonClicked()
+{
+    //the bursts have to be the only thing coming back through the input
+    if (state != Stopped || !engine.measureLatency())
+    {
+        latencyLabel.setText("Stop playback first", juce::dontSendNotification);
+        return;
+    }
+
+    measureLatencyButton.setEnabled(false);
+    latencyLabel.setText("Measuring...", juce::dontSendNotification);
+}
+
+void MainComponent::updateLatencyLabel()
+{
+    auto& captureDispatcher = engine.getCaptureDispatcher();
+    const int latency = captureDispatcher.getRoundTripLatency();
+    const double sampleRate = captureDispatcher.getSampleRate();
+    juce::String text = "Round trip latency: " + juce::String(latency) + " samples";
+
+    if (sampleRate > 0.0)
+        text << " (" << juce::String(latency * 1000.0 / sampleRate, 1) << " ms)";
+
+    text << (captureDispatcher.hasMeasuredLatency() ? ", measured" : ", as reported by the device");
+    latencyLabel.setText(text, juce::dontSendNotification);
+}
+
 void MainComponent::savedLoopSelected()
 {
     //creates a warning here that will reset the dropdown and abort this function if they hit Cancel
@@ -616,99 +655,123 @@ void MainComponent::savedLoopSelected()
     }
     
 
-    //if they hit ok, then go ahead and load the selection
-    juce::String savedLoopFolderName = savedLoopsDropdown.getText();
-
-    bool test = savedLoopDirTree.loadWAVsFrom(savedLoopFolderName);
-
-    //DN: only try to read files if copying them was successfull
-    if (test)
+    //if they hit ok, then go ahead and load the selection - it's read in the background, and swaps in
+    //at the top of the loop once it's all there (see projectFinished)
+    if (!engine.startLoadingProject(savedLoopsDropdown.getText()))
     {
-        refreshAudioReferences();
-        redrawAndBufferAudio();
+        savedLoopsDropdown.setSelectedId(currentProjectListID, juce::dontSendNotification);
+        return;
     }
 
-    //load xml from project folder
-    auto projectFolder = savedLoopDirTree.getProjectFolder(savedLoopFolderName);
-    juce::XmlDocument projectStateDoc(juce::File(projectFolder.getChildFile(PROJECT_STATE_XML_FILENAME)));
-
+    projectListIDBeingLoaded = savedLoopsDropdown.getSelectedId();
+    projectIOProgress = 0.0;
+    projectProgressBar.setTextToDisplay("LOADING...");
+    updateProjectControls();
+}
 
-    //DN: can only try to acces the result of this if the file exists
-    if (auto projectState = projectStateDoc.getDocumentElement())
-    {
-        //DN: restore global project settings
-        tempoBox.setText(juce::String(projectState->getIntAttribute("tempo")));
-        beatsBox.setText(juce::String(projectState->getIntAttribute("beats")));
+void MainComponent::projectProgress(const ProjectIO::Request& request)
+{
+    projectIOProgress = request.getProgress();
+}
 
+void MainComponent::projectFinished(const ProjectIO::Request& request)
+{
+    projectIOProgress = 1.0;
 
-        //iterate through xml and restore the state of each track
-        for (int i = 0; i < NUM_TRACKS; ++i)
+    if (request.type == ProjectIO::Request::Type::save)
+    {
+        if (request.result.wasOk())
         {
-            forEachXmlChildElement(*projectState, trackState)
+            //DN: now we refresh the dropdown list with the current folders
+            //and find the folder we just saved To, then make it the current selection
+            juce::StringArray folderNames = engine.getSavedProjectNames();
+            savedLoopsDropdown.clear(juce::dontSendNotification);
+            savedLoopsDropdown.addItemList(folderNames,1); //DN: set first item index offset to 1, 0 will be when no project is selected
+            for (int i = 0; i < folderNames.size(); ++i)
             {
-                juce::String trackName = TRACK_FILENAME + juce::String(i + 1);
-                if (trackState->hasTagName(trackName))
-                    tracksArray[i]->restoreTrackState(trackState);
+                if (folderNames[i] == request.projectName)
+                {
+                    //account for dropdown index offset, don't trigger savedLoopSelected
+                    savedLoopsDropdown.setSelectedId(i + 1, juce::dontSendNotification);
+                    currentProjectListID = i+1;
+                }
             }
 
-            tracksArray[i]->setMasterLoop(tempoBox.getText().getIntValue(), beatsBox.getText().getIntValue());
+            //Need feedback if you hit save on an existing project
+            if (!savingNewProject)
+                showProjectNotice("Project Saved!", "", juce::AlertWindow::NoIcon);
         }
-    }
+        else
+        {
+            unsavedChanges = true;
 
-    currentProjectListID = savedLoopsDropdown.getSelectedId();
-    unsavedChanges = false;
+            if (!request.wasCancelled())
+                showProjectNotice("Couldn't Save Project", request.result.getErrorMessage(), juce::AlertWindow::WarningIcon);
+        }
+    }
+    else if (request.result.wasOk())
+    {
+        //DN: the loop length and the track controls come from the project
+        tempoBox.setText(juce::String(engine.getTempo()));
+        beatsBox.setText(juce::String(engine.getBeats()));
 
-    tempoBox.setEnabled(false);
-    tempoBox.setColour(juce::TextEditor::textColourId, SECONDARY_DRAW_COLOR);
-    auto text = tempoBox.getText();
-    tempoBox.clear();
-    tempoBox.setText(text);
-    tempoBoxLabel.setEnabled(false);
-}
+        for (auto* track : tracksArray)
+            track->syncWithEngine();
 
-void MainComponent::initializeTempWAVs()
-{
-    for (int i = 0; i < NUM_TRACKS; ++i)
+        currentProjectListID = projectListIDBeingLoaded;
+        unsavedChanges = false;
+    }
+    else
     {
-        juce::String fileName = TRACK_FILENAME + juce::String(i + 1);
-        auto trackFile = savedLoopDirTree.setFreshWAVInTempLoopDir(fileName);
-        tracksArray[i]->setLastRecording(trackFile);
+        //DN: nothing changed, so the dropdown goes back to the project that's still loaded
+        savedLoopsDropdown.setSelectedId(currentProjectListID, juce::dontSendNotification);
+
+        if (!request.wasCancelled())
+            showProjectNotice("Couldn't Load Project", request.result.getErrorMessage(), juce::AlertWindow::WarningIcon);
     }
+
+    updateProjectControls();
 }
 
-void MainComponent::refreshAudioReferences()
+void MainComponent::updateProjectControls()
 {
-    for (int i = 0; i < NUM_TRACKS; ++i)
-    {
-        juce::String fileName = TRACK_FILENAME + juce::String(i + 1);
-        auto trackFile = savedLoopDirTree.getOrCreateWAVInTempLoopDir(fileName);
-        tracksArray[i]->setLastRecording(trackFile);
-    }
+    //DN: projects save and load while the loop plays on, but one at a time - and starting a new
+    //project still waits until we've stopped
+    const bool busy = engine.isBusyWithProject();
+    const bool canStartNewProject = !busy && state == Stopped;
+
+    projectProgressBar.setVisible(busy);
+    cancelProjectButton.setVisible(busy);
+    savedLoopsDropdown.setVisible(!busy);
+    saveButton.setEnabled(!busy);
+
+    initializeButton.setEnabled(canStartNewProject);
+    initializeButton.setOutline(canStartNewProject ? MAIN_DRAW_COLOR : SECONDARY_DRAW_COLOR, NEW_FILE_LINE_THICKNESS);
+    plusIcon.setEnabled(canStartNewProject);
 }
 
-//DN:  call after refreshAudioReferences to load the audio into memory and redraw waveforms
-void MainComponent::redrawAndBufferAudio()
+//Doesn't wait for OK, so it can't hold anything up (it deletes itself once it's dismissed)
+void MainComponent::showProjectNotice(const juce::String& title, const juce::String& message, juce::AlertWindow::AlertIconType icon)
 {
-    for (auto& track : tracksArray)
-    {
-        track->redrawAndBufferAudio();
-    }
-
+    auto* notice = new juce::AlertWindow(title, message, icon);
+    notice->setLookAndFeel(&customLookAndFeel);
+    notice->addButton("OK", 1, juce::KeyPress(juce::KeyPress::returnKey));
+    notice->enterModalState(true, nullptr, true);
 }
 
 // =============================== MISC ============================================
 
 void MainComponent::metronomeButtonClicked()
 {
-    if (metronome.getState() == Metronome::Stopped)
+    if (!engine.isMetronomeOn())
     {
-        metronome.start();
+        engine.setMetronomeOn(true);
         metronomeSVG->replaceColour(MAIN_DRAW_COLOR, METRONOME_ON_COLOR);
         metronomeButton.setImages(metronomeSVG.get());
     }
-    else if (metronome.getState() == Metronome::Playing)
+    else
     {
-        metronome.stop();
+        engine.setMetronomeOn(false);
         metronomeSVG->replaceColour(METRONOME_ON_COLOR, MAIN_DRAW_COLOR);
         metronomeButton.setImages(metronomeSVG.get());
     }
@@ -725,7 +788,7 @@ bool MainComponent::keyPressed(const juce::KeyPress& key, juce::Component* origi
     }
     else if (key == juce::KeyPress::spaceKey)
     {
-        if (trackCurrentlyPlaying())
+        if (engine.isPlaying())
             stopButtonClicked();
         else
             playButtonClicked();
@@ -734,26 +797,6 @@ bool MainComponent::keyPressed(const juce::KeyPress& key, juce::Component* origi
     return true;
 }
 
-bool MainComponent::trackCurrentlyPlaying()
-{
-    for (auto& track : tracksArray)
-    {
-        if (track->isPlaying())
-            return true;
-    }
-    return false;
-}
-
-bool MainComponent::trackCurrentlyRecording()
-{
-    for (auto& track : tracksArray)
-    {
-        if (track->isRecording() || track->isWaitingToRecord())
-            return true;
-    }
-    return false;
-}
-
 void MainComponent::changeState(TransportState newState)
 {
     if (state != newState)
@@ -767,34 +810,17 @@ void MainComponent::changeState(TransportState newState)
             loopLengthButton.setEnabled(true);
             stopButton.setEnabled(false);
             playButton.setEnabled(true);
-            savedLoopsDropdown.setEnabled(true);
-            savedLoopsDropdown.setColour(juce::ComboBox::outlineColourId, MAIN_DRAW_COLOR);
-            saveButton.setEnabled(true);
-            initializeButton.setEnabled(true);
-            initializeButton.setOutline(MAIN_DRAW_COLOR, NEW_FILE_LINE_THICKNESS);
-            plusIcon.setEnabled(true);
-            for (auto& track : tracksArray)
-            {
-                track->setPosition(0);
-            }
+            updateProjectControls();
+            engine.rewind();
             break;
 
         case Starting: 
-            metronome.reset();
+            engine.play();
             settingsButton.setEnabled(false);
             loopLengthButton.setEnabled(false);
             playButton.setEnabled(false);
             playButton.setOutline(juce::Colours::limegreen, PLAY_STOP_LINE_THICKNESS);
-            savedLoopsDropdown.setEnabled(false);
-            savedLoopsDropdown.setColour(juce::ComboBox::outlineColourId, SECONDARY_DRAW_COLOR);
-            saveButton.setEnabled(false);
-            initializeButton.setEnabled(false);
-            initializeButton.setOutline(SECONDARY_DRAW_COLOR, NEW_FILE_LINE_THICKNESS);
-            plusIcon.setEnabled(false);
-            for (auto& track : tracksArray)
-            {
-                track->start();
-            }
+            updateProjectControls();  //saving and loading carry on being allowed while we play
             break;
 
         case Playing:                           
@@ -803,33 +829,35 @@ void MainComponent::changeState(TransportState newState)
 
         case Stopping:
             playButton.setOutline(MAIN_DRAW_COLOR, PLAY_STOP_LINE_THICKNESS);
-            metronome.stop();
+            engine.stop();  //the metronome too, and anything that's recording
             metronomeSVG->replaceColour(METRONOME_ON_COLOR, MAIN_DRAW_COLOR);
             metronomeButton.setImages(metronomeSVG.get());
-            for (auto& track : tracksArray)
-            {
-                track->stop();
-            }
             break;
 
         }
     }
 }
 
+//The engine follows whatever's in the tempo and beats boxes
+void MainComponent::updateLoopLength()
+{
+    engine.setLoopLength(tempoBox.getText().getIntValue(), beatsBox.getText().getIntValue());
+
+    for (auto& track : tracksArray)
+        track->repaint();
+}
+
 // AF: Text Box Listeners
 void MainComponent::textEditorReturnKeyPressed(juce::TextEditor &textEditor)
 {
     if (&textEditor == &tempoBox)
     {
-        metronome.setBpm(textEditor.getText().getIntValue());
-        for (auto& track : tracksArray)
-            track->setMasterLoop(tempoBox.getText().getIntValue(), beatsBox.getText().getIntValue());
+        updateLoopLength();
     }
 
     if (&textEditor == &beatsBox)
     {
-        for (auto& track : tracksArray)
-            track->setMasterLoop(tempoBox.getText().getIntValue(), beatsBox.getText().getIntValue());
+        updateLoopLength();
     }
 
     juce::Component::unfocusAllComponents();
@@ -838,9 +866,7 @@ void MainComponent::textEditorFocusLost(juce::TextEditor &textEditor)
 {
     if (&textEditor == &tempoBox)
     {
-        metronome.setBpm(textEditor.getText().getIntValue());
-        for (auto& track : tracksArray)
-            track->setMasterLoop(tempoBox.getText().getIntValue(), beatsBox.getText().getIntValue());
+        updateLoopLength();
 
         //DN: trying to un-highlight when you click away
         int oldValue = tempoBox.getText().getIntValue();
@@ -851,8 +877,7 @@ void MainComponent::textEditorFocusLost(juce::TextEditor &textEditor)
 
     if (&textEditor == &beatsBox)
     {
-        for (auto& track : tracksArray)
-            track->setMasterLoop(tempoBox.getText().getIntValue(), beatsBox.getText().getIntValue());
+        updateLoopLength();
         
         //DN: only way to un-highlight when you click away
         int oldValue = beatsBox.getText().getIntValue();
@@ -871,12 +896,6 @@ void MainComponent::textEditorTextChanged(juce::TextEditor& textEditor)
     {
         int newBeats = beatsBox.getText().getIntValue();
         DBG("textChanged " + juce::String(newBeats));
-        int newTempo = tempoBox.getText().getIntValue();
-        for (auto& track : tracksArray)
-        {
-            DBG("changing track looplength");
-            track->setMasterLoop(newTempo, newBeats);
-            track->repaint();
-        }
+        updateLoopLength();
     }
 }
\ No newline at end of file
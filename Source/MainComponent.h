@@ -1,8 +1,8 @@
 #pragma once
 
 #include "AudioTrack.h"
-#include "InputMonitor.h"
-#include "Metronome.h"
+#include "LooperEngine.h"
+#include "ProfilerOverlay.h"
 #include "BinaryData.h"
 
 
@@ -10,12 +10,15 @@
 //==============================================================================
 /*
     This component lives inside our window, and contains all
-    controls and content.
+    controls and content.  The looper itself is the LooperEngine
+    (see LooperEngine.h) - this plays it, and keeps the controls
+    in step with it.
 */
 class MainComponent  : public juce::AudioAppComponent,
                        public juce::ChangeListener,
                        public juce::KeyListener,
-    public juce::TextEditor::Listener
+    public juce::TextEditor::Listener,
+    private LooperEngine::Listener
 {
 public:
     //==============================================================================
@@ -39,6 +42,19 @@ public:
     void textEditorFocusLost(juce::TextEditor &textEditor) override;
     void textEditorTextChanged(juce::TextEditor& textEditor) override;
 
+    //==============================================================================
+    // For driving the app without anyone at the controls (see RealtimeCheck.h) - each one
+    // does what clicking that control does, once the message loop gets to it
+    void clickPlay();
+    void clickStop();
+    void clickMetronome();
+    void clickAddTrack();
+    void clickRecord(int trackIndex);
+    void clickOverdub(int trackIndex);
+    void clickReverse(int trackIndex);
+    void clickUndo(int trackIndex);
+    void setLoopLength(int tempo, int beats);
+
 private:
 
     // AF: enum responsible to change the states of play and stop buttons
@@ -59,28 +75,37 @@ private:
     void saveButtonClicked();
     void initializeButtonClicked();
     void settingsButtonClicked();
+    void measureLatencyButtonClicked();
+    void updateLatencyLabel();
+    void updateLoopLength();
     void metronomeButtonClicked();
     void savedLoopSelected();
+    void updateProjectControls();
+    void showProjectNotice(const juce::String& title, const juce::String& message, juce::AlertWindow::AlertIconType icon);
 
     bool keyPressed(const juce::KeyPress& key,
         Component* originatingComponent);
 
-    // Loading/Saving Audio to from tracks
-    void initializeTempWAVs();
-    void refreshAudioReferences();
-    void redrawAndBufferAudio();
-
-    //==============================================================================
-    // AF: Method that returns true if any tracks are currently playing
-    bool trackCurrentlyPlaying();
-    // AF: Returns true if any tracks are currently recording
-    bool trackCurrentlyRecording();
+    // The engine's tracks come and go (the track count can change while audio is running),
+    // each one gets an AudioTrack with its controls
+    void trackAdded(TrackEngine& trackEngine, int index) override;
+    void trackRemoving(TrackEngine& trackEngine, int index) override;
+    void latencyMeasured(int result) override;
+    void projectProgress(const ProjectIO::Request& request) override;
+    void projectFinished(const ProjectIO::Request& request) override;
 
     //==============================================================================
 
     std::unique_ptr<juce::AudioDeviceSelectorComponent> audioSetupComp;
     juce::DialogWindow::LaunchOptions settingsWindow;
 
+    //the settings window: the device selector, with latency calibration underneath
+    juce::Component settingsContent;
+    juce::TextButton measureLatencyButton{ "MEASURE LATENCY" };
+    juce::Label latencyLabel;
+    juce::ToggleButton showProfilerButton{ "Show DSP load" };
+    juce::ToggleButton logProfilerButton{ "Log DSP load to Loopspace/" PROFILER_LOG_FILENAME };
+
     //Header
     juce::Label appTitle{ "appTitle" ,"L O O P S P A C E"};
 
@@ -94,12 +119,15 @@ private:
     juce::TextEditor beatsBox;
     juce::Label beatsBoxLabel;
 
-    Metronome metronome;
     std::unique_ptr<juce::Drawable> metronomeSVG;
     juce::DrawableButton metronomeButton{ "metronomeButton",juce::DrawableButton::ButtonStyle::ImageFitted };
 
     juce::ComboBox savedLoopsDropdown{ "savedLoopsDropdown" };
-    DirectoryTree savedLoopDirTree;
+
+    //DN: in place of the dropdown while a project is saving or loading in the background
+    double projectIOProgress = 0.0;
+    juce::ProgressBar projectProgressBar{ projectIOProgress };
+    juce::TextButton cancelProjectButton{ "CANCEL" };
 
     std::unique_ptr<juce::Drawable> saveSVG;
     juce::DrawableButton saveButton{ "saveButton",juce::DrawableButton::ButtonStyle::ImageFitted };
@@ -113,6 +141,10 @@ private:
     std::unique_ptr<juce::Drawable> loopLengthSVG;
     LoopLengthButton loopLengthButton{ "loopLengthButton",juce::DrawableButton::ButtonStyle::ImageFitted };
 
+    juce::TextButton addTrackButton{ "+ TRACK" };
+    juce::Viewport trackListViewport;
+    juce::Component trackListContent;
+
 
     // Dialog Windows
     juce::AlertWindow saveProjectDialog{ "Save Project","Enter the name of your Loop Project:",juce::AlertWindow::AlertIconType::NoIcon };
@@ -121,17 +153,17 @@ private:
     // flags etc
     bool unsavedChanges = false; //DN: determines whether to warn about unsaved progress when switching projects
     int currentProjectListID = 0; //DN: keep track of where we are in the project list.  Update this when changing the dropdown
-    bool settingsHaveBeenOpened = false; //DN: set to true once someone hits settings the first time
+    int projectListIDBeingLoaded = 0; //DN: becomes currentProjectListID once the load has swapped in
+    bool savingNewProject = false; //DN: only saving over an existing project gets a "Project Saved!"
 
     //UI
     CustomLookAndFeel customLookAndFeel;
     SettingsLookAndFeel settingsLF;
 
     // Tracks / DSP
-    juce::OwnedArray<AudioTrack> tracksArray;
-
-    InputMonitor inputAudio;
-    juce::MixerAudioSource mixer;
+    LooperEngine engine{ deviceManager };  //declared before the tracks' controls so it outlives them
+    juce::OwnedArray<AudioTrack> tracksArray;  //one for each of the engine's tracks, in the same order
+    ProfilerOverlay profilerOverlay{ engine.getProfiler() };
 
     TransportState state;
 
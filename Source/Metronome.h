@@ -5,90 +5,153 @@
 
     Class to play a metronome click sample, using provided tempo and synced with
     the tracks in our loop.
+
+    The click is decoded once up front (and resampled to the device rate in
+    prepareToPlay), so the audio thread only ever copies samples.  Click times
+    come from the shared TransportClock and are laid out across the master loop
+    exactly the way LoopSource measures it, so the clicks land on the same
+    samples as the loop's beats however long the session runs.  Each click is
+    mixed in at its exact offset in the block, and one that started in an
+    earlier block carries on where it left off.
+
+    A loaded project's tempo takes over at the loop start the tracks swap
+    over at: the clicks up to there follow the old loop, and the new loop's
+    count from there (see TransportClock::scheduleLoopRestart()).
+
+    The first beat of each bar is accented, and beats can be subdivided into
+    quieter ticks.
   ==============================================================================
 */
 
 #pragma once
 
-#include <JuceHeader.h>
-#include "../JuceLibraryCode/JuceHeader.h"
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <limits>
+#include "BinaryData.h"
+#include "MixEngine.h"
+#include "TransportClock.h"
 
-class Metronome : public juce::AudioSource
+class Metronome : public juce::AudioSource, public MixEngineSource
 {
 public:
-    Metronome()
+    Metronome(const TransportClock& transportToFollow)
+        : transport(transportToFollow)
     {
-        mFormatManager.registerBasicFormats();
-
         juce::WavAudioFormat wavFormat;
         std::unique_ptr<juce::AudioFormatReader> formatReader(wavFormat.createReaderFor(new juce::MemoryInputStream(
                                                        BinaryData::MOTUclick_wav, BinaryData::MOTUclick_wavSize, false), true));
         jassert(formatReader.get() != nullptr);
 
-        pMetronomeSample.reset(new juce::AudioFormatReaderSource(formatReader.release(), true));
-
-        mUpdateInterval = 60.0 / mBpm * mSampleRate;
+        //decode the whole click now, so nothing gets read or decoded on the audio thread
+        if (formatReader != nullptr)
+        {
+            decodedClick.setSize((int)formatReader->numChannels, (int)formatReader->lengthInSamples);
+            formatReader->read(&decodedClick, 0, (int)formatReader->lengthInSamples, 0, true, true);
+            decodedClickSampleRate = formatReader->sampleRate;
+        }
     }
 
-    void prepareToPlay(int samplesPerBlock, double sampleRate)
+    void prepareToPlay(int samplesPerBlock, double sampleRate) override
     {
         mSampleRate = sampleRate;
-        mUpdateInterval = 60.0 / mBpm * mSampleRate;
 
-        if (pMetronomeSample != nullptr)
+        //resample the click to the device's rate once, here, rather than on every click
+        if (decodedClick.getNumSamples() == 0 || decodedClickSampleRate <= 0.0 || sampleRate <= 0.0)
         {
-            pMetronomeSample->prepareToPlay(samplesPerBlock, sampleRate);
+            click.setSize(1, 0);
+            return;
+        }
+
+        const double speedRatio = decodedClickSampleRate / sampleRate;
+        const int numResampled = (int)std::ceil(decodedClick.getNumSamples() / speedRatio);
+
+        click.setSize(decodedClick.getNumChannels(), numResampled);
+
+        for (int channel = 0; channel < decodedClick.getNumChannels(); ++channel)
+        {
+            juce::LagrangeInterpolator interpolator;
+            interpolator.process(speedRatio, decodedClick.getReadPointer(channel), click.getWritePointer(channel),
+                                 numResampled, decodedClick.getNumSamples(), 0);
         }
     }
 
-    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill)
+    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill) override
     {
-        mUpdateInterval = 60.0 / mBpm * mSampleRate;
-        const auto bufferSize = bufferToFill.numSamples;
+        bufferToFill.clearActiveBufferRegion();
+        mixNextAudioBlock(bufferToFill);
+    }
 
-        mTotalSamples += bufferSize;
+    //Adds every click that sounds during this block on top of what's already there
+    void mixNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToMixInto) override
+    {
+        const int clickLength = click.getNumSamples();
+        const int numSamples = bufferToMixInto.numSamples;
 
-        mSamplesRemaining = mTotalSamples % mUpdateInterval;
+        if (state != Playing || !transport.isRunning() || clickLength == 0 || numSamples <= 0)
+            return;
 
-        if ((mSamplesRemaining + bufferSize) >= mUpdateInterval)
-        {
-            const auto timeToStartPlaying = mUpdateInterval - mSamplesRemaining;
-            pMetronomeSample->setNextReadPosition(0);
-
-            bool played = false;
-
-            for (auto sample = 0; sample < bufferSize; sample++)
-            {
-                if (sample == timeToStartPlaying && state == Playing)
-                {
-                    played = true;
-                    pMetronomeSample->getNextAudioBlock(bufferToFill);
-                }
-            }
-
-            // AF: Need this in case timeToStartPlaying ends up being exactly == bufferSize
-            if (played == false && state == Playing)
-            {
-                played = true;
-                pMetronomeSample->getNextAudioBlock(bufferToFill);
-            }
-        }
+        const auto blockStart = transport.getBlockStartSample();
+        const auto blockEnd = blockStart + numSamples;
+        const auto changeFrom = loopChangeFrom.load();
+
+        //start from the first tick that could still be ringing at the start of this block - the loop before a
+        //change still has some ringing for a little while after it
+        mixClicks(bufferToMixInto, mBpm, mBeatsPerLoop, transport.getLoopOriginAt(juce::jmin(blockStart, changeFrom - 1)),
+                  blockStart - clickLength + 1, juce::jmin(blockEnd, changeFrom));
+
+        if (changeFrom < blockEnd)
+            mixClicks(bufferToMixInto, nextBpm, nextBeatsPerLoop, changeFrom,
+                      juce::jmax(blockStart - clickLength + 1, changeFrom), blockEnd);
     }
 
     // AF: Getter
     int getBpm() {
-        return mBpm;
+        return nextBpm;
     }
 
     // AF: Setter
     void setBpm(int newBpm) {
-        mBpm = newBpm;
-        reset();
+        setMasterLoop(newBpm, nextBeatsPerLoop);
+    }
+
+    //Call this along with the tracks' setMasterLoop so the clicks line up with the loop
+    void setMasterLoop(int tempo, int beatsPerLoop)
+    {
+        mBpm = tempo;
+        mBeatsPerLoop = beatsPerLoop;
+        loopChangeFrom = noLoopChange;
+        nextBpm = tempo;
+        nextBeatsPerLoop = beatsPerLoop;
+    }
+
+    //The same, but from transportSample on, where the loop restarts - call it just after scheduling the
+    //restart on the TransportClock, and not until the last change has been reached
+    void setMasterLoopFrom(int tempo, int beatsPerLoop, juce::int64 transportSample)
+    {
+        //DN: a change that's already happened becomes the loop before this one first, so there's never a block
+        //that sees the change gone but not its tempo
+        if (loopChangeFrom.load() != noLoopChange)
+        {
+            mBpm = nextBpm.load();
+            mBeatsPerLoop = nextBeatsPerLoop.load();
+        }
+
+        loopChangeFrom = noLoopChange;
+        nextBpm = tempo;
+        nextBeatsPerLoop = beatsPerLoop;
+        loopChangeFrom = transportSample;
+    }
+
+    //The first beat of every bar gets the accent
+    void setBeatsPerBar(int newBeatsPerBar)
+    {
+        mBeatsPerBar = juce::jmax(1, newBeatsPerBar);
     }
 
-    void reset()
+    //1 = just the beats, 2 = eighth notes, 4 = sixteenths, etc.
+    void setSubdivisions(int newSubdivisions)
     {
-        mTotalSamples = 0;
+        mSubdivisions = juce::jmax(1, newSubdivisions);
     }
 
     enum mPlayState
@@ -116,10 +179,9 @@ public:
     void stop()
     {
         state = Stopped;
-        reset();
     }
 
-    void releaseResources()
+    void releaseResources() override
     {
         // AF: Required override by parent class AudioSource
     }
@@ -130,15 +192,96 @@ public:
     }
 
 private:
-    int mTotalSamples{ 0 };
-    double mSampleRate{ 0 };
-    int mBpm{ 120 };
-    int mUpdateInterval{ 0 };
-    int mSamplesRemaining{ 0 };
-    double gain{ 1.0 };
+    //Adds the clicks of the loop at tempo and beatsPerLoop, counting from origin, that start in [fromSample, toSample).
+    //Each one carries on to the end of the block, even past toSample
+    void mixClicks(const juce::AudioSourceChannelInfo& bufferToMixInto, int tempo, int beatsPerLoop, juce::int64 origin,
+                   juce::int64 fromSample, juce::int64 toSample)
+    {
+        const auto loopLength = TransportClock::getLoopLengthInSamples(tempo, beatsPerLoop, mSampleRate);
+        const auto subdivisions = (juce::int64)juce::jmax(1, mSubdivisions.load());
+        const auto ticksPerLoop = juce::jmax((juce::int64)1, (juce::int64)beatsPerLoop) * subdivisions;
+
+        if (loopLength <= 0 || fromSample >= toSample)
+            return;
+
+        const int clickLength = click.getNumSamples();
+        const int numSamples = bufferToMixInto.numSamples;
+        const auto blockStart = transport.getBlockStartSample();
+
+        for (auto tick = getFirstTickStartingAtOrAfter(fromSample - origin, loopLength, ticksPerLoop); ; ++tick)
+        {
+            const auto tickStart = origin + getTickStartSample(tick, loopLength, ticksPerLoop);
+
+            if (tickStart >= toSample)
+                break;
+
+            //a click that started in an earlier block picks up part way through
+            const int offsetInClick = (int)juce::jmax((juce::int64)0, blockStart - tickStart);
+            const int offsetInBlock = (int)juce::jmax((juce::int64)0, tickStart - blockStart);
+            const int numToMix = juce::jmin(clickLength - offsetInClick, numSamples - offsetInBlock);
+
+            if (numToMix <= 0)
+                continue;
+
+            const float tickGain = (float)gain.load() * getTickGain(tick % ticksPerLoop, subdivisions);
+
+            for (int channel = 0; channel < bufferToMixInto.buffer->getNumChannels(); ++channel)
+                juce::FloatVectorOperations::addWithMultiply(bufferToMixInto.buffer->getWritePointer(channel, bufferToMixInto.startSample + offsetInBlock),
+                                                             click.getReadPointer(channel % click.getNumChannels(), offsetInClick),
+                                                             tickGain, numToMix);
+        }
+    }
+
+    //Ticks are spread evenly over the loop, and rounded the same way every loop, so they never drift
+    //from the loop even when a beat isn't a whole number of samples
+    static juce::int64 getTickStartSample(juce::int64 tick, juce::int64 loopLength, juce::int64 ticksPerLoop) noexcept
+    {
+        return (tick / ticksPerLoop) * loopLength + ((tick % ticksPerLoop) * loopLength) / ticksPerLoop;
+    }
+
+    static juce::int64 getFirstTickStartingAtOrAfter(juce::int64 sample, juce::int64 loopLength, juce::int64 ticksPerLoop) noexcept
+    {
+        if (sample <= 0)
+            return 0;
+
+        //estimate from below, then step up to the exact tick
+        auto tick = juce::jmax((juce::int64)0, (sample * ticksPerLoop) / loopLength - 1);
+
+        while (getTickStartSample(tick, loopLength, ticksPerLoop) < sample)
+            ++tick;
+
+        return tick;
+    }
+
+    float getTickGain(juce::int64 tickInLoop, juce::int64 subdivisions) const noexcept
+    {
+        if (tickInLoop % subdivisions != 0)
+            return subdivisionGain;
+
+        const auto beatInLoop = tickInLoop / subdivisions;
+        return beatInLoop % mBeatsPerBar.load() == 0 ? accentGain : beatGain;
+    }
+
+    const TransportClock& transport;
+
+    std::atomic<double> mSampleRate{ 44100.0 };  //prepareToPlay can come from the device's thread
+    static constexpr juce::int64 noLoopChange = std::numeric_limits<juce::int64>::max();
+
+    std::atomic<int> mBpm{ 120 };
+    std::atomic<int> mBeatsPerLoop{ 16 };
+    std::atomic<int> nextBpm{ 120 }, nextBeatsPerLoop{ 16 };  //the loop from loopChangeFrom on
+    std::atomic<juce::int64> loopChangeFrom{ noLoopChange };
+    std::atomic<int> mBeatsPerBar{ 4 };
+    std::atomic<int> mSubdivisions{ 1 };
+    std::atomic<double> gain{ 1.0 };
+
+    static constexpr float accentGain = 1.0f;
+    static constexpr float beatGain = 0.7f;
+    static constexpr float subdivisionGain = 0.4f;
 
-    mPlayState state{ Stopped };
+    std::atomic<mPlayState> state{ Stopped };
 
-    juce::AudioFormatManager mFormatManager;
-    std::unique_ptr<juce::AudioFormatReaderSource> pMetronomeSample{ nullptr };
+    juce::AudioBuffer<float> decodedClick;   //the click as it is in BinaryData
+    double decodedClickSampleRate{ 0 };
+    juce::AudioBuffer<float> click;          //the click at the device's sample rate, what actually gets played
 };
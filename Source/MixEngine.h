@@ -0,0 +1,230 @@
+/*
+  ==============================================================================
+
+    MixEngine.h
+
+    Replaces juce::MixerAudioSource for our main output.  MixerAudioSource has
+    every source fill a temp buffer which then gets summed into the output, on
+    top of the separate gain and pan passes each track used to make.  Here a
+    MixEngineSource adds itself straight into the output (gain, pan and sum in
+    one pass, see MixKernels.h), so each track's audio is touched once per block.
+
+    Sources can be added and removed while audio is running - the list is
+    swapped in through a RealtimeHandoff.  Once there are enough of them, each
+    block is rendered in parallel on a RenderThreadPool: every source mixes into
+    its own preallocated buffer, and those get summed into the output at the end.
+    The buffers are sized well past the block the device asked for; a block
+    that still doesn't fit is mixed on the audio thread instead, since every
+    source works out its position from the block it's handed.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+#include "CallbackProfiler.h"
+#include "MixKernels.h"
+#include "RealtimeHandoff.h"
+#include "RenderThreadPool.h"
+
+
+//Anything that can add its audio directly into the output
+class MixEngineSource
+{
+public:
+    virtual ~MixEngineSource() = default;
+
+    virtual void prepareToPlay(int samplesPerBlockExpected, double sampleRate) = 0;
+    virtual void releaseResources() = 0;
+
+    //Add the next block on top of whatever is already in the buffer - don't clear it
+    virtual void mixNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToMixInto) = 0;
+
+    //Message thread, before the source is added: the engine times every block the source renders into this
+    void setProfilerStage(CallbackProfiler::Stage* newStage) noexcept    { profilerStage = newStage; }
+    CallbackProfiler::Stage* getProfilerStage() const noexcept          { return profilerStage; }
+
+private:
+    CallbackProfiler::Stage* profilerStage = nullptr;
+};
+
+
+class MixEngine
+{
+public:
+    MixEngine()
+    {
+        sourceList.publish(std::make_unique<SourceList>());
+    }
+
+    //Message thread: the source starts playing on the next block.  If the engine is already
+    //running the source gets prepared first
+    void addSource(MixEngineSource* newSource)
+    {
+        jassert(newSource != nullptr);
+
+        const juce::ScopedLock sl(writerLock);
+
+        if (isPrepared)
+            newSource->prepareToPlay(preparedBlockSize, preparedSampleRate);
+
+        auto newList = copySourceList();
+        newList->sources.add(newSource);
+        newList->renderBuffers.add(new juce::AudioBuffer<float>(preparedChannels, getRenderBufferSize()));
+        sourceList.publish(std::move(newList));
+    }
+
+    //Message thread: once this returns the audio thread has stopped using the source,
+    //so it's safe to delete
+    void removeSource(MixEngineSource* sourceToRemove)
+    {
+        const juce::ScopedLock sl(writerLock);
+
+        auto newList = copySourceList();
+        const int index = newList->sources.indexOf(sourceToRemove);
+
+        if (index < 0)
+            return;
+
+        newList->sources.remove(index);
+        newList->renderBuffers.remove(index);
+        sourceList.publish(std::move(newList));
+        sourceList.waitForReaderToMoveOn();
+
+        if (isPrepared)
+            sourceToRemove->releaseResources();
+    }
+
+    //With fewer sources than this, everything mixes straight into the output on the audio thread
+    void setMinSourcesForParallelRender(int newMinimum)
+    {
+        minSourcesForParallelRender = juce::jmax(2, newMinimum);
+    }
+
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate, int numOutputChannels)
+    {
+        const juce::ScopedLock sl(writerLock);
+
+        preparedBlockSize = juce::jmax(1, samplesPerBlockExpected);
+        preparedSampleRate = sampleRate;
+        preparedChannels = juce::jmax(2, numOutputChannels);
+        isPrepared = true;
+
+        //rebuild the per-source buffers for the new block size/channel count
+        auto newList = copySourceList();
+
+        for (auto* source : newList->sources)
+            source->prepareToPlay(samplesPerBlockExpected, sampleRate);
+
+        sourceList.publish(std::move(newList));
+    }
+
+    void releaseResources()
+    {
+        const juce::ScopedLock sl(writerLock);
+
+        for (auto* source : sourceList.getForWriter()->sources)
+            source->releaseResources();
+
+        isPrepared = false;
+    }
+
+    void getNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToFill)
+    {
+        bufferToFill.clearActiveBufferRegion();
+
+        const RealtimeHandoff<SourceList>::ScopedRead list(sourceList);
+
+        if (list->sources.size() >= minSourcesForParallelRender && renderPool.getNumWorkers() > 0
+            && bufferToFill.numSamples <= getRenderBufferSize(*list))
+            renderSourcesInParallel(*list, bufferToFill);
+        else
+            for (auto* source : list->sources)
+            {
+                const CallbackProfiler::ScopedTimer timer(source->getProfilerStage());
+                source->mixNextAudioBlock(bufferToFill);
+            }
+    }
+
+private:
+    struct SourceList
+    {
+        juce::Array<MixEngineSource*> sources;
+        juce::OwnedArray<juce::AudioBuffer<float>> renderBuffers;  //one per source, only used when rendering in parallel
+    };
+
+    //DN: some drivers hand over blocks a few times bigger than they said they would, so the parallel
+    //path gets plenty of room before it has to fall back to mixing serially
+    static constexpr int minRenderBufferSize = 8192;
+
+    int getRenderBufferSize() const noexcept
+    {
+        return juce::jmax(preparedBlockSize, minRenderBufferSize);
+    }
+
+    static int getRenderBufferSize(const SourceList& list) noexcept
+    {
+        return list.renderBuffers.isEmpty() ? 0 : list.renderBuffers.getUnchecked(0)->getNumSamples();
+    }
+
+    //Message thread (under writerLock): a fresh copy of the current list with buffers at the render size
+    std::unique_ptr<SourceList> copySourceList() const
+    {
+        auto newList = std::make_unique<SourceList>();
+
+        for (auto* source : sourceList.getForWriter()->sources)
+        {
+            newList->sources.add(source);
+            newList->renderBuffers.add(new juce::AudioBuffer<float>(preparedChannels, getRenderBufferSize()));
+        }
+
+        return newList;
+    }
+
+    //Each source mixes into its own buffer on whichever pool thread picks it up, then the
+    //buffers are summed into the output here.  The whole block has to fit in the buffers
+    void renderSourcesInParallel(SourceList& list, const juce::AudioSourceChannelInfo& bufferToFill)
+    {
+        const int numSources = list.sources.size();
+        const int numChannels = juce::jmin(bufferToFill.buffer->getNumChannels(), preparedChannels);
+        const int numSamples = bufferToFill.numSamples;
+
+        jassert(numSamples <= getRenderBufferSize(list));
+
+        auto renderOne = [&list, numChannels, numSamples](int index)
+        {
+            auto* renderBuffer = list.renderBuffers.getUnchecked(index);
+            juce::AudioBuffer<float> view(renderBuffer->getArrayOfWritePointers(), numChannels, numSamples);
+            view.clear();
+
+            //timed on whichever thread renders it
+            auto* source = list.sources.getUnchecked(index);
+            const CallbackProfiler::ScopedTimer timer(source->getProfilerStage());
+            source->mixNextAudioBlock(juce::AudioSourceChannelInfo(&view, 0, numSamples));
+        };
+
+        renderPool.runJobs(numSources, renderOne);
+
+        //the reduction: sum every source's block into the output, one output channel at a time
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            auto* dest = bufferToFill.buffer->getWritePointer(channel, bufferToFill.startSample);
+
+            for (auto* renderBuffer : list.renderBuffers)
+                juce::FloatVectorOperations::add(dest, renderBuffer->getReadPointer(channel), numSamples);
+        }
+    }
+
+    RealtimeHandoff<SourceList> sourceList;
+    RenderThreadPool renderPool;
+
+    juce::CriticalSection writerLock;  //only ever taken by threads changing the source list, never the audio thread
+    int preparedBlockSize = 512;
+    int preparedChannels = 2;
+    double preparedSampleRate = 44100.0;
+    bool isPrepared = false;
+    int minSourcesForParallelRender = 8;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(MixEngine)
+};
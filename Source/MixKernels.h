@@ -0,0 +1,111 @@
+/*
+  ==============================================================================
+
+    MixKernels.h
+
+    The inner loops of the mix path.  Everything that ends up in the output
+    (loops, input monitoring) goes through addWithGainRamp (or its reversed
+    twin), so gain, pan and summing into the output all happen in a single
+    pass over the samples.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+
+//Per-output-channel gain for one source.  Channel 0/1 carry the pan, any
+//further output channels just get the overall gain
+struct ChannelGains
+{
+    float left = 1.0f;
+    float right = 1.0f;
+    float overall = 1.0f;
+
+    float forChannel(int channel) const noexcept
+    {
+        return channel == 0 ? left : (channel == 1 ? right : overall);
+    }
+
+    // AF: Panning law - the channel we're panning away from gets lowered by (1 - |pan|),
+    // the other one stays at full gain. pan is -1 (L) to 1 (R)
+    static ChannelGains fromGainAndPan(float gain, float pan) noexcept
+    {
+        ChannelGains gains;
+        gains.overall = gain;
+        gains.left = pan > 0.0f ? gain * (1.0f - pan) : gain;
+        gains.right = pan < 0.0f ? gain * (1.0f + pan) : gain;
+        return gains;
+    }
+
+    static ChannelGains silent() noexcept
+    {
+        return { 0.0f, 0.0f, 0.0f };
+    }
+
+    //t = 0 gives a, t = 1 gives b
+    static ChannelGains interpolate(const ChannelGains& a, const ChannelGains& b, float t) noexcept
+    {
+        return { a.left + (b.left - a.left) * t,
+                 a.right + (b.right - a.right) * t,
+                 a.overall + (b.overall - a.overall) * t };
+    }
+};
+
+
+namespace MixKernels
+{
+    //dest += source * gain, with the gain moving linearly from startGain to endGain over the span
+    inline void addWithGainRamp(float* dest, const float* source, int numSamples, float startGain, float endGain) noexcept
+    {
+        if (numSamples <= 0)
+            return;
+
+        if (startGain == endGain)
+        {
+            if (startGain != 0.0f)
+                juce::FloatVectorOperations::addWithMultiply(dest, source, startGain, numSamples);
+
+            return;
+        }
+
+        //kept as a plain indexed loop with no branches so the compiler vectorises it
+        const float step = (endGain - startGain) / (float)numSamples;
+
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] += source[i] * (startGain + step * (float)i);
+    }
+
+    //Same as addWithGainRamp, but reading the source backwards: dest[i] += source[-i] * gain, so source
+    //points at the last sample of the span as it's stored.  Still a plain indexed loop - the compiler
+    //vectorises the backwards read with a shuffle
+    inline void addReversedWithGainRamp(float* dest, const float* source, int numSamples, float startGain, float endGain) noexcept
+    {
+        if (numSamples <= 0 || (startGain == 0.0f && endGain == 0.0f))
+            return;
+
+        const float step = (endGain - startGain) / (float)numSamples;
+
+        for (int i = 0; i < numSamples; ++i)
+            dest[i] += source[-i] * (startGain + step * (float)i);
+    }
+
+    //loop = loop * feedback + input, in place.  feedback < 1 lets older layers decay a little every pass
+    inline void overdub(float* loop, const float* input, int numSamples, float feedback) noexcept
+    {
+        if (numSamples <= 0)
+            return;
+
+        if (feedback == 1.0f)
+        {
+            juce::FloatVectorOperations::add(loop, input, numSamples);
+            return;
+        }
+
+        //same as above, plain indexed loop so it vectorises
+        for (int i = 0; i < numSamples; ++i)
+            loop[i] = loop[i] * feedback + input[i];
+    }
+}
@@ -0,0 +1,337 @@
+/*
+  ==============================================================================
+
+    OfflineRenderer.h
+
+    Bounces a saved project to audio files without an audio device: the full
+    mix, and a stem per track, for however many times round the loop you ask
+    for.  It plays the project through exactly what the app plays it through -
+    a LoopSource per track (so slip, reverse, tempo stretching and rate
+    conversion all come out the same), the track's gain and pan, and
+    optionally the Metronome - it just doesn't have to wait for a device to
+    ask for each block.
+
+    Every track has its own TransportClock, so tracks don't depend on each
+    other and render in parallel, a block at a time, on a thread pool.  Each
+    track writes its own stem as it goes, and once they've all done a block
+    it's summed into the mix.  Only a block of each is ever in memory, however
+    long the bounce is.
+
+    Used from the command line (see CommandLineRenderer.h) to batch-bounce
+    saved projects.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_formats/juce_audio_formats.h>
+#include "LoopSource.h"
+#include "Metronome.h"
+#include "MixKernels.h"
+#include "SaveLoad.h"
+#include "TransportClock.h"
+
+
+class OfflineRenderer
+{
+public:
+    struct Options
+    {
+        int numRepetitions = 1;     //times round the loop
+        double sampleRate = 0.0;    //0 renders at the rate the project's WAVs were saved at
+        bool renderMix = true;
+        bool renderStems = true;
+        bool includeMetronome = false;  //in the mix, not the stems
+        juce::String format = "wav";    //"wav" or "flac"
+        int bitsPerSample = 24;
+        int numThreads = juce::SystemStats::getNumCpus();
+    };
+
+    OfflineRenderer(const Options& optionsToUse)
+        : options(optionsToUse), pool(juce::jmax(1, optionsToUse.numThreads))
+    {
+        formatManager.registerBasicFormats();
+    }
+
+    //Reads the project saved in projectFolder and writes Mix.<format> and a LoopspaceTrackN.<format> per track
+    //into outputFolder.  Blocks until it's done, including waiting for any conversion or stretching the tracks
+    //need - it does the message thread's side of that itself, so call it from the message thread
+    juce::Result render(const juce::File& projectFolder, const juce::File& outputFolder)
+    {
+        juce::XmlDocument projectStateDoc(projectFolder.getChildFile(PROJECT_STATE_XML_FILENAME));
+        auto projectState = projectStateDoc.getDocumentElement();
+
+        if (projectState == nullptr)
+            return juce::Result::fail("No project in " + projectFolder.getFullPathName());
+
+        const int tempo = projectState->getIntAttribute("tempo");
+        const int beats = projectState->getIntAttribute("beats");
+        const int numTracks = projectState->getIntAttribute("numTracks", DEFAULT_NUM_TRACKS);
+
+        if (tempo <= 0 || beats <= 0)
+            return juce::Result::fail("The project has no tempo");
+
+        std::unique_ptr<juce::AudioFormat> format;
+
+        if (options.format.equalsIgnoreCase("flac"))
+            format = std::make_unique<juce::FlacAudioFormat>();
+        else if (options.format.equalsIgnoreCase("wav"))
+            format = std::make_unique<juce::WavAudioFormat>();
+        else
+            return juce::Result::fail("Unknown format: " + options.format);
+
+        if (!format->getPossibleBitDepths().contains(options.bitsPerSample))
+            return juce::Result::fail(format->getFormatName() + " can't be " + juce::String(options.bitsPerSample) + "-bit");
+
+        if (!outputFolder.createDirectory())
+            return juce::Result::fail("Couldn't create " + outputFolder.getFullPathName());
+
+        //the WAVs are read before anything's set up, since the first one decides the rate if it wasn't given
+        juce::OwnedArray<Track> tracks;
+        double sampleRate = options.sampleRate;
+
+        for (int i = 0; i < numTracks; ++i)
+        {
+            const auto name = DirectoryTree::getTrackWAVName(i + 1);
+            auto* track = tracks.add(new Track(name));
+            loadTrackAudio(*track, projectFolder.getChildFile(name + ".wav"));
+
+            if (sampleRate <= 0.0)
+                sampleRate = track->fileSampleRate;
+        }
+
+        if (sampleRate <= 0.0)
+            sampleRate = 44100.0;
+
+        const int loopLength = (int)TransportClock::getLoopLengthInSamples(tempo, beats, sampleRate);
+        const juce::int64 totalLength = (juce::int64)loopLength * juce::jmax(1, options.numRepetitions);
+
+        //the same steps a track goes through when a project is loaded (see TrackEngine::restoreState())
+        forEachXmlChildElement(*projectState, trackState)
+            for (auto* track : tracks)
+                if (trackState->hasTagName(track->name))
+                    track->restoreState(*trackState);
+
+        for (auto* track : tracks)
+            track->prepare(tempo, beats, sampleRate);
+
+        //any conversion or stretching is running on every track at once by now, this just waits for it all
+        for (auto* track : tracks)
+            track->waitForTimeStretch();
+
+        if (options.renderStems)
+            for (auto* track : tracks)
+                if ((track->writer = createWriter(*format, outputFolder.getChildFile(track->name), sampleRate)) == nullptr)
+                    return juce::Result::fail("Couldn't write " + track->name);
+
+        std::unique_ptr<juce::AudioFormatWriter> mixWriter;
+
+        if (options.renderMix && (mixWriter = createWriter(*format, outputFolder.getChildFile("Mix"), sampleRate)) == nullptr)
+            return juce::Result::fail("Couldn't write the mix");
+
+        TransportClock metronomeClock;
+        Metronome metronome(metronomeClock);
+        metronome.prepareToPlay(blockSize, sampleRate);
+        metronome.setMasterLoop(tempo, beats);
+        metronome.start();
+        metronomeClock.start();
+
+        juce::AudioBuffer<float> mix(numOutputChannels, blockSize);
+
+        for (juce::int64 done = 0; done < totalLength; done += blockSize)
+        {
+            const int numSamples = (int)juce::jmin((juce::int64)blockSize, totalLength - done);
+
+            for (auto* track : tracks)
+            {
+                track->job.numSamples = numSamples;
+                pool.addJob(&track->job, false);
+            }
+
+            for (auto* track : tracks)
+                pool.waitForJobToFinish(&track->job, -1);
+
+            for (auto* track : tracks)
+                if (track->writeFailed)
+                    return juce::Result::fail("Couldn't write " + track->name);
+
+            if (mixWriter == nullptr)
+                continue;
+
+            mix.clear();
+
+            for (auto* track : tracks)
+                for (int channel = 0; channel < numOutputChannels; ++channel)
+                    mix.addFrom(channel, 0, track->block, channel, 0, numSamples);
+
+            if (options.includeMetronome)
+            {
+                metronome.mixNextAudioBlock(juce::AudioSourceChannelInfo(&mix, 0, numSamples));
+                metronomeClock.advance(numSamples);
+            }
+
+            if (!mixWriter->writeFromAudioSampleBuffer(mix, 0, numSamples))
+                return juce::Result::fail("Couldn't write the mix");
+        }
+
+        return juce::Result::ok();
+    }
+
+private:
+    static constexpr int blockSize = 32768;
+    static constexpr int numOutputChannels = 2;
+
+    struct Track;
+
+    //One block of one track, on a pool thread
+    class BlockJob : public juce::ThreadPoolJob
+    {
+    public:
+        BlockJob(Track& trackToRender)
+            : juce::ThreadPoolJob("Offline Render"), track(trackToRender)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            track.renderBlock(numSamples);
+            return jobHasFinished;
+        }
+
+        int numSamples = 0;
+
+    private:
+        Track& track;
+    };
+
+    struct Track
+    {
+        Track(const juce::String& trackName)
+            : name(trackName), job(*this)
+        {
+        }
+
+        void restoreState(const juce::XmlElement& trackState)
+        {
+            gains = ChannelGains::fromGainAndPan((float)trackState.getDoubleAttribute("gain", 1.0),
+                                                 (float)trackState.getDoubleAttribute("pan"));
+            slip = trackState.getIntAttribute("slipValue");
+            reversed = trackState.getBoolAttribute("isReversed");
+            fileTempo = trackState.getIntAttribute("tempo");
+        }
+
+        //Message thread: the same order TrackEngine does it in - the audio, then the slip, then the reverse.
+        //A track saved mid-stretch is at a tempo of its own, which it starts out at and then gets stretched from
+        void prepare(int tempo, int beats, double sampleRate)
+        {
+            loop.prepareToPlay(blockSize, sampleRate);
+            loop.setMasterLoop(fileTempo > 0 ? fileTempo : tempo, beats);
+
+            if (take != nullptr)
+                loop.loadTake(std::move(take), fileSampleRate);
+            else
+                loop.loadTake(std::make_unique<LoopTake>(1, (int)loop.getMasterLoopLength()), sampleRate);
+
+            loop.setFileStartOffset(slip);
+
+            if (reversed)
+                loop.reverseAudio();
+
+            loop.clearHistory();
+            loop.setMasterLoop(tempo, beats);
+            block.setSize(numOutputChannels, blockSize);
+        }
+
+        //Message thread: nothing is rendering yet, so whatever the loop is converted or stretched to
+        //gets swapped straight in
+        void waitForTimeStretch()
+        {
+            while (loop.isTimeStretchPending())
+            {
+                if (!loop.updateTimeStretch())
+                    juce::Thread::sleep(5);
+
+                renderNothing();
+            }
+
+            loop.start(0);
+            clock.start();
+            renderNothing();
+        }
+
+        //An empty block, so the loop picks up the take, offset and direction it's been handed without
+        //crossfading into them at the start of the render
+        void renderNothing()
+        {
+            loop.mixNextAudioBlock(juce::AudioSourceChannelInfo(&block, 0, 0), gains, gains);
+        }
+
+        void renderBlock(int numSamples)
+        {
+            block.clear();
+            loop.mixNextAudioBlock(juce::AudioSourceChannelInfo(&block, 0, numSamples), gains, gains);
+            clock.advance(numSamples);
+
+            if (writer != nullptr && !writer->writeFromAudioSampleBuffer(block, 0, numSamples))
+                writeFailed = true;
+        }
+
+        const juce::String name;
+        TransportClock clock;
+        LoopSource loop{ clock };
+        BlockJob job;
+
+        std::unique_ptr<LoopTake> take;   //until prepare() hands it to the loop
+        double fileSampleRate = 0.0;
+        int fileTempo = 0;  //0 is the project's
+        ChannelGains gains;
+        int slip = 0;
+        bool reversed = false;
+
+        juce::AudioBuffer<float> block;
+        std::unique_ptr<juce::AudioFormatWriter> writer;
+        bool writeFailed = false;
+    };
+
+    //A track with no WAV (or one that won't open) is silent, like an empty track in the app
+    void loadTrackAudio(Track& track, const juce::File& file)
+    {
+        std::unique_ptr<juce::AudioFormatReader> reader(formatManager.createReaderFor(file));
+
+        if (reader == nullptr || reader->lengthInSamples <= 0)
+            return;
+
+        juce::AudioBuffer<float> audio((int)reader->numChannels, (int)reader->lengthInSamples);
+        reader->read(&audio, 0, (int)reader->lengthInSamples, 0, true, true);
+
+        track.take = LoopTake::fromBuffer(audio);
+        track.fileSampleRate = reader->sampleRate;
+    }
+
+    std::unique_ptr<juce::AudioFormatWriter> createWriter(juce::AudioFormat& format, const juce::File& fileWithoutExtension,
+                                                          double sampleRate) const
+    {
+        const auto file = fileWithoutExtension.withFileExtension(format.getFileExtensions()[0]);
+        file.deleteFile();
+
+        std::unique_ptr<juce::FileOutputStream> fileStream(file.createOutputStream());
+
+        if (fileStream == nullptr)
+            return {};
+
+        std::unique_ptr<juce::AudioFormatWriter> writer(format.createWriterFor(fileStream.get(), sampleRate, (unsigned int)numOutputChannels,
+                                                                                 options.bitsPerSample, {}, 0));
+
+        if (writer != nullptr)
+            fileStream.release();  //(the writer deletes it)
+
+        return writer;
+    }
+
+    const Options options;
+    juce::AudioFormatManager formatManager;
+    juce::ThreadPool pool;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(OfflineRenderer)
+};
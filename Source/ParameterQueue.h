@@ -0,0 +1,122 @@
+/*
+  ==============================================================================
+
+    ParameterQueue.h
+
+    Gets parameter changes (gain, pan, slip...) from the message thread to the
+    audio thread without either side sharing a variable.  The message thread
+    pushes a change onto a fixed-size single-producer single-consumer FIFO,
+    and the audio thread drains everything that's arrived at the start of
+    each block, in the order it was pushed, into state that only it touches.
+
+    If the FIFO is full (e.g. the device is stopped, so nothing is draining
+    it) the change is held back on the message thread, and only the latest
+    value of each parameter is kept - that's all the audio thread would end
+    up with anyway.  Whatever's held back goes out, in order, with the next
+    push or flush().
+
+    Nothing allocates or locks on either side.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+
+class ParameterQueue
+{
+public:
+    //Parameters are small ints (an enum of the owner's), below maxParameters
+    static constexpr int maxParameters = 8;
+
+    struct Change
+    {
+        int parameter = 0;
+        double value = 0.0;
+        const void* target = nullptr;  //for a value that only means something alongside one object, e.g. the take an offset is for
+    };
+
+    ParameterQueue() = default;
+
+    //Message thread
+    void push(int parameter, double value, const void* target = nullptr)
+    {
+        jassert(juce::isPositiveAndBelow(parameter, maxParameters));
+
+        auto& held = heldBack[parameter];
+        held.change = { parameter, value, target };
+        held.order = ++numPushed;
+        held.waiting = true;
+
+        flush();
+    }
+
+    //Message thread: sends whatever didn't fit last time.  Call it every so often (e.g. from a timer),
+    //so a change made while nothing was draining still gets there
+    void flush()
+    {
+        for (;;)
+        {
+            HeldBack* oldest = nullptr;
+
+            for (auto& held : heldBack)
+                if (held.waiting && (oldest == nullptr || held.order < oldest->order))
+                    oldest = &held;
+
+            if (oldest == nullptr || !write(oldest->change))
+                return;
+
+            oldest->waiting = false;
+        }
+    }
+
+    //Audio thread: calls apply(const Change&) for everything pushed since last time, oldest first
+    template <typename ApplyFunction>
+    void drain(ApplyFunction&& apply) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToRead(fifo.getNumReady(), start1, size1, start2, size2);
+
+        for (int i = 0; i < size1; ++i)
+            apply(changes[(size_t)(start1 + i)]);
+
+        for (int i = 0; i < size2; ++i)
+            apply(changes[(size_t)(start2 + i)]);
+
+        fifo.finishedRead(size1 + size2);
+    }
+
+private:
+    static constexpr int capacity = 128;
+
+    struct HeldBack
+    {
+        Change change;
+        juce::uint32 order = 0;
+        bool waiting = false;
+    };
+
+    bool write(const Change& change) noexcept
+    {
+        int start1, size1, start2, size2;
+        fifo.prepareToWrite(1, start1, size1, start2, size2);
+
+        if (size1 + size2 < 1)
+            return false;
+
+        changes[(size_t)(size1 > 0 ? start1 : start2)] = change;
+        fifo.finishedWrite(1);
+        return true;
+    }
+
+    juce::AbstractFifo fifo{ capacity };
+    std::array<Change, capacity> changes;
+
+    //message thread only
+    std::array<HeldBack, maxParameters> heldBack;
+    juce::uint32 numPushed = 0;
+
+    JUCE_DECLARE_NON_COPYABLE(ParameterQueue)
+};
@@ -0,0 +1,108 @@
+/*
+  ==============================================================================
+
+    ProfilerOverlay.h
+
+    Draws the CallbackProfiler's latest results over the top of the app: the
+    whole callback's load, missed deadlines and device xruns, then a row per
+    stage with its DSP load (red once it's taking more than its share of the
+    block - all of it for the whole callback, an even split between the
+    rest) and p50/p99/max block times.  It doesn't take any clicks, so everything
+    underneath still works while it's showing.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "CallbackProfiler.h"
+#include "customUI.h"
+
+
+class ProfilerOverlay : public juce::Component, private juce::ChangeListener
+{
+public:
+    static constexpr int rowHeight = 16;
+
+    ProfilerOverlay(CallbackProfiler& profilerToShow)
+        : profiler(profilerToShow)
+    {
+        setInterceptsMouseClicks(false, false);
+        profiler.addChangeListener(this);
+    }
+
+    ~ProfilerOverlay() override
+    {
+        profiler.removeChangeListener(this);
+    }
+
+    //Enough room for the header and every stage
+    int getIdealHeight() const
+    {
+        return (profiler.getLatest().stages.size() + 3) * rowHeight;
+    }
+
+    void paint(juce::Graphics& g) override
+    {
+        const auto& latest = profiler.getLatest();
+
+        g.setColour(MAIN_BACKGROUND_COLOR.withAlpha(0.9f));
+        g.fillRoundedRectangle(getLocalBounds().toFloat(), ROUNDED_CORNER_SIZE);
+        g.setColour(MAIN_DRAW_COLOR);
+        g.drawRoundedRectangle(getLocalBounds().toFloat().reduced(1.0f), ROUNDED_CORNER_SIZE, 1.0f);
+
+        g.setFont(juce::Font(juce::Font::getDefaultMonospacedFontName(), 12.0f, juce::Font::plain));
+
+        auto area = getLocalBounds().reduced(8, 4);
+
+        juce::String header;
+        header << "block " << juce::String(latest.blockMilliseconds, 2) << "ms"
+               << "  missed " << latest.missedDeadlines << " (" << latest.totalMissedDeadlines << ")"
+               << "  xruns " << (latest.deviceXRuns >= 0 ? juce::String(latest.deviceXRuns) : juce::String("-"));
+
+        g.setColour(latest.missedDeadlines > 0 ? juce::Colours::red : MAIN_DRAW_COLOR);
+        g.drawText(header, area.removeFromTop(rowHeight), juce::Justification::centredLeft);
+
+        g.setColour(SECONDARY_DRAW_COLOR);
+        drawRow(g, area.removeFromTop(rowHeight), "", "load", "p50", "p99", "max");
+
+        //the whole callback comes first and gets the whole block, the stages inside it share it out
+        const int numInnerStages = juce::jmax(1, latest.stages.size() - 1);
+
+        for (int i = 0; i < latest.stages.size(); ++i)
+        {
+            const auto& stage = latest.stages.getReference(i);
+            const double share = i == 0 ? 1.0 : 1.0 / numInnerStages;
+
+            g.setColour(stage.load > share ? juce::Colours::red : MAIN_DRAW_COLOR);
+            drawRow(g, area.removeFromTop(rowHeight), stage.name, juce::String(stage.load * 100.0, 1) + "%",
+                    juce::String(stage.p50, 2), juce::String(stage.p99, 2), juce::String(stage.max, 2));
+        }
+    }
+
+private:
+    void drawRow(juce::Graphics& g, juce::Rectangle<int> row, const juce::String& name, const juce::String& load,
+                 const juce::String& p50, const juce::String& p99, const juce::String& max)
+    {
+        const int columnWidth = (row.getWidth() - 110) / 4;
+
+        g.drawText(name, row.removeFromLeft(110), juce::Justification::centredLeft, true);
+
+        for (auto* column : { &load, &p50, &p99, &max })
+            g.drawText(*column, row.removeFromLeft(columnWidth), juce::Justification::centredRight);
+    }
+
+    void changeListenerCallback(juce::ChangeBroadcaster*) override
+    {
+        //the number of stages changes as tracks come and go
+        if (getHeight() != getIdealHeight())
+            setSize(getWidth(), getIdealHeight());
+
+        repaint();
+    }
+
+    CallbackProfiler& profiler;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ProfilerOverlay)
+};
@@ -0,0 +1,333 @@
+/*
+  ==============================================================================
+
+    ProjectIO.h
+
+    Saves and loads projects on a background thread, so the loop keeps
+    playing while a project is written out or read in, and either can be
+    cancelled part way.
+
+    Saving writes from a snapshot of the tracks taken on the message thread:
+    each track's LoopTake is a copy that shares its chunks with what's
+    playing (see LoopTake.h), so taking it costs nothing and the audio
+    thread can carry on overdubbing or swapping takes underneath it.  Every
+    file is written to a temp file first and only moved into place once
+    they've all been written, so a cancelled or failed save leaves the
+    project as it was (and a new project's folder isn't left behind).
+
+    Loading reads the project's XML and decodes each track's WAV into a
+    LoopTake, ready for LooperEngine to swap in at the top of the loop.
+    A track with no WAV is silent.
+
+    The jobs run one at a time, in the order they were asked for, so a
+    project that's being saved is always finished before it's read back.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_formats/juce_audio_formats.h>
+#include "LoopTake.h"
+#include "SaveLoad.h"
+
+
+class ProjectIO
+{
+public:
+    //One track's audio, forwards (see LoopTake.h) at the rate it was recorded or converted to.
+    //take is nullptr for a track with nothing on it
+    struct TrackAudio
+    {
+        std::unique_ptr<LoopTake> take;
+        double sampleRate = 0.0;
+    };
+
+    //A save or load that's queued or running
+    struct Request : public juce::ReferenceCountedObject
+    {
+        using Ptr = juce::ReferenceCountedObjectPtr<Request>;
+
+        enum class Type
+        {
+            save,
+            load
+        };
+
+        Request(Type requestType, const juce::String& name, const juce::File& folder)
+            : type(requestType), projectName(name), projectFolder(folder)
+        {
+        }
+
+        //Stops at the next chance it gets.  A save leaves what was there before, a load loads nothing
+        void cancel() noexcept              { cancelled = true; }
+        bool isFinished() const noexcept    { return finished.load(); }
+
+        //0 to 1, from any thread
+        double getProgress() const noexcept { return progress.load(); }
+
+        //once isFinished(): it gave up because it was cancelled, rather than failing
+        bool wasCancelled() const noexcept  { return result.failed() && cancelled.load(); }
+
+        const Type type;
+        const juce::String projectName;
+        const juce::File projectFolder;
+
+        //for a save, what's written (filled in before it's queued).  For a load, what was read - only
+        //touch these once isFinished().  Track n + 1's audio is tracks[n]
+        std::unique_ptr<juce::XmlElement> state;
+        std::vector<TrackAudio> tracks;
+
+        //only touch this once isFinished()
+        juce::Result result = juce::Result::ok();
+
+        std::atomic<bool> cancelled{ false }, finished{ false };
+        std::atomic<double> progress{ 0.0 };
+    };
+
+    ProjectIO()
+        : pool(1)
+    {
+        //below the audio thread, and it's only waiting on the disk anyway
+        pool.setThreadPriorities(3);
+        formatManager.registerBasicFormats();
+    }
+
+    ~ProjectIO()
+    {
+        pool.removeAllJobs(true, 4000);
+    }
+
+    //Message thread: queues projectState and the tracks' audio to be written into projectFolder (made if
+    //it's new), as PROJECT_STATE_XML_FILENAME and a WAV per track that has audio
+    Request::Ptr save(const juce::String& projectName, const juce::File& projectFolder,
+                      std::unique_ptr<juce::XmlElement> projectState, std::vector<TrackAudio> tracks)
+    {
+        Request::Ptr request = new Request(Request::Type::save, projectName, projectFolder);
+        request->state = std::move(projectState);
+        request->tracks = std::move(tracks);
+        pool.addJob(new Job(*this, request), true);
+        return request;
+    }
+
+    //Message thread: queues the project in projectFolder to be read
+    Request::Ptr load(const juce::String& projectName, const juce::File& projectFolder)
+    {
+        Request::Ptr request = new Request(Request::Type::load, projectName, projectFolder);
+        pool.addJob(new Job(*this, request), true);
+        return request;
+    }
+
+private:
+    //DN: read and written a block at a time, so there's a chance to cancel and report progress in between
+    static constexpr int samplesPerBlock = 65536;
+
+    class Job : public juce::ThreadPoolJob
+    {
+    public:
+        Job(ProjectIO& ownerToUse, Request::Ptr requestToRun)
+            : juce::ThreadPoolJob(requestToRun->type == Request::Type::save ? "Save Project" : "Load Project"),
+              owner(ownerToUse), request(requestToRun)
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            request->result = request->type == Request::Type::save ? save() : load();
+
+            if (request->result.wasOk())
+                request->progress = 1.0;
+
+            request->finished = true;
+            return jobHasFinished;
+        }
+
+    private:
+        bool shouldStop()
+        {
+            return request->cancelled.load() || shouldExit();
+        }
+
+        static juce::Result cancelledResult()
+        {
+            return juce::Result::fail("Cancelled");
+        }
+
+        juce::Result save()
+        {
+            const auto& folder = request->projectFolder;
+            const bool folderIsNew = !folder.isDirectory();
+
+            if (request->state == nullptr)
+                return juce::Result::fail("Nothing to save");
+
+            if (!folder.createDirectory())
+                return juce::Result::fail("Couldn't create " + folder.getFullPathName());
+
+            auto result = writeToTempFiles();
+
+            if (result.wasOk())
+                result = moveTempFilesIntoPlace();
+
+            //a new project that didn't get saved shouldn't show up as an empty one
+            if (result.failed() && folderIsNew)
+                folder.deleteRecursively();
+
+            tempFiles.clear();
+            return result;
+        }
+
+        juce::Result writeToTempFiles()
+        {
+            juce::int64 totalSamples = 0, samplesDone = 0;
+
+            for (const auto& track : request->tracks)
+                if (track.take != nullptr)
+                    totalSamples += track.take->getNumSamples();
+
+            for (int i = 0; i < (int)request->tracks.size(); ++i)
+            {
+                const auto& track = request->tracks[(size_t)i];
+
+                //an empty track has no WAV, it loads as silence
+                if (track.take == nullptr || !track.take->hasAudio())
+                {
+                    samplesDone += track.take != nullptr ? track.take->getNumSamples() : 0;
+                    continue;
+                }
+
+                const auto file = request->projectFolder.getChildFile(DirectoryTree::getTrackWAVName(i + 1) + ".wav");
+                auto* tempFile = tempFiles.add(new juce::TemporaryFile(file));
+                auto fileStream = std::unique_ptr<juce::FileOutputStream>(tempFile->getFile().createOutputStream());
+
+                if (fileStream == nullptr)
+                    return juce::Result::fail("Couldn't write " + file.getFullPathName());
+
+                juce::WavAudioFormat wavFormat;
+                auto writer = std::unique_ptr<juce::AudioFormatWriter>(wavFormat.createWriterFor(fileStream.get(), track.sampleRate,
+                                                                       (unsigned int)track.take->getNumChannels(), 24, {}, 0));
+
+                if (writer == nullptr)
+                    return juce::Result::fail("Couldn't write " + file.getFullPathName());
+
+                fileStream.release(); // (the writer owns the stream now)
+                bool written = true, stopped = false;
+
+                //straight out of the take's chunks, nothing gets copied into one big buffer first
+                track.take->forEachChunk([&](int, const juce::AudioBuffer<float>& chunkAudio, int numSamples)
+                {
+                    if (stopped || !written)
+                        return;
+
+                    if (shouldStop())
+                    {
+                        stopped = true;
+                        return;
+                    }
+
+                    written = writer->writeFromAudioSampleBuffer(chunkAudio, 0, numSamples);
+                    samplesDone += numSamples;
+                    request->progress = 0.95 * (double)samplesDone / (double)juce::jmax((juce::int64)1, totalSamples);
+                });
+
+                writer.reset();
+
+                if (stopped)
+                    return cancelledResult();
+
+                if (!written)
+                    return juce::Result::fail("Couldn't write " + file.getFullPathName());
+            }
+
+            const auto stateFile = request->projectFolder.getChildFile(PROJECT_STATE_XML_FILENAME);
+            auto* tempFile = tempFiles.add(new juce::TemporaryFile(stateFile));
+
+            if (!request->state->writeTo(tempFile->getFile()))
+                return juce::Result::fail("Couldn't write " + stateFile.getFullPathName());
+
+            return shouldStop() ? cancelledResult() : juce::Result::ok();
+        }
+
+        //Past here it can't be cancelled - the project gets every new file, or keeps its old ones
+        juce::Result moveTempFilesIntoPlace()
+        {
+            juce::Array<juce::File> written;
+
+            for (auto* tempFile : tempFiles)
+            {
+                if (!tempFile->overwriteTargetFileWithTemporary())
+                    return juce::Result::fail("Couldn't write " + tempFile->getTargetFile().getFullPathName());
+
+                written.add(tempFile->getTargetFile());
+            }
+
+            //DN: WAVs left over from tracks that have since been removed or emptied would come back on loading
+            for (auto& file : request->projectFolder.findChildFiles(juce::File::findFiles, false, "*.wav"))
+                if (!written.contains(file))
+                    file.deleteFile();
+
+            return juce::Result::ok();
+        }
+
+        juce::Result load()
+        {
+            const auto& folder = request->projectFolder;
+            juce::XmlDocument projectStateDoc(folder.getChildFile(PROJECT_STATE_XML_FILENAME));
+            request->state = projectStateDoc.getDocumentElement();
+
+            if (request->state == nullptr)
+                return juce::Result::fail("Couldn't read " + request->projectName);
+
+            //DN: projects saved before the track count was stored always had 4
+            const int numTracks = juce::jlimit(1, MAX_NUM_TRACKS, request->state->getIntAttribute("numTracks", DEFAULT_NUM_TRACKS));
+            request->tracks.resize((size_t)numTracks);
+
+            for (int i = 0; i < numTracks; ++i)
+            {
+                if (shouldStop())
+                    return cancelledResult();
+
+                const auto file = folder.getChildFile(DirectoryTree::getTrackWAVName(i + 1) + ".wav");
+                std::unique_ptr<juce::AudioFormatReader> reader(owner.formatManager.createReaderFor(file));
+
+                //no WAV (or one that won't open) is an empty track
+                if (reader == nullptr || reader->lengthInSamples <= 0)
+                    continue;
+
+                const int length = (int)reader->lengthInSamples;
+                juce::AudioBuffer<float> loopBuffer((int)reader->numChannels, length);
+
+                for (int done = 0; done < length;)
+                {
+                    if (shouldStop())
+                        return cancelledResult();
+
+                    const int numSamples = juce::jmin(samplesPerBlock, length - done);
+
+                    if (!reader->read(&loopBuffer, done, numSamples, done, true, true))
+                        return juce::Result::fail("Couldn't read " + file.getFullPathName());
+
+                    done += numSamples;
+                    request->progress = ((double)i + (double)done / (double)length) / (double)numTracks;
+                }
+
+                auto& track = request->tracks[(size_t)i];
+                track.take = LoopTake::fromBuffer(loopBuffer);
+                track.sampleRate = reader->sampleRate;
+            }
+
+            return juce::Result::ok();
+        }
+
+        ProjectIO& owner;
+        Request::Ptr request;
+        juce::OwnedArray<juce::TemporaryFile> tempFiles;  //a save's, deleted unless they're moved into place
+    };
+
+    juce::AudioFormatManager formatManager;  //only used on the pool's thread
+
+    //last, so it's gone before anything its jobs use
+    juce::ThreadPool pool;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ProjectIO)
+};
@@ -0,0 +1,162 @@
+/*
+  ==============================================================================
+
+    RealtimeCheck.h
+
+    Runs the whole app on the dummy audio device with the real-time safety
+    checker on, works through a script of what someone might do with it
+    (play, record, overdub, record several tracks at once, reverse, undo,
+    change the tempo, add a track, stop and start again), and fails if the
+    audio thread did anything it shouldn't have along the way:
+
+        467AudioLoopStation --check-realtime [--report <file>]
+
+    Needs no sound card and no window, so it runs on a headless Linux CI
+    machine.  Nothing is checked unless the app was built with
+    LOOPSTATION_REALTIME_CHECKS=1 (the RealtimeCheck configuration).
+
+    The exit code is 0 if nothing was flagged, 1 if anything was (the report,
+    with a stack trace for each, goes to stdout and the --report file), and
+    2 if the check couldn't run.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <iostream>
+#include "DummyAudioDevice.h"
+#include "MainComponent.h"
+#include "RealtimeSafetyChecker.h"
+
+
+class RealtimeCheck : private juce::Timer
+{
+public:
+    static bool isCheckCommand(const juce::StringArray& arguments)
+    {
+        return arguments.contains("--check-realtime");
+    }
+
+    //Message thread, from JUCEApplication::initialise(): starts the script, and quits the app with the
+    //result once it's done
+    RealtimeCheck(const juce::StringArray& arguments)
+    {
+        const int reportIndex = arguments.indexOf("--report");
+
+        if (reportIndex >= 0 && reportIndex + 1 < arguments.size())
+            reportFile = juce::File::getCurrentWorkingDirectory().getChildFile(arguments[reportIndex + 1]);
+
+        if (!RealtimeSafetyChecker::isEnabledInBuild)
+        {
+            quitWith(couldNotRun, "This build doesn't have LOOPSTATION_REALTIME_CHECKS turned on, so nothing can be checked");
+            return;
+        }
+
+        mainComponent = std::make_unique<MainComponent>();
+
+        //whatever device the app opened is swapped for the dummy one, which calls back just the same
+        auto& deviceManager = mainComponent->deviceManager;
+        deviceManager.addAudioDeviceType(std::make_unique<DummyAudioIODeviceType>());
+        deviceManager.setCurrentAudioDeviceType(DUMMY_DEVICE_TYPE_NAME, true);
+
+        if (deviceManager.getCurrentAudioDevice() == nullptr)
+        {
+            quitWith(couldNotRun, "Couldn't open the dummy audio device");
+            return;
+        }
+
+        RealtimeSafetyChecker::enable();
+        startTime = juce::Time::getMillisecondCounterHiRes();
+        startTimer(50);
+    }
+
+    ~RealtimeCheck() override
+    {
+        stopTimer();
+        RealtimeSafetyChecker::disable();
+    }
+
+private:
+    enum ExitCode
+    {
+        passed = 0,
+        violationsFound = 1,
+        couldNotRun = 2
+    };
+
+    struct Step
+    {
+        double time;  //seconds after the start
+        const char* description;
+        std::function<void(MainComponent&)> action;
+    };
+
+    //A 2 second loop at first, so a take doesn't keep the script waiting
+    static std::vector<Step> getScript()
+    {
+        return {
+            { 0.0,  "loop length 120bpm x 4",           [](MainComponent& app) { app.setLoopLength(120, 4); } },
+            { 0.5,  "play",                             [](MainComponent& app) { app.clickPlay(); } },
+            { 1.0,  "metronome on",                     [](MainComponent& app) { app.clickMetronome(); } },
+            { 1.5,  "record track 1",                   [](MainComponent& app) { app.clickRecord(0); } },
+            { 6.0,  "overdub track 1",                  [](MainComponent& app) { app.clickOverdub(0); } },
+            { 10.0, "stop overdubbing track 1",         [](MainComponent& app) { app.clickOverdub(0); } },
+            { 10.5, "record tracks 2 and 3 together",   [](MainComponent& app) { app.clickRecord(1); app.clickRecord(2); } },
+            { 15.0, "reverse track 1",                  [](MainComponent& app) { app.clickReverse(0); } },
+            { 15.5, "undo track 1",                     [](MainComponent& app) { app.clickUndo(0); } },
+            { 16.0, "tempo to 100bpm",                  [](MainComponent& app) { app.setLoopLength(100, 4); } },
+            { 20.0, "add a track",                      [](MainComponent& app) { app.clickAddTrack(); } },
+            { 20.5, "record track 5",                   [](MainComponent& app) { app.clickRecord(4); } },
+            { 25.0, "stop",                             [](MainComponent& app) { app.clickStop(); } },
+            { 26.0, "play",                             [](MainComponent& app) { app.clickPlay(); } },
+            { 28.0, "stop, metronome off",              [](MainComponent& app) { app.clickStop(); app.clickMetronome(); } },
+            { 29.0, "done",                             [](MainComponent&) {} }
+        };
+    }
+
+    void timerCallback() override
+    {
+        const auto elapsed = (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+        while (nextStep < script.size() && script[nextStep].time <= elapsed)
+        {
+            const auto& step = script[nextStep++];
+            std::cout << juce::String(step.time, 1) << "s: " << step.description << std::endl;
+            step.action(*mainComponent);
+        }
+
+        if (nextStep < script.size())
+            return;
+
+        stopTimer();
+
+        //the audio stops first, so nothing's still adding to the results while they're read
+        mainComponent->deviceManager.closeAudioDevice();
+        RealtimeSafetyChecker::disable();
+
+        const auto report = RealtimeSafetyChecker::getReport();
+
+        if (reportFile != juce::File())
+            reportFile.replaceWithText(report);
+
+        quitWith(RealtimeSafetyChecker::getNumViolations() > 0 ? violationsFound : passed, report);
+    }
+
+    void quitWith(ExitCode exitCode, const juce::String& message)
+    {
+        (exitCode == passed ? std::cout : std::cerr) << message << std::endl;
+
+        juce::JUCEApplicationBase::getInstance()->setApplicationReturnValue(exitCode);
+        juce::JUCEApplicationBase::quit();
+    }
+
+    std::unique_ptr<MainComponent> mainComponent;
+    const std::vector<Step> script = getScript();
+    size_t nextStep = 0;
+    double startTime = 0.0;
+    juce::File reportFile;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RealtimeCheck)
+};
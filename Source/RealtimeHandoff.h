@@ -0,0 +1,192 @@
+/*
+  ==============================================================================
+
+    RealtimeHandoff.h
+
+    Lets the message thread swap out an object the audio thread is reading
+    (e.g. a loop's AudioBuffer) without either side ever taking a lock.
+
+    The audio thread wraps each use of the object in a ScopedRead, which bumps
+    an epoch counter on the way in and out (odd == inside a read).  Publishing
+    is a single atomic exchange, and the old object is handed to the shared
+    ReleasePool, whose background thread deletes it once the epoch shows the
+    reader can no longer be holding it.  Nothing is ever freed on the audio
+    thread and nothing the audio thread is using is ever freed.
+
+    There is one reader (the audio callback) and one writer (the message thread)
+    per handoff.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+
+class ReleasePool : private juce::Thread
+{
+public:
+    ReleasePool() : juce::Thread("Release Pool Thread")
+    {
+        startThread();
+    }
+
+    ~ReleasePool() override
+    {
+        stopThread(1000);
+        pending.clear();
+    }
+
+    //Queues an object for deletion once readerEpoch has moved past its current value
+    template <typename ObjectType>
+    void retire(std::unique_ptr<ObjectType> object, const std::atomic<juce::uint32>& readerEpoch)
+    {
+        if (object == nullptr)
+            return;
+
+        //read the epoch after the caller has swapped the pointer out, never before
+        const auto retiredAt = readerEpoch.load();
+
+        {
+            const juce::ScopedLock sl(pendingLock);
+            pending.push_back({ std::shared_ptr<void>(std::move(object)), &readerEpoch, retiredAt });
+        }
+
+        notify();
+    }
+
+    //Called when a reader goes away for good, so nothing can be reading its old objects
+    void releaseAllFrom(const std::atomic<juce::uint32>& readerEpoch)
+    {
+        std::vector<Entry> toDelete;
+
+        {
+            const juce::ScopedLock sl(pendingLock);
+            auto firstToDelete = std::stable_partition(pending.begin(), pending.end(),
+                                                       [&readerEpoch](const Entry& e) { return e.epoch != &readerEpoch; });
+            std::move(firstToDelete, pending.end(), std::back_inserter(toDelete));
+            pending.erase(firstToDelete, pending.end());
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<void> object;
+        const std::atomic<juce::uint32>* epoch;
+        juce::uint32 retiredAt;
+
+        bool isSafeToDelete() const
+        {
+            //even == the reader wasn't inside a read when we swapped, so it will pick up the new object
+            //otherwise wait until it has left the read it was in
+            return (retiredAt & 1) == 0 || epoch->load() != retiredAt;
+        }
+    };
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            std::vector<Entry> toDelete;
+            bool anythingStillPending = false;
+
+            {
+                const juce::ScopedLock sl(pendingLock);
+                auto firstToDelete = std::stable_partition(pending.begin(), pending.end(),
+                                                           [](const Entry& e) { return !e.isSafeToDelete(); });
+                std::move(firstToDelete, pending.end(), std::back_inserter(toDelete));
+                pending.erase(firstToDelete, pending.end());
+                anythingStillPending = !pending.empty();
+            }
+
+            //deleting happens here, outside the lock
+            toDelete.clear();
+
+            wait(anythingStillPending ? 10 : -1);
+        }
+    }
+
+    juce::CriticalSection pendingLock;
+    std::vector<Entry> pending;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ReleasePool)
+};
+
+
+template <typename ObjectType>
+class RealtimeHandoff
+{
+public:
+    explicit RealtimeHandoff(std::unique_ptr<ObjectType> initialObject = {})
+        : current(initialObject.release())
+    {
+    }
+
+    ~RealtimeHandoff()
+    {
+        releasePool->releaseAllFrom(epoch);
+        delete current.load();
+    }
+
+    //Audio thread: hold one of these for as long as you use the object
+    class ScopedRead
+    {
+    public:
+        explicit ScopedRead(RealtimeHandoff& handoffToRead) : handoff(handoffToRead)
+        {
+            handoff.epoch.fetch_add(1);
+            object = handoff.current.load();
+        }
+
+        ~ScopedRead()
+        {
+            handoff.epoch.fetch_add(1);
+        }
+
+        ObjectType* get() const noexcept        { return object; }
+        ObjectType* operator->() const noexcept { return object; }
+        ObjectType& operator*() const noexcept  { return *object; }
+
+    private:
+        RealtimeHandoff& handoff;
+        ObjectType* object = nullptr;
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedRead)
+    };
+
+    //Message thread: swap in a new object, the old one gets freed on the release pool thread
+    void publish(std::unique_ptr<ObjectType> newObject)
+    {
+        std::unique_ptr<ObjectType> oldObject(current.exchange(newObject.release()));
+        releasePool->retire(std::move(oldObject), epoch);
+    }
+
+    //Message thread only - safe because that's the only thread that can retire the object
+    ObjectType* getForWriter() const noexcept
+    {
+        return current.load();
+    }
+
+    //Message thread: returns once the reader can no longer be using anything it picked up
+    //before this call, e.g. before deleting something the old object pointed at.
+    //This waits at most one audio block
+    void waitForReaderToMoveOn() const
+    {
+        const auto epochWhenCalled = epoch.load();
+
+        if ((epochWhenCalled & 1) == 0)
+            return;
+
+        while (epoch.load() == epochWhenCalled)
+            juce::Thread::yield();
+    }
+
+private:
+    std::atomic<ObjectType*> current{ nullptr };
+    std::atomic<juce::uint32> epoch{ 0 };
+    juce::SharedResourcePointer<ReleasePool> releasePool;
+
+    JUCE_DECLARE_NON_COPYABLE(RealtimeHandoff)
+};
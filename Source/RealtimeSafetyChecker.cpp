@@ -0,0 +1,439 @@
+/*
+  ==============================================================================
+
+    RealtimeSafetyChecker.cpp
+
+    The interception itself.  The functions below replace the C library's
+    own for the whole process (anything that calls malloc, including
+    operator new, or pthread_mutex_lock, including juce::CriticalSection and
+    std::mutex, ends up here), check whether the calling thread is marked as
+    the audio thread, and then call through to the real thing.  Allocation
+    goes to glibc's __libc_* entry points, everything else to whatever
+    dlsym(RTLD_NEXT) finds (dlvsym() for the condition variables, which
+    have an older version too), so none of it depends on the order things
+    get initialised in.
+
+    Recording a violation mustn't allocate or lock either (it happens inside
+    malloc), so violations go into a fixed table, and only the raw return
+    addresses are kept - they're turned into symbols when the report is
+    written.  Functions in the app itself only get names if it's linked with
+    -rdynamic, otherwise it's module+offset, for addr2line.
+
+    Linux only.  Anywhere else the audio thread is still marked, but nothing
+    gets intercepted.
+
+  ==============================================================================
+*/
+
+//the fortified inline wrappers for read() etc. would clash with the definitions below
+#undef _FORTIFY_SOURCE
+
+#include "RealtimeSafetyChecker.h"
+
+#if LOOPSTATION_REALTIME_CHECKS
+
+#if JUCE_LINUX
+ #include <cxxabi.h>
+ #include <dlfcn.h>
+ #include <errno.h>
+ #include <execinfo.h>
+ #include <fcntl.h>
+ #include <poll.h>
+ #include <pthread.h>
+ #include <semaphore.h>
+ #include <stdarg.h>
+ #include <time.h>
+ #include <unistd.h>
+#endif
+
+namespace
+{
+    constexpr int maxDistinctViolations = 256;
+    constexpr int maxFrames = 32;
+
+    struct Violation
+    {
+        RealtimeSafetyChecker::ViolationType type;
+        const char* function;
+        int numFrames;
+        void* frames[maxFrames];
+        std::atomic<int> count;
+        std::atomic<bool> ready;
+    };
+
+    Violation violations[maxDistinctViolations];
+    std::atomic<int> numDistinctViolations{ 0 };
+    std::atomic<int> numViolations{ 0 };
+    std::atomic<bool> enabled{ false };
+
+    thread_local int audioThreadDepth = 0;
+    thread_local int allowedDepth = 0;
+    thread_local bool recordingViolation = false;
+
+    const char* getTypeName(RealtimeSafetyChecker::ViolationType type) noexcept
+    {
+        switch (type)
+        {
+            case RealtimeSafetyChecker::ViolationType::allocation:      return "allocation";
+            case RealtimeSafetyChecker::ViolationType::deallocation:    return "deallocation";
+            case RealtimeSafetyChecker::ViolationType::lock:            return "lock or wait";
+            case RealtimeSafetyChecker::ViolationType::systemCall:      return "blocking system call";
+        }
+
+        return "";
+    }
+
+   #if JUCE_LINUX
+    bool isSameViolation(const Violation& violation, RealtimeSafetyChecker::ViolationType type,
+                         const char* function, void* const* frames, int numFrames) noexcept
+    {
+        if (violation.type != type || violation.function != function || violation.numFrames != numFrames)
+            return false;
+
+        for (int i = 0; i < numFrames; ++i)
+            if (violation.frames[i] != frames[i])
+                return false;
+
+        return true;
+    }
+
+    //Called from inside the interceptors, so it only touches the fixed table.  Two threads recording the same
+    //violation at once can end up with an entry each, which only means it's listed twice.  Never inlined, so
+    //it and the interceptor are always the top two frames
+    __attribute__((noinline)) void recordViolation(RealtimeSafetyChecker::ViolationType type, const char* function) noexcept
+    {
+        if (audioThreadDepth == 0 || allowedDepth > 0 || recordingViolation || !enabled.load(std::memory_order_relaxed))
+            return;
+
+        recordingViolation = true;
+        numViolations.fetch_add(1);
+
+        void* frames[maxFrames];
+        const int numFrames = backtrace(frames, maxFrames);
+        const int numRecorded = juce::jmin(numDistinctViolations.load(), maxDistinctViolations);
+        bool found = false;
+
+        for (int i = 0; i < numRecorded && !found; ++i)
+        {
+            auto& violation = violations[i];
+
+            if (violation.ready.load() && isSameViolation(violation, type, function, frames, numFrames))
+            {
+                violation.count.fetch_add(1);
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            const int index = numDistinctViolations.fetch_add(1);
+
+            if (index < maxDistinctViolations)
+            {
+                auto& violation = violations[index];
+                violation.type = type;
+                violation.function = function;
+                violation.numFrames = numFrames;
+                std::copy(frames, frames + numFrames, violation.frames);
+                violation.count = 1;
+                violation.ready = true;
+            }
+        }
+
+        recordingViolation = false;
+    }
+
+    //Where the real function is, looked up the first time it's needed.  If it has a version, that one's
+    //asked for first: depending on the glibc, plain dlsym() can hand back the oldest, which for some (the
+    //pthread_cond_* ones) is a compatibility version that isn't the one the rest of the process is using
+    template <typename FunctionType>
+    FunctionType getReal(std::atomic<void*>& cached, const char* name, const char* version = nullptr) noexcept
+    {
+        auto* function = cached.load(std::memory_order_acquire);
+
+        if (function == nullptr)
+        {
+            if (version != nullptr)
+                function = dlvsym(RTLD_NEXT, name, version);
+
+            //a platform that only ever had the one version
+            if (function == nullptr)
+                function = dlsym(RTLD_NEXT, name);
+
+            cached.store(function, std::memory_order_release);
+        }
+
+        return reinterpret_cast<FunctionType>(function);
+    }
+
+    //"_ZN13MainComponent17getNextAudioBlock...+0x45" out of one of backtrace_symbols()'s lines, demangled
+    juce::String describeFrame(const char* symbol)
+    {
+        const juce::String line(symbol);
+        const auto mangled = line.fromFirstOccurrenceOf("(", false, false).upToFirstOccurrenceOf("+", false, false);
+
+        if (mangled.isEmpty())
+            return line;
+
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(mangled.toRawUTF8(), nullptr, nullptr, &status);
+
+        if (status != 0 || demangled == nullptr)
+            return line;
+
+        const auto result = line.replace(mangled, demangled);
+        ::free(demangled);
+        return result;
+    }
+   #endif
+}
+
+void RealtimeSafetyChecker::enable()
+{
+   #if JUCE_LINUX
+    //backtrace() loads the unwinder the first time it's called, which allocates - do that now
+    void* frames[4];
+    backtrace(frames, 4);
+   #endif
+
+    for (auto& violation : violations)
+        violation.ready = false;
+
+    numDistinctViolations = 0;
+    numViolations = 0;
+    enabled = true;
+}
+
+void RealtimeSafetyChecker::disable() noexcept
+{
+    enabled = false;
+}
+
+int RealtimeSafetyChecker::getNumViolations() noexcept
+{
+    return numViolations.load();
+}
+
+juce::String RealtimeSafetyChecker::getReport()
+{
+    const int total = numViolations.load();
+
+    if (total == 0)
+        return "No real-time safety violations";
+
+    const int numDistinct = juce::jmin(numDistinctViolations.load(), maxDistinctViolations);
+    juce::String report;
+    report << total << " real-time safety violation(s) on the audio thread, " << numDistinct << " distinct:" << juce::newLine;
+
+    for (int i = 0; i < numDistinct; ++i)
+    {
+        const auto& violation = violations[i];
+
+        if (!violation.ready.load())
+            continue;
+
+        report << juce::newLine << "#" << (i + 1) << " " << getTypeName(violation.type) << " (" << violation.function << "), "
+               << violation.count.load() << " time(s)" << juce::newLine;
+
+       #if JUCE_LINUX
+        //skips the frames inside the checker itself
+        if (auto* symbols = backtrace_symbols(violation.frames, violation.numFrames))
+        {
+            for (int frame = 2; frame < violation.numFrames; ++frame)
+                report << "    " << describeFrame(symbols[frame]) << juce::newLine;
+
+            ::free(symbols);
+        }
+       #endif
+    }
+
+    if (numDistinctViolations.load() > maxDistinctViolations)
+        report << juce::newLine << "(only the first " << maxDistinctViolations << " distinct violations are listed)" << juce::newLine;
+
+    return report;
+}
+
+void RealtimeSafetyChecker::enterAudioThread() noexcept    { ++audioThreadDepth; }
+void RealtimeSafetyChecker::leaveAudioThread() noexcept    { --audioThreadDepth; }
+void RealtimeSafetyChecker::enterAllowed() noexcept        { ++allowedDepth; }
+void RealtimeSafetyChecker::leaveAllowed() noexcept        { --allowedDepth; }
+
+//==============================================================================
+#if JUCE_LINUX
+
+using ViolationType = RealtimeSafetyChecker::ViolationType;
+
+extern "C"
+{
+    void* __libc_malloc(size_t);
+    void* __libc_calloc(size_t, size_t);
+    void* __libc_realloc(void*, size_t);
+    void* __libc_memalign(size_t, size_t);
+    void __libc_free(void*);
+
+    //------------------------------------------------------------------------------
+    void* malloc(size_t size) noexcept
+    {
+        recordViolation(ViolationType::allocation, "malloc");
+        return __libc_malloc(size);
+    }
+
+    void* calloc(size_t numElements, size_t size) noexcept
+    {
+        recordViolation(ViolationType::allocation, "calloc");
+        return __libc_calloc(numElements, size);
+    }
+
+    void* realloc(void* pointer, size_t size) noexcept
+    {
+        recordViolation(ViolationType::allocation, "realloc");
+        return __libc_realloc(pointer, size);
+    }
+
+    void* memalign(size_t alignment, size_t size) noexcept
+    {
+        recordViolation(ViolationType::allocation, "memalign");
+        return __libc_memalign(alignment, size);
+    }
+
+    void* aligned_alloc(size_t alignment, size_t size) noexcept
+    {
+        recordViolation(ViolationType::allocation, "aligned_alloc");
+        return __libc_memalign(alignment, size);
+    }
+
+    int posix_memalign(void** result, size_t alignment, size_t size) noexcept
+    {
+        recordViolation(ViolationType::allocation, "posix_memalign");
+
+        if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+            return EINVAL;
+
+        *result = __libc_memalign(alignment, size);
+        return *result != nullptr || size == 0 ? 0 : ENOMEM;
+    }
+
+    void free(void* pointer) noexcept
+    {
+        if (pointer != nullptr)
+            recordViolation(ViolationType::deallocation, "free");
+
+        __libc_free(pointer);
+    }
+
+    //------------------------------------------------------------------------------
+    static std::atomic<void*> realMutexLock, realRwlockRdlock, realRwlockWrlock, realCondWait, realCondTimedwait,
+                              realSemWait, realSemTimedwait;
+
+    //DN: the condition variables glibc has used since 2.3.2.  On x86-64 an unversioned lookup can find the
+    //2.2.5 ones, which don't work with pthread_cond_signal() from the new ones
+    static constexpr const char* condVersion = "GLIBC_2.3.2";
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept
+    {
+        recordViolation(ViolationType::lock, "pthread_mutex_lock");
+        return getReal<int (*)(pthread_mutex_t*)>(realMutexLock, "pthread_mutex_lock")(mutex);
+    }
+
+    int pthread_rwlock_rdlock(pthread_rwlock_t* rwlock) noexcept
+    {
+        recordViolation(ViolationType::lock, "pthread_rwlock_rdlock");
+        return getReal<int (*)(pthread_rwlock_t*)>(realRwlockRdlock, "pthread_rwlock_rdlock")(rwlock);
+    }
+
+    int pthread_rwlock_wrlock(pthread_rwlock_t* rwlock) noexcept
+    {
+        recordViolation(ViolationType::lock, "pthread_rwlock_wrlock");
+        return getReal<int (*)(pthread_rwlock_t*)>(realRwlockWrlock, "pthread_rwlock_wrlock")(rwlock);
+    }
+
+    int pthread_cond_wait(pthread_cond_t* condition, pthread_mutex_t* mutex)
+    {
+        recordViolation(ViolationType::lock, "pthread_cond_wait");
+        return getReal<int (*)(pthread_cond_t*, pthread_mutex_t*)>(realCondWait, "pthread_cond_wait", condVersion)(condition, mutex);
+    }
+
+    int pthread_cond_timedwait(pthread_cond_t* condition, pthread_mutex_t* mutex, const struct timespec* time)
+    {
+        recordViolation(ViolationType::lock, "pthread_cond_timedwait");
+        return getReal<int (*)(pthread_cond_t*, pthread_mutex_t*, const struct timespec*)>(realCondTimedwait, "pthread_cond_timedwait", condVersion)(condition, mutex, time);
+    }
+
+    int sem_wait(sem_t* semaphore)
+    {
+        recordViolation(ViolationType::lock, "sem_wait");
+        return getReal<int (*)(sem_t*)>(realSemWait, "sem_wait")(semaphore);
+    }
+
+    int sem_timedwait(sem_t* semaphore, const struct timespec* time)
+    {
+        recordViolation(ViolationType::lock, "sem_timedwait");
+        return getReal<int (*)(sem_t*, const struct timespec*)>(realSemTimedwait, "sem_timedwait")(semaphore, time);
+    }
+
+    //------------------------------------------------------------------------------
+    static std::atomic<void*> realOpen, realOpen64, realRead, realWrite, realClose, realPoll, realNanosleep, realUsleep;
+
+    int open(const char* path, int flags, ...)
+    {
+        recordViolation(ViolationType::systemCall, "open");
+
+        va_list args;
+        va_start(args, flags);
+        const auto mode = (flags & O_CREAT) != 0 ? va_arg(args, mode_t) : (mode_t)0;
+        va_end(args);
+
+        return getReal<int (*)(const char*, int, ...)>(realOpen, "open")(path, flags, mode);
+    }
+
+    int open64(const char* path, int flags, ...)
+    {
+        recordViolation(ViolationType::systemCall, "open64");
+
+        va_list args;
+        va_start(args, flags);
+        const auto mode = (flags & O_CREAT) != 0 ? va_arg(args, mode_t) : (mode_t)0;
+        va_end(args);
+
+        return getReal<int (*)(const char*, int, ...)>(realOpen64, "open64")(path, flags, mode);
+    }
+
+    ssize_t read(int file, void* buffer, size_t numBytes)
+    {
+        recordViolation(ViolationType::systemCall, "read");
+        return getReal<ssize_t (*)(int, void*, size_t)>(realRead, "read")(file, buffer, numBytes);
+    }
+
+    ssize_t write(int file, const void* buffer, size_t numBytes)
+    {
+        recordViolation(ViolationType::systemCall, "write");
+        return getReal<ssize_t (*)(int, const void*, size_t)>(realWrite, "write")(file, buffer, numBytes);
+    }
+
+    int close(int file)
+    {
+        recordViolation(ViolationType::systemCall, "close");
+        return getReal<int (*)(int)>(realClose, "close")(file);
+    }
+
+    int poll(struct pollfd* files, nfds_t numFiles, int timeout)
+    {
+        recordViolation(ViolationType::systemCall, "poll");
+        return getReal<int (*)(struct pollfd*, nfds_t, int)>(realPoll, "poll")(files, numFiles, timeout);
+    }
+
+    int nanosleep(const struct timespec* duration, struct timespec* remaining)
+    {
+        recordViolation(ViolationType::systemCall, "nanosleep");
+        return getReal<int (*)(const struct timespec*, struct timespec*)>(realNanosleep, "nanosleep")(duration, remaining);
+    }
+
+    int usleep(useconds_t microseconds)
+    {
+        recordViolation(ViolationType::systemCall, "usleep");
+        return getReal<int (*)(useconds_t)>(realUsleep, "usleep")(microseconds);
+    }
+}
+
+#endif
+#endif
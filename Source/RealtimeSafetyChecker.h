@@ -0,0 +1,98 @@
+/*
+  ==============================================================================
+
+    RealtimeSafetyChecker.h
+
+    Catches the audio thread doing things it mustn't: allocating or freeing
+    memory, taking a lock or waiting on something, sleeping, or file I/O.
+    The audio callback (and the render workers, while they're running its
+    jobs) mark themselves with a ScopedAudioThread, and while a thread is
+    marked every call it makes to malloc/free, pthread locks and waits, and
+    a handful of blocking system calls gets recorded, with a stack trace, as
+    a violation.  Anything that's called from the same place over and over
+    is only recorded once, with a count.
+
+    It's opt-in: build with LOOPSTATION_REALTIME_CHECKS=1 (the RealtimeCheck
+    configuration) and the calls are intercepted on Linux - see
+    RealtimeSafetyChecker.cpp.  Otherwise everything here compiles away to
+    nothing.  RealtimeCheck.h runs the app on a dummy device with it on.
+
+    The few things the audio thread does on purpose that would count (e.g.
+    waking a sleeping render worker) go inside a ScopedAllowed.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#ifndef LOOPSTATION_REALTIME_CHECKS
+ #define LOOPSTATION_REALTIME_CHECKS 0
+#endif
+
+
+class RealtimeSafetyChecker
+{
+public:
+    static constexpr bool isEnabledInBuild = LOOPSTATION_REALTIME_CHECKS != 0;
+
+    enum class ViolationType
+    {
+        allocation,
+        deallocation,
+        lock,
+        systemCall
+    };
+
+   #if LOOPSTATION_REALTIME_CHECKS
+    //Marks the calling thread as rendering audio until it goes out of scope
+    struct ScopedAudioThread
+    {
+        ScopedAudioThread() noexcept    { enterAudioThread(); }
+        ~ScopedAudioThread() noexcept   { leaveAudioThread(); }
+    };
+
+    //Something the audio thread does on purpose that would otherwise be a violation
+    struct ScopedAllowed
+    {
+        ScopedAllowed() noexcept        { enterAllowed(); }
+        ~ScopedAllowed() noexcept       { leaveAllowed(); }
+    };
+
+    //Starts recording violations (nothing is recorded until this is called), and forgets any from before
+    static void enable();
+    static void disable() noexcept;
+
+    //How many times the audio thread has done something it shouldn't since enable()
+    static int getNumViolations() noexcept;
+
+    //Message thread, once the audio has stopped or the checker is disabled: every distinct violation,
+    //with how many times it happened and where from
+    static juce::String getReport();
+
+   private:
+    static void enterAudioThread() noexcept;
+    static void leaveAudioThread() noexcept;
+    static void enterAllowed() noexcept;
+    static void leaveAllowed() noexcept;
+
+   #else
+    struct ScopedAudioThread
+    {
+        ScopedAudioThread() noexcept {}
+        ~ScopedAudioThread() noexcept {}
+    };
+
+    struct ScopedAllowed
+    {
+        ScopedAllowed() noexcept {}
+        ~ScopedAllowed() noexcept {}
+    };
+
+    static void enable() {}
+    static void disable() noexcept {}
+    static int getNumViolations() noexcept              { return 0; }
+    static juce::String getReport()                     { return "Built without LOOPSTATION_REALTIME_CHECKS, nothing was checked"; }
+   #endif
+};
@@ -0,0 +1,123 @@
+/*
+  ==============================================================================
+
+    RenderThreadPool.cpp
+
+    The workers' semaphore, which is different on every platform.  Posting
+    one is the only thing the audio thread does to wake a worker, so none of
+    these take a lock to do it: glibc's sem_post is an atomic increment, plus
+    a futex wake if someone's waiting, dispatch_semaphore_signal only goes to
+    the kernel when there's a waiter, and ReleaseSemaphore is a single kernel
+    call.  The waiting side is only ever a worker, so it can block however
+    it likes.
+
+  ==============================================================================
+*/
+
+#include "RenderThreadPool.h"
+
+#if JUCE_WINDOWS
+ #include <windows.h>
+#elif JUCE_MAC || JUCE_IOS
+ #include <dispatch/dispatch.h>
+#else
+ #include <errno.h>
+ #include <semaphore.h>
+ #include <time.h>
+#endif
+
+#if JUCE_WINDOWS
+
+RenderThreadPool::Semaphore::Semaphore()
+    : handle(CreateSemaphoreW(nullptr, 0, 0x7fffffff, nullptr))
+{
+    jassert(handle != nullptr);
+}
+
+RenderThreadPool::Semaphore::~Semaphore()
+{
+    CloseHandle(handle);
+}
+
+void RenderThreadPool::Semaphore::post() noexcept
+{
+    ReleaseSemaphore(handle, 1, nullptr);
+}
+
+void RenderThreadPool::Semaphore::wait(int timeOutMilliseconds) noexcept
+{
+    WaitForSingleObject(handle, timeOutMilliseconds < 0 ? INFINITE : (DWORD)timeOutMilliseconds);
+}
+
+#elif JUCE_MAC || JUCE_IOS
+
+RenderThreadPool::Semaphore::Semaphore()
+    : handle(dispatch_semaphore_create(0))
+{
+    jassert(handle != nullptr);
+}
+
+RenderThreadPool::Semaphore::~Semaphore()
+{
+    dispatch_release(static_cast<dispatch_semaphore_t>(handle));
+}
+
+void RenderThreadPool::Semaphore::post() noexcept
+{
+    dispatch_semaphore_signal(static_cast<dispatch_semaphore_t>(handle));
+}
+
+void RenderThreadPool::Semaphore::wait(int timeOutMilliseconds) noexcept
+{
+    dispatch_semaphore_wait(static_cast<dispatch_semaphore_t>(handle),
+                            timeOutMilliseconds < 0 ? DISPATCH_TIME_FOREVER
+                                                    : dispatch_time(DISPATCH_TIME_NOW, (int64_t)timeOutMilliseconds * (int64_t)NSEC_PER_MSEC));
+}
+
+#else
+
+RenderThreadPool::Semaphore::Semaphore()
+    : handle(new sem_t())
+{
+    const auto result = sem_init(static_cast<sem_t*>(handle), 0, 0);
+    jassert(result == 0);
+    juce::ignoreUnused(result);
+}
+
+RenderThreadPool::Semaphore::~Semaphore()
+{
+    sem_destroy(static_cast<sem_t*>(handle));
+    delete static_cast<sem_t*>(handle);
+}
+
+void RenderThreadPool::Semaphore::post() noexcept
+{
+    sem_post(static_cast<sem_t*>(handle));
+}
+
+void RenderThreadPool::Semaphore::wait(int timeOutMilliseconds) noexcept
+{
+    auto* semaphore = static_cast<sem_t*>(handle);
+
+    if (timeOutMilliseconds < 0)
+    {
+        while (sem_wait(semaphore) != 0 && errno == EINTR) {}
+        return;
+    }
+
+    //sem_timedwait wants the time it gives up at, on the realtime clock
+    timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += timeOutMilliseconds / 1000;
+    until.tv_nsec += (long)(timeOutMilliseconds % 1000) * 1000000L;
+
+    if (until.tv_nsec >= 1000000000L)
+    {
+        ++until.tv_sec;
+        until.tv_nsec -= 1000000000L;
+    }
+
+    while (sem_timedwait(semaphore, &until) != 0 && errno == EINTR) {}
+}
+
+#endif
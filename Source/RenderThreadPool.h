@@ -0,0 +1,237 @@
+/*
+  ==============================================================================
+
+    RenderThreadPool.h
+
+    A small pool of worker threads the audio callback can hand per-track
+    rendering to, so a block with lots of tracks gets spread across cores.
+
+    runJobs() never allocates and never takes a lock.  Each job index is
+    claimed with a compare-and-swap on one shared word that holds the block's
+    generation, its number of jobs and the next index, so a late worker can't
+    claim work from the next block (or past the end of this one), and
+    whichever thread is free takes the next track and the load balances itself.
+    The calling (audio) thread claims and runs jobs too, so it's never left
+    waiting on a worker that hasn't got round to the block yet - it only waits
+    for jobs a worker is already in the middle of.  The workers run at the
+    same realtime priority as the audio thread, so one of those isn't going
+    to be preempted by anything less urgent.
+
+    Between blocks the workers spin for a few tens of microseconds in case the
+    next block is right behind, then go to sleep until the audio thread wakes
+    them, so an idle pool doesn't burn a core.  They're usually asleep by the
+    time the next block comes, so waking them has to be cheap: it's a
+    semaphore post (see RenderThreadPool.cpp), with no mutex in it the way
+    juce::WaitableEvent has, so the audio thread never waits on a worker.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include "RealtimeSafetyChecker.h"
+
+#if JUCE_INTEL
+ #include <emmintrin.h>
+#endif
+
+
+class RenderThreadPool
+{
+public:
+    explicit RenderThreadPool(int numWorkerThreads = juce::jmax(0, juce::SystemStats::getNumCpus() - 1))
+    {
+        for (int i = 0; i < numWorkerThreads; ++i)
+            workers.add(new Worker(*this, i));
+
+        //realtime, like the audio thread - it waits on whatever job a worker has claimed
+        for (auto* worker : workers)
+            worker->startThread(10);
+    }
+
+    ~RenderThreadPool()
+    {
+        for (auto* worker : workers)
+            worker->signalThreadShouldExit();
+
+        for (auto* worker : workers)
+        {
+            worker->wakeUp.post();
+            worker->stopThread(2000);
+        }
+    }
+
+    int getNumWorkers() const noexcept { return workers.size(); }
+
+    //Audio thread: calls job(index) for every index in [0, numJobs) across the workers and
+    //the calling thread, and returns once they've all finished.  job mustn't allocate or lock,
+    //and it must be safe to call for different indices at the same time
+    template <typename JobFunction>
+    void runJobs(int numJobs, JobFunction& job)
+    {
+        if (numJobs <= 0)
+            return;
+
+        //the state word has room for 65535 jobs a block, far more than MAX_NUM_TRACKS
+        if (workers.isEmpty() || numJobs == 1 || numJobs > maxJobsPerBlock)
+        {
+            jassert(numJobs <= maxJobsPerBlock);
+
+            for (int i = 0; i < numJobs; ++i)
+                job(i);
+
+            return;
+        }
+
+        jobContext = &job;
+        jobFunction = [](void* context, int index) { (*static_cast<JobFunction*>(context))(index); };
+        jobsFinished.store(0);
+
+        //the job count goes out with the generation, so no worker sees one without the other
+        const auto generation = ++currentGeneration;
+        jobState.store(makeJobState(generation, numJobs, 0));
+
+        //one post per sleep - a worker that's already woken up by itself doesn't need another.
+        //Whatever they haven't claimed by the time we get going, we run ourselves
+        for (auto* worker : workers)
+            if (worker->isSleeping.exchange(false))
+                worker->wakeUp.post();
+
+        runAvailableJobs(generation);
+
+        //every job's been claimed - all that's left is whatever a worker is part way through
+        while (jobsFinished.load() < numJobs)
+            spinPause();
+    }
+
+private:
+    //A semaphore that can be posted from the audio thread without taking a lock or waiting: a
+    //futex-based sem_t on Linux, a dispatch semaphore on Apple's, a kernel semaphore on Windows.
+    //Defined in RenderThreadPool.cpp, so the platform headers stay out of here
+    class Semaphore
+    {
+    public:
+        Semaphore();
+        ~Semaphore();
+
+        void post() noexcept;
+
+        //returns early if it's posted, or never if timeOutMilliseconds is negative
+        void wait(int timeOutMilliseconds) noexcept;
+
+    private:
+        void* handle = nullptr;
+
+        JUCE_DECLARE_NON_COPYABLE(Semaphore)
+    };
+
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(RenderThreadPool& ownerPool, int index)
+            : juce::Thread("Render Worker " + juce::String(index)), pool(ownerPool)
+        {
+        }
+
+        void run() override
+        {
+            juce::uint32 lastGeneration = 0;
+            auto idleSince = juce::Time::getHighResolutionTicks();
+            const auto maxIdleSpinTicks = juce::Time::secondsToHighResolutionTicks(maxIdleSpinSeconds);
+
+            while (!threadShouldExit())
+            {
+                const auto generation = getGeneration(pool.jobState.load());
+
+                if (generation != lastGeneration)
+                {
+                    //the jobs are part of the audio callback, so they're held to the same rules
+                    const RealtimeSafetyChecker::ScopedAudioThread audioThread;
+                    lastGeneration = generation;
+                    pool.runAvailableJobs(generation);
+                    idleSince = juce::Time::getHighResolutionTicks();
+                    continue;
+                }
+
+                if (juce::Time::getHighResolutionTicks() - idleSince < maxIdleSpinTicks)
+                {
+                    spinPause();
+                    continue;
+                }
+
+                //nothing's come in for a while, go to sleep until the audio thread wakes us.
+                //isSleeping is set before re-checking, so a block posted in between is never missed
+                isSleeping.store(true);
+
+                if (getGeneration(pool.jobState.load()) == lastGeneration)
+                    wakeUp.wait(100);
+
+                isSleeping.store(false);
+                idleSince = juce::Time::getHighResolutionTicks();
+            }
+        }
+
+        RenderThreadPool& pool;
+        std::atomic<bool> isSleeping{ false };
+        Semaphore wakeUp;
+
+        //long enough to catch a block that follows straight on (e.g. a device splitting its buffer),
+        //short enough that an idle pool sleeps rather than spins between ordinary blocks
+        static constexpr double maxIdleSpinSeconds = 0.00005;
+    };
+
+    //Claims and runs jobs from the given generation until there are none left
+    void runAvailableJobs(juce::uint32 generation)
+    {
+        for (;;)
+        {
+            auto state = jobState.load();
+
+            if (getGeneration(state) != generation)
+                return;
+
+            const auto index = getNextIndex(state);
+
+            if (index >= getNumJobs(state))
+                return;
+
+            //fails if another thread claimed it first, or a new block has started since the load
+            if (jobState.compare_exchange_weak(state, state + 1))
+            {
+                jobFunction(jobContext, index);
+                jobsFinished.fetch_add(1);
+            }
+        }
+    }
+
+    static constexpr int maxJobsPerBlock = 0xffff;
+
+    static juce::uint64 makeJobState(juce::uint32 generation, int numJobs, int nextIndex) noexcept
+    {
+        return ((juce::uint64)generation << 32) | ((juce::uint64)(juce::uint32)numJobs << 16) | (juce::uint64)(juce::uint32)nextIndex;
+    }
+
+    static juce::uint32 getGeneration(juce::uint64 state) noexcept  { return (juce::uint32)(state >> 32); }
+    static int getNumJobs(juce::uint64 state) noexcept               { return (int)((state >> 16) & 0xffff); }
+    static int getNextIndex(juce::uint64 state) noexcept             { return (int)(state & 0xffff); }
+
+    static void spinPause() noexcept
+    {
+       #if JUCE_INTEL
+        _mm_pause();
+       #endif
+    }
+
+    juce::OwnedArray<Worker> workers;
+
+    //top 32 bits: generation of the current block, then 16 bits each for its number of jobs and the
+    //next job index to claim (which never gets past the number of jobs, so it can't carry into it)
+    std::atomic<juce::uint64> jobState{ 0 };
+    juce::uint32 currentGeneration = 0;
+    std::atomic<int> jobsFinished{ 0 };
+    void (*jobFunction)(void*, int) = nullptr;
+    void* jobContext = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RenderThreadPool)
+};
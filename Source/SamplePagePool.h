@@ -0,0 +1,124 @@
+/*
+  ==============================================================================
+
+    SamplePagePool.h
+
+    Where all loop audio lives.  Memory is allocated in slabs of fixed-size
+    pages (one channel of one LoopTake chunk each), aligned to the cache line,
+    and a page that's no longer needed goes back on the free list rather than
+    being freed - so recording, overdubbing, changing the loop length or
+    loading another project just reuses pages that are already there.
+
+    Silence never needs a page: LoopTake leaves silent chunks empty and reads
+    them from the one shared silent page instead.
+
+    Pages are taken and given back on the message thread (or the release pool
+    thread, when an old take is retired, a TimeStretcher thread building a
+    stretched one, or the disk thread letting go of a take it's written out),
+    never the audio thread.  One pool is
+    shared by every track, through a SharedResourcePointer.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+
+class SamplePagePool
+{
+public:
+    static constexpr int samplesPerPage = 16384;
+
+    SamplePagePool()
+    {
+        addSlab(initialNumPages);
+    }
+
+    ~SamplePagePool()
+    {
+        //every page should have come back by now
+        jassert(freePages.size() == totalNumPages);
+    }
+
+    //A page to write into.  Pages come back with whatever was in them last unless they're cleared
+    float* acquire(bool clearPage)
+    {
+        float* page = nullptr;
+
+        {
+            const juce::ScopedLock sl(lock);
+
+            if (freePages.isEmpty())
+                addSlab(pagesPerSlab);
+
+            page = freePages.removeAndReturn(freePages.size() - 1);
+        }
+
+        if (clearPage)
+            juce::FloatVectorOperations::clear(page, samplesPerPage);
+
+        return page;
+    }
+
+    void release(float* page)
+    {
+        if (page == nullptr)
+            return;
+
+        const juce::ScopedLock sl(lock);
+        freePages.add(page);
+    }
+
+    //Makes sure at least this many pages can be taken without allocating
+    void reserve(int numPages)
+    {
+        const juce::ScopedLock sl(lock);
+
+        if (freePages.size() < numPages)
+            addSlab(numPages - freePages.size());
+    }
+
+    int getNumFreePages() const
+    {
+        const juce::ScopedLock sl(lock);
+        return freePages.size();
+    }
+
+    //samplesPerPage zeros, for reading silent chunks - never write to it
+    static const float* getSilentPage() noexcept
+    {
+        alignas(cacheLineSize) static const float silence[samplesPerPage] = {};
+        return silence;
+    }
+
+private:
+    static constexpr size_t cacheLineSize = 64;
+    static constexpr int initialNumPages = 256;   //16MB, ~95s of mono audio at 44.1k
+    static constexpr int pagesPerSlab = 64;
+
+    //(under lock)
+    void addSlab(int numPages)
+    {
+        auto* slab = slabs.add(new juce::HeapBlock<char>((size_t)numPages * pageBytes + cacheLineSize));
+        auto address = reinterpret_cast<juce::pointer_sized_uint>(slab->getData());
+        auto* firstPage = reinterpret_cast<float*>((address + cacheLineSize - 1) & ~(juce::pointer_sized_uint)(cacheLineSize - 1));
+
+        freePages.ensureStorageAllocated(totalNumPages + numPages);
+
+        for (int i = 0; i < numPages; ++i)
+            freePages.add(firstPage + (size_t)i * samplesPerPage);
+
+        totalNumPages += numPages;
+    }
+
+    static constexpr size_t pageBytes = (size_t)samplesPerPage * sizeof(float);
+
+    juce::CriticalSection lock;
+    juce::OwnedArray<juce::HeapBlock<char>> slabs;
+    juce::Array<float*> freePages;
+    int totalNumPages = 0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SamplePagePool)
+};
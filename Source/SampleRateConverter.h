@@ -0,0 +1,155 @@
+/*
+  ==============================================================================
+
+    SampleRateConverter.h
+
+    Converts a loop from the rate it was recorded (or saved) at to the rate
+    the device is running at, so it keeps its pitch and length.  It's a
+    windowed-sinc resampler: a Kaiser-windowed sinc with 32 zero crossings
+    either side, tabulated at 512 phases and interpolated between them, with
+    the cutoff lowered when converting down so nothing aliases.  The inner
+    loop is a 64-tap dot product, done 4 floats at a time with SSE where it's
+    available.
+
+    Like everything else a loop goes through, the take is treated as a circle,
+    so the converted loop wraps round without a click.
+
+    It's only ever run on a TimeStretcher thread, one track per job, so a
+    project full of loops gets converted in parallel.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include "LoopTake.h"
+
+#if JUCE_INTEL
+ #include <emmintrin.h>
+#endif
+
+
+class SampleRateConverter
+{
+public:
+    //How long numSamples at one rate is at the other
+    static int getConvertedLength(int numSamples, double sourceRate, double targetRate) noexcept
+    {
+        return (sourceRate > 0.0 && targetRate > 0.0) ? juce::roundToInt((double)numSamples * targetRate / sourceRate) : numSamples;
+    }
+
+    //Converts the take on whichever thread calls it.  shouldStop() is checked every so often, and
+    //if it returns true this gives up and returns nullptr
+    template <typename ShouldStopFunction>
+    static std::unique_ptr<LoopTake> convert(const LoopTake& source, double sourceRate, double targetRate,
+                                             ShouldStopFunction&& shouldStop)
+    {
+        const int inLength = source.getNumSamples();
+        const int outLength = getConvertedLength(inLength, sourceRate, targetRate);
+        const int numChannels = source.getNumChannels();
+
+        if (inLength <= 0 || outLength <= 0 || numChannels <= 0 || !source.hasAudio())
+            return std::make_unique<LoopTake>(numChannels, outLength);
+
+        const auto filter = makeFilterTable(juce::jmin(1.0, targetRate / sourceRate));
+        const double step = (double)inLength / (double)outLength;  //exact, so the loop closes up
+
+        //each channel is padded with the other end of the loop either side, so every tap reads straight
+        //out of memory without wrapping
+        juce::HeapBlock<float> padded((size_t)(inLength + numTaps + 1));
+        juce::AudioBuffer<float> output(numChannels, outLength);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+        {
+            if (shouldStop())
+                return {};
+
+            for (int i = 0; i < inLength + numTaps + 1; ++i)
+            {
+                const int sample = ((i - zeroCrossings) % inLength + inLength) % inLength;
+                padded[i] = *source.getReadPointer(channel, sample);
+            }
+
+            auto* dest = output.getWritePointer(channel);
+
+            for (int i = 0; i < outLength; ++i)
+            {
+                const double position = i * step;
+                const int whole = (int)position;
+                const double phase = (position - whole) * numPhases;
+                const int phaseIndex = (int)phase;
+                const float phaseFraction = (float)(phase - phaseIndex);
+
+                //taps run from whole - zeroCrossings + 1 to whole + zeroCrossings, i.e. padded[whole + 1] on
+                const float* taps = padded.getData() + whole + 1;
+                const float a = dotProduct(taps, filter.getData() + phaseIndex * numTaps);
+                const float b = dotProduct(taps, filter.getData() + (phaseIndex + 1) * numTaps);
+
+                dest[i] = a + (b - a) * phaseFraction;
+            }
+        }
+
+        auto result = LoopTake::fromBuffer(output);
+        result->setPlayedReversed(source.isPlayedReversed());
+        return result;
+    }
+
+private:
+    static constexpr int zeroCrossings = 32;
+    static constexpr int numTaps = zeroCrossings * 2;
+    static constexpr int numPhases = 512;
+
+    //numPhases + 1 rows of numTaps coefficients.  Row p is for an output falling p / numPhases of the way
+    //from one input sample to the next.  cutoff is relative to the source's Nyquist
+    static juce::HeapBlock<float> makeFilterTable(double cutoff)
+    {
+        cutoff *= 0.97;  //a little below Nyquist, so the transition band doesn't alias either
+
+        //the window is tabulated at exactly the spacing the taps land on, so it's just indexed
+        const int windowSize = numTaps * numPhases + 1;
+        juce::HeapBlock<float> window((size_t)windowSize);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(window.getData(), (size_t)windowSize,
+                                                                 juce::dsp::WindowingFunction<float>::kaiser, false, 9.0f);
+
+        juce::HeapBlock<float> table((size_t)((numPhases + 1) * numTaps));
+
+        for (int phase = 0; phase <= numPhases; ++phase)
+        {
+            for (int tap = 0; tap < numTaps; ++tap)
+            {
+                //distance from the output position to this tap's input sample
+                const double distance = (tap - zeroCrossings + 1) - (double)phase / numPhases;
+                const double x = juce::MathConstants<double>::pi * cutoff * distance;
+                const double sinc = x == 0.0 ? 1.0 : std::sin(x) / x;
+
+                table[phase * numTaps + tap] = (float)(cutoff * sinc) * window[(tap + 1) * numPhases - phase];
+            }
+        }
+
+        return table;
+    }
+
+    static float dotProduct(const float* samples, const float* coefficients) noexcept
+    {
+       #if JUCE_INTEL
+        auto sum = _mm_setzero_ps();
+
+        for (int i = 0; i < numTaps; i += 4)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(samples + i), _mm_loadu_ps(coefficients + i)));
+
+        float lanes[4];
+        _mm_storeu_ps(lanes, sum);
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+       #else
+        //four separate sums so the compiler can keep them in one vector register
+        float sums[4] = {};
+
+        for (int i = 0; i < numTaps; i += 4)
+            for (int lane = 0; lane < 4; ++lane)
+                sums[lane] += samples[i + lane] * coefficients[i + lane];
+
+        return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+       #endif
+    }
+};
@@ -10,13 +10,16 @@
 
 #pragma once
 
+#include <juce_core/juce_core.h>
 
 #define MASTER_FOLDER_NAME "Loopspace"
 #define SAVED_LOOPS_FOLDER_NAME "Saved Loops"
 #define TEMP_LOOP_FOLDER_NAME "Temp WAVs"
 #define TRACK_FILENAME "LoopspaceTrack"
-#define NUM_TRACKS  4
+#define DEFAULT_NUM_TRACKS  4
+#define MAX_NUM_TRACKS  128
 #define PROJECT_STATE_XML_FILENAME "projectState.xml"
+#define PROFILER_LOG_FILENAME "DSP Load.log"
 
 
 class DirectoryTree
@@ -49,6 +52,20 @@ public:
     {
     }
 
+    //Track numbers start at 1, and there's no upper limit - the project XML says how many there are
+    static juce::String getTrackWAVName(int trackNum)
+    {
+        return TRACK_FILENAME + juce::String(trackNum);
+    }
+
+    //Used when tracks are removed, so their audio doesn't get saved with the project
+    void deleteWAVFromTempLoopDir(juce::String wavFilename)
+    {
+        auto wavFile = tempLoopFolder.getChildFile(wavFilename + ".wav");
+        if (wavFile.existsAsFile())
+            wavFile.deleteFile();
+    }
+
     //DN: We delete the file if in exists in temp loop dir and return
     //a blank file object to be used for a fresh project
     juce::File setFreshWAVInTempLoopDir(juce::String wavFilename)
@@ -83,67 +100,16 @@ public:
         return loopFolderNamesArray;
     }
 
-    //DN:  retrives saved audio files from given folder name, copies them to temp loop folder 
-    //  so they can be loaded into the project, then potentially recorded over
-    // without affecting the original saved audio
-    //call this when loading a previously saved project
-    //returns true if successful, false otherwise
-    bool loadWAVsFrom(juce::String folderName)
-    {
-        auto folderToCopyFrom = savedLoopsFolder.getChildFile(folderName);
-        if (!folderToCopyFrom.exists())
-            return false;
-
-        //DN: delete old WAVs to be overwritten
-        juce::Array<juce::File> wavsToDelete = tempLoopFolder.findChildFiles(2, false);
-        for (juce::File fileToDelete : wavsToDelete)
-            fileToDelete.deleteFile();
-
-        juce::Array<juce::File> childWAVs = folderToCopyFrom.findChildFiles(2, false);
-        for (juce::File fileToCopy : childWAVs)
-        {
-            //DN: the track WAV filenames will be the same for all sets of loops.  Folder names differentiate the loops
-            juce::File destinationFile = tempLoopFolder.getChildFile(fileToCopy.getFileName());
-            if (!fileToCopy.copyFileTo(destinationFile))
-                return false;
-        }
-
-        return true; 
-    }
-
-
-    //DN: copies current WAVs from temp folder to designated folder in Saved Loops directory.
-    //  if the folder name doesn't exist it will be created
-    //if WAVs exist in the folder already they will be overwritten
-    bool saveWAVsTo(juce::String folderName)
+    //Projects are saved into and loaded from here by ProjectIO, straight from and into memory
+    juce::File getProjectFolder(juce::String folderName)
     {
-        auto folderToCopyTo = savedLoopsFolder.getChildFile(folderName);
-        if (!folderToCopyTo.exists())
-        {
-            folderToCopyTo.createDirectory();
-        }
- 
-        //DN: delete old WAVs to be overwritten
-        juce::Array<juce::File> wavsToDelete = folderToCopyTo.findChildFiles(2, false);
-        for (juce::File fileToDelete : wavsToDelete)
-            fileToDelete.deleteFile();
-
-        //DN: get WAVs to copy
-        juce::Array<juce::File> wavsToCopy = tempLoopFolder.findChildFiles(2, false);
-
-        for (juce::File fileToCopy : wavsToCopy)
-        {
-            juce::File destFile = folderToCopyTo.getChildFile(fileToCopy.getFileName());
-            if (!fileToCopy.copyFileTo(destFile))
-                return false;
-        }
-
-        return true;
+        return savedLoopsFolder.getChildFile(folderName);
     }
 
-    juce::File getProjectFolder(juce::String folderName)
+    //Where the CallbackProfiler logs to, if it's been asked to
+    juce::File getProfilerLogFile()
     {
-        return savedLoopsFolder.getChildFile(folderName);
+        return masterFolder.getChildFile(PROFILER_LOG_FILENAME);
     }
 
 
@@ -0,0 +1,415 @@
+/*
+  ==============================================================================
+
+    SoakTest.h
+
+    Runs a headless LooperEngine on the dummy audio device for a long
+    simulated session - by default a day of it, on a clock running 100
+    times faster than real time - and checks it's still in one piece at
+    regular checkpoints along the way:
+
+        467AudioLoopStation --soak [--hours <simulated>] [--tracks <n>]
+            [--check-every <simulated minutes>] [--sample-rate <hz>]
+            [--block-sizes <n,n,...>] [--report <file>] [<device options>]
+
+    Every track records the device's input (a tone, unless --input says
+    otherwise) as soon as it starts, with the metronome on.  At each
+    checkpoint the device is closed while the checks are made:
+      - nothing NaN or infinite has come out of the callback
+      - the transport hasn't drifted from the samples the device has
+        actually called back with
+      - every playing track is exactly where the transport says it should be
+    then one track starts overdubbing, another is reversed and another
+    re-recorded, every fourth checkpoint the tempo changes, and the device
+    is reopened with the next of the --block-sizes.  At the end every track
+    has to have recorded something.
+
+    The device options (see DummyAudioIODevice::Options) inject jitter,
+    xruns and odd block sizes, so e.g.
+
+        467AudioLoopStation --soak --tracks 100 --xruns 0.001 --variable-blocks
+
+    is a day of a hundred tracks on a flaky driver.  It uses the app's temp
+    project for the tracks' audio, just as the app would.
+
+    The exit code is 0 if every check passed, 1 if any failed (each is
+    reported as it happens, with a summary at the end that also goes to the
+    --report file), and 2 if the soak couldn't run.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_devices/juce_audio_devices.h>
+#include <iostream>
+#include <map>
+#include "DummyAudioDevice.h"
+#include "LooperEngine.h"
+#include "RealtimeSafetyChecker.h"
+
+
+class SoakTest : private juce::Timer, private TrackEngine::Listener
+{
+public:
+    static bool isSoakCommand(const juce::StringArray& arguments)
+    {
+        return arguments.contains("--soak");
+    }
+
+    //Message thread, from JUCEApplication::initialise(): starts the session, and quits the app with the
+    //result once it's done
+    SoakTest(const juce::StringArray& arguments)
+    {
+        deviceOptions.speed = 100.0;
+        deviceOptions.input = DummyAudioIODevice::Options::Input::tone;
+
+        const auto error = parseArguments(arguments);
+
+        if (error.isNotEmpty())
+        {
+            quitWith(couldNotRun, error + "\nUsage: --soak [--hours <simulated>] [--tracks <n>] [--check-every <simulated minutes>]\n"
+                                  "       [--sample-rate <hz>] [--block-sizes <n,n,...>] [--report <file>]\n"
+                                  "       " + juce::String(DummyAudioIODevice::Options::getUsage()));
+            return;
+        }
+
+        auto deviceType = std::make_unique<DummyAudioIODeviceType>(deviceOptions);
+        session = deviceType->getSession();
+        deviceManager.addAudioDeviceType(std::move(deviceType));
+
+        engine = std::make_unique<LooperEngine>(deviceManager);
+        engine->setNumTracks(numTracks);
+
+        for (int i = 0; i < engine->getNumTracks(); ++i)
+            engine->getTrack(i)->addListener(this);
+
+        //DN: the transport's running before the first block, so every sample the device calls back with
+        //should move it on by one - which is what the drift check relies on
+        player.setSource(engine.get());
+        deviceManager.addAudioCallback(&player);
+        engine->play();
+
+        const auto openError = openDevice();
+
+        if (openError.isNotEmpty())
+        {
+            quitWith(couldNotRun, "Couldn't open the dummy audio device: " + openError);
+            return;
+        }
+
+        engine->setMetronomeOn(true);
+
+        for (int i = 0; i < engine->getNumTracks(); ++i)
+            engine->getTrack(i)->setWaitingToRecord(true);
+
+        if (RealtimeSafetyChecker::isEnabledInBuild)
+            RealtimeSafetyChecker::enable();
+
+        std::cout << "Soaking " << engine->getNumTracks() << " tracks for " << hours << " hours at "
+                  << (deviceOptions.speed > 0.0 ? juce::String(deviceOptions.speed) + "x real time" : juce::String("full speed"))
+                  << std::endl;
+
+        startTime = juce::Time::getMillisecondCounterHiRes();
+        startTimer(50);
+    }
+
+    ~SoakTest() override
+    {
+        stopTimer();
+        RealtimeSafetyChecker::disable();
+        deviceManager.closeAudioDevice();
+        deviceManager.removeAudioCallback(&player);
+        player.setSource(nullptr);
+
+        if (engine != nullptr)
+            for (int i = 0; i < engine->getNumTracks(); ++i)
+                engine->getTrack(i)->removeListener(this);
+    }
+
+private:
+    enum ExitCode
+    {
+        passed = 0,
+        problemsFound = 1,
+        couldNotRun = 2
+    };
+
+    struct TakeCount
+    {
+        int started = 0;
+        int finished = 0;
+    };
+
+    //An empty string if they're all fine
+    juce::String parseArguments(const juce::StringArray& arguments)
+    {
+        for (int i = 0; i < arguments.size(); ++i)
+        {
+            const auto& argument = arguments[i];
+            const bool hasValue = i + 1 < arguments.size();
+            juce::String error;
+
+            if (argument == "--soak")                           continue;
+            else if (argument == "--hours" && hasValue)         hours = arguments[++i].getDoubleValue();
+            else if (argument == "--tracks" && hasValue)        numTracks = arguments[++i].getIntValue();
+            else if (argument == "--check-every" && hasValue)   checkpointMinutes = arguments[++i].getDoubleValue();
+            else if (argument == "--sample-rate" && hasValue)   sampleRate = arguments[++i].getDoubleValue();
+            else if (argument == "--report" && hasValue)        reportFile = juce::File::getCurrentWorkingDirectory().getChildFile(arguments[++i]);
+            else if (argument == "--block-sizes" && hasValue)
+            {
+                blockSizes.clear();
+
+                for (const auto& size : juce::StringArray::fromTokens(arguments[++i], ",", {}))
+                    blockSizes.add(size.getIntValue());
+            }
+            else if (!deviceOptions.parseArgument(arguments, i, error))
+                return "Unknown option " + argument;
+
+            if (error.isNotEmpty())
+                return error;
+        }
+
+        if (hours <= 0.0 || checkpointMinutes <= 0.0 || sampleRate <= 0.0)
+            return "--hours, --check-every and --sample-rate have to be more than 0";
+
+        if (numTracks < 1 || numTracks > MAX_NUM_TRACKS)
+            return "--tracks has to be from 1 to " + juce::String(MAX_NUM_TRACKS);
+
+        for (const auto size : blockSizes)
+            if (size <= 0)
+                return "--block-sizes has to be a list of sizes, e.g. 64,512,2048";
+
+        if (blockSizes.isEmpty())
+            return "--block-sizes has to be a list of sizes, e.g. 64,512,2048";
+
+        return {};
+    }
+
+    //(Re)opens the device at the next block size, with all its channels
+    juce::String openDevice()
+    {
+        if (deviceManager.getCurrentAudioDeviceType() != DUMMY_DEVICE_TYPE_NAME)
+            deviceManager.setCurrentAudioDeviceType(DUMMY_DEVICE_TYPE_NAME, true);
+
+        auto setup = deviceManager.getAudioDeviceSetup();
+        setup.outputDeviceName = setup.inputDeviceName = DUMMY_DEVICE_NAME;
+        setup.sampleRate = sampleRate;
+        setup.bufferSize = blockSizes[numCheckpoints % blockSizes.size()];
+        setup.useDefaultInputChannels = setup.useDefaultOutputChannels = false;
+        setup.inputChannels.clear();
+        setup.inputChannels.setRange(0, deviceOptions.numChannels, true);
+        setup.outputChannels.clear();
+        setup.outputChannels.setRange(0, deviceOptions.numChannels, true);
+
+        const auto error = deviceManager.setAudioDeviceSetup(setup, true);
+
+        if (error.isNotEmpty())
+            return error;
+
+        return deviceManager.getCurrentAudioDevice() != nullptr ? juce::String() : juce::String("no device");
+    }
+
+    double getSimulatedSeconds() const
+    {
+        return (double)session->samplesElapsed.load() / sampleRate;
+    }
+
+    void timerCallback() override
+    {
+        const double simulatedSeconds = getSimulatedSeconds();
+        const bool finished = simulatedSeconds >= hours * 3600.0;
+
+        if (simulatedSeconds < (numCheckpoints + 1) * checkpointMinutes * 60.0 && !finished)
+            return;
+
+        //the audio stops while we look, so nothing moves under the checks
+        deviceManager.closeAudioDevice();
+        ++numCheckpoints;
+        runChecks();
+
+        if (finished)
+        {
+            finish();
+            return;
+        }
+
+        changeSomething();
+        const auto error = openDevice();
+
+        if (error.isNotEmpty())
+            addProblem("couldn't reopen the device at " + juce::String(blockSizes[numCheckpoints % blockSizes.size()])
+                       + " samples: " + error);
+
+        if (deviceManager.getCurrentAudioDevice() == nullptr)
+            finish();
+    }
+
+    //Message thread, with the device closed
+    void runChecks()
+    {
+        const auto& transport = engine->getTransport();
+        const auto transportPosition = transport.getBlockStartSample();
+        const auto calledBack = session->samplesCalledBack.load();
+        const auto nonFinite = session->nonFiniteBlocks.load();
+
+        if (transportPosition != calledBack)
+            addProblem("the transport is at " + juce::String(transportPosition) + " but the device has called back with "
+                       + juce::String(calledBack) + " samples");
+
+        if (nonFinite > reportedNonFiniteBlocks)
+        {
+            addProblem(juce::String(nonFinite - reportedNonFiniteBlocks) + " more blocks with NaNs or infs in the output");
+            reportedNonFiniteBlocks = nonFinite;
+        }
+
+        for (int i = 0; i < engine->getNumTracks(); ++i)
+        {
+            auto* track = engine->getTrack(i);
+            const auto loopLength = track->getMasterLoopLength();
+
+            if (!track->isPlaying() || loopLength <= 0)
+                continue;
+
+            //a block that ends right on the top of the loop leaves the track at its very end
+            const auto expected = (transportPosition - transport.getLoopOriginAt(transportPosition)) % loopLength;
+            const auto position = (juce::int64)track->getPosition();
+
+            if (position != expected && !(expected == 0 && position == loopLength))
+                addProblem("track " + juce::String(i + 1) + " is at " + juce::String(position) + " but the transport says "
+                           + juce::String(expected) + " (loop length " + juce::String(loopLength) + ")");
+        }
+
+        if (RealtimeSafetyChecker::isEnabledInBuild && RealtimeSafetyChecker::getNumViolations() > reportedViolations)
+        {
+            addProblem(juce::String(RealtimeSafetyChecker::getNumViolations() - reportedViolations)
+                       + " more real-time safety violations");
+            reportedViolations = RealtimeSafetyChecker::getNumViolations();
+        }
+
+        juce::String line;
+        line << juce::String(getSimulatedSeconds() / 3600.0, 2) << "h"
+             << "  (" << juce::String((juce::Time::getMillisecondCounterHiRes() - startTime) / 60000.0, 1) << " min)"
+             << "  blocks " << session->blocksCalledBack.load()
+             << "  dropped " << session->blocksDropped.load()
+             << "  problems " << problems.size();
+
+        const auto memory = getResidentMemoryMegabytes();
+
+        if (memory > 0.0)
+            line << "  memory " << juce::String(memory, 1) << "MB";
+
+        std::cout << line << std::endl;
+    }
+
+    //Message thread, with the device closed: something for the next stretch to chew on
+    void changeSomething()
+    {
+        const int n = engine->getNumTracks();
+
+        if (overdubbingTrack != nullptr)
+            overdubbingTrack->setOverdubbing(false);
+
+        overdubbingTrack = engine->getTrack(numCheckpoints % n);
+
+        if (overdubbingTrack->isRecording() || overdubbingTrack->isWaitingToRecord())
+            overdubbingTrack = nullptr;
+        else
+            overdubbingTrack->setOverdubbing(true);
+
+        engine->getTrack((numCheckpoints + 1) % n)->reverse();
+        engine->getTrack((numCheckpoints + 2) % n)->setWaitingToRecord(true);
+
+        if (numCheckpoints % 4 == 0)
+            engine->setLoopLength(engine->getTempo() == 120 ? 100 : 120, engine->getBeats());
+    }
+
+    //Message thread, with the device closed
+    void finish()
+    {
+        stopTimer();
+        engine->stop();
+        RealtimeSafetyChecker::disable();
+
+        for (int i = 0; i < engine->getNumTracks(); ++i)
+        {
+            const auto& count = takeCounts[engine->getTrack(i)];
+
+            if (count.started == 0)
+                addProblem("track " + juce::String(i + 1) + " never recorded anything");
+            else if (count.finished < count.started)
+                addProblem("track " + juce::String(i + 1) + " started " + juce::String(count.started)
+                           + " takes but only finished " + juce::String(count.finished));
+        }
+
+        juce::String report;
+        report << "Soaked " << engine->getNumTracks() << " tracks for " << juce::String(getSimulatedSeconds() / 3600.0, 2)
+               << " hours (" << juce::String((juce::Time::getMillisecondCounterHiRes() - startTime) / 60000.0, 1) << " minutes)\n"
+               << "Blocks called back: " << session->blocksCalledBack.load() << ", dropped: " << session->blocksDropped.load() << "\n"
+               << "Checkpoints: " << numCheckpoints << "\n";
+
+        if (RealtimeSafetyChecker::isEnabledInBuild && RealtimeSafetyChecker::getNumViolations() > 0)
+            report << RealtimeSafetyChecker::getReport() << "\n";
+
+        report << (problems.isEmpty() ? juce::String("No problems") : juce::String(problems.size()) + " problems:\n" + problems.joinIntoString("\n"));
+
+        if (reportFile != juce::File())
+            reportFile.replaceWithText(report);
+
+        quitWith(problems.isEmpty() ? passed : problemsFound, report);
+    }
+
+    void addProblem(const juce::String& problem)
+    {
+        const auto line = juce::String(getSimulatedSeconds() / 3600.0, 2) + "h: " + problem;
+        std::cerr << line << std::endl;
+        problems.add(line);
+    }
+
+    //0 where there's no way of telling
+    static double getResidentMemoryMegabytes()
+    {
+       #if JUCE_LINUX
+        const auto pages = juce::StringArray::fromTokens(juce::File("/proc/self/statm").loadFileAsString(), false);
+
+        if (pages.size() > 1)
+            return pages[1].getDoubleValue() * 4096.0 / (1024.0 * 1024.0);
+       #endif
+
+        return 0.0;
+    }
+
+    void takeStarted(TrackEngine& track) override   { ++takeCounts[&track].started; }
+    void takeFinished(TrackEngine& track) override  { ++takeCounts[&track].finished; }
+
+    void quitWith(ExitCode exitCode, const juce::String& message)
+    {
+        (exitCode == passed ? std::cout : std::cerr) << message << std::endl;
+
+        juce::JUCEApplicationBase::getInstance()->setApplicationReturnValue(exitCode);
+        juce::JUCEApplicationBase::quit();
+    }
+
+    DummyAudioIODevice::Options deviceOptions;
+    double hours = 24.0;
+    int numTracks = 16;
+    double checkpointMinutes = 15.0;
+    double sampleRate = 48000.0;
+    juce::Array<int> blockSizes{ 512 };
+    juce::File reportFile;
+
+    juce::AudioDeviceManager deviceManager;
+    std::shared_ptr<const DummyAudioIODevice::Session> session;
+    std::unique_ptr<LooperEngine> engine;  //declared after the device manager, which it needs
+    juce::AudioSourcePlayer player;
+
+    std::map<TrackEngine*, TakeCount> takeCounts;
+    TrackEngine* overdubbingTrack = nullptr;
+    juce::StringArray problems;
+    juce::int64 reportedNonFiniteBlocks = 0;
+    int reportedViolations = 0;
+    int numCheckpoints = 0;
+    double startTime = 0.0;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(SoakTest)
+};
@@ -0,0 +1,104 @@
+/*
+  ==============================================================================
+
+    TakeHistory.h
+
+    A track's undo/redo list.  Every state is a whole LoopTake, but since
+    LoopTakes share the chunks they have in common, each step only costs the
+    chunks that changed in it - a loop with a partial overdub on top of it is
+    the original plus the overdubbed chunks, not two loops.
+
+    Message thread only.  LoopSource publishes a copy of whichever state is
+    current, which is just the chunk list.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include "LoopTake.h"
+
+
+class TakeHistory
+{
+public:
+    struct State
+    {
+        LoopTake take;  //(which knows whether it plays reversed)
+        int fileStartOffset = 0;
+        int tempo = 0;  //what the take's length fits - it gets stretched if the loop's tempo is different
+        double sampleRate = 0.0;  //and the rate it's at - it gets converted if the device's is different
+
+        //the take converted to other rates it's been played at, so switching back to one is free
+        std::map<double, LoopTake> atOtherRates;
+    };
+
+    TakeHistory() = default;
+
+    //Forgets everything, the state becomes the only one
+    void reset(const State& initialState)
+    {
+        states.clear();
+        states.add(new State(initialState));
+        currentIndex = 0;
+    }
+
+    //Anything that had been undone can't be redone any more
+    void push(const State& newState)
+    {
+        states.removeLast(states.size() - (currentIndex + 1));
+        states.add(new State(newState));
+        currentIndex = states.size() - 1;
+        trimToMaxUndoSteps();
+    }
+
+    bool canUndo() const noexcept   { return currentIndex > 0; }
+    bool canRedo() const noexcept   { return currentIndex < states.size() - 1; }
+
+    const State& undo()
+    {
+        jassert(canUndo());
+        return *states.getUnchecked(--currentIndex);
+    }
+
+    const State& redo()
+    {
+        jassert(canRedo());
+        return *states.getUnchecked(++currentIndex);
+    }
+
+    //Changes that don't get a step of their own (e.g. slipping the loop) are kept with the current state
+    State& getCurrent()
+    {
+        jassert(juce::isPositiveAndBelow(currentIndex, states.size()));
+        return *states.getUnchecked(currentIndex);
+    }
+
+    //Lowering it drops the oldest states straight away, and with them any chunks nothing else shares
+    void setMaxUndoSteps(int newMaxUndoSteps)
+    {
+        maxUndoSteps = juce::jmax(1, newMaxUndoSteps);
+        trimToMaxUndoSteps();
+    }
+
+private:
+    //Oldest first; if that's still too many (a lot has been undone) the furthest redos go too
+    void trimToMaxUndoSteps()
+    {
+        while (states.size() > maxUndoSteps + 1 && currentIndex > 0)
+        {
+            states.remove(0);
+            --currentIndex;
+        }
+
+        if (states.size() > maxUndoSteps + 1)
+            states.removeLast(states.size() - (maxUndoSteps + 1));
+    }
+
+    juce::OwnedArray<State> states;
+    int currentIndex = -1;
+    int maxUndoSteps = 32;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TakeHistory)
+};
@@ -0,0 +1,317 @@
+/*
+  ==============================================================================
+
+    TimeStretcher.h
+
+    Renders a loop at a new length without changing its pitch, so recorded
+    loops can follow the tempo.  It's WSOLA (waveform similarity overlap-add):
+    the take is cut into overlapping Hann-windowed grains which are laid back
+    down a fixed hop apart at the new length.  Each grain comes from roughly
+    where it would fall in the original, nudged to whichever offset lines up
+    best with the audio that followed the previous grain, so the overlaps
+    don't smear or cancel out.  The take is treated as a circle on both sides,
+    so the stretched loop wraps round as seamlessly as the original did.
+
+    A take that isn't at the device's sample rate gets converted first (see
+    SampleRateConverter), in the same job, so it's at the right pitch before
+    it's stretched.
+
+    Stretching runs on a pool of background threads, so every track can be
+    working towards a new tempo at the same time.  To keep memory bounded, a
+    job only starts once what it needs fits in the budget alongside the jobs
+    already running (one job always gets to run, however big it is).
+    LoopSource asks for a stretch, keeps playing what it has, and checks back
+    until the result is ready.
+
+    One TimeStretcher is shared by every track, through a SharedResourcePointer.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_dsp/juce_dsp.h>
+#include "LoopTake.h"
+#include "SampleRateConverter.h"
+
+
+class TimeStretcher
+{
+public:
+    //A stretch that's queued or running.  The source is a LoopTake copy, so it shares its chunks
+    //with the take it was asked for rather than copying any audio
+    struct Request : public juce::ReferenceCountedObject
+    {
+        using Ptr = juce::ReferenceCountedObjectPtr<Request>;
+
+        Request(const LoopTake& takeToStretch, double takeSampleRate, double sampleRateToConvertTo, int lengthToStretchTo)
+            : source(takeToStretch), sourceRate(takeSampleRate), targetRate(sampleRateToConvertTo), targetLength(lengthToStretchTo)
+        {
+        }
+
+        //The result isn't wanted any more - the job stops (or never starts) at the next chance it gets
+        void cancel() noexcept              { cancelled = true; }
+        bool isFinished() const noexcept    { return finished.load(); }
+
+        const LoopTake source;
+        const double sourceRate, targetRate;
+        const int targetLength;
+
+        //only touch these once isFinished().  result is nullptr if it was cancelled, converted is the
+        //take at targetRate before it was stretched (nullptr if the rate didn't change)
+        std::unique_ptr<LoopTake> result, converted;
+        std::atomic<bool> cancelled{ false }, finished{ false };
+    };
+
+    TimeStretcher()
+        : pool(juce::jmax(1, juce::SystemStats::getNumCpus() - 1))
+    {
+        //below the audio thread and the render workers, this is never in a hurry
+        pool.setThreadPriorities(3);
+    }
+
+    ~TimeStretcher()
+    {
+        pool.removeAllJobs(true, 4000);
+    }
+
+    //Message thread: queues a copy of the take to be converted from sourceRate to targetRate, then
+    //stretched to newLength samples (at targetRate)
+    Request::Ptr stretch(const LoopTake& take, double sourceRate, double targetRate, int newLength)
+    {
+        Request::Ptr request = new Request(take, sourceRate, targetRate, newLength);
+        pool.addJob(new Job(*this, request), true);
+        return request;
+    }
+
+    //How much the stretches running at once can use between them
+    void setMemoryBudget(size_t newBudgetInBytes) noexcept
+    {
+        memoryBudget = newBudgetInBytes;
+    }
+
+    //Roughly what a request needs while it's running: the converted take (as a plain buffer and
+    //pages), then for stretching the whole take and result as plain buffers, the mono guide and
+    //window sums, and the result's pages
+    static size_t getMemoryNeeded(const Request& request) noexcept
+    {
+        const auto numChannels = (size_t)juce::jmax(1, request.source.getNumChannels());
+        const auto outLength = (size_t)juce::jmax(0, request.targetLength);
+        size_t inLength = (size_t)juce::jmax(0, request.source.getNumSamples());
+        size_t numBytes = 0;
+
+        if (request.sourceRate != request.targetRate)
+        {
+            inLength = (size_t)SampleRateConverter::getConvertedLength((int)inLength, request.sourceRate, request.targetRate);
+            numBytes += sizeof(float) * 2 * numChannels * inLength;
+        }
+
+        return numBytes + sizeof(float) * ((numChannels + 1) * (inLength + outLength) + numChannels * outLength);
+    }
+
+    //Does the stretching on whichever thread calls it.  shouldStop() is checked every so often,
+    //and if it returns true this gives up and returns nullptr
+    template <typename ShouldStopFunction>
+    static std::unique_ptr<LoopTake> stretchTake(const LoopTake& source, int newLength, ShouldStopFunction&& shouldStop)
+    {
+        const int inLength = source.getNumSamples();
+        const int numChannels = source.getNumChannels();
+
+        if (inLength <= 0 || newLength <= 0 || numChannels <= 0 || !source.hasAudio())
+            return std::make_unique<LoopTake>(numChannels, newLength);
+
+        const auto input = source.toBuffer();
+        juce::AudioBuffer<float> output(numChannels, newLength);
+        output.clear();
+
+        //grains are matched on a mono mix, and every channel takes the same grain so the image holds together
+        juce::HeapBlock<float> guide((size_t)inLength, true);
+
+        for (int channel = 0; channel < numChannels; ++channel)
+            juce::FloatVectorOperations::add(guide.getData(), input->getReadPointer(channel), inLength);
+
+        juce::HeapBlock<float> window((size_t)grainSize);
+        juce::dsp::WindowingFunction<float>::fillWindowingTables(window.getData(), (size_t)grainSize,
+                                                                 juce::dsp::WindowingFunction<float>::hann, false);
+
+        juce::HeapBlock<float> windowSum((size_t)newLength, true);
+
+        const double analysisHop = (double)synthesisHop * (double)inLength / (double)newLength;
+        const int numGrains = (newLength + synthesisHop - 1) / synthesisHop;
+        int previousStart = 0;
+
+        for (int grain = 0; grain < numGrains; ++grain)
+        {
+            if (grain % 32 == 0 && shouldStop())
+                return {};
+
+            int start = juce::roundToInt(grain * analysisHop);
+
+            if (grain > 0)
+                start = findBestMatch(guide.getData(), inLength, previousStart + synthesisHop, start);
+
+            overlapAdd(*input, output, windowSum.getData(), window.getData(), wrap(start, inLength), grain * synthesisHop);
+            previousStart = start;
+        }
+
+        for (int i = 0; i < newLength; ++i)
+        {
+            const float gain = windowSum[i] > 1.0e-3f ? 1.0f / windowSum[i] : 0.0f;
+
+            for (int channel = 0; channel < numChannels; ++channel)
+                output.getWritePointer(channel)[i] *= gain;
+        }
+
+        auto result = LoopTake::fromBuffer(output);
+        result->setPlayedReversed(source.isPlayedReversed());
+        return result;
+    }
+
+private:
+    static constexpr int grainSize = 2048;            //~46ms at 44.1k
+    static constexpr int synthesisHop = grainSize / 2;
+    static constexpr int searchRadius = 512;          //how far a grain can be nudged either way
+    static constexpr int matchStep = 4;               //only every 4th sample is compared when matching
+
+    static int wrap(int sample, int length) noexcept
+    {
+        sample %= length;
+        return sample < 0 ? sample + length : sample;
+    }
+
+    //The start within searchRadius of nominalStart whose first hop looks most like the audio
+    //starting at naturalStart (what would have followed the previous grain)
+    static int findBestMatch(const float* guide, int length, int naturalStart, int nominalStart) noexcept
+    {
+        int bestStart = nominalStart;
+        float bestScore = std::numeric_limits<float>::lowest();
+
+        for (int offset = -searchRadius; offset <= searchRadius; ++offset)
+        {
+            const int candidate = nominalStart + offset;
+            float score = 0.0f;
+
+            for (int i = 0; i < synthesisHop; i += matchStep)
+                score += guide[wrap(naturalStart + i, length)] * guide[wrap(candidate + i, length)];
+
+            if (score > bestScore)
+            {
+                bestScore = score;
+                bestStart = candidate;
+            }
+        }
+
+        return bestStart;
+    }
+
+    //Adds one windowed grain of every channel into the output, a contiguous run at a time
+    //since both the input and output wrap round
+    static void overlapAdd(const juce::AudioBuffer<float>& input, juce::AudioBuffer<float>& output, float* windowSum,
+                           const float* window, int inStart, int outStart) noexcept
+    {
+        const int inLength = input.getNumSamples();
+        const int outLength = output.getNumSamples();
+
+        for (int done = 0; done < grainSize;)
+        {
+            const int inSample = wrap(inStart + done, inLength);
+            const int outSample = wrap(outStart + done, outLength);
+            const int run = juce::jmin(grainSize - done, inLength - inSample, outLength - outSample);
+
+            for (int channel = 0; channel < input.getNumChannels(); ++channel)
+                juce::FloatVectorOperations::addWithMultiply(output.getWritePointer(channel, outSample),
+                                                             input.getReadPointer(channel, inSample), window + done, run);
+
+            juce::FloatVectorOperations::add(windowSum + outSample, window + done, run);
+            done += run;
+        }
+    }
+
+    //Budget bookkeeping for the jobs.  One job can always run, however much it needs
+    bool tryToReserve(size_t numBytes)
+    {
+        const juce::ScopedLock sl(budgetLock);
+
+        if (bytesInUse > 0 && bytesInUse + numBytes > memoryBudget.load())
+            return false;
+
+        bytesInUse += numBytes;
+        return true;
+    }
+
+    void release(size_t numBytes)
+    {
+        {
+            const juce::ScopedLock sl(budgetLock);
+            bytesInUse -= numBytes;
+        }
+
+        budgetFreed.signal();
+    }
+
+    class Job : public juce::ThreadPoolJob
+    {
+    public:
+        Job(TimeStretcher& ownerToUse, Request::Ptr requestToRun)
+            : juce::ThreadPoolJob("Time Stretch"), owner(ownerToUse), request(requestToRun),
+              memoryNeeded(getMemoryNeeded(*requestToRun))
+        {
+        }
+
+        JobStatus runJob() override
+        {
+            if (!request->cancelled.load() && !shouldExit())
+            {
+                //over budget - wait for another stretch to finish, then try again
+                if (!owner.tryToReserve(memoryNeeded))
+                {
+                    owner.budgetFreed.wait(50);
+                    return jobNeedsRunningAgain;
+                }
+
+                run();
+                owner.release(memoryNeeded);
+            }
+
+            request->finished = true;
+            return jobHasFinished;
+        }
+
+    private:
+        void run()
+        {
+            const auto shouldStop = [this] { return request->cancelled.load() || shouldExit(); };
+            const auto* take = &request->source;
+
+            if (request->sourceRate != request->targetRate)
+            {
+                request->converted = SampleRateConverter::convert(*take, request->sourceRate, request->targetRate, shouldStop);
+
+                if (request->converted == nullptr)
+                    return;
+
+                take = request->converted.get();
+            }
+
+            //only the rate needed changing
+            if (take->getNumSamples() == request->targetLength)
+                request->result = std::make_unique<LoopTake>(*take);
+            else
+                request->result = stretchTake(*take, request->targetLength, shouldStop);
+        }
+
+        TimeStretcher& owner;
+        Request::Ptr request;
+        const size_t memoryNeeded;
+    };
+
+    juce::CriticalSection budgetLock;
+    size_t bytesInUse = 0;
+    std::atomic<size_t> memoryBudget{ (size_t)256 * 1024 * 1024 };
+    juce::WaitableEvent budgetFreed;
+
+    //last, so it's gone before anything its jobs use
+    juce::ThreadPool pool;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TimeStretcher)
+};
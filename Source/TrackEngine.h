@@ -0,0 +1,632 @@
+/*
+  ==============================================================================
+
+    TrackEngine.h
+
+    Everything a track does apart from drawing itself: its LoopSource and
+    AudioRecorder, gain and pan, slip, reverse, overdubbing, undo/redo, which
+    inputs it records, and loading and saving its audio and settings.  It has
+    no components in it, so it runs without a display - AudioTrack is the
+    controls and waveform on top of one of these, and LooperEngine owns them.
+
+    Gain and pan go to the audio thread through a ParameterQueue, and get
+    smoothed there into per-sample gain ramps.
+
+    Punching in and out happens on the audio thread; a 10ms timer on the
+    message thread collects finished takes, hands over loops stretched to a
+    new tempo or loaded from a project and keeps the WAV matching what's
+    playing.  Anything that wants
+    to know when that happens (e.g. to redraw) adds a Listener.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_formats/juce_audio_formats.h>
+#include <juce_events/juce_events.h>
+#include "AudioRecorder.h"
+#include "CallbackProfiler.h"
+#include "LoopSource.h"
+#include "MixEngine.h"
+#include "ParameterQueue.h"
+#include "SaveLoad.h"
+
+
+class TrackEngine : public MixEngineSource, private juce::ChangeListener, private juce::Timer
+{
+public:
+    //Message thread callbacks
+    class Listener
+    {
+    public:
+        virtual ~Listener() = default;
+
+        //the audio thread punched in, and a take is being recorded from the top of the loop
+        virtual void takeStarted(TrackEngine&) {}
+        //a take was collected, or arming was cancelled before it started
+        virtual void takeFinished(TrackEngine&) {}
+        //undo/redo, an overdub finishing, a loop stretched to a new tempo or audio loaded from disk
+        //swapped what's playing for something else
+        virtual void loopAudioReplaced(TrackEngine&) {}
+        virtual void playStateChanged(TrackEngine&) {}
+    };
+
+    TrackEngine(CaptureDispatcher& captureDispatcher, const TransportClock& transport)
+        : dispatcher(captureDispatcher), loopSource(transport), recorder(captureDispatcher, loopSource)
+    {
+        formatManager.registerBasicFormats();
+        loopSource.addChangeListener(this);
+
+        setProfilerStage(&playbackStage);
+        recorder.setProfilerStage(&recordingStage);
+
+        startTimer(10);
+    }
+
+    ~TrackEngine() override
+    {
+        stopTimer();
+        dispatcher.disarm(&loopSource);
+        loopSource.removeChangeListener(this);
+    }
+
+    void addListener(Listener* listener)      { listeners.add(listener); }
+    void removeListener(Listener* listener)   { listeners.remove(listener); }
+
+    //==============================================================================
+    void prepareToPlay(int samplesPerBlockExpected, double newSampleRate) override
+    {
+        loopSource.prepareToPlay(samplesPerBlockExpected, newSampleRate);
+
+        //gain/pan moves get spread over ~20ms instead of jumping at the block boundary
+        applyParameterChanges();
+        gainSmoother.reset(newSampleRate, 0.02);
+        gainSmoother.setCurrentAndTargetValue(targetGain);
+        panSmoother.reset(newSampleRate, 0.02);
+        panSmoother.setCurrentAndTargetValue(targetPan);
+        currentGains = ChannelGains::fromGainAndPan(targetGain, targetPan);
+    }
+
+    //Adds this track into the output: gain, pan and summing happen in one pass inside the LoopSource
+    void mixNextAudioBlock(const juce::AudioSourceChannelInfo& bufferToMixInto) override
+    {
+        // AF: If only 1 output (mono), panning shouldn't work
+        const bool canPan = bufferToMixInto.buffer->getNumChannels() > 1;
+
+        applyParameterChanges();
+        gainSmoother.setTargetValue(targetGain);
+        panSmoother.setTargetValue(canPan ? targetPan : 0.0f);
+
+        const auto startGains = currentGains;
+        const auto endGain = gainSmoother.skip(bufferToMixInto.numSamples);
+        const auto endPan = panSmoother.skip(bufferToMixInto.numSamples);
+        currentGains = ChannelGains::fromGainAndPan(endGain, endPan);
+
+        loopSource.mixNextAudioBlock(bufferToMixInto, startGains, currentGains);
+    }
+
+    void releaseResources() override
+    {
+        loopSource.releaseResources();
+    }
+
+    //==============================================================================
+    void setGain(double newGain)
+    {
+        gain = newGain;
+        parameters.push(gainParameter, newGain);
+    }
+
+    double getGain() const noexcept { return gain; }
+
+    //-1 is hard left, 1 hard right
+    void setPan(double newPan)
+    {
+        pan = newPan;
+        parameters.push(panParameter, newPan);
+    }
+
+    double getPan() const noexcept { return pan; }
+
+    //Where the audio starts against the loop, in samples.  The overdub has the slip baked in, so not while it's
+    //going - and not while a project's audio is waiting to take over, which has its own
+    void setSlip(int newSlip)
+    {
+        if (!loopSource.isOverdubbing() && !isLoadPending())
+            loopSource.setFileStartOffset(newSlip);
+    }
+
+    int getSlip() const noexcept { return loopSource.getFileStartOffset(); }
+
+    //DN: reversing swaps the buffer out from under the overdub, so not while it's going (or while a
+    //project's audio is waiting to take over)
+    void reverse()
+    {
+        if (!loopSource.isOverdubbing() && !isLoadPending())
+            loopSource.reverseAudio();
+    }
+
+    bool isReversed() { return loopSource.isReversed(); }
+
+    //==============================================================================
+    // Playback mode
+    void start()
+    {
+        loopSource.start(0);
+    }
+
+    void stop()
+    {
+        loopSource.stop();
+    }
+
+    bool isPlaying()
+    {
+        return loopSource.isPlaying();
+    }
+
+    // DN:  set position in samples now, not seconds anymore (made it an int, not a double)
+    // (playback follows the TransportClock, this only moves the playhead until the next block)
+    void setPosition(juce::int64 newPosition)
+    {
+        loopSource.setNextReadPosition(newPosition);
+    }
+
+    int getPosition()
+    {
+        return loopSource.getPosition();
+    }
+
+    //Call this for all tracks to keep them in sync
+    void setMasterLoop(int tempo, int measures)
+    {
+        loopSource.setMasterLoop(tempo, measures);
+    }
+
+    juce::int64 getMasterLoopLength()
+    {
+        return loopSource.getMasterLoopLength();
+    }
+
+    double getSampleRate() const noexcept
+    {
+        return loopSource.getSampleRate();
+    }
+
+    //==============================================================================
+    //make sure to set this up before calling setWaitingToRecord()
+    void setLastRecording(juce::File file)
+    {
+        lastRecording = file;
+        writtenTake = nullptr;
+    }
+
+    const juce::File& getLastRecording() const noexcept { return lastRecording; }
+
+    //Arms the track: the take starts on the audio thread exactly when the loop next comes round to its start.
+    //Not while a project's audio is waiting to take over, since the loop's about to change length
+    void setWaitingToRecord(bool newWaitingToRecord)
+    {
+        if (newWaitingToRecord && isLoadPending())
+            return;
+
+        if (newWaitingToRecord && loopSource.isOverdubbing())
+            setOverdubbing(false);
+
+        if (newWaitingToRecord)
+        {
+            //the take gets written over the file as it comes in
+            writtenTake = nullptr;
+            recorder.arm(lastRecording, (int)loopSource.getMasterLoopLength());
+        }
+        else if (recorder.isArmed())
+            stopRecording();
+    }
+
+    bool isWaitingToRecord()
+    {
+        return recorder.isArmed();
+    }
+
+    bool isRecording()
+    {
+        return recorder.isRecording();
+    }
+
+    //Stops the take wherever it's got to (or disarms, if it hasn't started yet).  Takes that run
+    //the full loop stop themselves on the audio thread, this just collects them afterwards
+    void stopRecording()
+    {
+        //the take comes back already in memory, no need to read the WAV back in
+        //(it's still being finished off on the disk thread)
+        auto take = recorder.stop();
+        takeStarted = false;
+
+        if (take != nullptr)
+        {
+            // DN: send the take to the loopSource which will handle playback (and undo), transfer ownership of unique ptr
+            loopSource.setTake(std::move(take));
+        }
+
+        loopSource.stopRecording();
+        listeners.call([this](Listener& l) { l.takeFinished(*this); });
+    }
+
+    //While a take is going: what it's being recorded into, and how much of it has come in so far
+    //(what's before that can be read on the message thread).  nullptr when there's no take
+    const LoopTake* getTakeBeingRecorded() const noexcept   { return recorder.getTakeBeingRecorded(); }
+    juce::int64 getNumSamplesRecorded() const noexcept      { return recorder.getNumSamplesRecorded(); }
+
+    //==============================================================================
+    //Sound-on-sound: while on, the input gets layered into the loop as it plays.  Turning it off
+    //writes the result over lastRecording in the background
+    void setOverdubbing(bool shouldOverdub)
+    {
+        if (shouldOverdub == loopSource.isOverdubbing() || (shouldOverdub && (isRecording() || isWaitingToRecord() || isLoadPending())))
+            return;
+
+        if (shouldOverdub)
+        {
+            //the loop gets laid out at the offset it's playing at, so the slip is baked in from here
+            loopSource.prepareForOverdub(recorder.getFirstInputChannel(), recorder.getNumChannelsToRecord(),
+                                         dispatcher.getRoundTripLatency());
+            loopSource.setOverdubbing(true);
+            dispatcher.arm(&loopSource);
+        }
+        else
+        {
+            dispatcher.disarm(&loopSource);
+            loopSource.setOverdubbing(false);
+            audioReplaced();
+        }
+    }
+
+    bool isOverdubbing()
+    {
+        return loopSource.isOverdubbing();
+    }
+
+    void setOverdubFeedback(float newFeedback)
+    {
+        loopSource.setOverdubFeedback(newFeedback);
+    }
+
+    //Takes, reverses and overdubs can be undone, but not while the track is in the middle of one (or while a
+    //project's audio is waiting to take over, which has started the history over)
+    bool canUndo()
+    {
+        return canEditHistory() && !isLoadPending() && loopSource.canUndo();
+    }
+
+    bool canRedo()
+    {
+        return canEditHistory() && !isLoadPending() && loopSource.canRedo();
+    }
+
+    void undo()
+    {
+        if (canUndo())
+        {
+            loopSource.undo();
+            audioReplaced();
+        }
+    }
+
+    void redo()
+    {
+        if (canRedo())
+        {
+            loopSource.redo();
+            audioReplaced();
+        }
+    }
+
+    //==============================================================================
+    //Call this after setLastRecording to load its audio from disk into memory (also used when loading a
+    //project).  If there's no file the track goes back to silence
+    void loadAudio()
+    {
+        auto reader = std::unique_ptr<juce::AudioFormatReader>(formatManager.createReaderFor(lastRecording));
+
+        if (reader != nullptr)
+        {
+            //DN: set up a memory buffer to hold the audio for this loop file
+            juce::AudioBuffer<float> loopBuffer((int)reader->numChannels, (int)reader->lengthInSamples);
+            //DN: read the audio file into the loopBuffer
+            reader->read(&loopBuffer, 0, (int)reader->lengthInSamples, 0, true, true);
+
+            // DN: send the audio to the loopSource which will handle playback - this starts the undo history over,
+            // and it gets converted in the background if it was saved at a different rate to the device's
+            loopSource.loadTake(LoopTake::fromBuffer(loopBuffer), reader->sampleRate);
+        }
+        else
+        {
+            //silence doesn't take up any pages, so however long the loop is this costs nothing
+            loopSource.loadTake(std::make_unique<LoopTake>(1, (int)loopSource.getMasterLoopLength()), loopSource.getSampleRate());
+        }
+
+        //it's what's on disk already, nothing to write back (though it may be converted, so it isn't known to match)
+        writtenTake = nullptr;
+        listeners.call([this](Listener& l) { l.loopAudioReplaced(*this); });
+    }
+
+    //Goes silent straight away, with nothing to undo - a new project.  Nothing's read from disk, and the WAV
+    //is deleted once whatever's still being written into it is done
+    void clearAudio()
+    {
+        //silence doesn't take up any pages, so however long the loop is this costs nothing
+        loopSource.loadTake(std::make_unique<LoopTake>(1, (int)loopSource.getMasterLoopLength()), loopSource.getSampleRate());
+        audioReplaced();
+    }
+
+    //A project's audio, read in the background (nullptr for a track with none), saved at takeSampleRate with
+    //trackState's settings, and the project's loop.  What's playing carries on at the current loop until
+    //LooperEngine picks the loop start every track swaps over at with startLoadedAudioFrom() - it's converted
+    //to the project's tempo and the device's rate meanwhile, if it was saved at others.  Recording or
+    //overdubbing should have been stopped first
+    void loadAudioAtLoopStart(std::unique_ptr<LoopTake> take, double takeSampleRate, const juce::XmlElement* trackState,
+                              int loopTempo, int loopBeatsPerLoop)
+    {
+        int takeTempo = loopTempo;
+        int slip = 0;
+        bool reversed = false;
+
+        if (trackState != nullptr)
+        {
+            //projects saved before tracks kept their own tempo were always at the project's
+            takeTempo = trackState->getIntAttribute("tempo", takeTempo);
+            slip = (int)trackState->getDoubleAttribute("slipValue");
+            reversed = trackState->getBoolAttribute("isReversed");
+            pendingState = std::make_unique<juce::XmlElement>(*trackState);
+        }
+        else
+        {
+            pendingState = nullptr;
+        }
+
+        //silence doesn't take up any pages, so however long the loop is this costs nothing
+        if (take == nullptr)
+        {
+            takeSampleRate = loopSource.getSampleRate();
+            takeTempo = loopTempo;
+            take = std::make_unique<LoopTake>(1, (int)TransportClock::getLoopLengthInSamples(loopTempo, loopBeatsPerLoop, takeSampleRate));
+        }
+
+        take->setPlayedReversed(reversed);
+        loopSource.loadTakeAtLoopStart(std::move(take), takeTempo, takeSampleRate, slip, loopTempo, loopBeatsPerLoop);
+        loadPending = true;
+    }
+
+    //A project's audio is waiting to take over
+    bool isLoadPending() const noexcept { return loadPending; }
+
+    //...and has been converted to fit, so it's only waiting for startLoadedAudioFrom()
+    bool isLoadedAudioReady() const noexcept { return !loadPending || loopSource.isLoadedTakeReady(); }
+
+    //The loaded audio and loop take over the first time the loop comes round to its start at or after
+    //transportSample (see LoopSource::adoptLoadedTakeFrom())
+    void startLoadedAudioFrom(juce::int64 transportSample)
+    {
+        loopSource.adoptLoadedTakeFrom(transportSample);
+    }
+
+    //What saving the project writes for this track: what's playing, unless it's being overdubbed, in which
+    //case it's what the overdub started from.  It shares the take's memory, so it's cheap to hold on to
+    //while it's written out in the background
+    TakeHistory::State getAudioToSave()
+    {
+        return loopSource.getStateToSave();
+    }
+
+    //What's playing now.  The samples are always the forwards way round, reversing is just how it's played
+    const LoopTake& getLoopTake()
+    {
+        return loopSource.getLoopTake();
+    }
+
+    //==============================================================================
+    //The track's settings as saved in a project's PROJECT_STATE_XML_FILENAME, alongside audioToSave (from
+    //getAudioToSave()), which is at the tempo saved here
+    std::unique_ptr<juce::XmlElement> getState(int trackNum, const TakeHistory::State& audioToSave)
+    {
+        auto trackElement = std::make_unique<juce::XmlElement>(TRACK_FILENAME + juce::String(trackNum));
+
+        trackElement->setAttribute("id", trackNum);
+        trackElement->setAttribute("pan", pan);
+        trackElement->setAttribute("isReversed", audioToSave.take.isPlayedReversed());
+        trackElement->setAttribute("slipValue", audioToSave.fileStartOffset);
+        trackElement->setAttribute("tempo", audioToSave.tempo);
+        trackElement->setAttribute("gain", gain);
+        trackElement->setAttribute("firstInput", recorder.getFirstInputChannel());
+        trackElement->setAttribute("numInputs", recorder.getNumInputChannelsWanted());
+
+        return trackElement;
+    }
+
+    //After loadAudio(), to put the audio's slip and direction and the track's settings back
+    void restoreState(const juce::XmlElement& trackState)
+    {
+        restoreSettings(trackState);
+
+        //slip needs to happen before reverse
+        setSlip((int)trackState.getDoubleAttribute("slipValue"));
+
+        if (trackState.getBoolAttribute("isReversed"))
+            loopSource.reverseAudio();
+
+        //a freshly loaded project has nothing to undo
+        loopSource.clearHistory();
+    }
+
+    //A new project
+    void initializeState()
+    {
+        setPan(0.0);
+        setGain(1.0);
+        setSlip(0);
+        setInputChannels(0, 1);
+    }
+
+    //==============================================================================
+    //Records numChannels inputs from firstChannel on (0 is all of them) from the next take
+    void setInputChannels(int firstChannel, int numChannels)
+    {
+        recorder.setInputChannels(firstChannel, numChannels);
+    }
+
+    int getFirstInputChannel() const noexcept       { return recorder.getFirstInputChannel(); }
+    int getNumInputChannelsWanted() const noexcept  { return recorder.getNumInputChannelsWanted(); }
+
+    //what this track costs the audio callback: playback (overdubbing included) timed by the mixer,
+    //recording by the CaptureDispatcher.  LooperEngine adds them to its CallbackProfiler
+    CallbackProfiler::Stage playbackStage;
+    CallbackProfiler::Stage recordingStage;
+
+private:
+    //Everything but the audio's slip and direction, which are part of what's playing
+    void restoreSettings(const juce::XmlElement& trackState)
+    {
+        setPan(trackState.getDoubleAttribute("pan"));
+        setGain(trackState.getDoubleAttribute("gain"));
+
+        //older projects just had the first input
+        setInputChannels(trackState.getIntAttribute("firstInput", 0), trackState.getIntAttribute("numInputs", 1));
+    }
+
+    bool canEditHistory()
+    {
+        return !isRecording() && !isWaitingToRecord() && !loopSource.isOverdubbing();
+    }
+
+    enum Parameter
+    {
+        gainParameter,
+        panParameter
+    };
+
+    //Audio thread: picks up whatever's been set since the last block
+    void applyParameterChanges() noexcept
+    {
+        parameters.drain([this](const ParameterQueue::Change& change)
+        {
+            if (change.parameter == gainParameter)
+                targetGain = (float)change.value;
+            else if (change.parameter == panParameter)
+                targetPan = (float)change.value;
+        });
+    }
+
+    //Keeps lastRecording matching what's playing after an overdub, undo, redo or stretch.  The take's samples
+    //are always the forwards way round (reversing is just how it's played), same as the WAV.  Silence has no
+    //WAV - it's deleted instead, once the writes ahead of it are done
+    void audioReplaced()
+    {
+        const auto& take = loopSource.getLoopTake();
+        const auto sampleRate = loopSource.getLoopSampleRate();
+        deleteRecordingWhenWritten = !take.hasAudio();
+
+        //DN: nothing's rewritten if it's the very chunks that were written last time, e.g. undoing a reverse.
+        //Otherwise the disk thread gets a copy that shares the chunks - no audio gets copied here
+        if (!take.hasAudio())
+        {
+            writtenTake = nullptr;
+        }
+        else if (writtenTake == nullptr || writtenSampleRate != sampleRate || !take.sharesEveryChunkWith(*writtenTake))
+        {
+            writtenTake = std::make_unique<LoopTake>(take);
+            writtenSampleRate = sampleRate;
+            dispatcher.writeTakeInBackground(*writtenTake, lastRecording, sampleRate);
+        }
+
+        deleteRecordingIfWritten();
+        listeners.call([this](Listener& l) { l.loopAudioReplaced(*this); });
+    }
+
+    //DN: deleting it while a take or buffer is still being written into it would just have it come back
+    void deleteRecordingIfWritten()
+    {
+        //a take being armed replaces the file anyway
+        if (recorder.isArmed() || recorder.isRecording())
+            deleteRecordingWhenWritten = false;
+
+        if (!deleteRecordingWhenWritten || dispatcher.hasPendingWrites())
+            return;
+
+        deleteRecordingWhenWritten = false;
+        lastRecording.deleteFile();
+    }
+
+    //Punching in and out already happened on the audio thread, this just catches up with it
+    void timerCallback() override
+    {
+        //a silent track's WAV, once the disk thread has caught up
+        deleteRecordingIfWritten();
+
+        //an arm that was waiting for the last overdub or take to reach the disk
+        recorder.updateArming();
+
+        if (recorder.hasFinishedTake())
+            stopRecording();
+
+        if (isRecording() && !takeStarted)
+        {
+            //the new take always starts at the top of the loop
+            takeStarted = true;
+            loopSource.setFileStartOffset(0, false);  //the audio being recorded over keeps its own slip, for undo
+            listeners.call([this](Listener& l) { l.takeStarted(*this); });
+        }
+
+        //anything the audio thread wasn't around to take yet
+        parameters.flush();
+        loopSource.flushParameterChanges();
+
+        //a loop stretched to the tempo has taken over - not mid-take though, that's what's being recorded over
+        if (canEditHistory() && loopSource.updateTimeStretch())
+            audioReplaced();
+
+        //a project's audio took over (or got dropped for an edit), its settings come in with it
+        if (loadPending && !loopSource.isLoadPending())
+        {
+            loadPending = false;
+
+            if (pendingState != nullptr)
+                restoreSettings(*pendingState);
+
+            pendingState = nullptr;
+        }
+    }
+
+    void changeListenerCallback(juce::ChangeBroadcaster*) override
+    {
+        listeners.call([this](Listener& l) { l.playStateChanged(*this); });
+    }
+
+    CaptureDispatcher& dispatcher;
+    LoopSource loopSource;
+    AudioRecorder recorder;
+    juce::AudioFormatManager formatManager;
+    juce::ListenerList<Listener> listeners;
+    juce::File lastRecording;
+    std::unique_ptr<LoopTake> writtenTake;  //what was last queued to be written to lastRecording, if it's still what's there
+    double writtenSampleRate = 0.0;
+    bool takeStarted = false;
+    bool deleteRecordingWhenWritten = false;  //it's silent, once nothing's being written into it
+
+    //a project's audio waiting to take over, and the settings that come in with it
+    bool loadPending = false;
+    std::unique_ptr<juce::XmlElement> pendingState;
+
+    //message thread - what was last set, for saving
+    double gain = 1.0, pan = 0.0;
+
+    //gain and pan on their way to the audio thread
+    ParameterQueue parameters;
+
+    //audio thread only - where gain and pan are headed, and where the last block's gain ramp ended up
+    float targetGain = 1.0f, targetPan = 0.0f;
+    juce::SmoothedValue<float> gainSmoother, panSmoother;
+    ChannelGains currentGains;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TrackEngine)
+};
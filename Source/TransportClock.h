@@ -0,0 +1,101 @@
+/*
+  ==============================================================================
+
+    TransportClock.h
+
+    The shared timeline everything that plays in time follows.  It counts
+    samples since the transport was last rewound, in 64 bits so it doesn't
+    wrap however long a session runs.  Loop positions and metronome clicks
+    are both worked out from it, so they can't drift apart.
+
+    MainComponent advances it once at the end of every audio block, so for
+    the whole of a block every source sees the same block start.
+
+    Loops count from an origin on the timeline, which is 0 until the loop
+    changes length while playing (a loaded project swapping in).  That's
+    scheduled for a loop start ahead of time, and from there on every loop
+    counts from the new origin - the tracks and the metronome each switch
+    to the new length on the same sample.
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <limits>
+
+
+class TransportClock
+{
+public:
+    TransportClock() = default;
+
+    //Audio thread: the timeline position of the first sample of the block being rendered
+    juce::int64 getBlockStartSample() const noexcept { return blockStartSample.load(); }
+
+    bool isRunning() const noexcept { return running.load(); }
+
+    //Where loop position 0 falls for a point on the timeline.  From any thread, for a point at or after the
+    //start of the block being rendered
+    juce::int64 getLoopOriginAt(juce::int64 transportSample) const noexcept
+    {
+        const auto restart = pendingLoopOrigin.load();
+        return transportSample >= restart ? restart : loopOrigin.load();
+    }
+
+    //Audio thread, once every source has rendered the block
+    void advance(int numSamples) noexcept
+    {
+        if (running.load())
+            blockStartSample.fetch_add(numSamples);
+    }
+
+    void start() noexcept   { running = true; }
+    void stop() noexcept    { running = false; }
+
+    //Message thread, while stopped.  Loops count from 0 again, and a scheduled restart is forgotten
+    void setPosition(juce::int64 newPosition) noexcept
+    {
+        jassert(newPosition >= 0);
+        blockStartSample = newPosition;
+        loopOrigin = 0;
+        pendingLoopOrigin = noRestart;
+    }
+
+    //Message thread: loops count from transportSample on, once the transport gets there.  Only once the last
+    //restart has been reached, and not for the block being rendered (or earlier) unless we're stopped
+    void scheduleLoopRestart(juce::int64 transportSample) noexcept
+    {
+        //DN: a restart that's already happened becomes the origin first, so no block in between loses it
+        const auto restart = pendingLoopOrigin.load();
+
+        if (restart != noRestart)
+        {
+            jassert(transportSample >= restart);
+            loopOrigin = restart;
+        }
+
+        pendingLoopOrigin = transportSample;
+    }
+
+    //DN: length in SAMPLES of the master loop, from the tempo and # of beats.  Everything that
+    //needs the loop length gets it from here so they all round the same way
+    static juce::int64 getLoopLengthInSamples(int tempo, int beatsPerLoop, double sampleRate) noexcept
+    {
+        if (tempo <= 0)
+            return 0;
+
+        double lengthInSeconds = (double)(60.0f / tempo) * beatsPerLoop;
+        return juce::int64((lengthInSeconds * sampleRate) + 0.5f); //the 0.5 is to account for the integer cast, allows for correct rounding
+    }
+
+private:
+    static constexpr juce::int64 noRestart = std::numeric_limits<juce::int64>::max();
+
+    std::atomic<juce::int64> blockStartSample{ 0 };
+    std::atomic<juce::int64> loopOrigin{ 0 }, pendingLoopOrigin{ noRestart };
+    std::atomic<bool> running{ false };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TransportClock)
+};